@@ -16,17 +16,81 @@ struct MyUniforms {
 	tilemap_width: f32,
 	tilemap_height: f32,
 	tilemap_number_of_layers: f32,
-	pad_: f32,
+	tileset_columns: f32,
 	time: f32,
 	screen_width: f32,
 	screen_height: f32,
-	pad__: f32,
+	skip_covered_layers: f32,
+	camera_x: f32,
+	camera_y: f32,
+	pool_chunks_x: f32,
+	pool_chunks_y: f32,
+	palette: f32,
+	animated_gids: f32,
+	pad_1: f32,
+	pad_2: f32,
+};
+
+// Have to match TilemapStreamer::chunk_size, TilemapStreamer::tile_size and TilesetArray::empty_tile
+const CHUNK_SIZE = 32;
+const TILE_SIZE = 16;
+const EMPTY_TILE = 0xffffffffu;
+
+/**
+ * Per visible layer data, see TilemapStreamer::LayerData
+ */
+struct Layer {
+	opacity: f32,
+	parallax_x: f32,
+	parallax_y: f32,
+	map_layer: u32,
+};
+
+/**
+ * See TilemapStreamer::AnimationEntry
+ */
+struct AnimationEntry {
+	frame: u32,
+	time_ms: u32,
 };
 
 // Instead of the simple uTime variable, our uniform variable is a struct
 @group(0) @binding(0) var<uniform> uMyUniforms: MyUniforms;
-@group(0) @binding(1) var uTexture: texture_2d<f32>;
-@group(0) @binding(2) var uTilemap: texture_2d<u32>;
+// One tileset per array layer, palette indexed, every row of uPalette is one palette
+@group(0) @binding(1) var uTileset: texture_2d_array<u32>;
+@group(0) @binding(2) var uTilemap: texture_2d_array<u32>;
+@group(0) @binding(3) var uResidency: texture_2d_array<u32>;
+@group(0) @binding(4) var<storage, read> uLayers: array<Layer>;
+@group(0) @binding(5) var uFirstLayer: texture_2d<u32>;
+@group(0) @binding(6) var uPalette: texture_2d<f32>;
+@group(0) @binding(7) var<storage, read> uAnimations: array<AnimationEntry>;
+// Per gid, the array layer << 24 | row << 12 | column of its tile, see TilesetArray
+@group(0) @binding(8) var<storage, read> uTileRemap: array<u32>;
+
+// Replaces an animated gid with the gid of its current frame
+fn animate(gid: u32, time_ms: u32) -> u32 {
+	if (gid >= u32(uMyUniforms.animated_gids)) {
+		return gid;
+	}
+	let animation = uAnimations[gid];
+	if (animation.frame == 0u) {
+		return gid;
+	}
+	let time = time_ms % animation.time_ms;
+	var frame = animation.frame - 1u;
+	while (frame + 1u < arrayLength(&uAnimations) && uAnimations[frame].time_ms <= time) {
+		frame++;
+	}
+	return uAnimations[frame].frame;
+}
+
+// Where the tile of a gid lives in uTileset
+fn find_tile(gid: u32) -> u32 {
+	if (gid >= arrayLength(&uTileRemap)) {
+		return EMPTY_TILE;
+	}
+	return uTileRemap[gid];
+}
 
 @vertex
 fn vs_main(in: VertexInput) -> VertexOutput {
@@ -40,33 +104,57 @@ fn vs_main(in: VertexInput) -> VertexOutput {
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
 
+	// Only visible layers are in the pool and in uLayers
 	let number_of_layers = i32(uMyUniforms.tilemap_number_of_layers);
-	let width = u32(uMyUniforms.tilemap_width);
-	let height = u32(uMyUniforms.tilemap_height);
+	let map_size = vec2i(i32(uMyUniforms.tilemap_width), i32(uMyUniforms.tilemap_height));
+	let pool_chunks = vec2i(i32(uMyUniforms.pool_chunks_x), i32(uMyUniforms.pool_chunks_y));
+	let camera = vec2f(uMyUniforms.camera_x, uMyUniforms.camera_y);
+	let palette = u32(uMyUniforms.palette);
+	let time_ms = u32(uMyUniforms.time * 1000.0);
 
 	var color = vec3f(0.0, 0.0, 0.0);
 
-	for (var i = 0; i < number_of_layers; i++) {
-		let layer_offset = vec2i(0, i * 30);
+	// Layers below the topmost opaque tile are fully covered, the first layer map
+	// follows the camera grid and lives after the layers in the residency texture
+	var first_layer = 0;
+	let camera_tile = vec2i(floor(in.position.xy + camera)) / TILE_SIZE;
+	if (uMyUniforms.skip_covered_layers > 0.0 && all(camera_tile >= vec2i(0)) && all(camera_tile < map_size)) {
+		let chunk = camera_tile / CHUNK_SIZE;
+		let resident_chunk = textureLoad(uResidency, chunk % pool_chunks, number_of_layers, 0).r;
+		if (resident_chunk == ((u32(chunk.y) << 16u) | u32(chunk.x)) + 1u) {
+			first_layer = i32(textureLoad(uFirstLayer, camera_tile % (pool_chunks * CHUNK_SIZE), 0).r);
+		}
+	}
+
+	for (var i = first_layer; i < number_of_layers; i++) {
+		let layer = uLayers[i];
 
-		// Color by position
-		let texture_coord = vec2u(in.position.xy) % vec2u(16, 16);
-		let tilemap_coord = vec2i(in.position.xy) / vec2i(16, 16) + layer_offset;
-		let tilemap_data = textureLoad(uTilemap, tilemap_coord, 0).r;
-		
-		if (tilemap_data == u32(0)) {
+		let world_position = vec2i(floor(in.position.xy + camera * vec2f(layer.parallax_x, layer.parallax_y)));
+		let tile = world_position / TILE_SIZE;
+		if (any(world_position < vec2i(0)) || any(tile >= map_size)) {
 			continue;
 		}
 
-		let texture_coord_one_dimensional = tilemap_data - 1;
+		// Chunks live at a fixed slot of the pool, skip them while their upload is still pending
+		let chunk = tile / CHUNK_SIZE;
+		let slot = chunk % pool_chunks;
+		let resident_chunk = textureLoad(uResidency, slot, i, 0).r;
+		if (resident_chunk != ((u32(chunk.y) << 16u) | u32(chunk.x)) + 1u) {
+			continue;
+		}
 
-		let texture_coord_two_dim = vec2u(texture_coord_one_dimensional % width, 
-										texture_coord_one_dimensional / width);
+		let pool_coord = tile % (pool_chunks * CHUNK_SIZE);
+		let tile_data = find_tile(animate(textureLoad(uTilemap, pool_coord, i, 0).r, time_ms));
+		if (tile_data == EMPTY_TILE) {
+			continue;
+		}
 
-		let offset_texture_coord = texture_coord_two_dim * 16 + texture_coord;
+		let texture_coord = vec2u(world_position % vec2i(TILE_SIZE));
+		let tile_origin = vec2u(tile_data & 0xfffu, (tile_data >> 12u) & 0xfffu) * u32(TILE_SIZE);
 
-		let texture_color = textureLoad(uTexture, offset_texture_coord, 0);
-		color = mix(color, texture_color.rgb, texture_color.a);
+		let color_index = textureLoad(uTileset, tile_origin + texture_coord, tile_data >> 24u, 0).r;
+		let texture_color = textureLoad(uPalette, vec2u(color_index, palette), 0);
+		color = mix(color, texture_color.rgb, texture_color.a * layer.opacity);
 	}
 
 	// Gamma-correction
@@ -0,0 +1,83 @@
+/**
+ * See SpriteBatch::SpriteUniforms
+ */
+struct SpriteUniforms {
+	camera_x: f32,
+	camera_y: f32,
+	view_width: f32,
+	view_height: f32,
+};
+
+/**
+ * One instance per sprite, see SpriteBatch::Sprite
+ */
+struct Sprite {
+	x: f32,
+	y: f32,
+	width: f32,
+	height: f32,
+	atlas_x: f32,
+	atlas_y: f32,
+	atlas_width: f32,
+	atlas_height: f32,
+	depth: f32,
+	flags: u32,
+};
+
+// Have to match SpriteBatch::flip_x and SpriteBatch::flip_y
+const FLIP_X = 1u;
+const FLIP_Y = 2u;
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+	@location(0) atlas_position: vec2f,
+};
+
+@group(0) @binding(0) var<uniform> uSpriteUniforms: SpriteUniforms;
+@group(0) @binding(1) var<storage, read> uSprites: array<Sprite>;
+// Palette indexed like the tilesets, sprites read the first array layer and the first palette row
+@group(0) @binding(2) var uTexture: texture_2d_array<u32>;
+@group(0) @binding(3) var uPalette: texture_2d<f32>;
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex_index: u32, @builtin(instance_index) instance_index: u32) -> VertexOutput {
+	const corners = array<vec2f, 6>(
+		vec2f(0.0, 0.0),
+		vec2f(1.0, 0.0),
+		vec2f(0.0, 1.0),
+		vec2f(0.0, 1.0),
+		vec2f(1.0, 0.0),
+		vec2f(1.0, 1.0)
+	);
+
+	let sprite = uSprites[instance_index];
+	let corner = corners[vertex_index];
+
+	var atlas_corner = corner;
+	if ((sprite.flags & FLIP_X) != 0u) {
+		atlas_corner.x = 1.0 - atlas_corner.x;
+	}
+	if ((sprite.flags & FLIP_Y) != 0u) {
+		atlas_corner.y = 1.0 - atlas_corner.y;
+	}
+
+	let world_position = vec2f(sprite.x, sprite.y) + corner * vec2f(sprite.width, sprite.height);
+	let view_position = world_position - vec2f(uSpriteUniforms.camera_x, uSpriteUniforms.camera_y);
+	let view_size = vec2f(uSpriteUniforms.view_width, uSpriteUniforms.view_height);
+
+	var out: VertexOutput;
+	out.position = vec4f(view_position.x / view_size.x * 2.0 - 1.0, 1.0 - view_position.y / view_size.y * 2.0, sprite.depth, 1.0);
+	out.atlas_position = vec2f(sprite.atlas_x, sprite.atlas_y) + atlas_corner * vec2f(sprite.atlas_width, sprite.atlas_height);
+	return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+	let color_index = textureLoad(uTexture, vec2i(floor(in.atlas_position)), 0, 0).r;
+	let color = textureLoad(uPalette, vec2u(color_index, 0u), 0);
+	// Transparent pixels must not write depth, or they would hide sprites behind them
+	if (color.a == 0.0) {
+		discard;
+	}
+	return color;
+}
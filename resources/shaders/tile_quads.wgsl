@@ -0,0 +1,144 @@
+/**
+ * Same layout as in shader.wgsl, see Engine::MyUniforms
+ */
+struct MyUniforms {
+	tilemap_width: f32,
+	tilemap_height: f32,
+	tilemap_number_of_layers: f32,
+	tileset_columns: f32,
+	time: f32,
+	screen_width: f32,
+	screen_height: f32,
+	skip_covered_layers: f32,
+	camera_x: f32,
+	camera_y: f32,
+	pool_chunks_x: f32,
+	pool_chunks_y: f32,
+	palette: f32,
+	animated_gids: f32,
+	pad_1: f32,
+	pad_2: f32,
+};
+
+// Has to match TilemapStreamer::tile_size and TilesetArray::empty_tile
+const TILE_SIZE = 16;
+const EMPTY_TILE = 0xffffffffu;
+
+/**
+ * One instance per non-empty tile, see TileQuadRenderer::TileInstance
+ */
+struct TileInstance {
+	position: u32,
+	tile: u32,
+};
+
+/**
+ * Per visible layer data, see TilemapStreamer::LayerData
+ */
+struct Layer {
+	opacity: f32,
+	parallax_x: f32,
+	parallax_y: f32,
+	map_layer: u32,
+};
+
+/**
+ * See TilemapStreamer::AnimationEntry
+ */
+struct AnimationEntry {
+	frame: u32,
+	time_ms: u32,
+};
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+	@location(0) tile_position: vec2f,
+	@location(1) @interpolate(flat) tile: u32,
+	@location(2) @interpolate(flat) opacity: f32,
+};
+
+@group(0) @binding(0) var<uniform> uMyUniforms: MyUniforms;
+@group(0) @binding(1) var<storage, read> uInstances: array<TileInstance>;
+@group(0) @binding(2) var<storage, read> uLayers: array<Layer>;
+@group(0) @binding(3) var<storage, read> uAnimations: array<AnimationEntry>;
+// One tileset per array layer, palette indexed, every row of uPalette is one palette
+@group(0) @binding(4) var uTileset: texture_2d_array<u32>;
+@group(0) @binding(5) var uPalette: texture_2d<f32>;
+// Per gid, the array layer << 24 | row << 12 | column of its tile, see TilesetArray
+@group(0) @binding(6) var<storage, read> uTileRemap: array<u32>;
+
+// Replaces an animated gid with the gid of its current frame, see shader.wgsl
+fn animate(gid: u32, time_ms: u32) -> u32 {
+	if (gid >= u32(uMyUniforms.animated_gids)) {
+		return gid;
+	}
+	let animation = uAnimations[gid];
+	if (animation.frame == 0u) {
+		return gid;
+	}
+	let time = time_ms % animation.time_ms;
+	var frame = animation.frame - 1u;
+	while (frame + 1u < arrayLength(&uAnimations) && uAnimations[frame].time_ms <= time) {
+		frame++;
+	}
+	return uAnimations[frame].frame;
+}
+
+// Where the tile of a gid lives in uTileset, see shader.wgsl
+fn find_tile(gid: u32) -> u32 {
+	if (gid >= arrayLength(&uTileRemap)) {
+		return EMPTY_TILE;
+	}
+	return uTileRemap[gid];
+}
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex_index: u32, @builtin(instance_index) instance_index: u32) -> VertexOutput {
+	const corners = array<vec2f, 6>(
+		vec2f(0.0, 0.0),
+		vec2f(1.0, 0.0),
+		vec2f(0.0, 1.0),
+		vec2f(0.0, 1.0),
+		vec2f(1.0, 0.0),
+		vec2f(1.0, 1.0)
+	);
+
+	let instance = uInstances[instance_index];
+	let layer = uLayers[instance.tile >> 24u];
+	let corner = corners[vertex_index];
+
+	// Animating once per vertex instead of once per pixel is most of the point of drawing quads
+	let time_ms = u32(uMyUniforms.time * 1000.0);
+	let gid = animate(instance.tile & 0xffffffu, time_ms);
+
+	let tile = vec2f(f32(instance.position & 0xffffu), f32(instance.position >> 16u));
+	let camera = vec2f(uMyUniforms.camera_x, uMyUniforms.camera_y) * vec2f(layer.parallax_x, layer.parallax_y);
+	let view_position = (tile + corner) * f32(TILE_SIZE) - camera;
+	let view_size = vec2f(uMyUniforms.screen_width, uMyUniforms.screen_height);
+
+	var out: VertexOutput;
+	out.position = vec4f(view_position.x / view_size.x * 2.0 - 1.0, 1.0 - view_position.y / view_size.y * 2.0, 0.0, 1.0);
+	out.tile_position = corner * f32(TILE_SIZE);
+	out.tile = find_tile(gid);
+	out.opacity = layer.opacity;
+	return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+	if (in.tile == EMPTY_TILE) {
+		discard;
+	}
+	let palette = u32(uMyUniforms.palette);
+
+	let texture_coord = min(vec2u(floor(in.tile_position)), vec2u(TILE_SIZE - 1));
+	let tile_origin = vec2u(in.tile & 0xfffu, (in.tile >> 12u) & 0xfffu) * u32(TILE_SIZE);
+
+	let color_index = textureLoad(uTileset, tile_origin + texture_coord, in.tile >> 24u, 0).r;
+	let color = textureLoad(uPalette, vec2u(color_index, palette), 0);
+	let alpha = color.a * in.opacity;
+	if (alpha == 0.0) {
+		discard;
+	}
+	return vec4f(color.rgb, alpha);
+}
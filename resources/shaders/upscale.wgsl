@@ -0,0 +1,31 @@
+/**
+ * See Upscaler::UpscaleUniforms
+ */
+struct UpscaleUniforms {
+	offset_x: f32,
+	offset_y: f32,
+	scale: f32,
+	_pad: f32,
+};
+
+@group(0) @binding(0) var<uniform> uUpscaleUniforms: UpscaleUniforms;
+@group(0) @binding(1) var uScene: texture_2d<f32>;
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex_index: u32) -> @builtin(position) vec4f {
+	// One triangle covering the whole target
+	let corner = vec2f(f32((vertex_index << 1u) & 2u), f32(vertex_index & 2u));
+	return vec4f(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> @location(0) vec4f {
+	// Nearest neighbour, every scene pixel covers scale x scale target pixels
+	let offset = vec2f(uUpscaleUniforms.offset_x, uUpscaleUniforms.offset_y);
+	let source = floor((position.xy - offset) / uUpscaleUniforms.scale);
+	let scene_size = vec2f(textureDimensions(uScene));
+	if (any(source < vec2f(0.0)) || any(source >= scene_size)) {
+		return vec4f(0.0, 0.0, 0.0, 1.0);
+	}
+	return textureLoad(uScene, vec2i(source), 0);
+}
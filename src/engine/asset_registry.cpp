@@ -0,0 +1,398 @@
+#include "asset_registry.h"
+#include "../files/mapped_file.h"
+#include "../files/shader_loader.h"
+#include "../files/tilemap_loader.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace wgpu;
+
+namespace {
+
+uint64_t hash_content(const uint8_t* data, size_t size, uint32_t kind) {
+    // FNV-1a, mixed with the kind so one file loaded as two kinds gets two assets
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash ^ ((uint64_t)kind + 1) * 0x9e3779b97f4a7c15ull;
+}
+
+std::string entry_key(const std::filesystem::path& name, uint32_t kind) {
+    return name.generic_string() + '#' + std::to_string(kind);
+}
+
+// Only textures are kept around for the budget, everything else is released with its last handle
+template <typename T>
+uint64_t gpu_size(const T&) {
+    return 0;
+}
+
+uint64_t gpu_size(const TextureAsset& asset) {
+    return GpuMemory::texture_size(asset.texture);
+}
+
+uint64_t gpu_size(const IndexedTextureAsset& asset) {
+    return GpuMemory::texture_size(asset.texture.indices) + GpuMemory::texture_size(asset.texture.palette);
+}
+
+void track_indexed_texture(GpuMemory* memory, IndexedTextureAsset& asset) {
+    asset.memory = memory;
+    if (!memory) return;
+    memory->track(asset.texture.indices, GpuMemory::Category::Tileset);
+    memory->track(asset.texture.palette, GpuMemory::Category::Tileset);
+}
+
+void destroy_texture(GpuMemory* memory, Texture& texture) {
+    if (memory) {
+        memory->destroy(texture);
+    }
+    else if (texture) {
+        texture.destroy();
+        texture.release();
+    }
+}
+
+}
+
+ShaderAsset::~ShaderAsset() {
+    if (module) module.release();
+}
+
+TextureAsset::~TextureAsset() {
+    if (view) view.release();
+    destroy_texture(memory, texture);
+}
+
+IndexedTextureAsset::~IndexedTextureAsset() {
+    if (texture.indices_view) texture.indices_view.release();
+    destroy_texture(memory, texture.indices);
+    if (texture.palette_view) texture.palette_view.release();
+    destroy_texture(memory, texture.palette);
+}
+
+bool AssetRegistry::init(Device device, GpuMemory& memory, const path& resource_directory) {
+    m_device = device;
+    m_memory = &memory;
+    m_resource_directory = resource_directory;
+    m_last_poll_time = std::chrono::steady_clock::now();
+#ifdef __linux__
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify < 0) {
+        std::cerr << "Could not watch the resource directory, assets will not be reloaded" << std::endl;
+    }
+#endif
+    return true;
+}
+
+void AssetRegistry::terminate() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+#ifdef __linux__
+    if (m_inotify >= 0) close(m_inotify);
+#endif
+    m_inotify = -1;
+    m_watched_directories.clear();
+    m_retained_index.clear();
+    m_retained.clear();
+    m_entries.clear();
+    m_contents.clear();
+    m_device = nullptr;
+    m_memory = nullptr;
+}
+
+AssetRegistry::path AssetRegistry::resolve(const path& name) const {
+    return m_resource_directory / name;
+}
+
+template <typename T, typename Create>
+AssetRegistry::Handle<T> AssetRegistry::load(const path& name, Kind kind, Create create) {
+    std::string key = entry_key(name, (uint32_t)kind);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(key);
+    if (entry != m_entries.end()) {
+        if (std::shared_ptr<void> asset = entry->second.asset.lock()) {
+            retain(asset, gpu_size(*std::static_pointer_cast<T>(asset)));
+            return std::static_pointer_cast<T>(asset);
+        }
+    }
+    lock.unlock();
+
+    path file_path = resolve(name);
+    MappedFile file;
+    if (!file.open(file_path)) {
+        std::cerr << "Could not open asset " << file_path << std::endl;
+        return nullptr;
+    }
+    uint64_t hash = hash_content(file.data(), file.size(), (uint32_t)kind);
+    std::error_code error;
+    std::filesystem::file_time_type write_time = std::filesystem::last_write_time(file_path, error);
+
+    std::shared_ptr<T> asset;
+    lock.lock();
+    asset = std::static_pointer_cast<T>(find_content(hash, file.size()));
+    if (asset) {
+        m_stats.deduplicated++;
+    }
+    else {
+        // Decoding is the slow part, other threads keep loading meanwhile
+        lock.unlock();
+        std::shared_ptr<T> created = create(file_path, file);
+        if (!created) {
+            std::cerr << "Could not load asset " << file_path << std::endl;
+            return nullptr;
+        }
+        lock.lock();
+        // Another thread may have loaded the same content in the meantime
+        asset = std::static_pointer_cast<T>(find_content(hash, file.size()));
+        if (asset) {
+            m_stats.deduplicated++;
+        }
+        else {
+            asset = std::move(created);
+            m_contents[hash] = { file.size(), asset };
+            m_stats.loaded++;
+        }
+    }
+
+    m_entries[key] = { name, hash, asset, write_time };
+    watch(name);
+    retain(asset, gpu_size(*asset));
+    evict_unused();
+    return asset;
+}
+
+std::shared_ptr<void> AssetRegistry::find_content(uint64_t hash, uint64_t size) const {
+    auto content = m_contents.find(hash);
+    if (content == m_contents.end() || content->second.size != size) return nullptr;
+    return content->second.asset.lock();
+}
+
+void AssetRegistry::watch(const path& name) {
+    path directory = name.parent_path();
+#ifdef __linux__
+    if (m_inotify < 0) return;
+    for (const auto& [watch_descriptor, watched] : m_watched_directories) {
+        if (watched == directory) return;
+    }
+    // Editors often save by writing a temporary file and renaming it over the original
+    int descriptor = inotify_add_watch(m_inotify, resolve(directory).string().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (descriptor >= 0) {
+        m_watched_directories[descriptor] = directory;
+    }
+#endif
+}
+
+void AssetRegistry::retain(const std::shared_ptr<void>& asset, uint64_t bytes) {
+    if (bytes == 0 || !m_memory || m_memory->get_budget() == 0) return;
+    auto retained = m_retained_index.find(asset.get());
+    if (retained != m_retained_index.end()) {
+        m_retained.splice(m_retained.begin(), m_retained, retained->second);
+        return;
+    }
+    m_retained.push_front({ asset, bytes });
+    m_retained_index[asset.get()] = m_retained.begin();
+}
+
+void AssetRegistry::evict_unused() {
+    if (!m_memory) return;
+    for (auto retained = m_retained.end(); retained != m_retained.begin() && m_memory->over_budget();) {
+        --retained;
+        // Only the list still holds it
+        if (retained->asset.use_count() > 1) continue;
+        m_memory->record_eviction(retained->bytes);
+        m_stats.evicted++;
+        m_retained_index.erase(retained->asset.get());
+        retained = m_retained.erase(retained);
+    }
+}
+
+void AssetRegistry::trim() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    evict_unused();
+}
+
+AssetRegistry::Handle<ShaderAsset> AssetRegistry::load_shader(const path& name) {
+    return load<ShaderAsset>(name, Kind::Shader, [&](const path&, const MappedFile& file) {
+        std::shared_ptr<ShaderAsset> asset = std::make_shared<ShaderAsset>();
+        std::string source((const char*)file.data(), file.size());
+        asset->module = ShaderLoader::create_shader_module(source, m_device);
+        return asset->module ? asset : nullptr;
+    });
+}
+
+AssetRegistry::Handle<TextureAsset> AssetRegistry::load_texture(const path& name) {
+    return load<TextureAsset>(name, Kind::Texture, [&](const path& file_path, const MappedFile&) {
+        std::shared_ptr<TextureAsset> asset = std::make_shared<TextureAsset>();
+        asset->texture = TextureLoader::load_texture(file_path, m_device, &asset->view);
+        if (!asset->texture) return std::shared_ptr<TextureAsset>();
+        asset->memory = m_memory;
+        if (m_memory) m_memory->track(asset->texture, GpuMemory::Category::Sprite);
+        return asset;
+    });
+}
+
+AssetRegistry::Handle<IndexedTextureAsset> AssetRegistry::load_indexed_texture(const path& name) {
+    return load<IndexedTextureAsset>(name, Kind::IndexedTexture, [&](const path& file_path, const MappedFile&) {
+        std::shared_ptr<IndexedTextureAsset> asset = std::make_shared<IndexedTextureAsset>();
+        if (!TextureLoader::load_indexed_texture(file_path, m_device, asset->texture)) return std::shared_ptr<IndexedTextureAsset>();
+        track_indexed_texture(m_memory, *asset);
+        return asset;
+    });
+}
+
+AssetRegistry::Handle<IndexedTextureAsset> AssetRegistry::load_indexed_texture_array(const std::vector<path>& names) {
+    if (names.empty()) return nullptr;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Still loaded if every image has an entry for this very array, a changed image has lost its entry
+    const uint32_t kind = (uint32_t)Kind::IndexedTextureArray;
+    std::shared_ptr<IndexedTextureAsset> cached;
+    for (const path& name : names) {
+        auto entry = m_entries.find(entry_key(name, kind));
+        std::shared_ptr<IndexedTextureAsset> asset = entry == m_entries.end() ? nullptr : std::static_pointer_cast<IndexedTextureAsset>(entry->second.asset.lock());
+        if (!asset || asset->layers != names || (cached && asset != cached)) {
+            cached = nullptr;
+            break;
+        }
+        cached = asset;
+    }
+    if (cached) {
+        retain(cached, gpu_size(*cached));
+        return cached;
+    }
+
+    std::vector<path> file_paths;
+    std::vector<std::filesystem::file_time_type> write_times;
+    uint64_t hash = 0;
+    uint64_t size = 0;
+    for (const path& name : names) {
+        path file_path = resolve(name);
+        MappedFile file;
+        if (!file.open(file_path)) {
+            std::cerr << "Could not open asset " << file_path << std::endl;
+            return nullptr;
+        }
+        hash = hash * 1099511628211ull ^ hash_content(file.data(), file.size(), kind);
+        size += file.size();
+        std::error_code error;
+        write_times.push_back(std::filesystem::last_write_time(file_path, error));
+        file_paths.push_back(file_path);
+    }
+
+    std::shared_ptr<IndexedTextureAsset> asset;
+    asset = std::static_pointer_cast<IndexedTextureAsset>(find_content(hash, size));
+    if (asset && asset->layers == names) {
+        m_stats.deduplicated++;
+    }
+    else {
+        asset = std::make_shared<IndexedTextureAsset>();
+        if (!TextureLoader::load_indexed_texture_array(file_paths, m_device, asset->texture)) {
+            std::cerr << "Could not load texture array starting with " << file_paths.front() << std::endl;
+            return nullptr;
+        }
+        track_indexed_texture(m_memory, *asset);
+        asset->layers = names;
+        m_contents[hash] = { size, asset };
+        m_stats.loaded++;
+    }
+
+    for (size_t i = 0; i < names.size(); i++) {
+        m_entries[entry_key(names[i], kind)] = { names[i], hash, asset, write_times[i] };
+        watch(names[i]);
+    }
+    retain(asset, gpu_size(*asset));
+    evict_unused();
+    return asset;
+}
+
+AssetRegistry::Handle<CompiledTilemap> AssetRegistry::load_tilemap(const path& name) {
+    return load<CompiledTilemap>(name, Kind::Tilemap, [&](const path& file_path, const MappedFile&) {
+        std::shared_ptr<CompiledTilemap> tilemap = std::make_shared<CompiledTilemap>();
+        if (file_path.extension() == ".nmap") {
+            tilemap->open(file_path);
+        }
+        else {
+            // The loader returns an empty map for a file it could not read, like nostalgia_mapc it is not compiled
+            TilemapLoader::Tilemap source = TilemapLoader::load_tilemap(file_path);
+            if (source.width == 0 || source.height == 0) return std::shared_ptr<CompiledTilemap>();
+            tilemap->open_memory(CompiledTilemap::compile(source));
+        }
+        return tilemap->is_open() ? tilemap : nullptr;
+    });
+}
+
+AssetRegistry::Handle<CompiledMesh> AssetRegistry::load_mesh(const path& name) {
+    return load<CompiledMesh>(name, Kind::Mesh, [&](const path& file_path, const MappedFile&) {
+        std::shared_ptr<CompiledMesh> mesh = std::make_shared<CompiledMesh>();
+        if (file_path.extension() == ".nmesh") {
+            mesh->open(file_path);
+        }
+        else {
+            GeometryLoader::Geometry geometry;
+            if (GeometryLoader::load_geometry(file_path, geometry)) {
+                mesh->open_memory(CompiledMesh::compile(geometry));
+            }
+        }
+        return mesh->is_open() ? mesh : nullptr;
+    });
+}
+
+std::vector<AssetRegistry::path> AssetRegistry::poll_changes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<path> changed_files;
+#ifdef __linux__
+    if (m_inotify >= 0) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t offset = 0; offset < length;) {
+                const inotify_event* event = (const inotify_event*)(buffer + offset);
+                auto directory = m_watched_directories.find(event->wd);
+                if (event->len > 0 && directory != m_watched_directories.end()) {
+                    changed_files.push_back(directory->second / event->name);
+                }
+                offset += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+#else
+    // Without inotify, compare write times twice a second
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - m_last_poll_time < std::chrono::milliseconds(500)) return {};
+    m_last_poll_time = now;
+    for (const auto& [key, entry] : m_entries) {
+        std::error_code error;
+        if (std::filesystem::last_write_time(resolve(entry.name), error) != entry.write_time && !error) {
+            changed_files.push_back(entry.name);
+        }
+    }
+#endif
+
+    // Forget the entries of changed files, the next load reads the file again
+    std::vector<path> changed;
+    for (auto entry = m_entries.begin(); entry != m_entries.end();) {
+        bool is_changed = std::find(changed_files.begin(), changed_files.end(), entry->second.name) != changed_files.end();
+        bool is_alive = !entry->second.asset.expired();
+        if (is_changed && is_alive && std::find(changed.begin(), changed.end(), entry->second.name) == changed.end()) {
+            changed.push_back(entry->second.name);
+            m_stats.changed++;
+        }
+        // A stale texture is never loaded again, so it is not worth keeping
+        auto retained = is_changed && is_alive ? m_retained_index.find(entry->second.asset.lock().get()) : m_retained_index.end();
+        if (retained != m_retained_index.end()) {
+            m_retained.erase(retained->second);
+            m_retained_index.erase(retained);
+        }
+        entry = is_changed || !is_alive ? m_entries.erase(entry) : std::next(entry);
+    }
+    for (auto content = m_contents.begin(); content != m_contents.end();) {
+        content = content->second.asset.expired() ? m_contents.erase(content) : std::next(content);
+    }
+    return changed;
+}
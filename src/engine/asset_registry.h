@@ -0,0 +1,138 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "../files/compiled_mesh.h"
+#include "../files/compiled_tilemap.h"
+#include "../files/texture_loader.h"
+#include "gpu_memory.h"
+
+#include <chrono>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ShaderAsset {
+    wgpu::ShaderModule module = nullptr;
+    ~ShaderAsset();
+};
+
+struct TextureAsset {
+    wgpu::Texture texture = nullptr;
+    wgpu::TextureView view = nullptr;
+    GpuMemory* memory = nullptr;
+    ~TextureAsset();
+};
+
+struct IndexedTextureAsset {
+    TextureLoader::IndexedTexture texture;
+    // The names of the array layers, empty for a single texture
+    std::vector<std::filesystem::path> layers;
+    GpuMemory* memory = nullptr;
+    ~IndexedTextureAsset();
+};
+
+/**
+ * Loads assets by their name relative to the resource directory and hands
+ * out shared handles. An asset is released with its last handle, unless the
+ * GPU memory has a budget: then textures stay loaded after their last handle
+ * is gone, so switching back to a level does not upload them again, and
+ * trim() evicts the least recently loaded ones nobody holds while the memory
+ * is over budget. Textures in use are never evicted, even over budget.
+ *
+ * Files with identical content are loaded once: a second name, or another
+ * level using the same tileset, gets a handle to the existing asset.
+ *
+ * The directories of loaded assets are watched (inotify on Linux, write time
+ * polling elsewhere). poll_changes() reports the names whose file changed, the
+ * next load of such a name reads the new file and the caller swaps its
+ * handle, rebuilding whatever GPU objects depend on it.
+ *
+ * Loads may run on several threads at once, see the startup jobs in
+ * Engine::on_init. Tilemaps and meshes do not touch the GPU and can be loaded
+ * before there is a device, everything else needs set_device() first.
+ */
+class AssetRegistry {
+    public:
+        using path = std::filesystem::path;
+        template <typename T>
+        using Handle = std::shared_ptr<T>;
+
+        struct Stats {
+            uint32_t loaded = 0;
+            uint32_t deduplicated = 0;
+            uint32_t changed = 0;
+            uint32_t evicted = 0;
+        };
+
+        bool init(wgpu::Device device, GpuMemory& memory, const path& resource_directory);
+        void terminate();
+        void set_device(wgpu::Device device) { m_device = device; }
+
+        path resolve(const path& name) const;
+
+        Handle<ShaderAsset> load_shader(const path& name);
+        Handle<TextureAsset> load_texture(const path& name);
+        Handle<IndexedTextureAsset> load_indexed_texture(const path& name);
+        // Every image is watched on its own, a change to any of them is reported under its name
+        Handle<IndexedTextureAsset> load_indexed_texture_array(const std::vector<path>& names);
+        // .nmap files are memory mapped, Tiled .tmj maps are compiled on load
+        Handle<CompiledTilemap> load_tilemap(const path& name);
+        // .nmesh files are memory mapped, text geometries are compiled on load
+        Handle<CompiledMesh> load_mesh(const path& name);
+
+        // Names of loaded assets whose file changed since the last call
+        std::vector<path> poll_changes();
+        // Evicts unused textures, oldest first, until the GPU memory is within its budget
+        void trim();
+
+        const Stats& get_stats() const { return m_stats; }
+
+    private:
+        enum class Kind : uint32_t { Shader, Texture, IndexedTexture, Tilemap, IndexedTextureArray, Mesh };
+
+        struct Entry {
+            path name;
+            uint64_t hash;
+            std::weak_ptr<void> asset;
+            std::filesystem::file_time_type write_time;
+        };
+
+        struct Content {
+            // Of the file, or all files of an array, so a hash collision is not taken for the same content
+            uint64_t size;
+            std::weak_ptr<void> asset;
+        };
+
+        struct Retained {
+            std::shared_ptr<void> asset;
+            uint64_t bytes;
+        };
+
+        wgpu::Device m_device = nullptr;
+        GpuMemory* m_memory = nullptr;
+        path m_resource_directory;
+        // Guards the tables below, assets are created outside of it
+        std::mutex m_mutex;
+        // Keyed by name and kind, the same file can be loaded as different kinds
+        std::unordered_map<std::string, Entry> m_entries;
+        // Keyed by content hash and kind
+        std::unordered_map<uint64_t, Content> m_contents;
+        // Strong references to textures, most recently loaded first
+        std::list<Retained> m_retained;
+        std::unordered_map<const void*, std::list<Retained>::iterator> m_retained_index;
+        std::unordered_map<int, path> m_watched_directories;
+        int m_inotify = -1;
+        std::chrono::steady_clock::time_point m_last_poll_time;
+        Stats m_stats = {};
+
+        template <typename T, typename Create>
+        Handle<T> load(const path& name, Kind kind, Create create);
+        void watch(const path& name);
+        std::shared_ptr<void> find_content(uint64_t hash, uint64_t size) const;
+        void retain(const std::shared_ptr<void>& asset, uint64_t bytes);
+        void evict_unused();
+};
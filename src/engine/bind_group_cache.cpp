@@ -0,0 +1,85 @@
+#include "bind_group_cache.h"
+
+#include <iostream>
+
+using namespace wgpu;
+
+size_t BindGroupCache::KeyHash::operator()(const Key& key) const {
+    // FNV-1a over the words, good enough for pointers and small integers
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t word : key) {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    }
+    return (size_t)hash;
+}
+
+void BindGroupCache::init(Device device) {
+    terminate();
+    m_device = device;
+}
+
+void BindGroupCache::terminate() {
+    clear();
+    m_device = nullptr;
+    m_frame = 0;
+    m_stats = {};
+}
+
+void BindGroupCache::clear() {
+    for (auto& [key, entry] : m_bind_groups) entry.bind_group.release();
+    m_bind_groups.clear();
+    m_stats.cached = 0;
+}
+
+void BindGroupCache::build_key(BindGroupLayout layout, const std::vector<BindGroupEntry>& entries) {
+    m_key.clear();
+    m_key.push_back((uint64_t)(uintptr_t)(WGPUBindGroupLayout)layout);
+    for (const BindGroupEntry& entry : entries) {
+        m_key.push_back(entry.binding);
+        m_key.push_back((uint64_t)(uintptr_t)entry.buffer);
+        m_key.push_back(entry.offset);
+        m_key.push_back(entry.size);
+        m_key.push_back((uint64_t)(uintptr_t)entry.sampler);
+        m_key.push_back((uint64_t)(uintptr_t)entry.textureView);
+    }
+}
+
+BindGroup BindGroupCache::get(BindGroupLayout layout, const std::vector<BindGroupEntry>& entries) {
+    build_key(layout, entries);
+    auto it = m_bind_groups.find(m_key);
+    if (it != m_bind_groups.end()) {
+        it->second.last_used_frame = m_frame;
+        m_stats.hits++;
+        return it->second.bind_group;
+    }
+
+    BindGroupDescriptor bind_group_descriptor;
+    bind_group_descriptor.layout = layout;
+    bind_group_descriptor.entryCount = (uint32_t)entries.size();
+    bind_group_descriptor.entries = entries.data();
+    BindGroup bind_group = m_device.createBindGroup(bind_group_descriptor);
+    if (!bind_group) {
+        std::cerr << "Could not create a bind group with " << entries.size() << " entries" << std::endl;
+        return nullptr;
+    }
+    m_stats.misses++;
+    m_bind_groups.emplace(m_key, Entry{ bind_group, m_frame });
+    m_stats.cached = (uint32_t)m_bind_groups.size();
+    return bind_group;
+}
+
+void BindGroupCache::end_frame(uint32_t max_age) {
+    for (auto it = m_bind_groups.begin(); it != m_bind_groups.end();) {
+        if (m_frame - it->second.last_used_frame > max_age) {
+            it->second.bind_group.release();
+            it = m_bind_groups.erase(it);
+            m_stats.evictions++;
+        }
+        else {
+            ++it;
+        }
+    }
+    m_stats.cached = (uint32_t)m_bind_groups.size();
+    m_frame++;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Bind groups shared by everything that binds the same resources with the
+ * same layout, created on first use and then reused across frames.
+ *
+ * The key is the layout and every field of the entries, in the order they are
+ * given, so the same resources in another order make another bind group.
+ * Looking up an existing one builds the key into a reused buffer and does not
+ * allocate.
+ *
+ * A cached bind group keeps its resources alive, so a handle seen in a key
+ * cannot be freed and handed out again while its bind groups are cached.
+ * Bind groups nobody asked for in a while are released by end_frame().
+ */
+class BindGroupCache {
+    public:
+        struct Stats {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            uint32_t cached = 0;
+        };
+
+        void init(wgpu::Device device);
+        void terminate();
+        void clear();
+
+        // Null when the bind group cannot be created
+        wgpu::BindGroup get(wgpu::BindGroupLayout layout, const std::vector<wgpu::BindGroupEntry>& entries);
+        // Releases bind groups unused for more than max_age frames
+        void end_frame(uint32_t max_age = 120);
+
+        const Stats& get_stats() const { return m_stats; }
+
+    private:
+        using Key = std::vector<uint64_t>;
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct Entry {
+            wgpu::BindGroup bind_group;
+            uint64_t last_used_frame;
+        };
+
+        wgpu::Device m_device = nullptr;
+        std::unordered_map<Key, Entry, KeyHash> m_bind_groups;
+        Key m_key;
+        uint64_t m_frame = 0;
+        Stats m_stats = {};
+
+        void build_key(wgpu::BindGroupLayout layout, const std::vector<wgpu::BindGroupEntry>& entries);
+};
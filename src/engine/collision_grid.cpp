@@ -0,0 +1,171 @@
+#include "collision_grid.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// std::floor is a library call without SSE4.1, and the batched queries call it four times per box
+int32_t floor_to_int(float value) {
+    int32_t truncated = (int32_t)value;
+    return truncated - (value < (float)truncated ? 1 : 0);
+}
+
+}
+
+void CollisionGrid::init(uint32_t width, uint32_t height, float tile_size) {
+    m_width = width;
+    m_height = height;
+    m_words_per_row = (width + 63) / 64;
+    m_tile_size = tile_size > 0.0f ? tile_size : 16.0f;
+    m_inverse_tile_size = 1.0f / m_tile_size;
+    m_bits.assign((size_t)m_words_per_row * height, 0);
+    m_solid_gids.clear();
+    m_collision_layers.clear();
+}
+
+bool CollisionGrid::build(const CompiledTilemap& tilemap, float tile_size) {
+    if (!tilemap.is_open()) return false;
+    init(tilemap.width(), tilemap.height(), tile_size);
+
+    const uint32_t number_of_layers = tilemap.number_of_layers();
+    bool has_collision_layer = false;
+    for (uint32_t layer = 0; layer < number_of_layers; layer++) {
+        m_collision_layers.push_back(tilemap.layer_info(layer).collision ? 1 : 0);
+        has_collision_layer = has_collision_layer || m_collision_layers.back();
+    }
+    const uint32_t* solid_gids = tilemap.solid_gids();
+    for (uint32_t i = 0; i < tilemap.solid_gid_count(); i++) {
+        if (solid_gids[i] >= m_solid_gids.size()) m_solid_gids.resize(solid_gids[i] + 1, 0);
+        m_solid_gids[solid_gids[i]] = 1;
+    }
+    // Nothing can be solid, no need to decode the map
+    if (m_solid_gids.empty() && !has_collision_layer) return true;
+
+    const uint32_t chunk_size = CompiledTilemap::chunk_size;
+    std::vector<uint32_t> tiles(chunk_size * chunk_size);
+    for (uint32_t chunk_y = 0; chunk_y < tilemap.chunks_y(); chunk_y++) {
+        for (uint32_t chunk_x = 0; chunk_x < tilemap.chunks_x(); chunk_x++) {
+            for (uint32_t layer = 0; layer < number_of_layers; layer++) {
+                tilemap.decode_chunk(chunk_x, chunk_y, layer, tiles.data());
+                uint32_t columns = std::min(chunk_size, m_width - chunk_x * chunk_size);
+                uint32_t rows = std::min(chunk_size, m_height - chunk_y * chunk_size);
+                for (uint32_t row = 0; row < rows; row++) {
+                    for (uint32_t column = 0; column < columns; column++) {
+                        if (!is_solid_tile(layer, tiles[row * chunk_size + column])) continue;
+                        set_solid(chunk_x * chunk_size + column, chunk_y * chunk_size + row, true);
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void CollisionGrid::set_solid(uint32_t x, uint32_t y, bool solid) {
+    if (x >= m_width || y >= m_height) return;
+    uint64_t& word = m_bits[(size_t)y * m_words_per_row + x / 64];
+    uint64_t bit = 1ull << (x % 64);
+    word = solid ? word | bit : word & ~bit;
+}
+
+bool CollisionGrid::is_solid(uint32_t x, uint32_t y) const {
+    if (x >= m_width || y >= m_height) return false;
+    return (m_bits[(size_t)y * m_words_per_row + x / 64] >> (x % 64)) & 1;
+}
+
+bool CollisionGrid::is_solid_tile(uint32_t layer, uint32_t gid) const {
+    if (gid == 0) return false;
+    if (layer < m_collision_layers.size() && m_collision_layers[layer]) return true;
+    return gid < m_solid_gids.size() && m_solid_gids[gid];
+}
+
+uint32_t CollisionGrid::get_solid_count() const {
+    uint32_t count = 0;
+    for (uint64_t word : m_bits) count += (uint32_t)std::bitset<64>(word).count();
+    return count;
+}
+
+bool CollisionGrid::overlaps_tiles(int32_t first_x, int32_t first_y, int32_t last_x, int32_t last_y) const {
+    first_x = std::max(first_x, 0);
+    first_y = std::max(first_y, 0);
+    last_x = std::min(last_x, (int32_t)m_width - 1);
+    last_y = std::min(last_y, (int32_t)m_height - 1);
+    if (first_x > last_x || first_y > last_y) return false;
+
+    // The span of a row covers at most a few words, masked at both ends
+    const uint32_t first_word = first_x / 64;
+    const uint32_t last_word = last_x / 64;
+    const uint64_t first_mask = ~0ull << (first_x % 64);
+    const uint64_t last_mask = ~0ull >> (63 - last_x % 64);
+    for (int32_t y = first_y; y <= last_y; y++) {
+        const uint64_t* row = m_bits.data() + (size_t)y * m_words_per_row;
+        for (uint32_t word = first_word; word <= last_word; word++) {
+            uint64_t mask = (word == first_word ? first_mask : ~0ull) & (word == last_word ? last_mask : ~0ull);
+            if (row[word] & mask) return true;
+        }
+    }
+    return false;
+}
+
+bool CollisionGrid::overlaps(const Box& box) const {
+    // A box ending exactly on a tile edge does not touch the next tile
+    return overlaps_tiles(
+        floor_to_int(box.x * m_inverse_tile_size),
+        floor_to_int(box.y * m_inverse_tile_size),
+        -floor_to_int(-(box.x + box.width) * m_inverse_tile_size) - 1,
+        -floor_to_int(-(box.y + box.height) * m_inverse_tile_size) - 1
+    );
+}
+
+void CollisionGrid::overlaps(const float* x, const float* y, uint32_t count, float width, float height, uint8_t* results) const {
+    for (uint32_t i = 0; i < count; i++) {
+        results[i] = overlaps(Box{ x[i], y[i], width, height }) ? 1 : 0;
+    }
+}
+
+bool CollisionGrid::raycast(const Ray& ray, RayHit& hit) const {
+    // Steps from tile border to tile border, t is the distance along the ray in units of the direction
+    const float infinity = std::numeric_limits<float>::infinity();
+    int32_t tile_x = (int32_t)std::floor(ray.x / m_tile_size);
+    int32_t tile_y = (int32_t)std::floor(ray.y / m_tile_size);
+    int32_t step_x = ray.direction_x > 0.0f ? 1 : (ray.direction_x < 0.0f ? -1 : 0);
+    int32_t step_y = ray.direction_y > 0.0f ? 1 : (ray.direction_y < 0.0f ? -1 : 0);
+    float next_x = step_x == 0 ? infinity : ((float)(tile_x + (step_x > 0 ? 1 : 0)) * m_tile_size - ray.x) / ray.direction_x;
+    float next_y = step_y == 0 ? infinity : ((float)(tile_y + (step_y > 0 ? 1 : 0)) * m_tile_size - ray.y) / ray.direction_y;
+    float delta_x = step_x == 0 ? infinity : m_tile_size / std::abs(ray.direction_x);
+    float delta_y = step_y == 0 ? infinity : m_tile_size / std::abs(ray.direction_y);
+
+    float t = 0.0f;
+    while (t <= ray.max_distance) {
+        // Negative tiles wrap around to huge ones, which is_solid() treats as outside
+        if (is_solid((uint32_t)tile_x, (uint32_t)tile_y)) {
+            hit = { true, t, (uint32_t)tile_x, (uint32_t)tile_y };
+            return true;
+        }
+        // Outside of the map and moving away from it, nothing left to hit
+        if ((tile_x < 0 && step_x <= 0) || (tile_x >= (int32_t)m_width && step_x >= 0)) break;
+        if ((tile_y < 0 && step_y <= 0) || (tile_y >= (int32_t)m_height && step_y >= 0)) break;
+
+        if (next_x < next_y) {
+            t = next_x;
+            next_x += delta_x;
+            tile_x += step_x;
+        }
+        else {
+            t = next_y;
+            next_y += delta_y;
+            tile_y += step_y;
+        }
+    }
+    hit = { false, ray.max_distance, 0, 0 };
+    return false;
+}
+
+void CollisionGrid::raycast(const Ray* rays, uint32_t count, RayHit* hits) const {
+    for (uint32_t i = 0; i < count; i++) {
+        raycast(rays[i], hits[i]);
+    }
+}
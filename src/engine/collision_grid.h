@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../files/compiled_tilemap.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Solid tiles of the map as one bit per tile, for queries on the CPU.
+ *
+ * A tile is solid when any layer has a solid gid there, or any tile at all
+ * on a layer marked as a collision layer. Every row starts at a new 64 bit
+ * word, so a box query tests a whole row span with a couple of masked words
+ * instead of tile by tile.
+ *
+ * Positions and sizes are in pixels, tile coordinates only appear in hits.
+ * Everything outside the map is empty. The batched queries write one result
+ * per input into caller owned arrays and never allocate.
+ */
+class CollisionGrid {
+    public:
+        struct Box {
+            float x;
+            float y;
+            float width;
+            float height;
+        };
+
+        struct Ray {
+            float x;
+            float y;
+            // Does not have to be normalized, distances are in units of its length
+            float direction_x;
+            float direction_y;
+            float max_distance;
+        };
+
+        struct RayHit {
+            bool hit;
+            float distance;
+            uint32_t tile_x;
+            uint32_t tile_y;
+        };
+
+        // An empty grid, filled with set_solid()
+        void init(uint32_t width, uint32_t height, float tile_size);
+        bool build(const CompiledTilemap& tilemap, float tile_size);
+
+        void set_solid(uint32_t x, uint32_t y, bool solid);
+        bool is_solid(uint32_t x, uint32_t y) const;
+        // Fixed once built, so safe to read from any thread while the grid itself changes
+        bool is_solid_tile(uint32_t layer, uint32_t gid) const;
+
+        bool overlaps(const Box& box) const;
+        // Boxes of one size at the given positions, results[i] is 1 where box i touches a solid tile
+        void overlaps(const float* x, const float* y, uint32_t count, float width, float height, uint8_t* results) const;
+        // Stops at the first solid tile, a ray starting inside one hits at distance 0
+        bool raycast(const Ray& ray, RayHit& hit) const;
+        void raycast(const Ray* rays, uint32_t count, RayHit* hits) const;
+
+        uint32_t get_width() const { return m_width; }
+        uint32_t get_height() const { return m_height; }
+        float get_tile_size() const { return m_tile_size; }
+        uint32_t get_solid_count() const;
+
+    private:
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        uint32_t m_words_per_row = 0;
+        float m_tile_size = 16.0f;
+        float m_inverse_tile_size = 1.0f / 16.0f;
+        std::vector<uint64_t> m_bits;
+
+        // Indexed by gid and by map layer
+        std::vector<uint8_t> m_solid_gids;
+        std::vector<uint8_t> m_collision_layers;
+
+        bool overlaps_tiles(int32_t first_x, int32_t first_y, int32_t last_x, int32_t last_y) const;
+};
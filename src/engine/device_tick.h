@@ -0,0 +1,23 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+
+/**
+ * Device callbacks are only called from tick(), every wait for one of them
+ * goes through here so a hung or lost device cannot stall the engine forever.
+ *
+ * Returns false when the condition still does not hold after the timeout.
+ * The callback may then still be called later, at the latest when the device
+ * is destroyed, so whatever it references has to be kept alive.
+ */
+template<typename Condition>
+bool tick_until(wgpu::Device device, Condition condition, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        device.tick();
+    }
+    return true;
+}
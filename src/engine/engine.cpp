@@ -3,169 +3,447 @@
 #endif
 
 #include "engine.h"
+#include "device_tick.h"
 #include "../files/shader_loader.h"
-#include "../files/geometry_loader.h"
 #include "../files/texture_loader.h"
 
 #include <glfw3webgpu.h>
 #include <GLFW/glfw3.h>
 
-uint32_t ceilToNextMultiple(uint32_t value, uint32_t step) {
-    uint32_t divide_and_ceil = value / step + (value % step == 0 ? 0 : 1);
-    return step * divide_and_ceil;
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <thread>
+
+// Asset names, relative to RESOURCE_DIR
+const std::filesystem::path tilemap_shader_name = "shaders/shader.wgsl";
+const std::filesystem::path sprite_shader_name = "shaders/sprite.wgsl";
+const std::filesystem::path upscale_shader_name = "shaders/upscale.wgsl";
+const std::filesystem::path tile_quad_shader_name = "shaders/tile_quads.wgsl";
+const std::filesystem::path tileset_name = "textures/overworld.png";
+const std::filesystem::path compiled_tilemap_name = "tilemaps/map.nmap";
+const std::filesystem::path tilemap_name = "tilemaps/map.tmj";
+const std::filesystem::path compiled_geometry_name = "geometries/webgpu.nmesh";
+const std::filesystem::path geometry_name = "geometries/webgpu.txt";
+
+std::filesystem::path tilemap_asset_name(const AssetRegistry& assets) {
+    return std::filesystem::exists(assets.resolve(compiled_tilemap_name)) ? compiled_tilemap_name : tilemap_name;
 }
 
+std::filesystem::path geometry_asset_name(const AssetRegistry& assets) {
+    return std::filesystem::exists(assets.resolve(compiled_geometry_name)) ? compiled_geometry_name : geometry_name;
+}
+
+#ifdef WEBGPU_BACKEND_DAWN
+// Dawn only reports timestamp queries and implicit device synchronization with this toggle, which also
+// opens up every other unsafe and experimental API. Only profiling runs turn it on.
+const char* const dawn_toggles[] = { "allow_unsafe_apis" };
+
+// Chained into the instance, whose adapters inherit it, and into the device
+DawnTogglesDescriptor dawn_toggles_descriptor(bool allow_unsafe_apis) {
+    DawnTogglesDescriptor descriptor = Default;
+    descriptor.enabledTogglesCount = allow_unsafe_apis ? std::size(dawn_toggles) : 0;
+    descriptor.enabledToggles = dawn_toggles;
+    descriptor.disabledTogglesCount = 0;
+    descriptor.disabledToggles = nullptr;
+    return descriptor;
+}
+#endif
+
+// Render bundles are recorded on several threads when the device can be used from them
+bool supports_threaded_recording(Device device) {
+#ifdef WEBGPU_BACKEND_DAWN
+    return device.hasFeature(FeatureName::ImplicitDeviceSynchronization);
+#else
+    (void)device;
+    return false;
+#endif
+}
+
+// A window drag reports a new size every few milliseconds, the swap chain follows once it has settled
+const double resize_delay = 0.1;
+
+// For the startup and hot reload pipelines, the other device waits use the default of tick_until()
+const std::chrono::seconds pipeline_timeout(60);
+
+// Relative to the working directory, delete it to measure a cold start
+const std::filesystem::path pipeline_cache_directory = "pipeline_cache";
+
 bool Engine::on_init()  {
-    if (!init_window_and_device()) return false;
-    if (!init_swap_chain()) return false;
-    if (!init_render_pipeline()) return false;
-    if (!init_textures()) return false;
-    if (!init_geometries()) return false;
-    if (!init_buffers()) return false;
-    if (!init_bindings()) return false;
+    auto start_time = std::chrono::steady_clock::now();
+    m_gpu_memory.set_budget(m_settings.gpu_memory_budget);
+    if (!m_assets.init(nullptr, m_gpu_memory, RESOURCE_DIR)) return false;
+
+    // Files are read and decoded on workers while the main thread requests the adapter and device,
+    // everything touching the window or the GPU stays on the main thread and starts once its inputs are ready
+    using Affinity = JobGraph::Affinity;
+    JobGraph startup;
+    JobGraph::JobId load_tilemap = startup.add("load tilemap", Affinity::Worker, [this]() {
+        if (m_settings.tilemap) return true;
+        m_prefetched_tilemap = m_assets.load_tilemap(tilemap_asset_name(m_assets));
+        return m_prefetched_tilemap != nullptr;
+    });
+    JobGraph::JobId load_mesh = startup.add("load mesh", Affinity::Worker, [this]() {
+        m_prefetched_mesh = m_assets.load_mesh(geometry_asset_name(m_assets));
+        return m_prefetched_mesh != nullptr;
+    });
+    JobGraph::JobId decode_sprite_atlas = startup.add("decode sprite atlas", Affinity::Worker, [this]() {
+        TextureLoader::prefetch_image(m_assets.resolve(tileset_name));
+        return true;
+    });
+    JobGraph::JobId decode_tilesets = startup.add("decode tilesets", Affinity::Worker, [this]() {
+        // A failed decode is reported by the load that follows
+        const CompiledTilemap* tilemap = m_settings.tilemap ? m_settings.tilemap.get() : m_prefetched_tilemap.get();
+        std::filesystem::path map_name = m_settings.tilemap ? tilemap_name : tilemap_asset_name(m_assets);
+        for (uint32_t i = 0; i < tilemap->tileset_count(); i++) {
+            TextureLoader::prefetch_image(m_assets.resolve((map_name.parent_path() / tilemap->tileset_image(i)).lexically_normal()));
+        }
+        return true;
+    }, { load_tilemap });
+
+    JobGraph::JobId device = startup.add("window and device", Affinity::Main, [this]() { return init_window_and_device(); });
+    JobGraph::JobId swap_chain = startup.add("swap chain", Affinity::Main, [this]() { return init_swap_chain(); }, { device });
+    JobGraph::JobId render_graph = startup.add("render graph", Affinity::Main, [this]() { return init_render_graph(); }, { device });
+    // The tilemap pipeline takes its vertex layout from the mesh
+    JobGraph::JobId geometries = startup.add("geometries", Affinity::Main, [this]() { return init_geometries(); }, { device, load_mesh });
+    JobGraph::JobId render_pipeline = startup.add("render pipeline", Affinity::Main, [this]() { return init_render_pipeline(); }, { geometries });
+    JobGraph::JobId textures = startup.add("textures", Affinity::Main, [this]() { return init_textures(); }, { device, load_tilemap, decode_tilesets, decode_sprite_atlas });
+    JobGraph::JobId buffers = startup.add("buffers", Affinity::Main, [this]() { return init_buffers(); }, { device });
+    JobGraph::JobId bindings = startup.add("bindings", Affinity::Main, [this]() { return init_bindings(); }, { render_pipeline, textures, buffers });
+    JobGraph::JobId sprites = startup.add("sprites", Affinity::Main, [this]() { return init_sprites(); }, { device, decode_sprite_atlas });
+    JobGraph::JobId upscaler = startup.add("upscaler", Affinity::Main, [this]() { return init_upscaler(); }, { swap_chain, render_graph });
+    JobGraph::JobId tile_quads = startup.add("tile quads", Affinity::Main, [this]() { return init_tile_quads(); }, { bindings });
+    JobGraph::JobId render_bundles = startup.add("render bundles", Affinity::Main, [this]() { return init_render_bundles(); }, { buffers });
+    JobGraph::JobId simulation = startup.add("simulation", Affinity::Main, [this]() { return init_simulation(); }, { textures, sprites });
+    // Pipelines compile in the background while the steps above load their data
+    startup.add("pipelines", Affinity::Main, [this]() { return wait_for_pipelines(); }, { render_pipeline, sprites, upscaler, tile_quads, render_bundles, simulation });
+
+    bool started = startup.run(std::clamp(std::thread::hardware_concurrency(), 1u, 4u));
+    // Only kept for the startup jobs, later loads read the files again
+    TextureLoader::clear_prefetched_images();
+    m_prefetched_tilemap = nullptr;
+    m_prefetched_mesh = nullptr;
+    if (m_settings.print_profile) startup.print_timings();
+    if (!started) return false;
+
+    std::chrono::duration<double, std::milli> startup_time = std::chrono::steady_clock::now() - start_time;
+    m_startup_ms = startup_time.count();
+    PipelineCache::Stats cache_stats = m_pipeline_cache.get_stats();
+    std::cout << "Startup took " << m_startup_ms << " ms with a "
+        << (m_pipeline_cache.is_warm() ? "warm" : "cold") << " pipeline cache ("
+        << cache_stats.hits << " blobs loaded, " << cache_stats.stores << " compiled)" << std::endl;
+    print_gpu_memory();
+
+    m_last_stats_time = get_time();
+    m_simulation.start();
     return true;
 }
 
+double Engine::get_time() const {
+    // Not glfwGetTime(), GLFW is not initialized when headless
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_time).count();
+}
+
+bool Engine::wait_for_pipelines() {
+    // A cold pipeline cache compiles every pipeline from scratch, which may take a while on a software adapter
+    bool compiled = tick_until(m_device, [this]() {
+        return !m_render_pipeline_pending && !m_sprite_batch.is_pipeline_pending() && !m_upscaler.is_pipeline_pending() && !m_tile_quads.is_pipeline_pending();
+    }, pipeline_timeout);
+    if (!compiled) {
+        std::cerr << "Gave up waiting for the pipelines to compile" << std::endl;
+        return false;
+    }
+    bool has_tile_quads = m_settings.tilemap_renderer != TilemapRenderer::Quads || m_tile_quads.has_pipeline();
+    return m_render_pipeline != nullptr && m_sprite_batch.has_pipeline() && m_upscaler.has_pipeline() && has_tile_quads;
+}
+
 void Engine::on_finish() {
+    terminate_simulation();
+    m_frame_pacer.terminate();
+    m_profiler.terminate();
+    terminate_render_bundles();
+    terminate_tile_quads();
+    terminate_upscaler();
+    terminate_sprites();
     terminate_bindings();
     terminate_buffers();
     terminate_textures();
     terminate_render_pipeline();
+    terminate_geometries();
+    terminate_render_graph();
     terminate_swap_chain();
     terminate_window_and_device();
 }
 
 void Engine::on_frame() {
-    glfwPollEvents();
-
-    m_uniforms.time = static_cast<float>(glfwGetTime());
-    m_queue.writeBuffer(m_uniform_buffer, offsetof(MyUniforms, time), &m_uniforms.time, sizeof(MyUniforms::time));
+    // Wait for a free frame slot before sampling input, so input is as fresh as possible
+    m_profiler.begin_cpu("wait for frame slot");
+    uint32_t frame_slot = m_frame_pacer.begin_frame();
+    m_profiler.end_cpu();
+
+    m_profiler.begin_cpu("poll events");
+    if (m_window) glfwPollEvents();
+    update_input();
+    reload_assets();
+    m_assets.trim();
+    m_profiler.end_cpu();
+
+    double now = get_time();
+    if (m_resize_pending && now - m_resize_time >= resize_delay) {
+        m_resize_pending = false;
+        resize_screen(m_pending_window_width, m_pending_window_height);
+    }
 
-    TextureView nextTexture = m_swap_chain.getCurrentTextureView();
+    // The newest tick of the simulation thread, blended with the one before by how far this frame lies past it
+    m_simulation.update_snapshot();
+    const Simulation::Snapshot& snapshot = m_simulation.get_snapshot();
+    float blend = m_simulation.get_blend(std::chrono::steady_clock::now());
+    m_camera_x = snapshot.previous_camera_x + (snapshot.camera_x - snapshot.previous_camera_x) * blend;
+    m_camera_y = snapshot.previous_camera_y + (snapshot.camera_y - snapshot.previous_camera_y) * blend;
+
+    // The quads are built from the compiled chunks directly, the chunk pool is only read by the full screen shader
+    uint64_t tilemap_upload_bytes = 0;
+    if (m_settings.tilemap_renderer == TilemapRenderer::Quads) {
+        m_profiler.begin_cpu("tile quads");
+        m_tile_quads.update(frame_slot, m_camera_x, m_camera_y, (float)m_width, (float)m_height);
+        m_profiler.end_cpu();
+        tilemap_upload_bytes = m_tile_quads.get_uploaded_bytes();
+    }
+    else {
+        m_profiler.begin_cpu("tilemap streaming");
+        m_tilemap_streamer.update(m_camera_x, m_camera_y, (float)m_width, (float)m_height);
+        m_profiler.end_cpu();
+        tilemap_upload_bytes = m_tilemap_streamer.get_stats().uploaded_bytes;
+    }
+    m_profiler.begin_cpu("sprite upload");
+    update_sprites(snapshot, blend);
+    m_profiler.end_cpu();
+    update_frame_stats(now);
+
+    // Every draw of the frame pushes its uniforms into the region of the frame slot, uploaded together
+    m_profiler.begin_cpu("uniform upload");
+    // The last frame skipped the draws that did not fit, this one has room for them
+    if (!grow_uniform_arena()) std::cerr << "Could not grow the uniform arena!" << std::endl;
+    m_uniform_arena.begin_frame(frame_slot);
+    m_uniforms.time = static_cast<float>(now);
+    m_uniforms.camera_x = m_camera_x;
+    m_uniforms.camera_y = m_camera_y;
+    m_uniform_offset = m_uniform_arena.push(m_uniforms);
+    m_uniform_arena.upload();
+    m_profiler.end_cpu();
+    m_upload_bytes = m_uniform_arena.get_used_bytes() + tilemap_upload_bytes + m_sprite_batch.get_uploaded_bytes();
+
+    m_profiler.begin_cpu("acquire");
+    TextureView nextTexture = nullptr;
+    if (m_swap_chain) {
+        nextTexture = m_swap_chain.getCurrentTextureView();
+    }
+    else {
+        // Released like a swap chain view below
+        nextTexture = m_offscreen_texture_view;
+        if (nextTexture) nextTexture.reference();
+    }
+    m_profiler.end_cpu();
     if (!nextTexture) {
         std::cerr << "Cannot acquire next swap chain texture" << std::endl;
+        m_frame_pacer.end_frame();
+        m_profiler.end_frame();
         return;
     }
 
+    m_profiler.begin_cpu("encode");
     CommandEncoderDescriptor commandEncoderDesc;
     commandEncoderDesc.label = "Command Encoder";
     CommandEncoder encoder = m_device.createCommandEncoder(commandEncoderDesc);
-    
-    RenderPassDescriptor renderPassDesc;
-
-    RenderPassColorAttachment renderPassColorAttachment{};
-    renderPassColorAttachment.view = nextTexture;
-    renderPassColorAttachment.resolveTarget = nullptr;
-    renderPassColorAttachment.loadOp = LoadOp::Clear;
-    renderPassColorAttachment.storeOp = StoreOp::Store;
-    renderPassColorAttachment.clearValue = Color{ 0.05, 0.05, 0.05, 1.0 };
-    renderPassDesc.colorAttachmentCount = 1;
-    renderPassDesc.colorAttachments = &renderPassColorAttachment;
-
-    renderPassDesc.depthStencilAttachment = nullptr;
-    renderPassDesc.timestampWriteCount = 0;
-    renderPassDesc.timestampWrites = nullptr;
-    RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-
-    renderPass.setPipeline(m_render_pipeline);
-
-    renderPass.setVertexBuffer(0, m_vertex_buffer, 0, m_point_data.size() * sizeof(float));
-    renderPass.setIndexBuffer(m_index_buffer, IndexFormat::Uint16, 0, m_index_data.size() * sizeof(uint16_t));
-
-    uint32_t dynamicOffset = 0;
-
-    // Set binding group
-    dynamicOffset = 0 * m_uniform_stride;
-    renderPass.setBindGroup(0, m_bind_group, 1, &dynamicOffset);
-    uint32_t index_count = (uint32_t)m_index_data.size();
-    renderPass.drawIndexed(index_count, 1, 0, 0, 0);
-
-    // Set binding group with a different uniform offset
-    // dynamicOffset = 1 * m_uniform_stride;
-    // renderPass.setBindGroup(0, m_bind_group, 1, &dynamicOffset);
-    // renderPass.drawIndexed(index_count, 1, 0, 0, 0);
-
-    renderPass.end();
-    
+    // Static draws are only re-recorded when what they bind has changed, otherwise the bundle is replayed
+    if (m_settings.tilemap_renderer == TilemapRenderer::FullScreen && m_uniform_offset != UniformArena::no_offset) {
+        m_tilemap_bind_group = m_bind_groups.get(m_bind_group_layout, m_bindings);
+        m_render_bundles.set_inputs(m_tilemap_bundles[frame_slot], {
+            RenderBundleCache::handle_key(m_render_pipeline),
+            m_tilemap_bind_group ? RenderBundleCache::handle_key(m_tilemap_bind_group) : 0,
+            m_uniform_offset,
+        });
+        m_render_bundles.update();
+    }
+    if (m_settings.tilemap_renderer == TilemapRenderer::Quads && m_uniform_offset != UniformArena::no_offset) {
+        m_tile_quads.update_bundles(m_uniform_offset);
+    }
+    m_render_graph.set_imported_view(m_frame_target, nextTexture);
+    m_render_graph.execute(encoder);
     nextTexture.release();
 
+    m_profiler.resolve(encoder);
     CommandBufferDescriptor cmdBufferDescriptor{};
     cmdBufferDescriptor.label = "Command buffer";
     CommandBuffer command = encoder.finish(cmdBufferDescriptor);
+    m_profiler.end_cpu();
+
+    m_profiler.begin_cpu("submit");
     m_queue.submit(1, &command);
+    m_profiler.end_cpu();
 
-    m_swap_chain.present();
+    if (m_swap_chain) {
+        m_profiler.begin_cpu("present");
+        m_swap_chain.present();
+        m_profiler.end_cpu();
+    }
+    m_bind_groups.end_frame();
+    m_frame_pacer.end_frame();
+    m_profiler.end_frame();
     // Check for pending error callbacks
     m_device.tick();
     // break;
 }
 
 bool Engine::is_running() const {
-    return !glfwWindowShouldClose(m_window);
+    // Headless runs are stopped by whoever drives the frames
+    return !m_window || !glfwWindowShouldClose(m_window);
 }
 
-Engine::Engine(const u_int32_t width, const u_int32_t height) : m_width(width), m_height(height) {
+uint32_t Engine::get_tilemap_draw_count() const {
+    // The full screen tilemap is a single quad
+    return m_settings.tilemap_renderer == TilemapRenderer::Quads ? m_tile_quads.get_draw_count() : 1;
+}
+
+Engine::Engine(const u_int32_t width, const u_int32_t height, const EngineSettings& settings)
+    : m_settings(settings), m_frame_pacer(settings.frame), m_width(settings.virtual_width), m_height(settings.virtual_height),
+    m_window_width(width), m_window_height(height), m_start_time(std::chrono::steady_clock::now()) {
     m_uniforms.screen_width = m_width;
     m_uniforms.screen_height = m_height;
 }
 
+bool Engine::parse_tilemap_renderer(const std::string& name, TilemapRenderer& renderer) {
+    if (name == "fullscreen") renderer = TilemapRenderer::FullScreen;
+    else if (name == "quads") renderer = TilemapRenderer::Quads;
+    else return false;
+    return true;
+}
+
+const char* Engine::tilemap_renderer_name(TilemapRenderer renderer) {
+    if (renderer == TilemapRenderer::FullScreen) return "fullscreen";
+    if (renderer == TilemapRenderer::Quads) return "quads";
+    return "unknown";
+}
+
+bool Engine::wants_gpu_timestamps() const {
+    return m_settings.gpu_timestamps || m_settings.print_profile || !m_settings.trace_path.empty();
+}
+
 bool Engine::init_window_and_device() {
-    m_instance = createInstance(InstanceDescriptor{});
+    InstanceDescriptor instance_descriptor{};
+#ifdef WEBGPU_BACKEND_DAWN
+    DawnTogglesDescriptor instance_toggles = dawn_toggles_descriptor(wants_gpu_timestamps());
+    instance_descriptor.nextInChain = &instance_toggles.chain;
+#endif
+    m_instance = m_pipeline_cache.create_instance(pipeline_cache_directory, instance_descriptor);
 
     if (!m_instance) {
         std::cerr << "Could not create instance!" << std::endl;
         return false;
     }
 
-    if (!glfwInit()) {
-        std::cerr << "Could not initialize GLFW!" << std::endl;
-        return false;
-    }
+    if (!m_settings.headless) {
+        if (!glfwInit()) {
+            std::cerr << "Could not initialize GLFW!" << std::endl;
+            return false;
+        }
+
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        m_window = glfwCreateWindow(m_window_width, m_window_height, "nostalgia", NULL, NULL);
+        if (!m_window) {
+            std::cerr << "Could not open window!" << std::endl;
+            return false;
+        }
+
+        // The framebuffer is larger than the window on high DPI displays
+        int framebuffer_width = 0;
+        int framebuffer_height = 0;
+        glfwGetFramebufferSize(m_window, &framebuffer_width, &framebuffer_height);
+        if (framebuffer_width > 0 && framebuffer_height > 0) {
+            m_window_width = framebuffer_width;
+            m_window_height = framebuffer_height;
+        }
+
+        glfwSetWindowUserPointer(m_window, this);
+
+        // Only recorded here, on_frame() applies the size once the window stopped changing
+        glfwSetFramebufferSizeCallback(m_window, [](GLFWwindow* window, int width, int height) {
+            Engine* engine = (Engine*)glfwGetWindowUserPointer(window);
+            engine->m_pending_window_width = width;
+            engine->m_pending_window_height = height;
+            engine->m_resize_time = engine->get_time();
+            engine->m_resize_pending = true;
+        });
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    m_window = glfwCreateWindow(m_width, m_height, "nostalgia", NULL, NULL);
-    if (!m_window) {
-        std::cerr << "Could not open window!" << std::endl;
-        return false;
+        m_surface = glfwGetWGPUSurface(m_instance, m_window);
     }
 
-    glfwSetWindowUserPointer(m_window, this);
-
-    glfwSetFramebufferSizeCallback(m_window, [](GLFWwindow* window, int width, int height) {
-        Engine* engine = (Engine*)glfwGetWindowUserPointer(window);
-        engine->resize_screen(width, height);
-    });
-
-    m_surface = glfwGetWGPUSurface(m_instance, m_window);
     RequestAdapterOptions adapter_options{};
     adapter_options.compatibleSurface = m_surface;
+    adapter_options.forceFallbackAdapter = m_settings.force_fallback_adapter;
     m_adapter = m_instance.requestAdapter(adapter_options);
+    if (!m_adapter) {
+        std::cerr << "Could not get adapter!" << std::endl;
+        return false;
+    }
 
     SupportedLimits supported_limits;
     m_adapter.getLimits(&supported_limits);
 
     RequiredLimits required_limits = Default;
-    required_limits.limits.maxVertexAttributes = 2;
+    // Whatever a compiled mesh may use, see CompiledMesh::validate
+    required_limits.limits.maxVertexAttributes = CompiledMesh::max_attributes;
     required_limits.limits.maxVertexBuffers = 1;
-    required_limits.limits.maxBufferSize = 15 * 5 * sizeof(float);
-    required_limits.limits.maxVertexBufferArrayStride = 5 * sizeof(float);
+    // Sprite instances grow with the number of sprites on screen
+    required_limits.limits.maxBufferSize = supported_limits.limits.maxBufferSize;
+    required_limits.limits.maxVertexBufferArrayStride = CompiledMesh::max_vertex_stride;
     required_limits.limits.minStorageBufferOffsetAlignment = supported_limits.limits.minStorageBufferOffsetAlignment;
     required_limits.limits.minUniformBufferOffsetAlignment = supported_limits.limits.minUniformBufferOffsetAlignment;
     required_limits.limits.maxInterStageShaderComponents = 10;
     required_limits.limits.maxBindGroups = 1;
     required_limits.limits.maxUniformBuffersPerShaderStage = 1;
-    required_limits.limits.maxUniformBufferBindingSize = 16 * 4;
+    required_limits.limits.maxUniformBufferBindingSize = sizeof(MyUniforms);
     required_limits.limits.maxTextureDimension1D = 4096;
+    // The tilemap is streamed through a small chunk pool, so this no longer bounds the map size
     required_limits.limits.maxTextureDimension2D = 4096;
-    required_limits.limits.maxSampledTexturesPerShaderStage = 5;
+    required_limits.limits.maxSampledTexturesPerShaderStage = 6;
+    // Also bounds the number of tilesets, see TilesetArray
+    required_limits.limits.maxTextureArrayLayers = 256;
+    // The visible layers, the tile animation table, the tile remap table and the tile quad instances
+    required_limits.limits.maxStorageBuffersPerShaderStage = 4;
+    required_limits.limits.maxStorageBufferBindingSize = supported_limits.limits.maxStorageBufferBindingSize;
     // Extra limit requirement
     required_limits.limits.maxDynamicUniformBuffersPerPipelineLayout = 1;
+    // Sprite and tile quad instances are rotated per frame in flight
+    required_limits.limits.maxDynamicStorageBuffersPerPipelineLayout = 1;
+
+    // Timestamp queries let the profiler time render passes on the GPU
+    std::vector<WGPUFeatureName> required_features;
+    if (wants_gpu_timestamps() && m_adapter.hasFeature(FeatureName::TimestampQuery)) {
+        required_features.push_back(FeatureName::TimestampQuery);
+    }
+#ifdef WEBGPU_BACKEND_DAWN
+    // Lets render bundles be recorded on worker threads
+    if (m_adapter.hasFeature(FeatureName::ImplicitDeviceSynchronization)) {
+        required_features.push_back(FeatureName::ImplicitDeviceSynchronization);
+    }
+#endif
 
     DeviceDescriptor device_descriptor{};
     device_descriptor.label = "GPU";
-    device_descriptor.requiredFeaturesCount = 0;
+    device_descriptor.requiredFeaturesCount = required_features.size();
+    device_descriptor.requiredFeatures = required_features.data();
     device_descriptor.requiredLimits = &required_limits;
     device_descriptor.defaultQueue.label = "default";
+#ifdef WEBGPU_BACKEND_DAWN
+    DawnCacheDeviceDescriptor cache_descriptor = m_pipeline_cache.device_descriptor(m_adapter, required_limits.limits);
+    DawnTogglesDescriptor device_toggles = dawn_toggles_descriptor(wants_gpu_timestamps());
+    cache_descriptor.chain.next = &device_toggles.chain;
+    device_descriptor.nextInChain = &cache_descriptor.chain;
+#endif
     m_device = m_adapter.requestDevice(device_descriptor);
     // Get device limits
     SupportedLimits device_supported_limits;
@@ -181,70 +459,122 @@ bool Engine::init_window_and_device() {
 
     m_queue = m_device.getQueue();
 
+    std::cout << "Presenting with " << FramePacer::present_mode_name(m_frame_pacer.get_present_mode())
+        << " and " << m_frame_pacer.get_frames_in_flight() << " frames in flight" << std::endl;
+    if (!m_frame_pacer.init(m_device)) return false;
+    if (!m_profiler.init(m_device, m_settings.trace_path, m_settings.print_profile)) return false;
+
+    // The registry already loads the CPU side assets while the device is requested, see on_init()
+    m_assets.set_device(m_device);
     return true;
 }
 
 void Engine::terminate_window_and_device() {
-    m_surface.release();
+    m_assets.terminate();
+    if (m_surface) m_surface.release();
     m_queue.release();
     m_device.release();
     m_adapter.release();
     m_instance.release();
 
-    glfwDestroyWindow(m_window);
-    glfwTerminate();
+    if (m_window) {
+        glfwDestroyWindow(m_window);
+        glfwTerminate();
+    }
+    m_window = nullptr;
 }
 
 bool Engine::init_swap_chain() {
+    if (m_settings.headless) {
+        TextureDescriptor texture_descriptor;
+        texture_descriptor.label = "Offscreen color";
+        texture_descriptor.dimension = TextureDimension::_2D;
+        texture_descriptor.format = m_swap_chain_format;
+        texture_descriptor.mipLevelCount = 1;
+        texture_descriptor.sampleCount = 1;
+        texture_descriptor.size = { m_window_width, m_window_height, 1 };
+        texture_descriptor.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+        texture_descriptor.viewFormatCount = 0;
+        texture_descriptor.viewFormats = nullptr;
+        m_offscreen_texture = m_gpu_memory.create_texture(m_device, texture_descriptor, GpuMemory::Category::Target);
+        if (!m_offscreen_texture) return false;
+        TextureViewDescriptor texture_view_descriptor;
+        texture_view_descriptor.aspect = TextureAspect::All;
+        texture_view_descriptor.baseArrayLayer = 0;
+        texture_view_descriptor.arrayLayerCount = 1;
+        texture_view_descriptor.baseMipLevel = 0;
+        texture_view_descriptor.mipLevelCount = 1;
+        texture_view_descriptor.dimension = TextureViewDimension::_2D;
+        texture_view_descriptor.format = m_swap_chain_format;
+        m_offscreen_texture_view = m_offscreen_texture.createView(texture_view_descriptor);
+        return m_offscreen_texture_view != nullptr;
+    }
+
     SwapChainDescriptor swap_chain_descriptor = {};
-    swap_chain_descriptor.width = m_width;
-    swap_chain_descriptor.height = m_height;
+    swap_chain_descriptor.width = m_window_width;
+    swap_chain_descriptor.height = m_window_height;
     swap_chain_descriptor.usage = TextureUsage::RenderAttachment;
     swap_chain_descriptor.format = m_swap_chain_format;
-    swap_chain_descriptor.presentMode = PresentMode::Fifo;
+    swap_chain_descriptor.presentMode = m_frame_pacer.get_present_mode();
     m_swap_chain = m_device.createSwapChain(m_surface, swap_chain_descriptor);
     return m_swap_chain != nullptr;
 }
 
 void Engine::terminate_swap_chain() {
-    m_swap_chain.release();
+    if (m_swap_chain) m_swap_chain.release();
+    if (m_offscreen_texture_view) m_offscreen_texture_view.release();
+    if (m_offscreen_texture) m_gpu_memory.destroy(m_offscreen_texture);
+    m_swap_chain = nullptr;
+    m_offscreen_texture_view = nullptr;
 }
 
 void Engine::terminate_render_pipeline() {
-    m_render_pipeline.release();
-    m_shader_module.release();
+    // The pending callback would write into the released pipeline, after a timeout its storage is left to it
+    if (!tick_until(m_device, [this]() { return !m_render_pipeline_pending; })) {
+        std::cerr << "Gave up waiting for the tilemap pipeline" << std::endl;
+        m_render_pipeline_request.release();
+    }
+    m_render_pipeline_request.reset();
+    if (m_render_pipeline) m_render_pipeline.release();
+    m_render_pipeline = nullptr;
+    m_shader = nullptr;
     m_bind_group_layout.release();
+    release_reload_pipeline();
 }
 
-bool Engine::init_render_pipeline() {
-    RenderPipelineDescriptor pipeline_descriptor;
-
-    std::filesystem::path path = std::filesystem::path(RESOURCE_DIR "/shaders/shader.wgsl");
-    m_shader_module = ShaderLoader::load_shader_module(path, m_device);
-
-    // Vertex fetch
-    std::vector<VertexAttribute> vertex_attributes(2);
+void Engine::release_reload_pipeline() {
+    // Only a reload that timed out leaves something behind, its callback may still come
+    if (!tick_until(m_device, [this]() { return !m_reload_pipeline_pending; })) {
+        std::cerr << "Gave up waiting for the reloaded tilemap pipeline" << std::endl;
+        m_reload_pipeline_request.release();
+    }
+    m_reload_pipeline_request.reset();
+    if (m_reload_render_pipeline) m_reload_render_pipeline.release();
+    if (m_reload_bind_group_layout) m_reload_bind_group_layout.release();
+    m_reload_render_pipeline = nullptr;
+    m_reload_bind_group_layout = nullptr;
+}
 
-    // Position attribute
-    vertex_attributes[0].shaderLocation = 0;
-    vertex_attributes[0].format = VertexFormat::Float32x2;
-    vertex_attributes[0].offset = 0;
+bool Engine::init_render_pipeline() {
+    m_shader = m_assets.load_shader(tilemap_shader_name);
+    if (!m_shader) {
+        std::cerr << "Could not load shader!" << std::endl;
+        return false;
+    }
+    m_render_pipeline_request = request_render_pipeline(m_shader->module, m_bind_group_layout, m_render_pipeline, m_render_pipeline_pending);
+    return m_render_pipeline_request != nullptr;
+}
 
-    // Color attribute
-    vertex_attributes[1].shaderLocation = 1;
-    vertex_attributes[1].format = VertexFormat::Float32x3;
-    vertex_attributes[1].offset = 2 * sizeof(float);
+std::unique_ptr<CreateRenderPipelineAsyncCallback> Engine::request_render_pipeline(ShaderModule shader, BindGroupLayout& bind_group_layout, RenderPipeline& pipeline, bool& pending) {
+    RenderPipelineDescriptor pipeline_descriptor;
 
-    VertexBufferLayout vertex_buffer_layout;
-    vertex_buffer_layout.attributeCount = (uint32_t)vertex_attributes.size();
-    vertex_buffer_layout.attributes = vertex_attributes.data();
-    vertex_buffer_layout.arrayStride = 5 * sizeof(float);
-    vertex_buffer_layout.stepMode = VertexStepMode::Vertex;
+    // Vertex fetch, laid out as the mesh header describes
+    VertexBufferLayout vertex_buffer_layout = m_mesh.get_vertex_buffer_layout();
 
     pipeline_descriptor.vertex.bufferCount = 1;
     pipeline_descriptor.vertex.buffers = &vertex_buffer_layout;
 
-    pipeline_descriptor.vertex.module = m_shader_module;
+    pipeline_descriptor.vertex.module = shader;
     pipeline_descriptor.vertex.entryPoint = "vs_main";
     pipeline_descriptor.vertex.constantCount = 0;
     pipeline_descriptor.vertex.constants = nullptr;
@@ -256,7 +586,7 @@ bool Engine::init_render_pipeline() {
 
     FragmentState fragment_state;
     pipeline_descriptor.fragment = &fragment_state;
-    fragment_state.module = m_shader_module;
+    fragment_state.module = shader;
     fragment_state.entryPoint = "fs_main";
     fragment_state.constantCount = 0;
     fragment_state.constants = nullptr;
@@ -277,13 +607,20 @@ bool Engine::init_render_pipeline() {
     fragment_state.targetCount = 1;
     fragment_state.targets = &color_target;
     
-    pipeline_descriptor.depthStencil = nullptr;
+    // The tilemap shares the render pass with the sprites but never touches depth
+    DepthStencilState depth_stencil_state = Default;
+    depth_stencil_state.format = m_depth_texture_format;
+    depth_stencil_state.depthWriteEnabled = false;
+    depth_stencil_state.depthCompare = CompareFunction::Always;
+    depth_stencil_state.stencilReadMask = 0;
+    depth_stencil_state.stencilWriteMask = 0;
+    pipeline_descriptor.depthStencil = &depth_stencil_state;
 
     pipeline_descriptor.multisample.count = 1;
     pipeline_descriptor.multisample.mask = ~0u;
     pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
 
-    std::vector<BindGroupLayoutEntry> binding_layout_entries(3, Default);
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(9, Default);
     // Create binding layout
     BindGroupLayoutEntry& bindingLayout = binding_layout_entries[0];
     bindingLayout.binding = 0;
@@ -296,153 +633,636 @@ bool Engine::init_render_pipeline() {
     BindGroupLayoutEntry& texture_binding_layout = binding_layout_entries[1];
     texture_binding_layout.binding = 1;
     texture_binding_layout.visibility = ShaderStage::Fragment;
-    texture_binding_layout.texture.sampleType = TextureSampleType::Float;
-    texture_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+    texture_binding_layout.texture.sampleType = TextureSampleType::Uint;
+    texture_binding_layout.texture.viewDimension = TextureViewDimension::_2DArray;
 
     BindGroupLayoutEntry& tilemap_binding_layout = binding_layout_entries[2];
     tilemap_binding_layout.binding = 2;
     tilemap_binding_layout.visibility = ShaderStage::Fragment;
     tilemap_binding_layout.texture.sampleType = TextureSampleType::Uint;
-    tilemap_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+    tilemap_binding_layout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+    BindGroupLayoutEntry& residency_binding_layout = binding_layout_entries[3];
+    residency_binding_layout.binding = 3;
+    residency_binding_layout.visibility = ShaderStage::Fragment;
+    residency_binding_layout.texture.sampleType = TextureSampleType::Uint;
+    residency_binding_layout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+    BindGroupLayoutEntry& layer_binding_layout = binding_layout_entries[4];
+    layer_binding_layout.binding = 4;
+    layer_binding_layout.visibility = ShaderStage::Fragment;
+    layer_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    layer_binding_layout.buffer.minBindingSize = sizeof(TilemapStreamer::LayerData);
+
+    BindGroupLayoutEntry& first_layer_binding_layout = binding_layout_entries[5];
+    first_layer_binding_layout.binding = 5;
+    first_layer_binding_layout.visibility = ShaderStage::Fragment;
+    first_layer_binding_layout.texture.sampleType = TextureSampleType::Uint;
+    first_layer_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutEntry& palette_binding_layout = binding_layout_entries[6];
+    palette_binding_layout.binding = 6;
+    palette_binding_layout.visibility = ShaderStage::Fragment;
+    palette_binding_layout.texture.sampleType = TextureSampleType::Float;
+    palette_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutEntry& animation_binding_layout = binding_layout_entries[7];
+    animation_binding_layout.binding = 7;
+    animation_binding_layout.visibility = ShaderStage::Fragment;
+    animation_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    animation_binding_layout.buffer.minBindingSize = sizeof(TilemapStreamer::AnimationEntry);
+
+    BindGroupLayoutEntry& remap_binding_layout = binding_layout_entries[8];
+    remap_binding_layout.binding = 8;
+    remap_binding_layout.visibility = ShaderStage::Fragment;
+    remap_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    remap_binding_layout.buffer.minBindingSize = sizeof(uint32_t);
 
     // Create a bind group layout
     BindGroupLayoutDescriptor bind_group_layout_descriptor;
     bind_group_layout_descriptor.entryCount = (uint32_t)binding_layout_entries.size();
     bind_group_layout_descriptor.entries = binding_layout_entries.data();
-    m_bind_group_layout = m_device.createBindGroupLayout(bind_group_layout_descriptor);
+    bind_group_layout = m_device.createBindGroupLayout(bind_group_layout_descriptor);
 
     // Create the pipeline layout
     PipelineLayoutDescriptor pipeline_layout_descriptor;
     pipeline_layout_descriptor.bindGroupLayoutCount = 1;
-    pipeline_layout_descriptor.bindGroupLayouts = (WGPUBindGroupLayout*)&m_bind_group_layout;
+    pipeline_layout_descriptor.bindGroupLayouts = (WGPUBindGroupLayout*)&bind_group_layout;
     PipelineLayout layout = m_device.createPipelineLayout(pipeline_layout_descriptor);
     pipeline_descriptor.layout = layout;
 
-    m_render_pipeline = m_device.createRenderPipeline(pipeline_descriptor);
-
-    return m_render_pipeline != nullptr;
+    // Compiled in the background, see wait_for_pipelines(). pipeline and pending must outlive the request.
+    pending = true;
+    RenderPipeline* result = &pipeline;
+    bool* result_pending = &pending;
+    return m_device.createRenderPipelineAsync(pipeline_descriptor, [result, result_pending](CreatePipelineAsyncStatus status, RenderPipeline created, char const* message) {
+        *result_pending = false;
+        if (status != CreatePipelineAsyncStatus::Success) {
+            std::cerr << "Could not create render pipeline: " << (message ? message : "") << std::endl;
+            return;
+        }
+        *result = created;
+    });
 }
 
 bool Engine::init_textures() {
+    if (!create_textures(m_tilemap_streamer, m_tilesets)) return false;
+    update_tilemap_uniforms();
+    return true;
+}
 
-    std::filesystem::path tileset_path = std::filesystem::path(RESOURCE_DIR "/textures/overworld.png");
-    m_tileset_texture = TextureLoader::load_texture(tileset_path, m_device, &m_tileset_texture_view);
-    if (!m_tileset_texture) {
-        std::cerr << "Could not load texture!" << std::endl;
+bool Engine::create_textures(TilemapStreamer& tilemap_streamer, TilesetArray& tilesets) {
+
+    // Maps converted ahead of time by nostalgia_mapc are memory mapped, plain .tmj maps are compiled on load
+    std::shared_ptr<const CompiledTilemap> tilemap = m_settings.tilemap;
+    std::filesystem::path map_name = tilemap_name;
+    if (!tilemap) {
+        map_name = tilemap_asset_name(m_assets);
+        tilemap = m_assets.load_tilemap(map_name);
+    }
+    if (!tilemap) {
+        std::cerr << "Could not load tilemap!" << std::endl;
         return false;
     }
 
-    std::filesystem::path tilemap_path = std::filesystem::path(RESOURCE_DIR "/tilemaps/map.tmj");
-    auto tilemap = TilemapLoader::load_tilemap(tilemap_path);
-    m_uniforms.tilemap_width = tilemap.width;
-    m_uniforms.tilemap_height = tilemap.height;
-    m_uniforms.number_of_layers = tilemap.number_of_layers;
-    m_tilemap_texture = TextureLoader::load_tilemap_as_texture(tilemap, m_device, &m_tilemap_texture_view);
+    // Pixel art tilesets only use a handful of colors, so one byte per pixel plus a palette is enough.
+    // All tilesets of the map go into one texture array, the map still draws with a single bind group.
+    if (!tilesets.init(m_device, m_gpu_memory, m_assets, *tilemap, map_name, tileset_name)) {
+        std::cerr << "Could not load texture!" << std::endl;
+        return false;
+    }
 
-    if (!m_tilemap_texture) {
-        std::cerr << "Could not load tilemap texture!" << std::endl;
+    uint32_t pool_chunks_x = TilemapStreamer::pool_chunks_for_view(m_width);
+    uint32_t pool_chunks_y = TilemapStreamer::pool_chunks_for_view(m_height);
+    if (!tilemap_streamer.init(m_device, m_gpu_memory, std::move(tilemap), pool_chunks_x, pool_chunks_y)) {
+        std::cerr << "Could not create tilemap chunk pool!" << std::endl;
         return false;
     }
 
+    // Lets the shader start at the topmost opaque tile instead of blending every layer
+    tilemap_streamer.set_opaque_tiles(tilesets.find_opaque_tiles(m_assets));
     return true;
 }
 
+void Engine::update_tilemap_uniforms() {
+    m_uniforms.tilemap_width = m_tilemap_streamer.get_tilemap().width();
+    m_uniforms.tilemap_height = m_tilemap_streamer.get_tilemap().height();
+    m_uniforms.palette = 0.0f;
+    // Hidden layers are not part of the pool, the shader only loops over the visible ones
+    m_uniforms.number_of_layers = m_tilemap_streamer.get_number_of_visible_layers();
+    m_uniforms.pool_chunks_x = m_tilemap_streamer.get_pool_chunks_x();
+    m_uniforms.pool_chunks_y = m_tilemap_streamer.get_pool_chunks_y();
+    m_uniforms.animated_gids = m_tilemap_streamer.get_animated_gid_count();
+    m_uniforms.skip_covered_layers = m_settings.skip_covered_layers ? 1.0f : 0.0f;
+}
+
 bool Engine::init_geometries() {
 
-    std::filesystem::path geometry_path = std::filesystem::path(RESOURCE_DIR "/geometries/webgpu.txt");
-    bool success = GeometryLoader::load_geometry(geometry_path, m_point_data, m_index_data);
-    if (!success) {
+    // Meshes converted ahead of time by nostalgia_meshc are memory mapped, text geometries are compiled on load
+    AssetRegistry::Handle<CompiledMesh> geometry = m_assets.load_mesh(geometry_asset_name(m_assets));
+    if (!geometry || !m_mesh.init(m_device, m_gpu_memory, *geometry)) {
         std::cerr << "Could not load geometry!" << std::endl;
         return false;
     }
     return true;
 }
 
-bool Engine::init_buffers() {
+void Engine::terminate_geometries() {
+    m_mesh.terminate();
+}
 
-    // Create vertex buffer
-    BufferDescriptor buffer_description;
-    buffer_description.size = m_point_data.size() * sizeof(float);
-    buffer_description.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-    buffer_description.mappedAtCreation = false;
-    m_vertex_buffer = m_device.createBuffer(buffer_description);
-    m_queue.writeBuffer(m_vertex_buffer, 0, m_point_data.data(), buffer_description.size);
-    
-    // Create index buffer
-    buffer_description.size = m_index_data.size() * sizeof(float);
-    buffer_description.usage = BufferUsage::CopyDst | BufferUsage::Index;
-    buffer_description.mappedAtCreation = false;
-    m_index_buffer = m_device.createBuffer(buffer_description);
-    m_queue.writeBuffer(m_index_buffer, 0, m_index_data.data(), buffer_description.size);
-
-    m_uniform_stride = ceilToNextMultiple(
-        (uint32_t)sizeof(MyUniforms),
-        (uint32_t)m_device_limits.minUniformBufferOffsetAlignment
-    );
-    // The buffer will contain 2 values for the uniforms plus the space in between
-    // (NB: stride = sizeof(MyUniforms) + spacing)
-    buffer_description.size = m_uniform_stride + sizeof(MyUniforms);
-    buffer_description.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-    buffer_description.mappedAtCreation = false;
-    m_uniform_buffer = m_device.createBuffer(buffer_description);
-    
-    m_uniforms.time = 1.0f;
-    m_queue.writeBuffer(m_uniform_buffer, 0, &m_uniforms, sizeof(MyUniforms));
+bool Engine::init_buffers() {
+    // Aligned slots for every draw of the frame, the tilemap only needs one
+    if (!m_uniform_arena.init(m_device, m_gpu_memory, m_frame_pacer.get_frames_in_flight(), m_settings.uniform_arena_capacity)) {
+        std::cerr << "Could not create the uniform arena!" << std::endl;
+        return false;
+    }
+    m_bind_groups.init(m_device);
+    return true;
+}
 
+bool Engine::grow_uniform_arena() {
+    uint64_t requested = m_uniform_arena.get_requested_bytes();
+    uint64_t capacity = m_uniform_arena.get_frame_capacity();
+    uint64_t max_capacity = m_uniform_arena.get_max_frame_capacity();
+    if (requested <= capacity || capacity >= max_capacity) return true;
+    while (capacity < requested) capacity *= 2;
+    if (!m_uniform_arena.resize((uint32_t)std::min(capacity, max_capacity))) return false;
+
+    // Every bind group of the old buffer goes, the scene pass gets a new one from the cache
+    m_bind_groups.clear();
+    m_tilemap_bind_group = nullptr;
+    m_bindings[0].buffer = m_uniform_arena.get_buffer();
+    if (m_tile_quad_shader && !m_tile_quads.set_uniform_buffer(m_uniform_arena.get_buffer(), sizeof(MyUniforms))) return false;
+    std::cerr << "Grew the uniform arena to " << m_uniform_arena.get_frame_capacity() << " bytes per frame" << std::endl;
     return true;
 }
 
 bool Engine::init_bindings() {
+    m_bindings = create_bindings(m_tilemap_streamer, m_tilesets);
 
-    m_bindings = std::vector<BindGroupEntry>(3);
-    m_bindings[0].binding = 0;
-    m_bindings[0].buffer = m_uniform_buffer;
-    m_bindings[0].offset = 0;
-    m_bindings[0].size = sizeof(MyUniforms);
+    // Created by the cache the first time the scene pass draws with these resources
+    if (!m_bind_groups.get(m_bind_group_layout, m_bindings)) return false;
 
-    m_bindings[1].binding = 1;
-    m_bindings[1].textureView = m_tileset_texture_view;
+    // On a reload the streamer and the tilesets may have been replaced, on startup init_tile_quads() follows
+    if (m_tile_quad_shader) {
+        return m_tile_quads.set_tilemap(m_tilemap_streamer, m_tilesets, m_uniform_arena.get_buffer(), sizeof(MyUniforms));
+    }
+    return true;
+}
 
-    m_bindings[2].binding = 2;
-    m_bindings[2].textureView = m_tilemap_texture_view;
+std::vector<BindGroupEntry> Engine::create_bindings(const TilemapStreamer& tilemap_streamer, const TilesetArray& tilesets) const {
+    std::vector<BindGroupEntry> bindings(9);
+    bindings[0].binding = 0;
+    bindings[0].buffer = m_uniform_arena.get_buffer();
+    bindings[0].offset = 0;
+    bindings[0].size = sizeof(MyUniforms);
 
-    m_bind_group_descriptor.layout = m_bind_group_layout;
-    m_bind_group_descriptor.entryCount = (uint32_t)m_bindings.size();
-    m_bind_group_descriptor.entries = m_bindings.data();
-    m_bind_group = m_device.createBindGroup(m_bind_group_descriptor);
+    bindings[1].binding = 1;
+    bindings[1].textureView = tilesets.get_indices_view();
 
-    return true;
+    bindings[2].binding = 2;
+    bindings[2].textureView = tilemap_streamer.get_tilemap_view();
+
+    bindings[3].binding = 3;
+    bindings[3].textureView = tilemap_streamer.get_residency_view();
+
+    bindings[4].binding = 4;
+    bindings[4].buffer = tilemap_streamer.get_layer_buffer();
+    bindings[4].offset = 0;
+    bindings[4].size = std::max<uint64_t>(tilemap_streamer.get_layer_buffer_size(), sizeof(TilemapStreamer::LayerData));
+
+    bindings[5].binding = 5;
+    bindings[5].textureView = tilemap_streamer.get_first_layer_view();
+
+    bindings[6].binding = 6;
+    bindings[6].textureView = tilesets.get_palette_view();
+
+    bindings[7].binding = 7;
+    bindings[7].buffer = tilemap_streamer.get_animation_buffer();
+    bindings[7].offset = 0;
+    bindings[7].size = tilemap_streamer.get_animation_buffer_size();
+
+    bindings[8].binding = 8;
+    bindings[8].buffer = tilesets.get_remap_buffer();
+    bindings[8].offset = 0;
+    bindings[8].size = tilesets.get_remap_buffer_size();
+    return bindings;
 }
 
 void Engine::terminate_buffers() {
-    m_vertex_buffer.destroy();
-    m_vertex_buffer.release();
-    m_index_buffer.destroy();
-    m_index_buffer.release();
-    m_uniform_buffer.destroy();
-    m_uniform_buffer.release();
+    m_bind_groups.terminate();
+    m_uniform_arena.terminate();
 }
 
 void Engine::terminate_bindings() {
-    m_bind_group.release();
+    // The resources of the bindings may be replaced, nothing should keep them alive
+    m_bind_groups.clear();
 }
 
 void Engine::resize_screen(const u_int32_t width, const u_int32_t height) {
+    // Minimized windows report a zero size, there is nothing to present then
+    if (width == 0 || height == 0) return;
+    if (width == m_window_width && height == m_window_height) return;
+
+    // The scene keeps its virtual resolution, only the swap chain and the upscale follow the window
     terminate_swap_chain();
+    const u_int32_t previous_width = m_window_width;
+    const u_int32_t previous_height = m_window_height;
+    m_window_width = width;
+    m_window_height = height;
+    if (!init_swap_chain()) {
+        // Frames are skipped without a swap chain. The old size stays stored, so the new one is not taken as unchanged
+        // when it is tried again after the resize delay.
+        std::cerr << "Could not recreate the swap chain at " << width << "x" << height << ", trying again" << std::endl;
+        terminate_swap_chain();
+        m_window_width = previous_width;
+        m_window_height = previous_height;
+        m_pending_window_width = width;
+        m_pending_window_height = height;
+        m_resize_pending = true;
+        m_resize_time = get_time();
+        return;
+    }
+    m_upscaler.set_target_size(m_window_width, m_window_height);
+}
 
-    m_width = width / 2;
-    m_height = height / 2;
-    m_uniforms.screen_width = m_width;
-    m_uniforms.screen_height = m_height;
+bool Engine::init_render_graph() {
+    m_render_graph.init(m_device, m_gpu_memory, &m_profiler);
+    m_scene_target = m_render_graph.create_texture("scene", { m_width, m_height, m_swap_chain_format });
+    RenderGraph::ResourceId depth = m_render_graph.create_texture("depth", { m_width, m_height, m_depth_texture_format });
+    m_frame_target = m_render_graph.import_texture("frame");
+    m_render_graph.mark_output(m_frame_target);
+
+    // The scene is drawn at the fixed virtual resolution and scaled up afterwards
+    RenderGraph::PassId scene_pass = m_render_graph.add_pass("scene pass", [this](RenderPassEncoder& render_pass) {
+        // Without uniforms the tilemap is skipped, the arena has already reported it
+        if (m_uniform_offset != UniformArena::no_offset) {
+            if (m_settings.tilemap_renderer == TilemapRenderer::Quads) {
+                m_tile_quads.render(render_pass);
+            }
+            else {
+                m_render_bundles.execute(render_pass, { m_tilemap_bundles[m_frame_pacer.get_frame_slot()] });
+            }
+        }
+        m_sprite_batch.render(render_pass);
+    });
+    m_render_graph.write_color(scene_pass, m_scene_target, LoadOp::Clear, Color{ 0.05, 0.05, 0.05, 1.0 });
+    // Only sprites test and write depth, the tilemap is always behind them
+    m_render_graph.write_depth(scene_pass, depth);
+
+    RenderGraph::PassId upscale_pass = m_render_graph.add_pass("upscale pass", [this](RenderPassEncoder& render_pass) {
+        m_upscaler.render(render_pass);
+    });
+    m_render_graph.read(upscale_pass, m_scene_target);
+    m_render_graph.write_color(upscale_pass, m_frame_target);
+
+    if (!m_render_graph.compile()) {
+        std::cerr << "Could not compile the render graph!" << std::endl;
+        return false;
+    }
+    const RenderGraph::Stats& stats = m_render_graph.get_stats();
+    std::cout << "Render graph: " << stats.passes - stats.culled_passes << " of " << stats.passes << " passes, "
+        << stats.transient_textures << " transient textures in " << stats.pooled_textures << " pooled ("
+        << stats.pooled_bytes / 1024 << " KiB)" << std::endl;
+    return true;
+}
+
+void Engine::terminate_render_graph() {
+    m_render_graph.terminate();
+}
+
+bool Engine::init_upscaler() {
+    m_upscale_shader = m_assets.load_shader(upscale_shader_name);
+    if (!m_upscale_shader || !m_upscaler.init(m_device, m_gpu_memory, m_upscale_shader->module, m_swap_chain_format)) {
+        std::cerr << "Could not create upscaler!" << std::endl;
+        return false;
+    }
+    m_upscaler.set_target_size(m_window_width, m_window_height);
+    return m_upscaler.set_scene(m_render_graph.get_view(m_scene_target), m_width, m_height);
+}
+
+void Engine::terminate_upscaler() {
+    m_upscaler.terminate();
+    m_upscale_shader = nullptr;
+}
+
+bool Engine::init_tile_quads() {
+    if (m_settings.tilemap_renderer != TilemapRenderer::Quads) return true;
+    m_tile_quad_shader = m_assets.load_shader(tile_quad_shader_name);
+    if (!m_tile_quad_shader || !m_tile_quads.init(m_device, m_gpu_memory, m_tile_quad_shader->module, m_swap_chain_format, m_depth_texture_format,
+        m_frame_pacer.get_frames_in_flight(), m_settings.tile_quad_bundles, supports_threaded_recording(m_device))) {
+        std::cerr << "Could not create tile quad renderer!" << std::endl;
+        return false;
+    }
+    return m_tile_quads.set_tilemap(m_tilemap_streamer, m_tilesets, m_uniform_arena.get_buffer(), sizeof(MyUniforms));
+}
+
+bool Engine::init_render_bundles() {
+    if (!m_render_bundles.init(m_device, m_swap_chain_format, m_depth_texture_format, std::clamp(std::thread::hardware_concurrency(), 1u, 4u), supports_threaded_recording(m_device))) {
+        std::cerr << "Could not create render bundle cache!" << std::endl;
+        return false;
+    }
+    for (uint32_t slot = 0; slot < m_frame_pacer.get_frames_in_flight(); slot++) {
+        m_tilemap_bundles.push_back(m_render_bundles.add("tilemap", [this](RenderBundleEncoder& render_bundle) {
+            if (!m_render_pipeline || !m_tilemap_bind_group) return;
+            render_bundle.setPipeline(m_render_pipeline);
+            render_bundle.setBindGroup(0, m_tilemap_bind_group, 1, &m_uniform_offset);
+            m_mesh.draw(render_bundle);
+        }));
+    }
+    return true;
+}
+
+void Engine::terminate_render_bundles() {
+    m_render_bundles.terminate();
+    m_tilemap_bundles.clear();
+    m_tilemap_bind_group = nullptr;
+}
+
+void Engine::terminate_tile_quads() {
+    m_tile_quads.terminate();
+    m_tile_quad_shader = nullptr;
+}
+
+bool Engine::set_tile(uint32_t layer, uint32_t x, uint32_t y, uint32_t gid) {
+    if (!m_tilemap_streamer.set_tile(layer, x, y, gid)) return false;
+    m_tile_quads.invalidate_tile(layer, x, y);
+
+    // The tile is solid if any of its layers says so, not just the edited one
+    bool solid = false;
+    const uint32_t number_of_layers = m_tilemap_streamer.get_tilemap().number_of_layers();
+    for (uint32_t i = 0; i < number_of_layers && !solid; i++) {
+        solid = m_simulation.is_solid_tile(i, i == layer ? gid : m_tilemap_streamer.get_tile(i, x, y));
+    }
+    m_simulation.set_solid(x, y, solid);
+    return true;
+}
 
-    init_swap_chain();
+void Engine::reload_assets() {
+    std::vector<std::filesystem::path> changed = m_assets.poll_changes();
+    if (changed.empty()) return;
+
+    auto is_changed = [&](const std::filesystem::path& name) {
+        return std::find(changed.begin(), changed.end(), name) != changed.end();
+    };
+    bool reload_pipeline = is_changed(tilemap_shader_name);
+    bool reload_textures = is_changed(compiled_tilemap_name) || is_changed(tilemap_name);
+    for (const std::filesystem::path& name : changed) {
+        reload_textures = reload_textures || m_tilesets.uses_image(name);
+    }
+
+    // Only the objects depending on the changed files are rebuilt, next to the ones in use. They are
+    // swapped in once every step worked, a broken shader, tileset or map keeps the previous assets.
+    if (reload_pipeline || reload_textures) {
+        AssetRegistry::Handle<ShaderAsset> shader = m_shader;
+        BindGroupLayout bind_group_layout = m_bind_group_layout;
+        RenderPipeline render_pipeline = m_render_pipeline;
+        TilemapStreamer tilemap_streamer;
+        TilesetArray tilesets;
+        bool reloaded = true;
+        if (reload_pipeline) {
+            shader = m_assets.load_shader(tilemap_shader_name);
+            bind_group_layout = nullptr;
+            render_pipeline = nullptr;
+            if (m_reload_pipeline_pending) {
+                std::cerr << "The previous reload of the tilemap shader is still compiling" << std::endl;
+            }
+            else if (shader) {
+                release_reload_pipeline();
+                m_reload_pipeline_request = request_render_pipeline(shader->module, m_reload_bind_group_layout, m_reload_render_pipeline, m_reload_pipeline_pending);
+                // A hot reload is rare enough to block on, but a device that does not answer keeps the previous pipeline
+                if (tick_until(m_device, [this]() { return !m_reload_pipeline_pending; }, pipeline_timeout)) {
+                    m_reload_pipeline_request.reset();
+                    std::swap(bind_group_layout, m_reload_bind_group_layout);
+                    std::swap(render_pipeline, m_reload_render_pipeline);
+                }
+                else {
+                    std::cerr << "Gave up waiting for the reloaded tilemap pipeline" << std::endl;
+                }
+            }
+            reloaded = render_pipeline != nullptr;
+        }
+        if (reloaded && reload_textures) {
+            reloaded = create_textures(tilemap_streamer, tilesets);
+        }
+        std::vector<BindGroupEntry> bindings;
+        if (reloaded) {
+            bindings = create_bindings(reload_textures ? tilemap_streamer : m_tilemap_streamer, reload_textures ? tilesets : m_tilesets);
+            reloaded = m_bind_groups.get(bind_group_layout, bindings) != nullptr;
+        }
+
+        if (reloaded) {
+            // The bind groups of the old resources go first, nothing should keep them alive
+            terminate_bindings();
+            if (reload_pipeline) {
+                terminate_render_pipeline();
+                m_shader = shader;
+                m_bind_group_layout = bind_group_layout;
+                m_render_pipeline = render_pipeline;
+            }
+            if (reload_textures) {
+                std::swap(m_tilemap_streamer, tilemap_streamer);
+                std::swap(m_tilesets, tilesets);
+                update_tilemap_uniforms();
+            }
+            m_bindings = std::move(bindings);
+            if (!m_bind_groups.get(m_bind_group_layout, m_bindings)) reloaded = false;
+            if (m_tile_quad_shader && !m_tile_quads.set_tilemap(m_tilemap_streamer, m_tilesets, m_uniform_arena.get_buffer(), sizeof(MyUniforms))) {
+                reloaded = false;
+            }
+            if (!reloaded) std::cerr << "Could not bind the reloaded assets!" << std::endl;
+        }
+        else {
+            std::cerr << "Could not reload the changed assets, keeping the previous ones" << std::endl;
+            if (reload_pipeline) {
+                if (render_pipeline) render_pipeline.release();
+                if (bind_group_layout) bind_group_layout.release();
+            }
+        }
+        // The replaced objects when reloaded, the unused new ones otherwise
+        tilemap_streamer.terminate();
+        tilesets.terminate();
+    }
+
+    if (is_changed(upscale_shader_name)) {
+        AssetRegistry::Handle<ShaderAsset> upscale_shader = m_assets.load_shader(upscale_shader_name);
+        if (upscale_shader && m_upscaler.set_shader_module(upscale_shader->module)) {
+            m_upscale_shader = upscale_shader;
+        }
+    }
+    if (is_changed(tile_quad_shader_name) && m_settings.tilemap_renderer == TilemapRenderer::Quads) {
+        AssetRegistry::Handle<ShaderAsset> tile_quad_shader = m_assets.load_shader(tile_quad_shader_name);
+        if (tile_quad_shader && m_tile_quads.set_shader_module(tile_quad_shader->module)) {
+            m_tile_quad_shader = tile_quad_shader;
+        }
+    }
+    if (is_changed(sprite_shader_name)) {
+        AssetRegistry::Handle<ShaderAsset> sprite_shader = m_assets.load_shader(sprite_shader_name);
+        if (sprite_shader && m_sprite_batch.set_shader_module(sprite_shader->module)) {
+            m_sprite_shader = sprite_shader;
+        }
+    }
+    if (is_changed(tileset_name)) {
+        AssetRegistry::Handle<IndexedTextureAsset> sprite_atlas = m_assets.load_indexed_texture_array({ tileset_name });
+        if (sprite_atlas) {
+            m_sprite_batch.set_texture(m_tileset_sprite_texture, sprite_atlas->texture.indices_view, sprite_atlas->texture.palette_view);
+            m_sprite_atlas = sprite_atlas;
+        }
+    }
+}
+
+void Engine::update_input() {
+    if (!m_window) return;
+    float dx = 0.0f;
+    float dy = 0.0f;
+    if (glfwGetKey(m_window, GLFW_KEY_LEFT) == GLFW_PRESS || glfwGetKey(m_window, GLFW_KEY_A) == GLFW_PRESS) dx -= 1.0f;
+    if (glfwGetKey(m_window, GLFW_KEY_RIGHT) == GLFW_PRESS || glfwGetKey(m_window, GLFW_KEY_D) == GLFW_PRESS) dx += 1.0f;
+    if (glfwGetKey(m_window, GLFW_KEY_UP) == GLFW_PRESS || glfwGetKey(m_window, GLFW_KEY_W) == GLFW_PRESS) dy -= 1.0f;
+    if (glfwGetKey(m_window, GLFW_KEY_DOWN) == GLFW_PRESS || glfwGetKey(m_window, GLFW_KEY_S) == GLFW_PRESS) dy += 1.0f;
+    m_simulation.set_input(dx, dy);
 }
 
 void Engine::terminate_textures() {
-    m_tilemap_texture_view.release();
-    m_tilemap_texture.destroy();
-    m_tilemap_texture.release();
-    m_tileset_texture_view.release();
-    m_tileset_texture.destroy();
-    m_tileset_texture.release();
+    m_tilemap_streamer.terminate();
+    m_tilesets.terminate();
 }
+
+bool Engine::init_sprites() {
+    m_sprite_shader = m_assets.load_shader(sprite_shader_name);
+    if (!m_sprite_shader || !m_sprite_batch.init(m_device, m_gpu_memory, m_sprite_shader->module, m_swap_chain_format, m_depth_texture_format, std::max(1u, m_settings.sprite_count), m_frame_pacer.get_frames_in_flight())) {
+        std::cerr << "Could not create sprite batch!" << std::endl;
+        return false;
+    }
+    // The tileset doubles as the sprite atlas of the demo. As a one layer array it is the very texture the tilemap draws from
+    // whenever the map has no other tileset, otherwise a second copy of its indices.
+    m_sprite_atlas = m_assets.load_indexed_texture_array({ tileset_name });
+    if (!m_sprite_atlas) {
+        std::cerr << "Could not load texture!" << std::endl;
+        return false;
+    }
+    m_tileset_sprite_texture = m_sprite_batch.add_texture(m_sprite_atlas->texture.indices_view, m_sprite_atlas->texture.palette_view);
+    m_uniforms.tileset_columns = m_sprite_atlas->texture.indices.getWidth() / TilemapStreamer::tile_size;
+    return true;
+}
+
+void Engine::terminate_sprites() {
+    m_sprite_batch.terminate();
+    m_sprite_atlas = nullptr;
+    m_sprite_shader = nullptr;
+}
+
+bool Engine::init_simulation() {
+    const CompiledTilemap& tilemap = m_tilemap_streamer.get_tilemap();
+    Simulation::World world;
+    world.map_width = (float)(tilemap.width() * TilemapStreamer::tile_size);
+    world.map_height = (float)(tilemap.height() * TilemapStreamer::tile_size);
+    world.view_width = (float)m_width;
+    world.view_height = (float)m_height;
+    world.sprite_size = (float)TilemapStreamer::tile_size;
+    world.auto_pan = m_window == nullptr;
+    uint32_t tile_count = (uint32_t)m_uniforms.tileset_columns * (m_sprite_atlas->texture.indices.getHeight() / TilemapStreamer::tile_size);
+
+    CollisionGrid collision;
+    if (!collision.build(tilemap, world.sprite_size)) {
+        std::cerr << "Could not build the collision grid!" << std::endl;
+        return false;
+    }
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> random_x(0.0f, world.map_width);
+    std::uniform_real_distribution<float> random_y(0.0f, world.map_height);
+    std::uniform_real_distribution<float> random_velocity(-60.0f, 60.0f);
+    std::uniform_int_distribution<uint32_t> random_tile(0, std::max(1u, tile_count) - 1);
+    // Every entity cycles through four consecutive tiles of the tileset
+    EntityStore entities;
+    entities.reserve(m_settings.sprite_count);
+    for (uint32_t i = 0; i < m_settings.sprite_count; i++) {
+        EntityStore::Entity entity;
+        entity.x = random_x(random);
+        entity.y = random_y(random);
+        // Entities spawned inside walls would stay stuck there, a few retries find a free spot on most maps
+        for (uint32_t retry = 0; retry < 8 && collision.overlaps({ entity.x, entity.y, world.sprite_size, world.sprite_size }); retry++) {
+            entity.x = random_x(random);
+            entity.y = random_y(random);
+        }
+        entity.velocity_x = random_velocity(random);
+        entity.velocity_y = random_velocity(random);
+        entity.first_tile = random_tile(random);
+        entity.frame_count = 4;
+        entity.frame_duration = 0.125f;
+        entities.create(entity);
+    }
+    // Started last in on_init(), so the first tick does not race the startup
+    return m_simulation.init(m_settings.tick_rate, world, std::move(entities), std::move(collision));
+}
+
+void Engine::terminate_simulation() {
+    m_simulation.stop();
+}
+
+void Engine::update_frame_stats(double time) {
+    if (!m_window || time - m_last_stats_time < 1.0) return;
+    m_last_stats_time = time;
+
+    // Shown in the title once a second, averaged over the frames since the last update
+    FramePacer::Stats stats = m_frame_pacer.take_stats();
+    uint64_t tick = m_simulation.get_snapshot().tick;
+    uint64_t ticks = tick - m_last_stats_tick;
+    m_last_stats_tick = tick;
+    std::ostringstream title;
+    title << std::fixed << std::setprecision(2) << "nostalgia - "
+        << FramePacer::present_mode_name(m_frame_pacer.get_present_mode()) << ", " << m_frame_pacer.get_frames_in_flight() << " in flight"
+        << " - frame " << stats.frame_time_ms << " ms (waiting " << stats.wait_time_ms << " ms)"
+        << " - latency " << stats.latency_ms << " ms (max " << stats.max_latency_ms << " ms)"
+        << " - " << ticks << " ticks/s"
+        << " - " << (double)m_gpu_memory.get_stats().total_bytes / (1024.0 * 1024.0) << " MiB VRAM";
+    glfwSetWindowTitle(m_window, title.str().c_str());
+}
+
+void Engine::print_gpu_memory() const {
+    const double mebibyte = 1024.0 * 1024.0;
+    GpuMemory::Stats stats = m_gpu_memory.get_stats();
+    std::cout << std::fixed << std::setprecision(2) << "GPU memory " << stats.total_bytes / mebibyte << " MiB";
+    if (stats.budget > 0) std::cout << " of " << stats.budget / mebibyte << " MiB";
+    for (uint32_t category = 0; category < GpuMemory::category_count; category++) {
+        if (stats.objects[category] == 0) continue;
+        std::cout << ", " << GpuMemory::category_name((GpuMemory::Category)category) << " " << stats.bytes[category] / mebibyte
+            << " MiB in " << stats.objects[category];
+    }
+    std::cout << std::defaultfloat << std::endl;
+}
+
+void Engine::update_sprites(const Simulation::Snapshot& snapshot, float blend) {
+    uint32_t columns = std::max(1u, (uint32_t)m_uniforms.tileset_columns);
+    uint32_t tile_count = std::max(1u, columns * (m_sprite_atlas->texture.indices.getHeight() / TilemapStreamer::tile_size));
+    const float size = (float)TilemapStreamer::tile_size;
+    const uint32_t count = (uint32_t)snapshot.x.size();
+
+    // Visible entities are written straight into the instance layout, the rest of the allocation is trimmed
+    m_sprite_batch.begin(m_frame_pacer.get_frame_slot());
+    SpriteBatch::Sprite* instances = m_sprite_batch.allocate(m_tileset_sprite_texture, count);
+    uint32_t visible = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        float x = snapshot.previous_x[i] + (snapshot.x[i] - snapshot.previous_x[i]) * blend;
+        float y = snapshot.previous_y[i] + (snapshot.y[i] - snapshot.previous_y[i]) * blend;
+        if (x + size < m_camera_x || x > m_camera_x + m_width) continue;
+        if (y + size < m_camera_y || y > m_camera_y + m_height) continue;
+
+        uint32_t tile = snapshot.tile[i] % tile_count;
+        SpriteBatch::Sprite& instance = instances[visible++];
+        instance.x = x;
+        instance.y = y;
+        instance.width = size;
+        instance.height = size;
+        instance.atlas_x = (float)(tile % columns) * size;
+        instance.atlas_y = (float)(tile / columns) * size;
+        instance.atlas_width = size;
+        instance.atlas_height = size;
+        // Strictly between the cleared 1.0 and 0.0, the sprite pipeline tests with Less
+        instance.depth = 1.0f - (float)(i + 1) / (float)(count + 2);
+        instance.flags = snapshot.flip_x[i] ? SpriteBatch::flip_x : 0;
+    }
+    m_sprite_batch.trim(count - visible);
+    m_sprite_batch.end(m_camera_x, m_camera_y, (float)m_width, (float)m_height);
+}
\ No newline at end of file
@@ -1,11 +1,67 @@
 #pragma once
 
 #include <webgpu/webgpu.hpp>
+#include "tilemap_streamer.h"
+#include "sprite_batch.h"
+#include "asset_registry.h"
+#include "pipeline_cache.h"
+#include "frame_pacer.h"
+#include "profiler.h"
+#include "upscaler.h"
+#include "simulation.h"
+#include "tile_quad_renderer.h"
+#include "tileset_array.h"
+#include "mesh.h"
+#include "render_graph.h"
+#include "uniform_arena.h"
+#include "bind_group_cache.h"
+#include "render_bundle_cache.h"
+#include "job_graph.h"
+#include "gpu_memory.h"
 
 using namespace wgpu;
 
 struct GLFWwindow;
 
+enum class TilemapRenderer {
+    // One full screen pass looping over the layers per pixel, see resources/shaders/shader.wgsl
+    FullScreen,
+    // One instanced quad per non-empty tile, see TileQuadRenderer
+    Quads,
+};
+
+struct EngineSettings {
+    FramePacer::Settings frame;
+    // An empty trace path disables the Chrome trace
+    std::filesystem::path trace_path;
+    bool print_profile = true;
+    // Timestamp queries time the passes on the GPU for the profiler. On Dawn they need its allow_unsafe_apis toggle,
+    // so it is only turned on here, when the profile is printed or traced. Otherwise passes are timed on the CPU.
+    bool gpu_timestamps = false;
+    // Renders into an offscreen texture without a window, the camera pans over the map by itself
+    bool headless = false;
+    // Asks for a CPU/software adapter, such as SwiftShader
+    bool force_fallback_adapter = false;
+    // Replaces the tilemap from the resources when set
+    std::shared_ptr<const CompiledTilemap> tilemap;
+    // Number of animated sprites bouncing over the map
+    uint32_t sprite_count = 10000;
+    // The scene is always rendered at this size and scaled up to the window
+    uint32_t virtual_width = 320;
+    uint32_t virtual_height = 240;
+    // Game logic ticks per second, independent of the frame rate
+    uint32_t tick_rate = 60;
+    TilemapRenderer tilemap_renderer = TilemapRenderer::FullScreen;
+    // The full screen tilemap starts at the topmost opaque tile instead of blending every layer
+    bool skip_covered_layers = true;
+    // The tile quads replay one render bundle per chunk instead of encoding every chunk's draw each frame
+    bool tile_quad_bundles = true;
+    // Bytes of uniforms per frame in flight to start with, doubled from the next frame on when a frame needs more
+    uint32_t uniform_arena_capacity = 64 * 1024;
+    // In bytes, 0 is unlimited. Above it, textures nobody uses are evicted from the asset registry
+    uint64_t gpu_memory_budget = 256ull * 1024 * 1024;
+};
+
 class Engine {
 
     struct MyUniforms {
@@ -13,11 +69,19 @@ class Engine {
         float tilemap_width;
         float tilemap_height;
         float number_of_layers;
-        float _pad0;
+        // Of the sprite atlas, the tilemap shaders find tiles through TilesetArray
+        float tileset_columns;
         float time;
         float screen_width;
         float screen_height;
-        float _pad;
+        float skip_covered_layers;
+        float camera_x;
+        float camera_y;
+        float pool_chunks_x;
+        float pool_chunks_y;
+        float palette;
+        float animated_gids;
+        float _pad[2];
     };
 
     public:
@@ -25,53 +89,150 @@ class Engine {
         void on_finish();
         void on_frame();
         bool is_running() const;
-        Engine(const u_int32_t width, const u_int32_t height);
+        Engine(const u_int32_t width, const u_int32_t height, const EngineSettings& settings = {});
+
+        // Accepts fullscreen and quads
+        static bool parse_tilemap_renderer(const std::string& name, TilemapRenderer& renderer);
+        static const char* tilemap_renderer_name(TilemapRenderer renderer);
+
+        // Bytes written to GPU buffers and textures by the last frame
+        uint64_t get_upload_bytes() const { return m_upload_bytes; }
+        // Draw calls of the tilemap in the last frame
+        uint32_t get_tilemap_draw_count() const;
+        GpuMemory::Stats get_gpu_memory_stats() const { return m_gpu_memory.get_stats(); }
+        // For benchmarks, which read the GPU time of the render graph passes by name
+        Profiler& get_profiler() { return m_profiler; }
+        // Of the last on_init(), with the state of the pipeline cache it started with
+        double get_startup_ms() const { return m_startup_ms; }
+        bool is_pipeline_cache_warm() const { return m_pipeline_cache.is_warm(); }
+        PipelineCache::Stats get_pipeline_cache_stats() const { return m_pipeline_cache.get_stats(); }
+
+        // Edits a tile of a map layer, uploaded with the other edits of the frame by the next on_frame()
+        bool set_tile(uint32_t layer, uint32_t x, uint32_t y, uint32_t gid);
+        uint32_t get_tile(uint32_t layer, uint32_t x, uint32_t y) const { return m_tilemap_streamer.get_tile(layer, x, y); }
 
     private:
+        EngineSettings m_settings;
+        // Outlives every member holding GPU objects it tracks
+        GpuMemory m_gpu_memory;
+        PipelineCache m_pipeline_cache;
         Instance m_instance = nullptr;
         Surface m_surface = nullptr;
         Adapter m_adapter = nullptr;
         Device m_device = nullptr;
         Queue m_queue = nullptr;
         SwapChain m_swap_chain = nullptr;
+        // Replaces the swap chain when headless
+        Texture m_offscreen_texture = nullptr;
+        TextureView m_offscreen_texture_view = nullptr;
+        FramePacer m_frame_pacer;
+        double m_last_stats_time = 0.0;
+        Profiler m_profiler;
+        uint64_t m_upload_bytes = 0;
         const TextureFormat m_swap_chain_format = TextureFormat::BGRA8Unorm;
-        ShaderModule m_shader_module = nullptr;
+        const TextureFormat m_depth_texture_format = TextureFormat::Depth24Plus;
+        RenderGraph m_render_graph;
+        RenderGraph::ResourceId m_scene_target = 0;
+        RenderGraph::ResourceId m_frame_target = 0;
+        // Into the uniform arena, of the uniforms the scene pass draws the tilemap with
+        uint32_t m_uniform_offset = 0;
+        AssetRegistry m_assets;
+        // Loaded by the startup jobs, held until the init steps using them have picked them up
+        AssetRegistry::Handle<CompiledTilemap> m_prefetched_tilemap;
+        AssetRegistry::Handle<CompiledMesh> m_prefetched_mesh;
+        AssetRegistry::Handle<ShaderAsset> m_shader;
         BindGroupLayout m_bind_group_layout = nullptr;
         Limits m_device_limits = {};
         RenderPipeline m_render_pipeline = nullptr;
-        TextureView m_tilemap_texture_view = nullptr;
-        Texture m_tilemap_texture = nullptr;
-        TextureView m_tileset_texture_view = nullptr;
-        Texture m_tileset_texture = nullptr;
-        std::vector<float> m_point_data;
-        std::vector<uint16_t> m_index_data;
-        Buffer m_vertex_buffer = nullptr;
-        Buffer m_index_buffer = nullptr;
-        Buffer m_uniform_buffer = nullptr;
-        BindGroup m_bind_group = nullptr;
-        BindGroupDescriptor m_bind_group_descriptor = {};
+        std::unique_ptr<CreateRenderPipelineAsyncCallback> m_render_pipeline_request;
+        bool m_render_pipeline_pending = false;
+        // A hot reload's pipeline, members so a request that times out can still complete into them
+        BindGroupLayout m_reload_bind_group_layout = nullptr;
+        RenderPipeline m_reload_render_pipeline = nullptr;
+        std::unique_ptr<CreateRenderPipelineAsyncCallback> m_reload_pipeline_request;
+        bool m_reload_pipeline_pending = false;
+        TilemapStreamer m_tilemap_streamer;
+        TilesetArray m_tilesets;
+        AssetRegistry::Handle<ShaderAsset> m_sprite_shader;
+        AssetRegistry::Handle<IndexedTextureAsset> m_sprite_atlas;
+        SpriteBatch m_sprite_batch;
+        AssetRegistry::Handle<ShaderAsset> m_upscale_shader;
+        Upscaler m_upscaler;
+        AssetRegistry::Handle<ShaderAsset> m_tile_quad_shader;
+        TileQuadRenderer m_tile_quads;
+        uint32_t m_tileset_sprite_texture = 0;
+        Simulation m_simulation;
+        uint64_t m_last_stats_tick = 0;
+        Mesh m_mesh;
+        UniformArena m_uniform_arena;
+        BindGroupCache m_bind_groups;
         std::vector<BindGroupEntry> m_bindings;
         MyUniforms m_uniforms = {};
-        uint32_t m_uniform_stride = 0;
+        RenderBundleCache m_render_bundles;
+        // The full screen tilemap draw, one bundle per frame slot since each binds its own uniform offset
+        std::vector<RenderBundleCache::BundleId> m_tilemap_bundles;
+        // What the tilemap bundle of the current frame slot is recorded with
+        BindGroup m_tilemap_bind_group = nullptr;
 
         GLFWwindow* m_window = nullptr;
 
+        // Virtual resolution of the scene
         u_int32_t m_width = 0;
         u_int32_t m_height = 0;
+        // Size of the swap chain, in framebuffer pixels
+        u_int32_t m_window_width = 0;
+        u_int32_t m_window_height = 0;
+        u_int32_t m_pending_window_width = 0;
+        u_int32_t m_pending_window_height = 0;
+        double m_resize_time = 0.0;
+        bool m_resize_pending = false;
+
+        // Blended between the last two simulation ticks
+        float m_camera_x = 0.0f;
+        float m_camera_y = 0.0f;
+        std::chrono::steady_clock::time_point m_start_time;
+        double m_startup_ms = 0.0;
 
         bool init_window_and_device();
         bool init_swap_chain();
+        bool init_render_graph();
         bool init_render_pipeline();
+        std::unique_ptr<CreateRenderPipelineAsyncCallback> request_render_pipeline(ShaderModule shader, BindGroupLayout& bind_group_layout, RenderPipeline& pipeline, bool& pending);
         bool init_textures();
+        bool create_textures(TilemapStreamer& tilemap_streamer, TilesetArray& tilesets);
+        void update_tilemap_uniforms();
         bool init_geometries();
         bool init_buffers();
+        bool grow_uniform_arena();
         bool init_bindings();
+        std::vector<BindGroupEntry> create_bindings(const TilemapStreamer& tilemap_streamer, const TilesetArray& tilesets) const;
+        bool init_sprites();
+        bool init_simulation();
+        bool init_upscaler();
+        bool init_tile_quads();
+        bool init_render_bundles();
+        bool wait_for_pipelines();
+        double get_time() const;
+        bool wants_gpu_timestamps() const;
         void terminate_window_and_device();
         void terminate_swap_chain();
+        void terminate_render_graph();
         void terminate_render_pipeline();
+        void release_reload_pipeline();
+        void terminate_geometries();
         void terminate_textures();
         void terminate_buffers();
         void terminate_bindings();
+        void terminate_sprites();
+        void terminate_simulation();
+        void terminate_upscaler();
+        void terminate_tile_quads();
+        void terminate_render_bundles();
 
         void resize_screen(const u_int32_t width, const u_int32_t height);
+        void reload_assets();
+        void update_input();
+        void update_sprites(const Simulation::Snapshot& snapshot, float blend);
+        void update_frame_stats(double time);
+        void print_gpu_memory() const;
 };
\ No newline at end of file
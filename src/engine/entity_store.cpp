@@ -0,0 +1,133 @@
+#include "entity_store.h"
+
+#include <algorithm>
+
+namespace {
+
+template <typename T>
+void remove_swap(std::vector<T>& values, uint32_t index) {
+    values[index] = values.back();
+    values.pop_back();
+}
+
+// GCC only trusts __restrict on parameters, so the loops live in functions of their own.
+// Comparisons become 0 or 1 and are combined with arithmetic, no branch or select is left to block vectorization.
+// They are converted to float as signed ints, SSE2 has no unsigned conversion.
+void move_axis(float* __restrict position, float* __restrict velocity, uint32_t count, float delta_time, float max) {
+    for (uint32_t i = 0; i < count; i++) {
+        float moved = position[i] + velocity[i] * delta_time;
+        position[i] = moved;
+        int32_t outside = (int32_t)(moved < 0.0f) | (int32_t)(moved > max);
+        velocity[i] *= 1.0f - 2.0f * (float)outside;
+    }
+}
+
+void advance_frames(float* __restrict animation_timer, uint32_t* __restrict frame, const float* __restrict frame_duration,
+    const uint32_t* __restrict frame_count, uint32_t count, float delta_time) {
+    for (uint32_t i = 0; i < count; i++) {
+        float timer = animation_timer[i] + delta_time;
+        int32_t advance = (int32_t)(timer >= frame_duration[i]);
+        animation_timer[i] = timer - frame_duration[i] * (float)advance;
+        uint32_t next = frame[i] + (uint32_t)advance;
+        // All ones while next is a valid frame, zero once it wraps around
+        frame[i] = next & (0u - (uint32_t)(next < frame_count[i]));
+    }
+}
+
+}
+
+void EntityStore::reserve(uint32_t capacity) {
+    Components& c = m_components;
+    c.x.reserve(capacity);
+    c.y.reserve(capacity);
+    c.velocity_x.reserve(capacity);
+    c.velocity_y.reserve(capacity);
+    c.animation_timer.reserve(capacity);
+    c.frame_duration.reserve(capacity);
+    c.frame.reserve(capacity);
+    c.frame_count.reserve(capacity);
+    c.first_tile.reserve(capacity);
+}
+
+uint32_t EntityStore::create(const Entity& entity) {
+    Components& c = m_components;
+    c.x.push_back(entity.x);
+    c.y.push_back(entity.y);
+    c.velocity_x.push_back(entity.velocity_x);
+    c.velocity_y.push_back(entity.velocity_y);
+    c.animation_timer.push_back(0.0f);
+    c.frame_duration.push_back(std::max(entity.frame_duration, 0.001f));
+    c.frame.push_back(0);
+    c.frame_count.push_back(std::max(entity.frame_count, 1u));
+    c.first_tile.push_back(entity.first_tile);
+    return size() - 1;
+}
+
+void EntityStore::destroy(uint32_t index) {
+    if (index >= size()) return;
+    Components& c = m_components;
+    remove_swap(c.x, index);
+    remove_swap(c.y, index);
+    remove_swap(c.velocity_x, index);
+    remove_swap(c.velocity_y, index);
+    remove_swap(c.animation_timer, index);
+    remove_swap(c.frame_duration, index);
+    remove_swap(c.frame, index);
+    remove_swap(c.frame_count, index);
+    remove_swap(c.first_tile, index);
+}
+
+void EntityStore::clear() {
+    m_components = {};
+}
+
+void EntityStore::update_motion(float delta_time, float max_x, float max_y) {
+    // One axis per loop keeps every loop on two arrays
+    Components& c = m_components;
+    move_axis(c.x.data(), c.velocity_x.data(), size(), delta_time, max_x);
+    move_axis(c.y.data(), c.velocity_y.data(), size(), delta_time, max_y);
+}
+
+void EntityStore::update_animation(float delta_time) {
+    // Frames last longer than a tick, so an entity advances at most one frame per update
+    Components& c = m_components;
+    advance_frames(c.animation_timer.data(), c.frame.data(), c.frame_duration.data(), c.frame_count.data(), size(), delta_time);
+}
+
+void EntityStore::resolve_tile_collisions(const CollisionGrid& grid, const float* previous_x, const float* previous_y, float entity_size, std::vector<uint8_t>& hits) {
+    // Most entities touch nothing, one batched query finds the few that need a closer look
+    const uint32_t count = size();
+    Components& c = m_components;
+    hits.resize(count);
+    grid.overlaps(c.x.data(), c.y.data(), count, entity_size, entity_size, hits.data());
+    for (uint32_t i = 0; i < count; i++) {
+        if (!hits[i]) continue;
+        bool blocked_x = grid.overlaps({ c.x[i], previous_y[i], entity_size, entity_size });
+        bool blocked_y = grid.overlaps({ previous_x[i], c.y[i], entity_size, entity_size });
+        // Only the diagonal move is blocked, a corner
+        if (!blocked_x && !blocked_y) blocked_x = blocked_y = true;
+        if (blocked_x) {
+            c.x[i] = previous_x[i];
+            c.velocity_x[i] = -c.velocity_x[i];
+        }
+        if (blocked_y) {
+            c.y[i] = previous_y[i];
+            c.velocity_y[i] = -c.velocity_y[i];
+        }
+    }
+}
+
+void EntityStore::resolve_contacts(const std::vector<SpatialHash::Pair>& pairs) {
+    Components& c = m_components;
+    for (const SpatialHash::Pair& pair : pairs) {
+        uint32_t a = pair.first;
+        uint32_t b = pair.second;
+        float dx = c.x[b] - c.x[a];
+        float dy = c.y[b] - c.y[a];
+        float approach = (c.velocity_x[b] - c.velocity_x[a]) * dx + (c.velocity_y[b] - c.velocity_y[a]) * dy;
+        // Entities already moving apart are left alone, or they would stick together
+        if (approach >= 0.0f) continue;
+        std::swap(c.velocity_x[a], c.velocity_x[b]);
+        std::swap(c.velocity_y[a], c.velocity_y[b]);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "collision_grid.h"
+#include "spatial_hash.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Moving, animated entities stored as one array per component.
+ *
+ * There are no per-entity objects, an entity is just an index into the
+ * arrays. Destroying one moves the last entity into its place, so the arrays
+ * stay dense and indices are only stable until the next destroy().
+ *
+ * The motion and animation systems walk a few arrays at a time with
+ * branch-free loop bodies, which GCC and Clang vectorize at -O3 (every build
+ * but Debug, see CMakeLists.txt), and touch nothing but the components they
+ * update. The collision systems branch per entity and stay scalar.
+ */
+class EntityStore {
+    public:
+        struct Entity {
+            float x = 0.0f;
+            float y = 0.0f;
+            float velocity_x = 0.0f;
+            float velocity_y = 0.0f;
+            // The animation cycles through frame_count tiles starting at first_tile
+            uint32_t first_tile = 0;
+            uint32_t frame_count = 1;
+            float frame_duration = 0.125f;
+        };
+
+        struct Components {
+            std::vector<float> x;
+            std::vector<float> y;
+            std::vector<float> velocity_x;
+            std::vector<float> velocity_y;
+            std::vector<float> animation_timer;
+            std::vector<float> frame_duration;
+            std::vector<uint32_t> frame;
+            std::vector<uint32_t> frame_count;
+            std::vector<uint32_t> first_tile;
+        };
+
+        void reserve(uint32_t capacity);
+        // Returns the index of the new entity
+        uint32_t create(const Entity& entity);
+        void destroy(uint32_t index);
+        void clear();
+        uint32_t size() const { return (uint32_t)m_components.x.size(); }
+
+        // Moves every entity and reflects its velocity when it leaves [0, max_x] x [0, max_y]
+        void update_motion(float delta_time, float max_x, float max_y);
+        void update_animation(float delta_time);
+        // Moves entities that ran into a solid tile back to their previous position on the blocked axes and bounces them.
+        // hits is scratch space kept by the caller.
+        void resolve_tile_collisions(const CollisionGrid& grid, const float* previous_x, const float* previous_y, float entity_size, std::vector<uint8_t>& hits);
+        // Overlapping entities moving towards each other trade velocities, as equal masses would
+        void resolve_contacts(const std::vector<SpatialHash::Pair>& pairs);
+
+        const Components& get_components() const { return m_components; }
+
+    private:
+        Components m_components;
+};
@@ -0,0 +1,102 @@
+#include "frame_pacer.h"
+#include "device_tick.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+FramePacer::FramePacer(const Settings& settings) : m_settings(settings) {
+    m_settings.frames_in_flight = std::clamp(m_settings.frames_in_flight, 1u, max_frames_in_flight);
+}
+
+bool FramePacer::init(Device device) {
+    m_device = device;
+    m_queue = m_device.getQueue();
+    m_slot = 0;
+    m_frame_number = 0;
+    m_last_begin_time = clock::now();
+    take_stats();
+    return m_queue != nullptr;
+}
+
+void FramePacer::terminate() {
+    for (Frame& frame : m_frames) {
+        // After a timeout the callback storage is left to it
+        if (!tick_until(m_device, [&frame]() { return !frame.pending; })) {
+            std::cerr << "Gave up waiting for a frame in flight" << std::endl;
+            frame.request.release();
+        }
+        frame.request = nullptr;
+    }
+    if (m_queue) m_queue.release();
+    m_queue = nullptr;
+    m_device = nullptr;
+}
+
+void FramePacer::wait_for(Frame& frame) {
+    // The work done callbacks are only called from tick()
+    while (frame.pending) m_device.tick();
+}
+
+uint32_t FramePacer::begin_frame() {
+    m_slot = (uint32_t)(m_frame_number % m_settings.frames_in_flight);
+    Frame& frame = m_frames[m_slot];
+
+    clock::time_point wait_start = clock::now();
+    wait_for(frame);
+    clock::time_point now = clock::now();
+
+    m_wait_time_sum += std::chrono::duration<double, std::milli>(now - wait_start).count();
+    m_frame_time_sum += std::chrono::duration<double, std::milli>(now - m_last_begin_time).count();
+    m_begun_frames++;
+    m_last_begin_time = now;
+
+    frame.input_time = now;
+    return m_slot;
+}
+
+void FramePacer::end_frame() {
+    Frame& frame = m_frames[m_slot];
+    frame.pending = true;
+    frame.request = m_queue.onSubmittedWorkDone(0, [this, &frame](QueueWorkDoneStatus status) {
+        frame.pending = false;
+        if (status != QueueWorkDoneStatus::Success) return;
+        double latency = std::chrono::duration<double, std::milli>(clock::now() - frame.input_time).count();
+        m_latency_sum += latency;
+        m_stats.max_latency_ms = std::max(m_stats.max_latency_ms, latency);
+        m_stats.frames++;
+    });
+    m_frame_number++;
+}
+
+FramePacer::Stats FramePacer::take_stats() {
+    Stats stats = m_stats;
+    if (stats.frames > 0) stats.latency_ms = m_latency_sum / stats.frames;
+    if (m_begun_frames > 0) {
+        stats.frame_time_ms = m_frame_time_sum / m_begun_frames;
+        stats.wait_time_ms = m_wait_time_sum / m_begun_frames;
+    }
+
+    m_stats = {};
+    m_latency_sum = 0.0;
+    m_frame_time_sum = 0.0;
+    m_wait_time_sum = 0.0;
+    m_begun_frames = 0;
+    return stats;
+}
+
+bool FramePacer::parse_present_mode(const std::string& name, PresentMode& present_mode) {
+    if (name == "fifo") present_mode = PresentMode::Fifo;
+    else if (name == "mailbox") present_mode = PresentMode::Mailbox;
+    else if (name == "immediate") present_mode = PresentMode::Immediate;
+    else return false;
+    return true;
+}
+
+const char* FramePacer::present_mode_name(PresentMode present_mode) {
+    if (present_mode == PresentMode::Fifo) return "fifo";
+    if (present_mode == PresentMode::Mailbox) return "mailbox";
+    if (present_mode == PresentMode::Immediate) return "immediate";
+    return "unknown";
+}
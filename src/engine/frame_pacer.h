@@ -0,0 +1,85 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+/**
+ * Bounds how many frames the CPU may queue ahead of the GPU and measures the
+ * resulting latency.
+ *
+ * Every frame gets a slot in [0, frames in flight). Per-frame resources are
+ * kept once per slot, and begin_frame() only returns a slot once the GPU has
+ * finished the frame that used it last, so its data can be overwritten safely.
+ * More frames in flight keep the GPU busier, fewer lower the latency.
+ *
+ * Latency is measured from begin_frame(), right before input is sampled, to
+ * the GPU finishing the frame's work. Compositing and scanout come on top of
+ * that and are not visible to the application.
+ */
+class FramePacer {
+    public:
+        static constexpr uint32_t max_frames_in_flight = 4;
+
+        struct Settings {
+            wgpu::PresentMode present_mode = wgpu::PresentMode::Fifo;
+            uint32_t frames_in_flight = 2;
+        };
+
+        // Averages over the frames completed since the last call to take_stats()
+        struct Stats {
+            uint32_t frames = 0;
+            double frame_time_ms = 0.0;
+            double wait_time_ms = 0.0;
+            double latency_ms = 0.0;
+            double max_latency_ms = 0.0;
+        };
+
+        FramePacer() = default;
+        FramePacer(const Settings& settings);
+
+        bool init(wgpu::Device device);
+        // Waits for the frames still in flight
+        void terminate();
+
+        // Blocks until the next slot is free and returns it
+        uint32_t begin_frame();
+        // Call after the frame has been submitted and presented
+        void end_frame();
+
+        wgpu::PresentMode get_present_mode() const { return m_settings.present_mode; }
+        uint32_t get_frames_in_flight() const { return m_settings.frames_in_flight; }
+        uint32_t get_frame_slot() const { return m_slot; }
+        Stats take_stats();
+
+        // Accepts fifo, mailbox and immediate
+        static bool parse_present_mode(const std::string& name, wgpu::PresentMode& present_mode);
+        static const char* present_mode_name(wgpu::PresentMode present_mode);
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct Frame {
+            std::unique_ptr<wgpu::QueueWorkDoneCallback> request;
+            bool pending = false;
+            clock::time_point input_time;
+        };
+
+        Settings m_settings;
+        wgpu::Device m_device = nullptr;
+        wgpu::Queue m_queue = nullptr;
+        Frame m_frames[max_frames_in_flight];
+        uint32_t m_slot = 0;
+        uint64_t m_frame_number = 0;
+        clock::time_point m_last_begin_time;
+
+        Stats m_stats;
+        double m_frame_time_sum = 0.0;
+        double m_wait_time_sum = 0.0;
+        double m_latency_sum = 0.0;
+        uint32_t m_begun_frames = 0;
+
+        void wait_for(Frame& frame);
+};
@@ -0,0 +1,129 @@
+#include "gpu_memory.h"
+
+#include <algorithm>
+
+using namespace wgpu;
+
+namespace {
+
+uint32_t bytes_per_texel(TextureFormat format) {
+    if (format == TextureFormat::R8Unorm || format == TextureFormat::R8Uint) return 1;
+    if (format == TextureFormat::RGBA16Float) return 8;
+    if (format == TextureFormat::RGBA32Float) return 16;
+    // RGBA8, BGRA8, R32 and the depth formats the engine uses
+    return 4;
+}
+
+uint64_t texture_size(uint32_t width, uint32_t height, uint32_t layers, uint32_t mip_levels, uint32_t samples, TextureFormat format) {
+    uint64_t texels = 0;
+    for (uint32_t level = 0; level < std::max(1u, mip_levels); level++) {
+        texels += (uint64_t)std::max(1u, width >> level) * std::max(1u, height >> level);
+    }
+    return texels * std::max(1u, layers) * std::max(1u, samples) * bytes_per_texel(format);
+}
+
+}
+
+const char* GpuMemory::category_name(Category category) {
+    if (category == Category::Tilemap) return "tilemap";
+    if (category == Category::Tileset) return "tileset";
+    if (category == Category::Sprite) return "sprite";
+    if (category == Category::Mesh) return "mesh";
+    if (category == Category::Uniform) return "uniform";
+    if (category == Category::Transient) return "transient";
+    if (category == Category::Target) return "target";
+    return "unknown";
+}
+
+uint64_t GpuMemory::texture_size(const TextureDescriptor& descriptor) {
+    return ::texture_size(descriptor.size.width, descriptor.size.height, descriptor.size.depthOrArrayLayers,
+        descriptor.mipLevelCount, descriptor.sampleCount, descriptor.format);
+}
+
+uint64_t GpuMemory::texture_size(Texture texture) {
+    if (!texture) return 0;
+    return ::texture_size(texture.getWidth(), texture.getHeight(), texture.getDepthOrArrayLayers(),
+        texture.getMipLevelCount(), texture.getSampleCount(), texture.getFormat());
+}
+
+void GpuMemory::set_budget(uint64_t budget) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.budget = budget;
+}
+
+uint64_t GpuMemory::get_budget() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats.budget;
+}
+
+bool GpuMemory::over_budget() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats.budget > 0 && m_stats.total_bytes > m_stats.budget;
+}
+
+Texture GpuMemory::create_texture(Device device, const TextureDescriptor& descriptor, Category category) {
+    Texture texture = device.createTexture(descriptor);
+    if (texture) add((WGPUTexture)texture, category, texture_size(descriptor));
+    return texture;
+}
+
+Buffer GpuMemory::create_buffer(Device device, const BufferDescriptor& descriptor, Category category) {
+    Buffer buffer = device.createBuffer(descriptor);
+    if (buffer) add((WGPUBuffer)buffer, category, descriptor.size);
+    return buffer;
+}
+
+void GpuMemory::track(Texture texture, Category category) {
+    if (texture) add((WGPUTexture)texture, category, texture_size(texture));
+}
+
+void GpuMemory::track(Buffer buffer, Category category) {
+    if (buffer) add((WGPUBuffer)buffer, category, buffer.getSize());
+}
+
+void GpuMemory::destroy(Texture& texture) {
+    if (!texture) return;
+    remove((WGPUTexture)texture);
+    texture.destroy();
+    texture.release();
+    texture = nullptr;
+}
+
+void GpuMemory::destroy(Buffer& buffer) {
+    if (!buffer) return;
+    remove((WGPUBuffer)buffer);
+    buffer.destroy();
+    buffer.release();
+    buffer = nullptr;
+}
+
+void GpuMemory::record_eviction(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.evictions++;
+    m_stats.evicted_bytes += bytes;
+}
+
+GpuMemory::Stats GpuMemory::get_stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void GpuMemory::add(const void* handle, Category category, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Tracking an object twice counts it once
+    if (!m_allocations.emplace(handle, Allocation{ category, bytes }).second) return;
+    m_stats.bytes[(uint32_t)category] += bytes;
+    m_stats.objects[(uint32_t)category]++;
+    m_stats.total_bytes += bytes;
+    m_stats.peak_bytes = std::max(m_stats.peak_bytes, m_stats.total_bytes);
+}
+
+void GpuMemory::remove(const void* handle) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto allocation = m_allocations.find(handle);
+    if (allocation == m_allocations.end()) return;
+    m_stats.bytes[(uint32_t)allocation->second.category] -= allocation->second.bytes;
+    m_stats.objects[(uint32_t)allocation->second.category]--;
+    m_stats.total_bytes -= allocation->second.bytes;
+    m_allocations.erase(allocation);
+}
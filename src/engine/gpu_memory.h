@@ -0,0 +1,72 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Accounts for the GPU memory of every texture and buffer the engine creates,
+ * by category, against a budget.
+ *
+ * Objects are created, or handed over right after creation, through the
+ * tracker and destroyed through it again. Sizes are computed from the
+ * descriptors, the driver may round them up and adds the swap chain, query
+ * sets and its own allocations on top, so the counters are a lower bound.
+ *
+ * The tracker does not evict anything itself. Caches such as AssetRegistry
+ * drop what nobody uses while over_budget() says so, and report it through
+ * record_eviction(). All methods are safe to call from any thread.
+ */
+class GpuMemory {
+    public:
+        enum class Category : uint32_t { Tilemap, Tileset, Sprite, Mesh, Uniform, Transient, Target, Count };
+        static constexpr uint32_t category_count = (uint32_t)Category::Count;
+
+        struct Stats {
+            std::array<uint64_t, category_count> bytes = {};
+            std::array<uint32_t, category_count> objects = {};
+            uint64_t total_bytes = 0;
+            uint64_t peak_bytes = 0;
+            // 0 is unlimited
+            uint64_t budget = 0;
+            uint32_t evictions = 0;
+            uint64_t evicted_bytes = 0;
+        };
+
+        static const char* category_name(Category category);
+        static uint64_t texture_size(const wgpu::TextureDescriptor& descriptor);
+        static uint64_t texture_size(wgpu::Texture texture);
+
+        void set_budget(uint64_t budget);
+        uint64_t get_budget() const;
+        bool over_budget() const;
+
+        wgpu::Texture create_texture(wgpu::Device device, const wgpu::TextureDescriptor& descriptor, Category category);
+        wgpu::Buffer create_buffer(wgpu::Device device, const wgpu::BufferDescriptor& descriptor, Category category);
+        // For objects created elsewhere, such as by TextureLoader
+        void track(wgpu::Texture texture, Category category);
+        void track(wgpu::Buffer buffer, Category category);
+        // Destroys, releases and clears the handle, null handles are ignored
+        void destroy(wgpu::Texture& texture);
+        void destroy(wgpu::Buffer& buffer);
+
+        void record_eviction(uint64_t bytes);
+        Stats get_stats() const;
+
+    private:
+        struct Allocation {
+            Category category;
+            uint64_t bytes;
+        };
+
+        mutable std::mutex m_mutex;
+        // Keyed by the raw handle, which stays unique while the object is alive
+        std::unordered_map<const void*, Allocation> m_allocations;
+        Stats m_stats = {};
+
+        void add(const void* handle, Category category, uint64_t bytes);
+        void remove(const void* handle);
+};
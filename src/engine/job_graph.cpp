@@ -0,0 +1,117 @@
+#include "job_graph.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+JobGraph::JobId JobGraph::add(const std::string& name, Affinity affinity, Run run, std::initializer_list<JobId> dependencies) {
+    Job job;
+    job.name = name;
+    job.affinity = affinity;
+    job.run = std::move(run);
+    for (JobId dependency : dependencies) {
+        if (dependency < m_jobs.size()) job.dependencies.push_back(dependency);
+    }
+    m_jobs.push_back(std::move(job));
+    return (JobId)m_jobs.size() - 1;
+}
+
+bool JobGraph::run(uint32_t worker_count) {
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool failed = false;
+    m_start = std::chrono::steady_clock::now();
+
+    // Jobs only depend on earlier ones, so one pass in order settles every job whose dependencies are done.
+    // Returns the first ready job of the given affinity, and whether any job is still waiting or running.
+    auto next_job = [&](Affinity affinity, bool& pending) -> Job* {
+        Job* ready = nullptr;
+        pending = false;
+        for (Job& job : m_jobs) {
+            if (job.state == State::Waiting) {
+                bool dependencies_done = true;
+                for (JobId dependency : job.dependencies) {
+                    State state = m_jobs[dependency].state;
+                    if (state == State::Failed || state == State::Skipped) {
+                        job.state = State::Skipped;
+                        break;
+                    }
+                    dependencies_done = dependencies_done && state == State::Succeeded;
+                }
+                if (job.state == State::Skipped) continue;
+                if (dependencies_done && job.affinity == affinity && !ready) ready = &job;
+            }
+            pending = pending || job.state == State::Waiting || job.state == State::Running;
+        }
+        return ready;
+    };
+
+    // Runs jobs of one affinity until none is left to come
+    auto work = [&](Affinity affinity) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            bool pending;
+            Job* job = next_job(affinity, pending);
+            if (!pending) break;
+            if (!job) {
+                changed.wait(lock);
+                continue;
+            }
+            job->state = State::Running;
+            job->start = std::chrono::steady_clock::now();
+            lock.unlock();
+            bool succeeded = job->run();
+            lock.lock();
+            job->end = std::chrono::steady_clock::now();
+            job->state = succeeded ? State::Succeeded : State::Failed;
+            if (!succeeded) {
+                std::cerr << "Startup job " << job->name << " failed" << std::endl;
+                failed = true;
+            }
+            changed.notify_all();
+        }
+        // Wakes the others, they also see there is nothing left
+        changed.notify_all();
+    };
+
+    std::vector<std::thread> workers;
+    bool has_worker_jobs = std::any_of(m_jobs.begin(), m_jobs.end(), [](const Job& job) { return job.affinity == Affinity::Worker; });
+    if (has_worker_jobs) {
+        for (uint32_t i = 0; i < std::max(1u, worker_count); i++) workers.emplace_back(work, Affinity::Worker);
+    }
+    work(Affinity::Main);
+    for (std::thread& worker : workers) worker.join();
+
+    m_total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+    return !failed;
+}
+
+std::vector<JobGraph::Timing> JobGraph::get_timings() const {
+    std::vector<Timing> timings;
+    for (const Job& job : m_jobs) {
+        bool ran = job.state == State::Succeeded || job.state == State::Failed;
+        double start_ms = ran ? std::chrono::duration<double, std::milli>(job.start - m_start).count() : -1.0;
+        double duration_ms = ran ? std::chrono::duration<double, std::milli>(job.end - job.start).count() : 0.0;
+        timings.push_back({ job.name, job.affinity, start_ms, duration_ms });
+    }
+    return timings;
+}
+
+void JobGraph::print_timings() const {
+    std::vector<Timing> timings = get_timings();
+    std::stable_sort(timings.begin(), timings.end(), [](const Timing& a, const Timing& b) { return a.start_ms < b.start_ms; });
+    std::cout << std::fixed << std::setprecision(2) << "Startup jobs over " << m_total_ms << " ms:";
+    for (const Timing& timing : timings) {
+        std::cout << "\n    " << timing.name << (timing.affinity == Affinity::Main ? " (main)" : " (worker)");
+        if (timing.start_ms < 0.0) {
+            std::cout << " skipped";
+        }
+        else {
+            std::cout << " at " << timing.start_ms << " ms took " << timing.duration_ms << " ms";
+        }
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+/**
+ * A one shot dependency graph of jobs, used for the startup of the engine.
+ *
+ * A job runs once all of its dependencies have succeeded. Worker jobs run on
+ * a small set of threads started by run(), main jobs on the thread calling
+ * run(), for everything that has to stay there such as window and device
+ * creation or GPU uploads. Ready main jobs run in the order they were added.
+ *
+ * A job returning false fails the graph: jobs depending on it are skipped,
+ * jobs already running finish, and run() returns false once nothing runs
+ * anymore. Every job is timed, print_timings() shows where the time went.
+ */
+class JobGraph {
+    public:
+        using JobId = uint32_t;
+        using Run = std::function<bool()>;
+
+        enum class Affinity { Main, Worker };
+
+        struct Timing {
+            std::string name;
+            Affinity affinity;
+            // Relative to the start of run(), negative when the job never ran
+            double start_ms;
+            double duration_ms;
+        };
+
+        // Dependencies have to be added before the jobs depending on them
+        JobId add(const std::string& name, Affinity affinity, Run run, std::initializer_list<JobId> dependencies = {});
+        bool run(uint32_t worker_count);
+
+        std::vector<Timing> get_timings() const;
+        double get_total_ms() const { return m_total_ms; }
+        void print_timings() const;
+
+    private:
+        enum class State { Waiting, Running, Succeeded, Failed, Skipped };
+
+        struct Job {
+            std::string name;
+            Affinity affinity;
+            Run run;
+            std::vector<JobId> dependencies;
+            State state = State::Waiting;
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point end;
+        };
+
+        std::vector<Job> m_jobs;
+        std::chrono::steady_clock::time_point m_start;
+        double m_total_ms = 0.0;
+};
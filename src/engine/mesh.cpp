@@ -0,0 +1,92 @@
+#include "mesh.h"
+
+#include <cstring>
+
+using namespace wgpu;
+
+VertexFormat Mesh::vertex_format(CompiledMesh::Format format) {
+    if (format == CompiledMesh::Format::Float32) return VertexFormat::Float32;
+    if (format == CompiledMesh::Format::Float32x2) return VertexFormat::Float32x2;
+    if (format == CompiledMesh::Format::Float32x3) return VertexFormat::Float32x3;
+    if (format == CompiledMesh::Format::Float32x4) return VertexFormat::Float32x4;
+    if (format == CompiledMesh::Format::Uint32) return VertexFormat::Uint32;
+    if (format == CompiledMesh::Format::Uint32x2) return VertexFormat::Uint32x2;
+    if (format == CompiledMesh::Format::Unorm8x4) return VertexFormat::Unorm8x4;
+    return VertexFormat::Undefined;
+}
+
+Buffer Mesh::create_buffer(Device device, BufferUsage usage, const uint8_t* data, uint64_t size) {
+    // Mapped buffers need a size in whole words, which the compiled mesh already pads to
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = size;
+    buffer_descriptor.usage = usage;
+    buffer_descriptor.mappedAtCreation = true;
+    Buffer buffer = m_memory->create_buffer(device, buffer_descriptor, GpuMemory::Category::Mesh);
+    if (!buffer) return nullptr;
+    void* mapped = buffer.getMappedRange(0, size);
+    if (mapped) std::memcpy(mapped, data, size);
+    buffer.unmap();
+    return mapped ? buffer : nullptr;
+}
+
+bool Mesh::init(Device device, GpuMemory& memory, const CompiledMesh& mesh) {
+    m_memory = &memory;
+    terminate();
+    if (!mesh.is_open() || mesh.vertex_data_size() == 0 || mesh.index_data_size() == 0) return false;
+
+    m_vertex_buffer_size = mesh.vertex_data_size();
+    m_index_buffer_size = mesh.index_data_size();
+    m_vertex_buffer = create_buffer(device, BufferUsage::Vertex, mesh.vertex_data(), m_vertex_buffer_size);
+    m_index_buffer = create_buffer(device, BufferUsage::Index, mesh.index_data(), m_index_buffer_size);
+    if (!m_vertex_buffer || !m_index_buffer) {
+        terminate();
+        return false;
+    }
+    m_index_format = mesh.index_size() == sizeof(uint32_t) ? IndexFormat::Uint32 : IndexFormat::Uint16;
+    m_index_count = mesh.index_count();
+    m_vertex_stride = mesh.vertex_stride();
+
+    const CompiledMesh::Attribute* attributes = mesh.attributes();
+    for (uint32_t i = 0; i < mesh.attribute_count(); i++) {
+        VertexAttribute attribute;
+        attribute.shaderLocation = attributes[i].shader_location;
+        attribute.format = vertex_format(attributes[i].format);
+        attribute.offset = attributes[i].offset;
+        m_attributes.push_back(attribute);
+    }
+    return true;
+}
+
+void Mesh::terminate() {
+    if (m_vertex_buffer) m_memory->destroy(m_vertex_buffer);
+    if (m_index_buffer) m_memory->destroy(m_index_buffer);
+    m_vertex_buffer = nullptr;
+    m_index_buffer = nullptr;
+    m_vertex_buffer_size = 0;
+    m_index_buffer_size = 0;
+    m_index_count = 0;
+    m_attributes.clear();
+}
+
+VertexBufferLayout Mesh::get_vertex_buffer_layout() const {
+    VertexBufferLayout vertex_buffer_layout;
+    vertex_buffer_layout.attributeCount = (uint32_t)m_attributes.size();
+    vertex_buffer_layout.attributes = m_attributes.data();
+    vertex_buffer_layout.arrayStride = m_vertex_stride;
+    vertex_buffer_layout.stepMode = VertexStepMode::Vertex;
+    return vertex_buffer_layout;
+}
+
+void Mesh::draw(RenderPassEncoder& render_pass, uint32_t instance_count) const {
+    if (!m_vertex_buffer || !m_index_buffer) return;
+    render_pass.setVertexBuffer(0, m_vertex_buffer, 0, m_vertex_buffer_size);
+    render_pass.setIndexBuffer(m_index_buffer, m_index_format, 0, m_index_buffer_size);
+    render_pass.drawIndexed(m_index_count, instance_count, 0, 0, 0);
+}
+
+void Mesh::draw(RenderBundleEncoder& render_bundle, uint32_t instance_count) const {
+    if (!m_vertex_buffer || !m_index_buffer) return;
+    render_bundle.setVertexBuffer(0, m_vertex_buffer, 0, m_vertex_buffer_size);
+    render_bundle.setIndexBuffer(m_index_buffer, m_index_format, 0, m_index_buffer_size);
+    render_bundle.drawIndexed(m_index_count, instance_count, 0, 0, 0);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+#include "../files/compiled_mesh.h"
+
+#include <vector>
+
+/**
+ * A CompiledMesh in GPU buffers, drawn with a single indexed draw.
+ *
+ * Both buffers are created mapped and filled straight from the compiled
+ * mesh, usually a memory mapped file, so there is no parse step and no
+ * staging copy. The vertex buffer layout of pipelines drawing the mesh comes
+ * from its header instead of being spelled out next to the shader.
+ */
+class Mesh {
+    public:
+        bool init(wgpu::Device device, GpuMemory& memory, const CompiledMesh& mesh);
+        void terminate();
+
+        // Points into the mesh, valid until the next init() or terminate()
+        wgpu::VertexBufferLayout get_vertex_buffer_layout() const;
+        void draw(wgpu::RenderPassEncoder& render_pass, uint32_t instance_count = 1) const;
+        void draw(wgpu::RenderBundleEncoder& render_bundle, uint32_t instance_count = 1) const;
+
+        uint32_t get_index_count() const { return m_index_count; }
+        uint64_t get_size() const { return m_vertex_buffer_size + m_index_buffer_size; }
+
+        static wgpu::VertexFormat vertex_format(CompiledMesh::Format format);
+
+    private:
+        wgpu::Buffer m_vertex_buffer = nullptr;
+        wgpu::Buffer m_index_buffer = nullptr;
+        GpuMemory* m_memory = nullptr;
+        uint64_t m_vertex_buffer_size = 0;
+        uint64_t m_index_buffer_size = 0;
+        wgpu::IndexFormat m_index_format = wgpu::IndexFormat::Uint16;
+        uint32_t m_index_count = 0;
+        uint32_t m_vertex_stride = 0;
+        std::vector<wgpu::VertexAttribute> m_attributes;
+
+        wgpu::Buffer create_buffer(wgpu::Device device, wgpu::BufferUsage usage, const uint8_t* data, uint64_t size);
+};
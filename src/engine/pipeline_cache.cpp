@@ -0,0 +1,146 @@
+#include "pipeline_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef WEBGPU_BACKEND_DAWN
+#include <dawn/native/DawnNative.h>
+#endif
+
+using namespace wgpu;
+
+namespace {
+
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string to_hex(uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(16, '0');
+    for (int i = 15; i >= 0; i--, value >>= 4) {
+        hex[i] = digits[value & 0xf];
+    }
+    return hex;
+}
+
+}
+
+PipelineCache::PipelineCache() = default;
+
+PipelineCache::~PipelineCache() = default;
+
+Instance PipelineCache::create_instance(const path& directory, const InstanceDescriptor& descriptor) {
+    m_directory = directory;
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+    m_warm = !error && std::filesystem::directory_iterator(m_directory, error) != std::filesystem::directory_iterator();
+    if (error) {
+        std::cerr << "Could not open pipeline cache " << m_directory << ", pipelines are compiled on every launch" << std::endl;
+    }
+
+#ifdef WEBGPU_BACKEND_DAWN
+    m_native_instance = std::make_unique<dawn::native::Instance>(&descriptor);
+    m_native_instance->SetPlatform(this);
+    // The native instance keeps its own reference, the engine releases this one
+    Instance instance = m_native_instance->Get();
+    instance.reference();
+    return instance;
+#else
+    return createInstance(descriptor);
+#endif
+}
+
+DawnCacheDeviceDescriptor PipelineCache::device_descriptor(Adapter adapter, const Limits& limits) {
+    AdapterProperties properties;
+    adapter.getProperties(&properties);
+
+    // The limits come from a RequiredLimits created with Default, which zeroes the padding too
+    m_isolation_key = std::to_string(properties.vendorID) + "-" + std::to_string(properties.deviceID)
+        + "-" + std::to_string((uint32_t)properties.backendType)
+        + "-" + (properties.driverDescription ? properties.driverDescription : "")
+        + "-" + to_hex(fnv1a(&limits, sizeof(Limits)));
+
+    DawnCacheDeviceDescriptor descriptor;
+    descriptor.chain.next = nullptr;
+    descriptor.chain.sType = SType::DawnCacheDeviceDescriptor;
+    descriptor.isolationKey = m_isolation_key.c_str();
+    return descriptor;
+}
+
+PipelineCache::Stats PipelineCache::get_stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+PipelineCache::path PipelineCache::blob_path(const void* key, size_t key_size) const {
+    return m_directory / (to_hex(fnv1a(key, key_size)) + ".blob");
+}
+
+#ifdef WEBGPU_BACKEND_DAWN
+
+dawn::platform::CachingInterface* PipelineCache::GetCachingInterface() {
+    return m_directory.empty() ? nullptr : this;
+}
+
+size_t PipelineCache::LoadData(const void* key, size_t key_size, void* value, size_t value_size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Blob layout: uint64 key size, key, value
+    std::ifstream file(blob_path(key, key_size), std::ios::binary | std::ios::ate);
+    size_t file_size = file.is_open() ? (size_t)file.tellg() : 0;
+    uint64_t stored_key_size = 0;
+    std::vector<char> stored_key;
+    if (file_size >= sizeof(uint64_t)) {
+        file.seekg(0);
+        file.read((char*)&stored_key_size, sizeof(uint64_t));
+    }
+    if (file_size < sizeof(uint64_t) || stored_key_size != key_size || file_size < sizeof(uint64_t) + key_size) {
+        // Dawn first asks for the size, that is where a miss is counted
+        if (value == nullptr) m_stats.misses++;
+        return 0;
+    }
+    stored_key.resize(key_size);
+    file.read(stored_key.data(), key_size);
+    if (!file || std::memcmp(stored_key.data(), key, key_size) != 0) {
+        if (value == nullptr) m_stats.misses++;
+        return 0;
+    }
+
+    size_t blob_size = file_size - sizeof(uint64_t) - key_size;
+    if (value == nullptr) return blob_size;
+    if (value_size < blob_size) return 0;
+    file.read((char*)value, blob_size);
+    if (!file) return 0;
+    m_stats.hits++;
+    return blob_size;
+}
+
+void PipelineCache::StoreData(const void* key, size_t key_size, const void* value, size_t value_size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Written next to the blob and renamed over it, so a crash never leaves a torn blob behind
+    path blob = blob_path(key, key_size);
+    path temporary = blob;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        uint64_t stored_key_size = key_size;
+        file.write((const char*)&stored_key_size, sizeof(uint64_t));
+        file.write((const char*)key, key_size);
+        file.write((const char*)value, value_size);
+        if (!file) return;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, blob, error);
+    if (!error) m_stats.stores++;
+}
+
+#endif
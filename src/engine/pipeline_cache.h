@@ -0,0 +1,74 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#ifdef WEBGPU_BACKEND_DAWN
+#include <dawn/platform/DawnPlatform.h>
+
+namespace dawn::native {
+    class Instance;
+}
+#endif
+
+/**
+ * Persists the shader and pipeline blobs compiled by Dawn to disk, so later
+ * launches skip shader translation and driver pipeline compilation.
+ *
+ * Dawn derives the blob keys from the shader source and the pipeline state.
+ * The device descriptor adds an isolation key built from the adapter and
+ * the required limits, so a cache is never reused on another device or with
+ * other limits. Every blob is one file named after the hash of its key. The
+ * full key is stored in the file to detect hash collisions.
+ *
+ * Other backends have no blob cache, the instance is created as usual there.
+ */
+class PipelineCache
+#ifdef WEBGPU_BACKEND_DAWN
+    : public dawn::platform::Platform, public dawn::platform::CachingInterface
+#endif
+{
+    public:
+        using path = std::filesystem::path;
+
+        struct Stats {
+            uint32_t hits = 0;
+            uint32_t misses = 0;
+            uint32_t stores = 0;
+        };
+
+        PipelineCache();
+        ~PipelineCache();
+
+        // Creates the instance with this cache attached, the cache has to outlive it
+        wgpu::Instance create_instance(const path& directory, const wgpu::InstanceDescriptor& descriptor = {});
+        // Chain the returned descriptor into the DeviceDescriptor, it references the cache's key
+        wgpu::DawnCacheDeviceDescriptor device_descriptor(wgpu::Adapter adapter, const wgpu::Limits& limits);
+
+        // True if the cache directory already held blobs when the instance was created
+        bool is_warm() const { return m_warm; }
+        Stats get_stats() const;
+
+#ifdef WEBGPU_BACKEND_DAWN
+        dawn::platform::CachingInterface* GetCachingInterface() override;
+        size_t LoadData(const void* key, size_t key_size, void* value, size_t value_size) override;
+        void StoreData(const void* key, size_t key_size, const void* value, size_t value_size) override;
+#endif
+
+    private:
+#ifdef WEBGPU_BACKEND_DAWN
+        std::unique_ptr<dawn::native::Instance> m_native_instance;
+#endif
+        path m_directory;
+        std::string m_isolation_key;
+        bool m_warm = false;
+        // Dawn loads and stores blobs from its worker threads
+        mutable std::mutex m_mutex;
+        Stats m_stats = {};
+
+        path blob_path(const void* key, size_t key_size) const;
+};
@@ -0,0 +1,218 @@
+#include "profiler.h"
+#include "device_tick.h"
+
+#include <iomanip>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+// Query resolves have to start at multiples of 256 bytes, which is exactly one frame of queries
+constexpr uint64_t frame_query_bytes = Profiler::max_gpu_scopes * 2 * sizeof(uint64_t);
+static_assert(frame_query_bytes % 256 == 0, "Every frame has to resolve to an aligned offset");
+
+}
+
+bool Profiler::init(Device device, const path& trace_path, bool print_summary) {
+    m_device = device;
+    m_print_summary = print_summary;
+    m_start_time = clock::now();
+    m_last_summary_time = m_start_time;
+
+    if (!trace_path.empty()) {
+        m_trace.open(trace_path, std::ios::trunc);
+        if (!m_trace.is_open()) {
+            std::cerr << "Could not open trace file " << trace_path << std::endl;
+            return false;
+        }
+        m_trace << "[\n";
+        m_first_event = true;
+    }
+
+    m_timestamps = m_device.hasFeature(FeatureName::TimestampQuery);
+    if (!m_timestamps) {
+        std::cout << "Timestamp queries are not supported, render passes are timed on the CPU" << std::endl;
+        return true;
+    }
+
+    QuerySetDescriptor query_set_descriptor;
+    query_set_descriptor.label = "Profiler timestamps";
+    query_set_descriptor.type = QueryType::Timestamp;
+    query_set_descriptor.count = max_gpu_scopes * 2 * readback_frames;
+    query_set_descriptor.pipelineStatistics = nullptr;
+    query_set_descriptor.pipelineStatisticsCount = 0;
+    m_query_set = m_device.createQuerySet(query_set_descriptor);
+
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = frame_query_bytes * readback_frames;
+    buffer_descriptor.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+    buffer_descriptor.mappedAtCreation = false;
+    m_resolve_buffer = m_device.createBuffer(buffer_descriptor);
+
+    buffer_descriptor.size = frame_query_bytes;
+    buffer_descriptor.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+    for (GpuFrame& frame : m_gpu_frames) {
+        frame.readback = m_device.createBuffer(buffer_descriptor);
+        if (!frame.readback) return false;
+    }
+    return m_query_set && m_resolve_buffer;
+}
+
+void Profiler::terminate() {
+    for (GpuFrame& frame : m_gpu_frames) {
+        // The map callback writes into the frame, after a timeout its storage is left to it
+        if (!tick_until(m_device, [&frame]() { return !frame.mapping; })) {
+            std::cerr << "Gave up waiting for a timestamp readback" << std::endl;
+            frame.request.release();
+        }
+        frame.request = nullptr;
+        frame.names.clear();
+        if (frame.readback) {
+            frame.readback.destroy();
+            frame.readback.release();
+        }
+        frame.readback = nullptr;
+    }
+    if (m_resolve_buffer) {
+        m_resolve_buffer.destroy();
+        m_resolve_buffer.release();
+    }
+    if (m_query_set) {
+        m_query_set.destroy();
+        m_query_set.release();
+    }
+    m_resolve_buffer = nullptr;
+    m_query_set = nullptr;
+    m_timestamps = false;
+
+    if (m_trace.is_open()) {
+        m_trace << "\n]\n";
+        m_trace.close();
+    }
+    m_cpu_scopes.clear();
+    m_totals.clear();
+    m_averages.clear();
+    m_device = nullptr;
+}
+
+double Profiler::now_us() const {
+    return std::chrono::duration<double, std::micro>(clock::now() - m_start_time).count();
+}
+
+void Profiler::begin_cpu(const char* name) {
+    m_cpu_scopes.push_back({ name, clock::now() });
+}
+
+void Profiler::end_cpu() {
+    if (m_cpu_scopes.empty()) return;
+    CpuScope scope = m_cpu_scopes.back();
+    m_cpu_scopes.pop_back();
+    double start_us = std::chrono::duration<double, std::micro>(scope.start - m_start_time).count();
+    record("cpu", scope.name, start_us, now_us() - start_us);
+}
+
+void Profiler::record(const char* track, const char* name, double start_us, double duration_us) {
+    std::string key = std::string(track) + ": " + name;
+    for (Total* total : { &m_totals[key], &m_averages[key] }) {
+        total->sum_ms += duration_us / 1000.0;
+        total->count++;
+    }
+
+    if (!m_trace.is_open()) return;
+    m_trace << (m_first_event ? "" : ",\n") << std::fixed << std::setprecision(3)
+        << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":\"" << track
+        << "\",\"ts\":" << start_us << ",\"dur\":" << duration_us << "}";
+    m_first_event = false;
+}
+
+void Profiler::begin_gpu_pass(const char* name, RenderPassDescriptor& render_pass_descriptor) {
+    GpuFrame& frame = m_gpu_frames[m_gpu_frame];
+    // Without timestamps, or while the readback of this frame slot is still in use, time the encoding instead
+    m_pass_on_cpu = !m_timestamps || frame.mapping || frame.names.size() >= max_gpu_scopes;
+    if (m_pass_on_cpu) {
+        begin_cpu(name);
+        return;
+    }
+
+    uint32_t first_query = (m_gpu_frame * max_gpu_scopes + (uint32_t)frame.names.size()) * 2;
+    m_timestamp_writes[0].querySet = m_query_set;
+    m_timestamp_writes[0].queryIndex = first_query;
+    m_timestamp_writes[0].location = RenderPassTimestampLocation::Beginning;
+    m_timestamp_writes[1].querySet = m_query_set;
+    m_timestamp_writes[1].queryIndex = first_query + 1;
+    m_timestamp_writes[1].location = RenderPassTimestampLocation::End;
+    render_pass_descriptor.timestampWriteCount = (uint32_t)m_timestamp_writes.size();
+    render_pass_descriptor.timestampWrites = m_timestamp_writes.data();
+    frame.names.push_back(name);
+}
+
+void Profiler::end_gpu_pass() {
+    if (m_pass_on_cpu) end_cpu();
+    m_pass_on_cpu = false;
+}
+
+void Profiler::resolve(CommandEncoder& encoder) {
+    GpuFrame& frame = m_gpu_frames[m_gpu_frame];
+    if (!m_timestamps || frame.mapping || frame.names.empty()) return;
+
+    uint32_t query_count = (uint32_t)frame.names.size() * 2;
+    uint64_t offset = m_gpu_frame * frame_query_bytes;
+    encoder.resolveQuerySet(m_query_set, m_gpu_frame * max_gpu_scopes * 2, query_count, m_resolve_buffer, offset);
+    encoder.copyBufferToBuffer(m_resolve_buffer, offset, frame.readback, 0, query_count * sizeof(uint64_t));
+}
+
+void Profiler::end_frame() {
+    GpuFrame& frame = m_gpu_frames[m_gpu_frame];
+    if (m_timestamps && !frame.mapping && !frame.names.empty()) {
+        frame.mapping = true;
+        frame.submit_time = now_us();
+        frame.request = frame.readback.mapAsync(MapMode::Read, 0, frame.names.size() * 2 * sizeof(uint64_t), [this, &frame](BufferMapAsyncStatus status) {
+            if (status == BufferMapAsyncStatus::Success) {
+                read_timestamps(frame);
+                frame.readback.unmap();
+            }
+            frame.names.clear();
+            frame.mapping = false;
+        });
+    }
+    m_gpu_frame = (m_gpu_frame + 1) % readback_frames;
+
+    m_frames++;
+    if (clock::now() - m_last_summary_time >= std::chrono::seconds(1)) {
+        print_summary();
+    }
+}
+
+void Profiler::read_timestamps(GpuFrame& frame) {
+    // Dawn reports timestamps in nanoseconds
+    const uint64_t* timestamps = (const uint64_t*)frame.readback.getConstMappedRange(0, frame.names.size() * 2 * sizeof(uint64_t));
+    if (!timestamps) return;
+    uint64_t frame_start = timestamps[0];
+    for (size_t i = 0; i < frame.names.size(); i++) {
+        uint64_t begin = timestamps[2 * i];
+        uint64_t end = timestamps[2 * i + 1];
+        // Timestamps may be reset or reordered by the driver, those passes are skipped
+        if (end < begin || begin < frame_start) continue;
+        record("gpu", frame.names[i], frame.submit_time + (begin - frame_start) / 1000.0, (end - begin) / 1000.0);
+    }
+}
+
+double Profiler::get_average_ms(const char* track, const std::string& name) const {
+    auto total = m_averages.find(std::string(track) + ": " + name);
+    return total == m_averages.end() || total->second.count == 0 ? 0.0 : total->second.sum_ms / total->second.count;
+}
+
+void Profiler::print_summary() {
+    if (m_print_summary) {
+        std::cout << std::fixed << std::setprecision(3) << "Profile over " << m_frames << " frames:";
+        for (const auto& [name, total] : m_totals) {
+            std::cout << "\n    " << name << " " << total.sum_ms / total.count << " ms";
+        }
+        std::cout << std::endl;
+    }
+
+    m_totals.clear();
+    m_frames = 0;
+    m_last_summary_time = clock::now();
+}
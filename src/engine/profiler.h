@@ -0,0 +1,110 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Measures CPU scopes and GPU render passes every frame.
+ *
+ * Render passes get a pair of timestamp queries when the device supports
+ * timestamp queries, otherwise their encoding is timed on the CPU. Timestamps
+ * are resolved into a small ring of readback buffers and read a few frames
+ * later, once their mapping completes, so measuring never stalls the GPU.
+ *
+ * Every scope goes to an optional Chrome trace (chrome://tracing, Perfetto)
+ * and into a summary printed once a second. GPU passes are placed on their
+ * own track, aligned to the CPU time of the submit, so their offsets within a
+ * frame are exact but their position relative to CPU scopes is approximate.
+ */
+class Profiler {
+    public:
+        using path = std::filesystem::path;
+
+        static constexpr uint32_t max_gpu_scopes = 16;
+        static constexpr uint32_t readback_frames = 4;
+
+        // Times the enclosing block
+        class Scope {
+            public:
+                Scope(Profiler& profiler, const char* name) : m_profiler(profiler) { m_profiler.begin_cpu(name); }
+                ~Scope() { m_profiler.end_cpu(); }
+            private:
+                Profiler& m_profiler;
+        };
+
+        // An empty trace path disables the trace
+        bool init(wgpu::Device device, const path& trace_path, bool print_summary = true);
+        void terminate();
+
+        void begin_cpu(const char* name);
+        void end_cpu();
+
+        // Adds the timestamp writes of the pass to its descriptor, which has to be used before the next pass begins
+        void begin_gpu_pass(const char* name, wgpu::RenderPassDescriptor& render_pass_descriptor);
+        void end_gpu_pass();
+        // Copies this frame's timestamps to its readback buffer, call before finishing the encoder
+        void resolve(wgpu::CommandEncoder& encoder);
+        // Call after the submit
+        void end_frame();
+
+        bool has_timestamps() const { return m_timestamps; }
+        // Average duration of a scope on the "cpu" or "gpu" track since the last reset, 0 when it was never timed there
+        double get_average_ms(const char* track, const std::string& name) const;
+        void reset_averages() { m_averages.clear(); }
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct CpuScope {
+            const char* name;
+            clock::time_point start;
+        };
+
+        struct GpuFrame {
+            wgpu::Buffer readback = nullptr;
+            std::vector<const char*> names;
+            std::unique_ptr<wgpu::BufferMapCallback> request;
+            bool mapping = false;
+            double submit_time = 0.0;
+        };
+
+        struct Total {
+            double sum_ms = 0.0;
+            uint32_t count = 0;
+        };
+
+        wgpu::Device m_device = nullptr;
+        bool m_timestamps = false;
+        wgpu::QuerySet m_query_set = nullptr;
+        wgpu::Buffer m_resolve_buffer = nullptr;
+        std::array<GpuFrame, readback_frames> m_gpu_frames;
+        uint32_t m_gpu_frame = 0;
+        std::array<wgpu::RenderPassTimestampWrite, 2> m_timestamp_writes;
+        bool m_pass_on_cpu = false;
+
+        std::vector<CpuScope> m_cpu_scopes;
+        clock::time_point m_start_time;
+        std::ofstream m_trace;
+        bool m_first_event = true;
+
+        // Keyed by track and scope name, reset with every summary
+        std::map<std::string, Total> m_totals;
+        uint32_t m_frames = 0;
+        bool m_print_summary = true;
+        // Same keys, kept across summaries for benchmarks
+        std::map<std::string, Total> m_averages;
+        clock::time_point m_last_summary_time;
+
+        double now_us() const;
+        void record(const char* track, const char* name, double start_us, double duration_us);
+        void read_timestamps(GpuFrame& frame);
+        void print_summary();
+};
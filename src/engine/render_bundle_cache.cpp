@@ -0,0 +1,162 @@
+#include "render_bundle_cache.h"
+
+#include <algorithm>
+
+using namespace wgpu;
+
+bool RenderBundleCache::init(Device device, TextureFormat color_format, TextureFormat depth_format, uint32_t worker_count, bool threaded) {
+    terminate();
+    m_device = device;
+    m_color_format = color_format;
+    m_depth_format = depth_format;
+    // The thread calling update() records as well
+    if (threaded) {
+        for (uint32_t i = 1; i < worker_count; i++) m_workers.emplace_back(&RenderBundleCache::work, this);
+    }
+    return m_device != nullptr;
+}
+
+void RenderBundleCache::stop_workers() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_work_ready.notify_all();
+    for (std::thread& worker : m_workers) worker.join();
+    m_workers.clear();
+    m_stopping = false;
+}
+
+void RenderBundleCache::terminate() {
+    stop_workers();
+    for (Bundle& bundle : m_bundles) {
+        if (bundle.render_bundle) bundle.render_bundle.release();
+    }
+    m_bundles.clear();
+    m_free.clear();
+    m_stale.clear();
+    m_execute.clear();
+    m_device = nullptr;
+    m_stats = {};
+}
+
+RenderBundleCache::BundleId RenderBundleCache::add(const char* label, Record record) {
+    m_stats.bundles++;
+    if (!m_free.empty()) {
+        BundleId bundle = m_free.back();
+        m_free.pop_back();
+        m_bundles[bundle] = { label, std::move(record), {}, true, nullptr };
+        return bundle;
+    }
+    m_bundles.push_back({ label, std::move(record), {}, true, nullptr });
+    return (BundleId)m_bundles.size() - 1;
+}
+
+void RenderBundleCache::remove(BundleId bundle) {
+    if (bundle >= m_bundles.size() || !m_bundles[bundle].record) return;
+    Bundle& entry = m_bundles[bundle];
+    if (entry.render_bundle) entry.render_bundle.release();
+    entry = { nullptr, nullptr, {}, false, nullptr };
+    m_free.push_back(bundle);
+    m_stats.bundles--;
+}
+
+void RenderBundleCache::set_inputs(BundleId bundle, std::initializer_list<uint64_t> inputs) {
+    if (bundle >= m_bundles.size()) return;
+    Bundle& entry = m_bundles[bundle];
+    if (std::equal(entry.inputs.begin(), entry.inputs.end(), inputs.begin(), inputs.end())) return;
+    entry.inputs.assign(inputs.begin(), inputs.end());
+    entry.stale = true;
+}
+
+void RenderBundleCache::invalidate(BundleId bundle) {
+    if (bundle < m_bundles.size()) m_bundles[bundle].stale = true;
+}
+
+void RenderBundleCache::record(Bundle& bundle) {
+    RenderBundleEncoderDescriptor encoder_descriptor;
+    encoder_descriptor.label = bundle.label;
+    encoder_descriptor.colorFormatsCount = 1;
+    encoder_descriptor.colorFormats = (WGPUTextureFormat*)&m_color_format;
+    encoder_descriptor.depthStencilFormat = m_depth_format;
+    encoder_descriptor.sampleCount = 1;
+    // Has to match the render passes, which write depth and leave stencil alone
+    encoder_descriptor.depthReadOnly = false;
+    encoder_descriptor.stencilReadOnly = true;
+    RenderBundleEncoder encoder = m_device.createRenderBundleEncoder(encoder_descriptor);
+    bundle.record(encoder);
+
+    RenderBundleDescriptor bundle_descriptor;
+    bundle_descriptor.label = bundle.label;
+    RenderBundle render_bundle = encoder.finish(bundle_descriptor);
+    encoder.release();
+
+    if (bundle.render_bundle) bundle.render_bundle.release();
+    bundle.render_bundle = render_bundle;
+    bundle.stale = false;
+}
+
+void RenderBundleCache::update() {
+    m_stale.clear();
+    for (BundleId bundle = 0; bundle < m_bundles.size(); bundle++) {
+        if (m_bundles[bundle].stale) m_stale.push_back(bundle);
+    }
+    m_stats.recorded = (uint32_t)m_stale.size();
+    m_stats.total_recorded += m_stale.size();
+    if (m_stale.empty()) return;
+
+    // A chunk scrolling into view only adds a few one draw bundles, those are quicker to record right here
+    if (m_workers.empty() || m_stale.size() < min_parallel_bundles) {
+        for (BundleId bundle : m_stale) record(m_bundles[bundle]);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_next_stale = 0;
+        m_busy = (uint32_t)m_workers.size();
+        m_generation++;
+    }
+    m_work_ready.notify_all();
+    record_stale();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_work_done.wait(lock, [this]() { return m_busy == 0; });
+}
+
+void RenderBundleCache::record_stale() {
+    for (uint32_t i = m_next_stale++; i < m_stale.size(); i = m_next_stale++) {
+        record(m_bundles[m_stale[i]]);
+    }
+}
+
+void RenderBundleCache::work() {
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_work_ready.wait(lock, [&]() { return m_stopping || m_generation != generation; });
+        if (m_stopping) return;
+        generation = m_generation;
+        lock.unlock();
+        record_stale();
+        lock.lock();
+        if (--m_busy == 0) m_work_done.notify_one();
+    }
+}
+
+void RenderBundleCache::execute(RenderPassEncoder& render_pass, std::initializer_list<BundleId> bundles) {
+    execute(render_pass, bundles.begin(), bundles.end());
+}
+
+void RenderBundleCache::execute(RenderPassEncoder& render_pass, const std::vector<BundleId>& bundles) {
+    execute(render_pass, bundles.begin(), bundles.end());
+}
+
+template<typename Iterator>
+void RenderBundleCache::execute(RenderPassEncoder& render_pass, Iterator begin, Iterator end) {
+    m_execute.clear();
+    for (Iterator bundle = begin; bundle != end; ++bundle) {
+        if (*bundle < m_bundles.size() && m_bundles[*bundle].render_bundle) {
+            m_execute.push_back(m_bundles[*bundle].render_bundle);
+        }
+    }
+    if (!m_execute.empty()) render_pass.executeBundles(m_execute);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Static draws recorded once into render bundles and replayed every frame
+ * with a single executeBundles.
+ *
+ * Every bundle has a list of inputs, such as the handles and dynamic offsets
+ * its draws bind. update() re-records exactly the bundles whose inputs have
+ * changed since they were last recorded, so encoding a frame costs the same
+ * no matter how many static draws the bundles hold.
+ *
+ * When the device can be used from several threads, which on Dawn takes the
+ * ImplicitDeviceSynchronization feature, init() starts worker_count - 1
+ * workers that wait for update(). An update with at least
+ * min_parallel_bundles stale bundles records them on the workers and the
+ * calling thread and waits for all of them, smaller ones are recorded inline.
+ * Recording functions then have to be safe to run concurrently and must only
+ * read state that does not change during update().
+ */
+class RenderBundleCache {
+    public:
+        using BundleId = uint32_t;
+        using Record = std::function<void(wgpu::RenderBundleEncoder&)>;
+
+        static constexpr BundleId no_bundle = UINT32_MAX;
+        // Below it, waking the workers costs more than recording the bundles on the calling thread
+        static constexpr uint32_t min_parallel_bundles = 16;
+
+        // Identifies a handle in the inputs of a bundle
+        template<typename T>
+        static uint64_t handle_key(T handle) {
+            return (uint64_t)(uintptr_t)(typename T::W&)handle;
+        }
+
+        struct Stats {
+            uint32_t bundles = 0;
+            // By the last update()
+            uint32_t recorded = 0;
+            uint64_t total_recorded = 0;
+        };
+
+        // Bundles are compatible with render passes of these attachment formats, depth is written and stencil unused
+        bool init(wgpu::Device device, wgpu::TextureFormat color_format, wgpu::TextureFormat depth_format, uint32_t worker_count, bool threaded);
+        void terminate();
+        ~RenderBundleCache() { stop_workers(); }
+
+        // Ids of removed bundles are handed out again
+        BundleId add(const char* label, Record record);
+        void remove(BundleId bundle);
+        // Cheap when nothing changed, the inputs are compared and only copied when they differ
+        void set_inputs(BundleId bundle, std::initializer_list<uint64_t> inputs);
+        void invalidate(BundleId bundle);
+        void update();
+
+        // In the given order, bundles without a recording are skipped
+        void execute(wgpu::RenderPassEncoder& render_pass, std::initializer_list<BundleId> bundles);
+        void execute(wgpu::RenderPassEncoder& render_pass, const std::vector<BundleId>& bundles);
+
+        const Stats& get_stats() const { return m_stats; }
+
+    private:
+        struct Bundle {
+            const char* label;
+            Record record;
+            std::vector<uint64_t> inputs;
+            bool stale;
+            wgpu::RenderBundle render_bundle;
+        };
+
+        wgpu::Device m_device = nullptr;
+        wgpu::TextureFormat m_color_format = wgpu::TextureFormat::Undefined;
+        wgpu::TextureFormat m_depth_format = wgpu::TextureFormat::Undefined;
+        std::vector<Bundle> m_bundles;
+        std::vector<BundleId> m_free;
+        std::vector<BundleId> m_stale;
+        std::vector<WGPURenderBundle> m_execute;
+        Stats m_stats = {};
+
+        // Every worker records stale bundles once per generation, update() waits until none is busy
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_work_ready;
+        std::condition_variable m_work_done;
+        uint64_t m_generation = 0;
+        uint32_t m_busy = 0;
+        bool m_stopping = false;
+        std::atomic<uint32_t> m_next_stale = 0;
+
+        void record(Bundle& bundle);
+        void record_stale();
+        void work();
+        void stop_workers();
+        template<typename Iterator>
+        void execute(wgpu::RenderPassEncoder& render_pass, Iterator begin, Iterator end);
+};
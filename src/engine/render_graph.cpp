@@ -0,0 +1,300 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+const uint32_t no_texture = UINT32_MAX;
+
+bool same_description(const RenderGraph::TextureDescription& a, const RenderGraph::TextureDescription& b) {
+    return a.width == b.width && a.height == b.height && a.format == b.format;
+}
+
+}
+
+void RenderGraph::init(Device device, GpuMemory& memory, Profiler* profiler) {
+    m_device = device;
+    m_memory = &memory;
+    m_profiler = profiler;
+}
+
+void RenderGraph::terminate() {
+    clear();
+    for (PooledTexture& pooled : m_pool) release_pooled_texture(pooled);
+    m_pool.clear();
+    m_device = nullptr;
+    m_memory = nullptr;
+    m_profiler = nullptr;
+    m_stats = {};
+}
+
+void RenderGraph::clear() {
+    m_resources.clear();
+    m_passes.clear();
+    m_compiled = false;
+}
+
+RenderGraph::ResourceId RenderGraph::create_texture(const std::string& name, const TextureDescription& description) {
+    m_resources.push_back({ name, false, false, description, 0, no_texture, nullptr });
+    m_compiled = false;
+    return (ResourceId)m_resources.size() - 1;
+}
+
+RenderGraph::ResourceId RenderGraph::import_texture(const std::string& name) {
+    m_resources.push_back({ name, true, false, { 0, 0, TextureFormat::Undefined }, 0, no_texture, nullptr });
+    m_compiled = false;
+    return (ResourceId)m_resources.size() - 1;
+}
+
+void RenderGraph::mark_output(ResourceId resource) {
+    if (resource >= m_resources.size()) return;
+    m_resources[resource].output = true;
+    m_compiled = false;
+}
+
+RenderGraph::PassId RenderGraph::add_pass(const std::string& name, Execute execute) {
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    m_passes.push_back(std::move(pass));
+    m_compiled = false;
+    return (PassId)m_passes.size() - 1;
+}
+
+void RenderGraph::write_color(PassId pass, ResourceId resource, LoadOp load_op, Color clear_value) {
+    if (pass >= m_passes.size() || resource >= m_resources.size()) return;
+    m_passes[pass].colors.push_back({ resource, load_op, clear_value, 0.0f, StoreOp::Store });
+    m_resources[resource].usage |= TextureUsage::RenderAttachment;
+    m_compiled = false;
+}
+
+void RenderGraph::write_depth(PassId pass, ResourceId resource, float clear_value) {
+    if (pass >= m_passes.size() || resource >= m_resources.size()) return;
+    m_passes[pass].has_depth = true;
+    m_passes[pass].depth = { resource, LoadOp::Clear, {}, clear_value, StoreOp::Store };
+    m_resources[resource].usage |= TextureUsage::RenderAttachment;
+    m_compiled = false;
+}
+
+void RenderGraph::read(PassId pass, ResourceId resource) {
+    if (pass >= m_passes.size() || resource >= m_resources.size()) return;
+    m_passes[pass].reads.push_back(resource);
+    m_resources[resource].usage |= TextureUsage::TextureBinding;
+    m_compiled = false;
+}
+
+void RenderGraph::cull_passes() {
+    // Walking backwards, a resource is needed while some later pass reads or loads it, or when it is an output.
+    // A pass writing nothing needed is culled, and the attachments it does keep are only stored when needed.
+    std::vector<bool> needed(m_resources.size());
+    for (ResourceId resource = 0; resource < m_resources.size(); resource++) {
+        needed[resource] = m_resources[resource].output;
+    }
+    for (size_t index = m_passes.size(); index-- > 0;) {
+        Pass& pass = m_passes[index];
+        bool writes_needed = pass.has_depth && needed[pass.depth.resource];
+        for (const Attachment& color : pass.colors) {
+            writes_needed = writes_needed || needed[color.resource];
+        }
+        pass.culled = !writes_needed;
+        if (pass.culled) continue;
+
+        auto write = [&](Attachment& attachment) {
+            attachment.store_op = needed[attachment.resource] ? StoreOp::Store : StoreOp::Discard;
+            needed[attachment.resource] = attachment.load_op == LoadOp::Load;
+        };
+        for (Attachment& color : pass.colors) write(color);
+        if (pass.has_depth) write(pass.depth);
+        for (ResourceId resource : pass.reads) needed[resource] = true;
+    }
+}
+
+uint32_t RenderGraph::acquire_pooled_texture(const TextureDescription& description, TextureUsageFlags usage, std::vector<bool>& busy) {
+    for (uint32_t index = 0; index < m_pool.size(); index++) {
+        const PooledTexture& pooled = m_pool[index];
+        if (!busy[index] && same_description(pooled.description, description) && pooled.usage == usage) {
+            busy[index] = true;
+            m_pool[index].used = true;
+            return index;
+        }
+    }
+
+    TextureDescriptor texture_descriptor;
+    texture_descriptor.dimension = TextureDimension::_2D;
+    texture_descriptor.format = description.format;
+    texture_descriptor.mipLevelCount = 1;
+    texture_descriptor.sampleCount = 1;
+    texture_descriptor.size = { description.width, description.height, 1 };
+    texture_descriptor.usage = usage;
+    texture_descriptor.viewFormatCount = 0;
+    texture_descriptor.viewFormats = nullptr;
+    Texture texture = m_memory->create_texture(m_device, texture_descriptor, GpuMemory::Category::Transient);
+    if (!texture) return no_texture;
+
+    TextureViewDescriptor texture_view_descriptor;
+    texture_view_descriptor.aspect = TextureAspect::All;
+    texture_view_descriptor.baseArrayLayer = 0;
+    texture_view_descriptor.arrayLayerCount = 1;
+    texture_view_descriptor.baseMipLevel = 0;
+    texture_view_descriptor.mipLevelCount = 1;
+    texture_view_descriptor.dimension = TextureViewDimension::_2D;
+    texture_view_descriptor.format = description.format;
+    TextureView view = texture.createView(texture_view_descriptor);
+
+    m_pool.push_back({ description, usage, texture, view, true });
+    busy.push_back(true);
+    return (uint32_t)m_pool.size() - 1;
+}
+
+void RenderGraph::release_pooled_texture(PooledTexture& pooled) {
+    if (pooled.view) pooled.view.release();
+    if (pooled.texture) m_memory->destroy(pooled.texture);
+    pooled.view = nullptr;
+}
+
+bool RenderGraph::allocate_transients() {
+    // First and last pass using each transient, culled passes do not count
+    std::vector<uint32_t> first_use(m_resources.size(), no_texture);
+    std::vector<uint32_t> last_use(m_resources.size(), no_texture);
+    for (uint32_t index = 0; index < m_passes.size(); index++) {
+        const Pass& pass = m_passes[index];
+        if (pass.culled) continue;
+        auto use = [&](ResourceId resource) {
+            if (first_use[resource] == no_texture) first_use[resource] = index;
+            last_use[resource] = index;
+        };
+        for (const Attachment& color : pass.colors) use(color.resource);
+        if (pass.has_depth) use(pass.depth.resource);
+        for (ResourceId resource : pass.reads) use(resource);
+    }
+
+    // A pool texture is busy from the first to the last use of its transient, then free for the next one
+    for (PooledTexture& pooled : m_pool) pooled.used = false;
+    std::vector<bool> busy(m_pool.size(), false);
+    m_stats.transient_textures = 0;
+    for (uint32_t index = 0; index < m_passes.size(); index++) {
+        for (ResourceId resource = 0; resource < m_resources.size(); resource++) {
+            Resource& entry = m_resources[resource];
+            if (entry.imported || first_use[resource] != index) continue;
+            entry.pool_index = acquire_pooled_texture(entry.description, entry.usage, busy);
+            if (entry.pool_index == no_texture) {
+                std::cerr << "Could not create the transient texture " << entry.name << std::endl;
+                return false;
+            }
+            m_stats.transient_textures++;
+        }
+        for (ResourceId resource = 0; resource < m_resources.size(); resource++) {
+            const Resource& entry = m_resources[resource];
+            if (!entry.imported && last_use[resource] == index) busy[entry.pool_index] = false;
+        }
+    }
+    for (ResourceId resource = 0; resource < m_resources.size(); resource++) {
+        if (first_use[resource] == no_texture) m_resources[resource].pool_index = no_texture;
+    }
+
+    // Pool textures no transient uses anymore are released, the rest move up
+    std::vector<uint32_t> remap(m_pool.size(), no_texture);
+    std::vector<PooledTexture> pool;
+    for (uint32_t index = 0; index < m_pool.size(); index++) {
+        if (!m_pool[index].used) {
+            release_pooled_texture(m_pool[index]);
+            continue;
+        }
+        remap[index] = (uint32_t)pool.size();
+        pool.push_back(m_pool[index]);
+    }
+    m_pool = std::move(pool);
+    m_stats.pooled_bytes = 0;
+    for (Resource& entry : m_resources) {
+        if (!entry.imported && entry.pool_index != no_texture) entry.pool_index = remap[entry.pool_index];
+    }
+    for (const PooledTexture& pooled : m_pool) {
+        m_stats.pooled_bytes += GpuMemory::texture_size(pooled.texture);
+    }
+    m_stats.pooled_textures = (uint32_t)m_pool.size();
+    return true;
+}
+
+bool RenderGraph::compile() {
+    if (!m_device) return false;
+    cull_passes();
+    if (!allocate_transients()) return false;
+    m_stats.passes = (uint32_t)m_passes.size();
+    m_stats.culled_passes = (uint32_t)std::count_if(m_passes.begin(), m_passes.end(), [](const Pass& pass) { return pass.culled; });
+    m_compiled = true;
+    return true;
+}
+
+void RenderGraph::set_imported_view(ResourceId resource, TextureView view) {
+    if (resource >= m_resources.size() || !m_resources[resource].imported) return;
+    m_resources[resource].imported_view = view;
+}
+
+TextureView RenderGraph::get_view(ResourceId resource) const {
+    if (resource >= m_resources.size()) return nullptr;
+    const Resource& entry = m_resources[resource];
+    if (entry.imported) return entry.imported_view;
+    return entry.pool_index == no_texture ? nullptr : m_pool[entry.pool_index].view;
+}
+
+bool RenderGraph::is_culled(PassId pass) const {
+    return pass >= m_passes.size() || m_passes[pass].culled;
+}
+
+void RenderGraph::execute(CommandEncoder& encoder) {
+    if (!m_compiled) {
+        std::cerr << "The render graph has to be compiled before it is executed" << std::endl;
+        return;
+    }
+
+    for (Pass& pass : m_passes) {
+        if (pass.culled) continue;
+
+        m_color_attachments.clear();
+        for (const Attachment& color : pass.colors) {
+            RenderPassColorAttachment color_attachment{};
+            color_attachment.view = get_view(color.resource);
+            color_attachment.resolveTarget = nullptr;
+            color_attachment.loadOp = color.load_op;
+            color_attachment.storeOp = color.store_op;
+            color_attachment.clearValue = color.clear_value;
+            m_color_attachments.push_back(color_attachment);
+        }
+
+        RenderPassDepthStencilAttachment depth_stencil_attachment;
+        if (pass.has_depth) {
+            depth_stencil_attachment.view = get_view(pass.depth.resource);
+            depth_stencil_attachment.depthClearValue = pass.depth.clear_depth;
+            depth_stencil_attachment.depthLoadOp = pass.depth.load_op;
+            depth_stencil_attachment.depthStoreOp = pass.depth.store_op;
+            depth_stencil_attachment.depthReadOnly = false;
+            depth_stencil_attachment.stencilClearValue = 0;
+            depth_stencil_attachment.stencilLoadOp = LoadOp::Undefined;
+            depth_stencil_attachment.stencilStoreOp = StoreOp::Undefined;
+            depth_stencil_attachment.stencilReadOnly = true;
+        }
+
+        RenderPassDescriptor render_pass_descriptor;
+        render_pass_descriptor.label = pass.name.c_str();
+        render_pass_descriptor.colorAttachmentCount = (uint32_t)m_color_attachments.size();
+        render_pass_descriptor.colorAttachments = m_color_attachments.data();
+        render_pass_descriptor.depthStencilAttachment = pass.has_depth ? &depth_stencil_attachment : nullptr;
+        render_pass_descriptor.timestampWriteCount = 0;
+        render_pass_descriptor.timestampWrites = nullptr;
+
+        if (m_profiler) m_profiler->begin_gpu_pass(pass.name.c_str(), render_pass_descriptor);
+        RenderPassEncoder render_pass = encoder.beginRenderPass(render_pass_descriptor);
+        pass.execute(render_pass);
+        render_pass.end();
+        render_pass.release();
+        if (m_profiler) m_profiler->end_gpu_pass();
+    }
+
+    // Borrowed for this frame only
+    for (Resource& entry : m_resources) {
+        if (entry.imported) entry.imported_view = nullptr;
+    }
+}
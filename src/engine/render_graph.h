@@ -0,0 +1,126 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+#include "profiler.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Render passes declared with the textures they read and write, encoded into
+ * one command encoder per frame.
+ *
+ * The graph is declared once and compiled, then executed every frame. Passes
+ * run in declaration order. compile() culls every pass whose writes reach
+ * no output, either directly or through the reads of later passes, and picks
+ * store ops: attachments nobody reads afterwards are discarded.
+ *
+ * Transient textures are owned by the graph. They are backed by a pool of
+ * textures kept across compiles, and two transients with the same size,
+ * format and usage share one pool texture when their lifetimes within the
+ * frame do not overlap. A transient's content is undefined when its first
+ * pass loads instead of clearing.
+ *
+ * Imported textures, such as the swap chain, belong to the caller, who hands
+ * in their view every frame. Only outputs keep passes alive.
+ */
+class RenderGraph {
+    public:
+        using ResourceId = uint32_t;
+        using PassId = uint32_t;
+        using Execute = std::function<void(wgpu::RenderPassEncoder&)>;
+
+        struct TextureDescription {
+            uint32_t width;
+            uint32_t height;
+            wgpu::TextureFormat format;
+        };
+
+        struct Stats {
+            uint32_t passes = 0;
+            uint32_t culled_passes = 0;
+            uint32_t transient_textures = 0;
+            // Backing textures, fewer than transients when some of them alias
+            uint32_t pooled_textures = 0;
+            uint64_t pooled_bytes = 0;
+        };
+
+        void init(wgpu::Device device, GpuMemory& memory, Profiler* profiler = nullptr);
+        void terminate();
+        // Drops every pass and resource, the texture pool stays for the next declaration
+        void clear();
+
+        ResourceId create_texture(const std::string& name, const TextureDescription& description);
+        ResourceId import_texture(const std::string& name);
+        void mark_output(ResourceId resource);
+
+        PassId add_pass(const std::string& name, Execute execute);
+        void write_color(PassId pass, ResourceId resource, wgpu::LoadOp load_op = wgpu::LoadOp::Clear, wgpu::Color clear_value = { 0.0, 0.0, 0.0, 1.0 });
+        void write_depth(PassId pass, ResourceId resource, float clear_value = 1.0f);
+        void read(PassId pass, ResourceId resource);
+
+        bool compile();
+        // Imported views are only borrowed for the frame
+        void set_imported_view(ResourceId resource, wgpu::TextureView view);
+        void execute(wgpu::CommandEncoder& encoder);
+
+        // Transient views are valid from compile() until the next compile() or terminate()
+        wgpu::TextureView get_view(ResourceId resource) const;
+        bool is_culled(PassId pass) const;
+        const Stats& get_stats() const { return m_stats; }
+
+    private:
+        struct Resource {
+            std::string name;
+            bool imported;
+            bool output;
+            TextureDescription description;
+            wgpu::TextureUsageFlags usage;
+            // Into m_pool for transients, unused for imports
+            uint32_t pool_index;
+            wgpu::TextureView imported_view;
+        };
+
+        struct Attachment {
+            ResourceId resource = 0;
+            wgpu::LoadOp load_op = wgpu::LoadOp::Clear;
+            wgpu::Color clear_value = { 0.0, 0.0, 0.0, 1.0 };
+            float clear_depth = 1.0f;
+            wgpu::StoreOp store_op = wgpu::StoreOp::Store;
+        };
+
+        struct Pass {
+            std::string name;
+            Execute execute;
+            std::vector<Attachment> colors;
+            bool has_depth = false;
+            Attachment depth;
+            std::vector<ResourceId> reads;
+            bool culled = false;
+        };
+
+        struct PooledTexture {
+            TextureDescription description;
+            wgpu::TextureUsageFlags usage;
+            wgpu::Texture texture;
+            wgpu::TextureView view;
+            bool used;
+        };
+
+        wgpu::Device m_device = nullptr;
+        GpuMemory* m_memory = nullptr;
+        Profiler* m_profiler = nullptr;
+        std::vector<Resource> m_resources;
+        std::vector<Pass> m_passes;
+        std::vector<PooledTexture> m_pool;
+        std::vector<wgpu::RenderPassColorAttachment> m_color_attachments;
+        bool m_compiled = false;
+        Stats m_stats = {};
+
+        void cull_passes();
+        bool allocate_transients();
+        uint32_t acquire_pooled_texture(const TextureDescription& description, wgpu::TextureUsageFlags usage, std::vector<bool>& busy);
+        void release_pooled_texture(PooledTexture& pooled);
+};
@@ -0,0 +1,163 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// After a longer stall, such as a debugger break, the missed ticks are dropped instead of run back to back
+const uint32_t max_late_ticks = 8;
+
+}
+
+Simulation::~Simulation() {
+    stop();
+}
+
+bool Simulation::init(uint32_t tick_rate, const World& world, EntityStore entities, CollisionGrid collision) {
+    if (tick_rate == 0) {
+        std::cerr << "The tick rate has to be at least 1" << std::endl;
+        return false;
+    }
+    m_tick_rate = tick_rate;
+    m_tick_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / tick_rate));
+    m_world = world;
+    m_entities = std::move(entities);
+    m_collision = std::move(collision);
+    // A few entities per cell, small enough that a bucket rarely holds more than a handful
+    m_spatial_hash.init(4.0f * m_world.sprite_size, m_world.sprite_size);
+    m_solid_edits.clear();
+    m_tick = 0;
+
+    // Every buffer starts at rest, so the first frames do not depend on which buffer they read
+    Snapshot snapshot;
+    snapshot.time = clock::now();
+    snapshot.previous_camera_x = snapshot.camera_x = m_camera_x;
+    snapshot.previous_camera_y = snapshot.camera_y = m_camera_y;
+    write_previous_entities(snapshot);
+    write_current_entities(snapshot);
+    m_snapshots.reset(snapshot);
+    return true;
+}
+
+void Simulation::start() {
+    if (m_running) return;
+    m_running = true;
+    m_thread = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop() {
+    m_running = false;
+    if (m_thread.joinable()) m_thread.join();
+}
+
+void Simulation::set_solid(uint32_t x, uint32_t y, bool solid) {
+    std::lock_guard<std::mutex> lock(m_solid_edits_mutex);
+    m_solid_edits.push_back({ x, y, solid });
+}
+
+void Simulation::set_input(float dx, float dy) {
+    m_input_x.store(dx, std::memory_order_relaxed);
+    m_input_y.store(dy, std::memory_order_relaxed);
+}
+
+float Simulation::get_blend(clock::time_point time) const {
+    double blend = std::chrono::duration<double>(time - get_snapshot().time) / m_tick_duration;
+    return (float)std::clamp(blend, 0.0, 1.0);
+}
+
+void Simulation::run() {
+    // Ticks follow a fixed schedule, a late tick is caught up by running the next ones without sleeping
+    clock::time_point next_tick = clock::now() + m_tick_duration;
+    while (m_running.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_until(next_tick);
+        clock::time_point now = clock::now();
+        if (now - next_tick > m_tick_duration * max_late_ticks) next_tick = now;
+
+        tick(next_tick);
+        next_tick += m_tick_duration;
+    }
+}
+
+void Simulation::tick(clock::time_point time) {
+    const float delta_time = 1.0f / (float)m_tick_rate;
+    Snapshot& snapshot = m_snapshots.get_back();
+    snapshot.tick = ++m_tick;
+    snapshot.time = time;
+
+    snapshot.previous_camera_x = m_camera_x;
+    snapshot.previous_camera_y = m_camera_y;
+    update_camera(delta_time);
+    snapshot.camera_x = m_camera_x;
+    snapshot.camera_y = m_camera_y;
+
+    // The back buffer was last written two ticks ago, the previous positions are copied before moving
+    write_previous_entities(snapshot);
+    apply_solid_edits();
+    m_entities.update_motion(delta_time, m_world.map_width - m_world.sprite_size, m_world.map_height - m_world.sprite_size);
+    update_collisions(snapshot);
+    m_entities.update_animation(delta_time);
+    write_current_entities(snapshot);
+    m_snapshots.publish();
+}
+
+void Simulation::update_camera(float delta_time) {
+    const float speed = 240.0f;
+    float dx = m_input_x.load(std::memory_order_relaxed);
+    float dy = m_input_y.load(std::memory_order_relaxed);
+    if (m_world.auto_pan) {
+        dx = m_pan_x;
+        dy = m_pan_y;
+    }
+
+    float max_x = std::max(0.0f, m_world.map_width - m_world.view_width);
+    float max_y = std::max(0.0f, m_world.map_height - m_world.view_height);
+    m_camera_x = std::clamp(m_camera_x + dx * speed * delta_time, 0.0f, max_x);
+    m_camera_y = std::clamp(m_camera_y + dy * speed * delta_time, 0.0f, max_y);
+
+    // Without input the camera bounces off the map edges, so new chunks keep streaming in
+    if (m_camera_x <= 0.0f) m_pan_x = 1.0f;
+    else if (m_camera_x >= max_x) m_pan_x = -1.0f;
+    if (m_camera_y <= 0.0f) m_pan_y = 0.5f;
+    else if (m_camera_y >= max_y) m_pan_y = -0.5f;
+}
+
+void Simulation::apply_solid_edits() {
+    {
+        std::lock_guard<std::mutex> lock(m_solid_edits_mutex);
+        std::swap(m_solid_edits, m_applied_solid_edits);
+    }
+    for (const SolidEdit& edit : m_applied_solid_edits) {
+        m_collision.set_solid(edit.x, edit.y, edit.solid);
+    }
+    m_applied_solid_edits.clear();
+}
+
+void Simulation::update_collisions(const Snapshot& snapshot) {
+    // The snapshot still holds the positions from before this tick's motion
+    m_entities.resolve_tile_collisions(m_collision, snapshot.previous_x.data(), snapshot.previous_y.data(), m_world.sprite_size, m_tile_hits);
+
+    const EntityStore::Components& components = m_entities.get_components();
+    m_spatial_hash.update(components.x.data(), components.y.data(), m_entities.size());
+    m_spatial_hash.find_pairs(components.x.data(), components.y.data(), m_pairs);
+    m_entities.resolve_contacts(m_pairs);
+}
+
+void Simulation::write_previous_entities(Snapshot& snapshot) const {
+    const EntityStore::Components& components = m_entities.get_components();
+    snapshot.previous_x.assign(components.x.begin(), components.x.end());
+    snapshot.previous_y.assign(components.y.begin(), components.y.end());
+}
+
+void Simulation::write_current_entities(Snapshot& snapshot) const {
+    const EntityStore::Components& components = m_entities.get_components();
+    snapshot.x.assign(components.x.begin(), components.x.end());
+    snapshot.y.assign(components.y.begin(), components.y.end());
+    const uint32_t count = m_entities.size();
+    snapshot.tile.resize(count);
+    snapshot.flip_x.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        snapshot.tile[i] = components.first_tile[i] + components.frame[i];
+        snapshot.flip_x[i] = components.velocity_x[i] < 0.0f;
+    }
+}
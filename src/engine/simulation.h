@@ -0,0 +1,121 @@
+#pragma once
+
+#include "triple_buffer.h"
+#include "entity_store.h"
+#include "collision_grid.h"
+#include "spatial_hash.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs the game logic at a fixed tick rate on its own thread.
+ *
+ * Every tick moves the camera and the entities by exactly one tick of time and
+ * publishes their previous and current positions as a snapshot. The render
+ * thread picks up the newest snapshot whenever it starts a frame and blends
+ * between the two positions by how far the frame lies past the tick, so motion
+ * stays smooth at any frame rate while the logic never waits for a present.
+ *
+ * Input is handed over through atomics, the render thread keeps polling the
+ * window because GLFW only allows that on the main thread.
+ *
+ * Entities bounce off solid tiles of the collision grid and off each other.
+ * Both belong to the simulation thread, tile edits from other threads are
+ * queued and reach the grid with the next tick.
+ */
+class Simulation {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        struct Snapshot {
+            uint64_t tick = 0;
+            // When the tick was due, frames at or after this time blend towards the current positions
+            clock::time_point time;
+            float previous_camera_x = 0.0f;
+            float previous_camera_y = 0.0f;
+            float camera_x = 0.0f;
+            float camera_y = 0.0f;
+            // One entry per entity, in the order of the entity store
+            std::vector<float> previous_x;
+            std::vector<float> previous_y;
+            std::vector<float> x;
+            std::vector<float> y;
+            std::vector<uint32_t> tile;
+            std::vector<uint8_t> flip_x;
+        };
+
+        struct World {
+            float map_width = 0.0f;
+            float map_height = 0.0f;
+            float view_width = 0.0f;
+            float view_height = 0.0f;
+            float sprite_size = 0.0f;
+            // Without input the camera pans by itself and bounces off the map edges
+            bool auto_pan = false;
+        };
+
+        ~Simulation();
+
+        bool init(uint32_t tick_rate, const World& world, EntityStore entities, CollisionGrid collision);
+        void start();
+        // Joins the thread, the last snapshot stays readable
+        void stop();
+
+        // Direction of the camera, each axis in [-1, 1]
+        void set_input(float dx, float dy);
+        // Thread safe, applied at the start of the next tick
+        void set_solid(uint32_t x, uint32_t y, bool solid);
+        bool is_solid_tile(uint32_t layer, uint32_t gid) const { return m_collision.is_solid_tile(layer, gid); }
+
+        // Render thread only, returns false when no new tick was published
+        bool update_snapshot() { return m_snapshots.update(); }
+        const Snapshot& get_snapshot() const { return m_snapshots.get_front(); }
+        // Where the frame at the given time lies between the previous and the current positions of the snapshot, in [0, 1]
+        float get_blend(clock::time_point time) const;
+
+        uint32_t get_tick_rate() const { return m_tick_rate; }
+
+    private:
+        uint32_t m_tick_rate = 60;
+        clock::duration m_tick_duration;
+        World m_world;
+        EntityStore m_entities;
+        float m_camera_x = 0.0f;
+        float m_camera_y = 0.0f;
+        float m_pan_x = 1.0f;
+        float m_pan_y = 0.5f;
+        uint64_t m_tick = 0;
+
+        CollisionGrid m_collision;
+        SpatialHash m_spatial_hash;
+        // Reused every tick, so resolving collisions does not allocate
+        std::vector<SpatialHash::Pair> m_pairs;
+        std::vector<uint8_t> m_tile_hits;
+
+        struct SolidEdit {
+            uint32_t x;
+            uint32_t y;
+            bool solid;
+        };
+        std::mutex m_solid_edits_mutex;
+        std::vector<SolidEdit> m_solid_edits;
+        std::vector<SolidEdit> m_applied_solid_edits;
+
+        std::atomic<float> m_input_x = 0.0f;
+        std::atomic<float> m_input_y = 0.0f;
+        TripleBuffer<Snapshot> m_snapshots;
+        std::thread m_thread;
+        std::atomic<bool> m_running = false;
+
+        void run();
+        void tick(clock::time_point time);
+        void update_camera(float delta_time);
+        void apply_solid_edits();
+        void update_collisions(const Snapshot& snapshot);
+        void write_previous_entities(Snapshot& snapshot) const;
+        void write_current_entities(Snapshot& snapshot) const;
+};
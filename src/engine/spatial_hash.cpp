@@ -0,0 +1,155 @@
+#include "spatial_hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+bool overlap(float ax, float ay, float bx, float by, float size) {
+    return std::abs(ax - bx) < size && std::abs(ay - by) < size;
+}
+
+uint64_t make_key(int32_t cell_x, int32_t cell_y) {
+    return ((uint64_t)(uint32_t)cell_y << 32) | (uint32_t)cell_x;
+}
+
+}
+
+void SpatialHash::init(float cell_size, float entity_size) {
+    m_entity_size = std::max(entity_size, 0.0f);
+    m_cell_size = std::max(cell_size, std::max(m_entity_size, 1.0f));
+    clear();
+}
+
+void SpatialHash::clear() {
+    m_slots.clear();
+    m_slot_mask = 0;
+    m_entity_cell.clear();
+    m_next.clear();
+    m_previous.clear();
+    m_moved_count = 0;
+}
+
+uint64_t SpatialHash::cell_key(float x, float y) const {
+    return make_key((int32_t)std::floor(x / m_cell_size), (int32_t)std::floor(y / m_cell_size));
+}
+
+uint32_t SpatialHash::slot(uint64_t key) const {
+    // Fibonacci hashing, neighbouring cells end up far apart in the table
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & m_slot_mask;
+}
+
+void SpatialHash::link(uint32_t index) {
+    uint32_t& head = m_slots[slot(m_entity_cell[index])];
+    m_previous[index] = none;
+    m_next[index] = head;
+    if (head != none) m_previous[head] = index;
+    head = index;
+}
+
+void SpatialHash::unlink(uint32_t index) {
+    uint32_t previous = m_previous[index];
+    uint32_t next = m_next[index];
+    if (previous != none) m_next[previous] = next;
+    else m_slots[slot(m_entity_cell[index])] = next;
+    if (next != none) m_previous[next] = previous;
+}
+
+void SpatialHash::resize_table(uint32_t entity_count) {
+    // About two slots per entity keeps the lists short, only ever grows
+    uint32_t slot_count = 16;
+    while (slot_count < 2 * entity_count) slot_count *= 2;
+    if (slot_count <= m_slots.size()) return;
+    m_slots.assign(slot_count, none);
+    m_slot_mask = slot_count - 1;
+    for (uint32_t i = 0; i < size(); i++) link(i);
+}
+
+void SpatialHash::update(const float* x, const float* y, uint32_t count) {
+    m_moved_count = 0;
+    while (size() > count) {
+        unlink(size() - 1);
+        m_entity_cell.pop_back();
+        m_next.pop_back();
+        m_previous.pop_back();
+    }
+    resize_table(count);
+
+    const uint32_t existing = size();
+    for (uint32_t i = 0; i < existing; i++) {
+        uint64_t key = cell_key(x[i], y[i]);
+        if (key == m_entity_cell[i]) continue;
+        unlink(i);
+        m_entity_cell[i] = key;
+        link(i);
+        m_moved_count++;
+    }
+
+    m_entity_cell.resize(count);
+    m_next.resize(count);
+    m_previous.resize(count);
+    for (uint32_t i = existing; i < count; i++) {
+        m_entity_cell[i] = cell_key(x[i], y[i]);
+        link(i);
+        m_moved_count++;
+    }
+}
+
+void SpatialHash::remove(uint32_t index) {
+    if (index >= size()) return;
+    const uint32_t last = size() - 1;
+    unlink(index);
+    if (index != last) {
+        unlink(last);
+        m_entity_cell[index] = m_entity_cell[last];
+        link(index);
+    }
+    m_entity_cell.pop_back();
+    m_next.pop_back();
+    m_previous.pop_back();
+}
+
+void SpatialHash::query(float x, float y, float width, float height, const float* entity_x, const float* entity_y, std::vector<uint32_t>& results) const {
+    results.clear();
+    if (m_slots.empty()) return;
+    // Entities belong to the cell of their top left corner, so the cells up to one entity size before the box count too
+    int32_t first_x = (int32_t)std::floor((x - m_entity_size) / m_cell_size);
+    int32_t first_y = (int32_t)std::floor((y - m_entity_size) / m_cell_size);
+    int32_t last_x = (int32_t)std::floor((x + width) / m_cell_size);
+    int32_t last_y = (int32_t)std::floor((y + height) / m_cell_size);
+    for (int32_t cell_y = first_y; cell_y <= last_y; cell_y++) {
+        for (int32_t cell_x = first_x; cell_x <= last_x; cell_x++) {
+            uint64_t key = make_key(cell_x, cell_y);
+            for (uint32_t index = m_slots[slot(key)]; index != none; index = m_next[index]) {
+                if (m_entity_cell[index] != key) continue;
+                float ex = entity_x[index];
+                float ey = entity_y[index];
+                if (ex < x + width && ex + m_entity_size > x && ey < y + height && ey + m_entity_size > y) {
+                    results.push_back(index);
+                }
+            }
+        }
+    }
+}
+
+void SpatialHash::find_pairs(const float* x, const float* y, std::vector<Pair>& pairs) const {
+    pairs.clear();
+    // Every entity looks at its own cell and half of the neighbouring ones, so each pair is found once
+    const int32_t neighbours[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+    const uint32_t count = size();
+    for (uint32_t a = 0; a < count; a++) {
+        const uint64_t key = m_entity_cell[a];
+        for (uint32_t b = m_slots[slot(key)]; b != none; b = m_next[b]) {
+            if (b > a && m_entity_cell[b] == key && overlap(x[a], y[a], x[b], y[b], m_entity_size)) pairs.push_back({ a, b });
+        }
+
+        int32_t cell_x = (int32_t)(uint32_t)(key & 0xffffffffu);
+        int32_t cell_y = (int32_t)(uint32_t)(key >> 32);
+        for (const auto& offset : neighbours) {
+            uint64_t other = make_key(cell_x + offset[0], cell_y + offset[1]);
+            for (uint32_t b = m_slots[slot(other)]; b != none; b = m_next[b]) {
+                if (m_entity_cell[b] == other && overlap(x[a], y[a], x[b], y[b], m_entity_size)) pairs.push_back({ std::min(a, b), std::max(a, b) });
+            }
+        }
+    }
+}
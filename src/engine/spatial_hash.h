@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Uniform grid hashed into a small table, for proximity queries between
+ * entities.
+ *
+ * Entities are indices into the caller's position arrays, in the order of
+ * the EntityStore, and belong to the cell of their position. Cells hash into
+ * a table of about twice as many slots as there are entities, each slot
+ * heading an intrusive list of the entities of the cells hashed there. The
+ * table does not depend on the map size and nothing allocates unless the
+ * number of entities grows.
+ *
+ * update() is incremental: only entities that crossed into another cell are
+ * relinked, which is a small fraction per tick. Cells sharing a slot are told
+ * apart by the cell stored with every entity.
+ *
+ * Every entity is a square of entity_size pixels at its position. The cell
+ * size has to be at least the entity size, so overlapping entities always
+ * lie in the same or in neighbouring cells.
+ */
+class SpatialHash {
+    public:
+        struct Pair {
+            uint32_t first;
+            uint32_t second;
+        };
+
+        void init(float cell_size, float entity_size);
+        void clear();
+
+        // Entities past count are removed, new ones are added
+        void update(const float* x, const float* y, uint32_t count);
+        // Mirrors EntityStore::destroy(), the last entity takes the place of the removed one
+        void remove(uint32_t index);
+
+        // Replaces results with the entities whose square touches the box, without allocating once results has grown
+        void query(float x, float y, float width, float height, const float* entity_x, const float* entity_y, std::vector<uint32_t>& results) const;
+        // Replaces pairs with every pair of overlapping entities, each pair once with first < second
+        void find_pairs(const float* x, const float* y, std::vector<Pair>& pairs) const;
+
+        uint32_t size() const { return (uint32_t)m_entity_cell.size(); }
+        // Entities that changed their cell in the last update()
+        uint32_t get_moved_count() const { return m_moved_count; }
+
+    private:
+        static constexpr uint32_t none = UINT32_MAX;
+
+        float m_cell_size = 64.0f;
+        float m_entity_size = 16.0f;
+        uint32_t m_moved_count = 0;
+
+        // First entity per slot, the table size is a power of two
+        std::vector<uint32_t> m_slots;
+        uint32_t m_slot_mask = 0;
+        // Per entity, keyed cell_y << 32 | cell_x
+        std::vector<uint64_t> m_entity_cell;
+        std::vector<uint32_t> m_next;
+        std::vector<uint32_t> m_previous;
+
+        uint64_t cell_key(float x, float y) const;
+        uint32_t slot(uint64_t key) const;
+        void link(uint32_t index);
+        void unlink(uint32_t index);
+        void resize_table(uint32_t entity_count);
+};
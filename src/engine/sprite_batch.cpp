@@ -0,0 +1,346 @@
+#include "sprite_batch.h"
+#include "device_tick.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+bool SpriteBatch::init(Device device, GpuMemory& memory, ShaderModule shader_module, TextureFormat color_format, TextureFormat depth_format, uint32_t capacity, uint32_t frames_in_flight) {
+    m_memory = &memory;
+    m_device = device;
+    m_queue = m_device.getQueue();
+    m_color_format = color_format;
+    m_depth_format = depth_format;
+    m_frames_in_flight = std::max(1u, frames_in_flight);
+    m_frame_slot = 0;
+
+    SupportedLimits supported_limits;
+    m_device.getLimits(&supported_limits);
+    m_storage_alignment = supported_limits.limits.minStorageBufferOffsetAlignment;
+    m_uniform_stride = (uint32_t)align_up(sizeof(SpriteUniforms), supported_limits.limits.minUniformBufferOffsetAlignment);
+    // Every frame region has to fit in one binding, and all of them in one buffer addressable by 32 bit dynamic offsets
+    uint64_t max_buffer_size = std::min<uint64_t>(supported_limits.limits.maxBufferSize, UINT32_MAX);
+    uint64_t max_region_size = std::min<uint64_t>(
+        supported_limits.limits.maxStorageBufferBindingSize,
+        max_buffer_size / m_frames_in_flight - m_storage_alignment
+    );
+    m_max_capacity = (uint32_t)std::min<uint64_t>(max_region_size / sizeof(Sprite), UINT32_MAX / 2);
+
+    if (!init_layouts() || !create_render_pipeline(shader_module)) {
+        std::cerr << "Could not create sprite pipeline!" << std::endl;
+        return false;
+    }
+
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = (uint64_t)(m_frames_in_flight - 1) * m_uniform_stride + sizeof(SpriteUniforms);
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+    buffer_descriptor.mappedAtCreation = false;
+    m_uniform_buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Uniform);
+    if (!m_uniform_buffer) return false;
+
+    return create_instance_buffer(std::max(1u, capacity));
+}
+
+void SpriteBatch::terminate() {
+    // The pending callback references the batch, after a timeout its storage is left to it
+    if (!tick_until(m_device, [this]() { return !m_pipeline_pending; })) {
+        std::cerr << "Gave up waiting for the sprite pipeline" << std::endl;
+        m_pipeline_request.release();
+    }
+    m_pipeline_request = nullptr;
+    release_bind_groups();
+    m_bind_groups.clear();
+    m_textures.clear();
+    if (m_instance_buffer) m_memory->destroy(m_instance_buffer);
+    if (m_uniform_buffer) m_memory->destroy(m_uniform_buffer);
+    if (m_render_pipeline) m_render_pipeline.release();
+    if (m_pipeline_layout) m_pipeline_layout.release();
+    if (m_bind_group_layout) m_bind_group_layout.release();
+    if (m_queue) m_queue.release();
+    m_instance_buffer = nullptr;
+    m_uniform_buffer = nullptr;
+    m_render_pipeline = nullptr;
+    m_pipeline_layout = nullptr;
+    m_bind_group_layout = nullptr;
+    m_queue = nullptr;
+    m_capacity = 0;
+}
+
+bool SpriteBatch::set_shader_module(ShaderModule shader_module) {
+    return create_render_pipeline(shader_module);
+}
+
+bool SpriteBatch::init_layouts() {
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(4, Default);
+    BindGroupLayoutEntry& uniform_binding_layout = binding_layout_entries[0];
+    uniform_binding_layout.binding = 0;
+    uniform_binding_layout.visibility = ShaderStage::Vertex;
+    uniform_binding_layout.buffer.type = BufferBindingType::Uniform;
+    uniform_binding_layout.buffer.hasDynamicOffset = true;
+    uniform_binding_layout.buffer.minBindingSize = sizeof(SpriteUniforms);
+
+    BindGroupLayoutEntry& instance_binding_layout = binding_layout_entries[1];
+    instance_binding_layout.binding = 1;
+    instance_binding_layout.visibility = ShaderStage::Vertex;
+    instance_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    instance_binding_layout.buffer.hasDynamicOffset = true;
+    instance_binding_layout.buffer.minBindingSize = sizeof(Sprite);
+
+    BindGroupLayoutEntry& texture_binding_layout = binding_layout_entries[2];
+    texture_binding_layout.binding = 2;
+    texture_binding_layout.visibility = ShaderStage::Fragment;
+    texture_binding_layout.texture.sampleType = TextureSampleType::Uint;
+    texture_binding_layout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+    BindGroupLayoutEntry& palette_binding_layout = binding_layout_entries[3];
+    palette_binding_layout.binding = 3;
+    palette_binding_layout.visibility = ShaderStage::Fragment;
+    palette_binding_layout.texture.sampleType = TextureSampleType::Float;
+    palette_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutDescriptor bind_group_layout_descriptor{};
+    bind_group_layout_descriptor.entryCount = (uint32_t)binding_layout_entries.size();
+    bind_group_layout_descriptor.entries = binding_layout_entries.data();
+    m_bind_group_layout = m_device.createBindGroupLayout(bind_group_layout_descriptor);
+
+    PipelineLayoutDescriptor pipeline_layout_descriptor{};
+    pipeline_layout_descriptor.bindGroupLayoutCount = 1;
+    pipeline_layout_descriptor.bindGroupLayouts = (WGPUBindGroupLayout*)&m_bind_group_layout;
+    m_pipeline_layout = m_device.createPipelineLayout(pipeline_layout_descriptor);
+    return m_bind_group_layout && m_pipeline_layout;
+}
+
+bool SpriteBatch::create_render_pipeline(ShaderModule shader_module) {
+    // Only one request at a time, its callback storage must live until it has been called
+    if (!tick_until(m_device, [this]() { return !m_pipeline_pending; })) {
+        std::cerr << "The previous sprite pipeline is still compiling" << std::endl;
+        return false;
+    }
+
+    // Quads are expanded from the vertex and instance index, no vertex buffers needed
+    RenderPipelineDescriptor pipeline_descriptor;
+    pipeline_descriptor.layout = m_pipeline_layout;
+    pipeline_descriptor.vertex.bufferCount = 0;
+    pipeline_descriptor.vertex.buffers = nullptr;
+    pipeline_descriptor.vertex.module = shader_module;
+    pipeline_descriptor.vertex.entryPoint = "vs_main";
+    pipeline_descriptor.vertex.constantCount = 0;
+    pipeline_descriptor.vertex.constants = nullptr;
+
+    pipeline_descriptor.primitive.topology = PrimitiveTopology::TriangleList;
+    pipeline_descriptor.primitive.stripIndexFormat = IndexFormat::Undefined;
+    pipeline_descriptor.primitive.frontFace = FrontFace::CCW;
+    pipeline_descriptor.primitive.cullMode = CullMode::None;
+
+    FragmentState fragment_state;
+    pipeline_descriptor.fragment = &fragment_state;
+    fragment_state.module = shader_module;
+    fragment_state.entryPoint = "fs_main";
+    fragment_state.constantCount = 0;
+    fragment_state.constants = nullptr;
+
+    BlendState blend_state{};
+    blend_state.color.srcFactor = BlendFactor::SrcAlpha;
+    blend_state.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+    blend_state.color.operation = BlendOperation::Add;
+    blend_state.alpha.srcFactor = BlendFactor::Zero;
+    blend_state.alpha.dstFactor = BlendFactor::One;
+    blend_state.alpha.operation = BlendOperation::Add;
+
+    ColorTargetState color_target;
+    color_target.format = m_color_format;
+    color_target.blend = &blend_state;
+    color_target.writeMask = ColorWriteMask::All;
+
+    fragment_state.targetCount = 1;
+    fragment_state.targets = &color_target;
+
+    DepthStencilState depth_stencil_state = Default;
+    depth_stencil_state.format = m_depth_format;
+    depth_stencil_state.depthWriteEnabled = true;
+    depth_stencil_state.depthCompare = CompareFunction::Less;
+    depth_stencil_state.stencilReadMask = 0;
+    depth_stencil_state.stencilWriteMask = 0;
+    pipeline_descriptor.depthStencil = &depth_stencil_state;
+
+    pipeline_descriptor.multisample.count = 1;
+    pipeline_descriptor.multisample.mask = ~0u;
+    pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
+
+    m_pipeline_pending = true;
+    m_pipeline_request = m_device.createRenderPipelineAsync(pipeline_descriptor, [this](CreatePipelineAsyncStatus status, RenderPipeline pipeline, char const* message) {
+        m_pipeline_pending = false;
+        if (status != CreatePipelineAsyncStatus::Success) {
+            std::cerr << "Could not create sprite pipeline: " << (message ? message : "") << std::endl;
+            return;
+        }
+        if (m_render_pipeline) m_render_pipeline.release();
+        m_render_pipeline = pipeline;
+    });
+    return m_pipeline_request != nullptr;
+}
+
+bool SpriteBatch::create_instance_buffer(uint32_t capacity) {
+    if (m_instance_buffer) m_memory->destroy(m_instance_buffer);
+
+    m_instance_stride = align_up((uint64_t)capacity * sizeof(Sprite), m_storage_alignment);
+
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = (m_frames_in_flight - 1) * m_instance_stride + (uint64_t)capacity * sizeof(Sprite);
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+    buffer_descriptor.mappedAtCreation = false;
+    m_instance_buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Sprite);
+    if (!m_instance_buffer) return false;
+    m_capacity = capacity;
+
+    // Every bind group references the instance buffer, so they have to follow it
+    release_bind_groups();
+    for (size_t i = 0; i < m_textures.size(); i++) {
+        m_bind_groups[i] = create_bind_group(m_textures[i]);
+    }
+    return true;
+}
+
+BindGroup SpriteBatch::create_bind_group(const TextureViews& texture) {
+    std::vector<BindGroupEntry> bindings(4);
+    bindings[0].binding = 0;
+    bindings[0].buffer = m_uniform_buffer;
+    bindings[0].offset = 0;
+    bindings[0].size = sizeof(SpriteUniforms);
+
+    bindings[1].binding = 1;
+    bindings[1].buffer = m_instance_buffer;
+    bindings[1].offset = 0;
+    bindings[1].size = (uint64_t)m_capacity * sizeof(Sprite);
+
+    bindings[2].binding = 2;
+    bindings[2].textureView = texture.indices;
+
+    bindings[3].binding = 3;
+    bindings[3].textureView = texture.palette;
+
+    BindGroupDescriptor bind_group_descriptor;
+    bind_group_descriptor.layout = m_bind_group_layout;
+    bind_group_descriptor.entryCount = (uint32_t)bindings.size();
+    bind_group_descriptor.entries = bindings.data();
+    return m_device.createBindGroup(bind_group_descriptor);
+}
+
+void SpriteBatch::release_bind_groups() {
+    for (BindGroup& bind_group : m_bind_groups) {
+        if (bind_group) bind_group.release();
+        bind_group = nullptr;
+    }
+}
+
+uint32_t SpriteBatch::add_texture(TextureView indices_view, TextureView palette_view) {
+    m_textures.push_back({ indices_view, palette_view });
+    m_bind_groups.push_back(create_bind_group(m_textures.back()));
+    return (uint32_t)m_textures.size() - 1;
+}
+
+void SpriteBatch::set_texture(uint32_t texture, TextureView indices_view, TextureView palette_view) {
+    if (texture >= m_textures.size()) return;
+    m_textures[texture] = { indices_view, palette_view };
+    if (m_bind_groups[texture]) m_bind_groups[texture].release();
+    m_bind_groups[texture] = create_bind_group(m_textures[texture]);
+}
+
+void SpriteBatch::begin(uint32_t frame_slot) {
+    m_frame_slot = frame_slot % m_frames_in_flight;
+    m_sprites.clear();
+    m_sprite_textures.clear();
+}
+
+void SpriteBatch::draw(uint32_t texture, const Sprite& sprite) {
+    m_sprites.push_back(sprite);
+    m_sprite_textures.push_back(texture);
+}
+
+SpriteBatch::Sprite* SpriteBatch::allocate(uint32_t texture, uint32_t count) {
+    size_t first = m_sprites.size();
+    m_sprites.resize(first + count);
+    m_sprite_textures.resize(first + count, texture);
+    return m_sprites.data() + first;
+}
+
+void SpriteBatch::trim(uint32_t count) {
+    size_t size = m_sprites.size() - std::min<size_t>(count, m_sprites.size());
+    m_sprites.resize(size);
+    m_sprite_textures.resize(size);
+}
+
+void SpriteBatch::end(float camera_x, float camera_y, float view_width, float view_height) {
+    SpriteUniforms uniforms = { camera_x, camera_y, view_width, view_height };
+    m_queue.writeBuffer(m_uniform_buffer, (uint64_t)m_frame_slot * m_uniform_stride, &uniforms, sizeof(SpriteUniforms));
+    m_uploaded_bytes = sizeof(SpriteUniforms);
+
+    m_batches.clear();
+    // Sprites beyond what a single storage binding can hold are dropped
+    uint32_t sprite_count = (uint32_t)std::min<size_t>(m_sprites.size(), m_max_capacity);
+    uint32_t texture_count = (uint32_t)m_textures.size();
+    if (sprite_count == 0 || texture_count == 0) return;
+
+    if (sprite_count > m_capacity) {
+        uint32_t capacity = m_capacity;
+        while (capacity < sprite_count) capacity *= 2;
+        capacity = std::min(capacity, m_max_capacity);
+        if (!create_instance_buffer(capacity)) {
+            std::cerr << "Could not grow the sprite instance buffer to " << capacity << " sprites" << std::endl;
+            return;
+        }
+    }
+
+    // Counting sort by texture, linear in the number of sprites and stable,
+    // so sprites of one texture keep their submission order.
+    // The last bucket collects sprites with an unknown texture, they are dropped.
+    m_texture_offsets.assign(texture_count + 1, 0);
+    for (uint32_t i = 0; i < sprite_count; i++) {
+        m_texture_offsets[std::min(m_sprite_textures[i], texture_count)]++;
+    }
+    uint32_t instance_count = 0;
+    for (uint32_t texture = 0; texture < texture_count; texture++) {
+        uint32_t count = m_texture_offsets[texture];
+        if (count > 0) {
+            m_batches.push_back({ texture, instance_count, count });
+        }
+        m_texture_offsets[texture] = instance_count;
+        instance_count += count;
+    }
+
+    if (instance_count == 0) return;
+    // Sprites of a single texture are already in instance order and uploaded as they were drawn
+    const Sprite* instances = m_sprites.data();
+    if (m_batches.size() > 1 || instance_count < sprite_count) {
+        m_instances.resize(instance_count);
+        for (uint32_t i = 0; i < sprite_count; i++) {
+            uint32_t texture = m_sprite_textures[i];
+            if (texture >= texture_count) continue;
+            m_instances[m_texture_offsets[texture]++] = m_sprites[i];
+        }
+        instances = m_instances.data();
+    }
+    m_queue.writeBuffer(m_instance_buffer, m_frame_slot * m_instance_stride, instances, (uint64_t)instance_count * sizeof(Sprite));
+    m_uploaded_bytes += (uint64_t)instance_count * sizeof(Sprite);
+}
+
+void SpriteBatch::render(RenderPassEncoder& render_pass) const {
+    if (m_batches.empty() || !m_render_pipeline) return;
+
+    // In binding order, uniforms then instances
+    uint32_t dynamic_offsets[2] = { m_frame_slot * m_uniform_stride, (uint32_t)(m_frame_slot * m_instance_stride) };
+    render_pass.setPipeline(m_render_pipeline);
+    for (const Batch& batch : m_batches) {
+        render_pass.setBindGroup(0, m_bind_groups[batch.texture], 2, dynamic_offsets);
+        render_pass.draw(6, batch.instance_count, 0, batch.first_instance);
+    }
+}
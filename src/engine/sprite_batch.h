@@ -0,0 +1,134 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Draws large numbers of sprites with one instanced draw call per texture.
+ *
+ * Sprites are collected between begin() and end(), bucketed by texture with a
+ * counting sort and uploaded with a single writeBuffer into an instance storage
+ * buffer that is reused from frame to frame. The vertex shader expands every
+ * instance into a quad, so there is no per-sprite vertex data.
+ *
+ * The uniform and instance buffers hold one region per frame in flight, selected
+ * with dynamic offsets, so a frame never overwrites what the GPU still reads.
+ *
+ * Sprites are depth tested against each other, which keeps the draw order
+ * between textures irrelevant. Fully transparent pixels are discarded so they
+ * never occlude what is behind them.
+ *
+ * Textures are palette indexed like the tilesets, see
+ * TextureLoader::IndexedTexture: sprites read the first array layer of the
+ * indices and the first row of the palette.
+ */
+class SpriteBatch {
+    public:
+        static constexpr uint32_t flip_x = 1;
+        static constexpr uint32_t flip_y = 2;
+
+        // Matches the Sprite struct in resources/shaders/sprite.wgsl
+        struct Sprite {
+            // Top left corner in world pixels
+            float x;
+            float y;
+            float width;
+            float height;
+            // Source rectangle in texture pixels
+            float atlas_x;
+            float atlas_y;
+            float atlas_width;
+            float atlas_height;
+            // 0 is in front, 1 is at the back
+            float depth;
+            uint32_t flags;
+        };
+
+        // The shader module is resources/shaders/sprite.wgsl and, like the texture views, has to outlive the batch
+        bool init(wgpu::Device device, GpuMemory& memory, wgpu::ShaderModule shader_module, wgpu::TextureFormat color_format, wgpu::TextureFormat depth_format, uint32_t capacity = 1024, uint32_t frames_in_flight = 1);
+        void terminate();
+        // The pipeline is compiled asynchronously, the previous one keeps drawing until it is ready
+        bool set_shader_module(wgpu::ShaderModule shader_module);
+        bool is_pipeline_pending() const { return m_pipeline_pending; }
+        bool has_pipeline() const { return m_render_pipeline != nullptr; }
+
+        // Takes a 2D array view of R8Uint indices and a view of the palette, returns the texture id used by draw()
+        uint32_t add_texture(wgpu::TextureView indices_view, wgpu::TextureView palette_view);
+        void set_texture(uint32_t texture, wgpu::TextureView indices_view, wgpu::TextureView palette_view);
+
+        // The frame slot selects the buffer regions written by end() and read by render()
+        void begin(uint32_t frame_slot = 0);
+        void draw(uint32_t texture, const Sprite& sprite);
+        // Appends count sprites to be written in place, valid until the next draw, allocate() or end()
+        Sprite* allocate(uint32_t texture, uint32_t count);
+        // Drops the last count sprites again, for allocations that turned out too large
+        void trim(uint32_t count);
+        void end(float camera_x, float camera_y, float view_width, float view_height);
+        void render(wgpu::RenderPassEncoder& render_pass) const;
+
+        uint32_t get_sprite_count() const { return (uint32_t)m_sprites.size(); }
+        uint32_t get_batch_count() const { return (uint32_t)m_batches.size(); }
+        uint32_t get_capacity() const { return m_capacity; }
+        // Written by the last end()
+        uint64_t get_uploaded_bytes() const { return m_uploaded_bytes; }
+
+    private:
+        // Matches the SpriteUniforms struct in resources/shaders/sprite.wgsl
+        struct SpriteUniforms {
+            float camera_x;
+            float camera_y;
+            float view_width;
+            float view_height;
+        };
+
+        struct TextureViews {
+            wgpu::TextureView indices;
+            wgpu::TextureView palette;
+        };
+
+        struct Batch {
+            uint32_t texture;
+            uint32_t first_instance;
+            uint32_t instance_count;
+        };
+
+        wgpu::Device m_device = nullptr;
+        GpuMemory* m_memory = nullptr;
+        wgpu::Queue m_queue = nullptr;
+        wgpu::TextureFormat m_color_format = wgpu::TextureFormat::Undefined;
+        wgpu::TextureFormat m_depth_format = wgpu::TextureFormat::Undefined;
+        wgpu::BindGroupLayout m_bind_group_layout = nullptr;
+        wgpu::PipelineLayout m_pipeline_layout = nullptr;
+        wgpu::RenderPipeline m_render_pipeline = nullptr;
+        std::unique_ptr<wgpu::CreateRenderPipelineAsyncCallback> m_pipeline_request;
+        bool m_pipeline_pending = false;
+        wgpu::Buffer m_uniform_buffer = nullptr;
+        wgpu::Buffer m_instance_buffer = nullptr;
+        uint32_t m_capacity = 0;
+        uint32_t m_max_capacity = 0;
+        uint32_t m_frames_in_flight = 1;
+        uint32_t m_frame_slot = 0;
+        uint32_t m_uniform_stride = 0;
+        uint64_t m_instance_stride = 0;
+        uint32_t m_storage_alignment = 0;
+        uint64_t m_uploaded_bytes = 0;
+
+        std::vector<TextureViews> m_textures;
+        std::vector<wgpu::BindGroup> m_bind_groups;
+
+        // Submission order, sorted into m_instances by end()
+        std::vector<Sprite> m_sprites;
+        std::vector<uint32_t> m_sprite_textures;
+        std::vector<Sprite> m_instances;
+        std::vector<uint32_t> m_texture_offsets;
+        std::vector<Batch> m_batches;
+
+        bool init_layouts();
+        bool create_render_pipeline(wgpu::ShaderModule shader_module);
+        bool create_instance_buffer(uint32_t capacity);
+        wgpu::BindGroup create_bind_group(const TextureViews& texture);
+        void release_bind_groups();
+};
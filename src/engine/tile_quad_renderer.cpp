@@ -0,0 +1,475 @@
+#include "tile_quad_renderer.h"
+#include "device_tick.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+using namespace wgpu;
+
+namespace {
+
+// Chunks out of view are evicted once the cache grows past this
+const size_t max_cached_chunks = 1024;
+// Enough for a few layers of a full screen of chunks, grown on demand
+const uint32_t initial_slot_count = 64;
+const uint32_t chunk_tiles = TilemapStreamer::chunk_size * TilemapStreamer::chunk_size;
+
+uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+uint64_t chunk_key(uint32_t layer, uint32_t chunk_x, uint32_t chunk_y) {
+    return ((uint64_t)layer << 32) | (chunk_y << 16) | chunk_x;
+}
+
+}
+
+bool TileQuadRenderer::init(Device device, GpuMemory& memory, ShaderModule shader_module, TextureFormat color_format, TextureFormat depth_format,
+    uint32_t frames_in_flight, bool use_bundles, bool threaded_bundles) {
+    m_memory = &memory;
+    m_device = device;
+    m_queue = m_device.getQueue();
+    m_color_format = color_format;
+    m_depth_format = depth_format;
+    m_frames_in_flight = std::max(1u, frames_in_flight);
+    m_frame_slot = 0;
+    m_uniform_offsets.assign(m_frames_in_flight, 0);
+    m_use_bundles = use_bundles;
+    m_chunk_data.resize(chunk_tiles);
+
+    SupportedLimits supported_limits;
+    m_device.getLimits(&supported_limits);
+    m_slot_stride = align_up(chunk_tiles * sizeof(TileInstance), supported_limits.limits.minStorageBufferOffsetAlignment);
+    // Dynamic offsets are 32 bit
+    uint64_t max_buffer_size = std::min<uint64_t>(supported_limits.limits.maxBufferSize, UINT32_MAX);
+    m_max_slot_count = (uint32_t)(max_buffer_size / m_slot_stride);
+
+    if (!init_layouts() || !create_render_pipeline(shader_module)) {
+        std::cerr << "Could not create tile quad pipeline!" << std::endl;
+        return false;
+    }
+    if (!m_bundles.init(m_device, m_color_format, m_depth_format, std::clamp(std::thread::hardware_concurrency(), 1u, 4u), threaded_bundles)) {
+        std::cerr << "Could not create the tile quad bundles!" << std::endl;
+        return false;
+    }
+    return create_slot_buffers(std::min(initial_slot_count, m_max_slot_count));
+}
+
+void TileQuadRenderer::terminate() {
+    // The pending callback references the renderer, after a timeout its storage is left to it
+    if (!tick_until(m_device, [this]() { return !m_pipeline_pending; })) {
+        std::cerr << "Gave up waiting for the tile quad pipeline" << std::endl;
+        m_pipeline_request.release();
+    }
+    m_pipeline_request = nullptr;
+    clear_chunks();
+    m_bundles.terminate();
+    if (m_bind_group) m_bind_group.release();
+    if (m_instance_buffer) m_memory->destroy(m_instance_buffer);
+    if (m_argument_buffer) m_memory->destroy(m_argument_buffer);
+    if (m_render_pipeline) m_render_pipeline.release();
+    if (m_pipeline_layout) m_pipeline_layout.release();
+    if (m_bind_group_layout) m_bind_group_layout.release();
+    if (m_queue) m_queue.release();
+    m_bind_group = nullptr;
+    m_instance_buffer = nullptr;
+    m_argument_buffer = nullptr;
+    m_render_pipeline = nullptr;
+    m_pipeline_layout = nullptr;
+    m_bind_group_layout = nullptr;
+    m_queue = nullptr;
+    m_slot_count = 0;
+    m_free_slots.clear();
+    m_streamer = nullptr;
+    m_tilesets = nullptr;
+    m_instances.clear();
+}
+
+bool TileQuadRenderer::set_shader_module(ShaderModule shader_module) {
+    return create_render_pipeline(shader_module);
+}
+
+bool TileQuadRenderer::init_layouts() {
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(7, Default);
+    BindGroupLayoutEntry& uniform_binding_layout = binding_layout_entries[0];
+    uniform_binding_layout.binding = 0;
+    uniform_binding_layout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
+    uniform_binding_layout.buffer.type = BufferBindingType::Uniform;
+    uniform_binding_layout.buffer.hasDynamicOffset = true;
+
+    BindGroupLayoutEntry& instance_binding_layout = binding_layout_entries[1];
+    instance_binding_layout.binding = 1;
+    instance_binding_layout.visibility = ShaderStage::Vertex;
+    instance_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    instance_binding_layout.buffer.hasDynamicOffset = true;
+    instance_binding_layout.buffer.minBindingSize = sizeof(TileInstance);
+
+    BindGroupLayoutEntry& layer_binding_layout = binding_layout_entries[2];
+    layer_binding_layout.binding = 2;
+    layer_binding_layout.visibility = ShaderStage::Vertex;
+    layer_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    layer_binding_layout.buffer.minBindingSize = sizeof(TilemapStreamer::LayerData);
+
+    BindGroupLayoutEntry& animation_binding_layout = binding_layout_entries[3];
+    animation_binding_layout.binding = 3;
+    animation_binding_layout.visibility = ShaderStage::Vertex;
+    animation_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    animation_binding_layout.buffer.minBindingSize = sizeof(TilemapStreamer::AnimationEntry);
+
+    BindGroupLayoutEntry& tileset_binding_layout = binding_layout_entries[4];
+    tileset_binding_layout.binding = 4;
+    tileset_binding_layout.visibility = ShaderStage::Fragment;
+    tileset_binding_layout.texture.sampleType = TextureSampleType::Uint;
+    tileset_binding_layout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+    BindGroupLayoutEntry& palette_binding_layout = binding_layout_entries[5];
+    palette_binding_layout.binding = 5;
+    palette_binding_layout.visibility = ShaderStage::Fragment;
+    palette_binding_layout.texture.sampleType = TextureSampleType::Float;
+    palette_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutEntry& remap_binding_layout = binding_layout_entries[6];
+    remap_binding_layout.binding = 6;
+    remap_binding_layout.visibility = ShaderStage::Vertex;
+    remap_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    remap_binding_layout.buffer.minBindingSize = sizeof(uint32_t);
+
+    BindGroupLayoutDescriptor bind_group_layout_descriptor{};
+    bind_group_layout_descriptor.entryCount = (uint32_t)binding_layout_entries.size();
+    bind_group_layout_descriptor.entries = binding_layout_entries.data();
+    m_bind_group_layout = m_device.createBindGroupLayout(bind_group_layout_descriptor);
+
+    PipelineLayoutDescriptor pipeline_layout_descriptor{};
+    pipeline_layout_descriptor.bindGroupLayoutCount = 1;
+    pipeline_layout_descriptor.bindGroupLayouts = (WGPUBindGroupLayout*)&m_bind_group_layout;
+    m_pipeline_layout = m_device.createPipelineLayout(pipeline_layout_descriptor);
+    return m_bind_group_layout && m_pipeline_layout;
+}
+
+bool TileQuadRenderer::create_render_pipeline(ShaderModule shader_module) {
+    // Only one request at a time, its callback storage must live until it has been called
+    if (!tick_until(m_device, [this]() { return !m_pipeline_pending; })) {
+        std::cerr << "The previous tile quad pipeline is still compiling" << std::endl;
+        return false;
+    }
+
+    // Quads are expanded from the vertex and instance index, no vertex buffers needed
+    RenderPipelineDescriptor pipeline_descriptor;
+    pipeline_descriptor.layout = m_pipeline_layout;
+    pipeline_descriptor.vertex.bufferCount = 0;
+    pipeline_descriptor.vertex.buffers = nullptr;
+    pipeline_descriptor.vertex.module = shader_module;
+    pipeline_descriptor.vertex.entryPoint = "vs_main";
+    pipeline_descriptor.vertex.constantCount = 0;
+    pipeline_descriptor.vertex.constants = nullptr;
+
+    pipeline_descriptor.primitive.topology = PrimitiveTopology::TriangleList;
+    pipeline_descriptor.primitive.stripIndexFormat = IndexFormat::Undefined;
+    pipeline_descriptor.primitive.frontFace = FrontFace::CCW;
+    pipeline_descriptor.primitive.cullMode = CullMode::None;
+
+    FragmentState fragment_state;
+    pipeline_descriptor.fragment = &fragment_state;
+    fragment_state.module = shader_module;
+    fragment_state.entryPoint = "fs_main";
+    fragment_state.constantCount = 0;
+    fragment_state.constants = nullptr;
+
+    BlendState blend_state{};
+    blend_state.color.srcFactor = BlendFactor::SrcAlpha;
+    blend_state.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+    blend_state.color.operation = BlendOperation::Add;
+    blend_state.alpha.srcFactor = BlendFactor::Zero;
+    blend_state.alpha.dstFactor = BlendFactor::One;
+    blend_state.alpha.operation = BlendOperation::Add;
+
+    ColorTargetState color_target;
+    color_target.format = m_color_format;
+    color_target.blend = &blend_state;
+    color_target.writeMask = ColorWriteMask::All;
+
+    fragment_state.targetCount = 1;
+    fragment_state.targets = &color_target;
+
+    // Like the full screen path, tiles share the render pass with the sprites but never touch depth
+    DepthStencilState depth_stencil_state = Default;
+    depth_stencil_state.format = m_depth_format;
+    depth_stencil_state.depthWriteEnabled = false;
+    depth_stencil_state.depthCompare = CompareFunction::Always;
+    depth_stencil_state.stencilReadMask = 0;
+    depth_stencil_state.stencilWriteMask = 0;
+    pipeline_descriptor.depthStencil = &depth_stencil_state;
+
+    pipeline_descriptor.multisample.count = 1;
+    pipeline_descriptor.multisample.mask = ~0u;
+    pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
+
+    m_pipeline_pending = true;
+    m_pipeline_request = m_device.createRenderPipelineAsync(pipeline_descriptor, [this](CreatePipelineAsyncStatus status, RenderPipeline pipeline, char const* message) {
+        m_pipeline_pending = false;
+        if (status != CreatePipelineAsyncStatus::Success) {
+            std::cerr << "Could not create tile quad pipeline: " << (message ? message : "") << std::endl;
+            return;
+        }
+        if (m_render_pipeline) m_render_pipeline.release();
+        m_render_pipeline = pipeline;
+    });
+    return m_pipeline_request != nullptr;
+}
+
+bool TileQuadRenderer::create_slot_buffers(uint32_t slot_count) {
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = slot_count * m_slot_stride;
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::CopySrc | BufferUsage::Storage;
+    buffer_descriptor.mappedAtCreation = false;
+    Buffer instance_buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Tilemap);
+    buffer_descriptor.size = slot_count * sizeof(DrawArguments);
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::CopySrc | BufferUsage::Indirect;
+    Buffer argument_buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Tilemap);
+    if (!instance_buffer || !argument_buffer) {
+        if (instance_buffer) m_memory->destroy(instance_buffer);
+        if (argument_buffer) m_memory->destroy(argument_buffer);
+        return false;
+    }
+
+    // Copied on the GPU, the chunks in the slots are not decoded again
+    if (m_slot_count > 0) {
+        CommandEncoderDescriptor encoder_descriptor;
+        encoder_descriptor.label = "Tile slot copy";
+        CommandEncoder encoder = m_device.createCommandEncoder(encoder_descriptor);
+        encoder.copyBufferToBuffer(m_instance_buffer, 0, instance_buffer, 0, m_slot_count * m_slot_stride);
+        encoder.copyBufferToBuffer(m_argument_buffer, 0, argument_buffer, 0, m_slot_count * sizeof(DrawArguments));
+        CommandBufferDescriptor command_buffer_descriptor;
+        command_buffer_descriptor.label = "Tile slot copy";
+        CommandBuffer command = encoder.finish(command_buffer_descriptor);
+        m_queue.submit(1, &command);
+        command.release();
+        encoder.release();
+        m_memory->destroy(m_instance_buffer);
+        m_memory->destroy(m_argument_buffer);
+    }
+    m_instance_buffer = instance_buffer;
+    m_argument_buffer = argument_buffer;
+    // Lowest slots first
+    for (uint32_t slot = slot_count; slot-- > m_slot_count;) m_free_slots.push_back(slot);
+    m_slot_count = slot_count;
+
+    // The bind group references the instance buffer, so it has to follow it
+    return m_streamer == nullptr || create_bind_group();
+}
+
+bool TileQuadRenderer::create_bind_group() {
+    if (m_bind_group) m_bind_group.release();
+    m_bind_group = nullptr;
+
+    std::vector<BindGroupEntry> bindings(7);
+    bindings[0].binding = 0;
+    bindings[0].buffer = m_uniform_buffer;
+    bindings[0].offset = 0;
+    bindings[0].size = m_uniform_size;
+
+    bindings[1].binding = 1;
+    bindings[1].buffer = m_instance_buffer;
+    bindings[1].offset = 0;
+    bindings[1].size = chunk_tiles * sizeof(TileInstance);
+
+    bindings[2].binding = 2;
+    bindings[2].buffer = m_streamer->get_layer_buffer();
+    bindings[2].offset = 0;
+    bindings[2].size = std::max<uint64_t>(m_streamer->get_layer_buffer_size(), sizeof(TilemapStreamer::LayerData));
+
+    bindings[3].binding = 3;
+    bindings[3].buffer = m_streamer->get_animation_buffer();
+    bindings[3].offset = 0;
+    bindings[3].size = m_streamer->get_animation_buffer_size();
+
+    bindings[4].binding = 4;
+    bindings[4].textureView = m_tilesets->get_indices_view();
+
+    bindings[5].binding = 5;
+    bindings[5].textureView = m_tilesets->get_palette_view();
+
+    bindings[6].binding = 6;
+    bindings[6].buffer = m_tilesets->get_remap_buffer();
+    bindings[6].offset = 0;
+    bindings[6].size = m_tilesets->get_remap_buffer_size();
+
+    BindGroupDescriptor bind_group_descriptor;
+    bind_group_descriptor.layout = m_bind_group_layout;
+    bind_group_descriptor.entryCount = (uint32_t)bindings.size();
+    bind_group_descriptor.entries = bindings.data();
+    m_bind_group = m_device.createBindGroup(bind_group_descriptor);
+    return m_bind_group != nullptr;
+}
+
+bool TileQuadRenderer::set_tilemap(const TilemapStreamer& streamer, const TilesetArray& tilesets, Buffer uniform_buffer, uint64_t uniform_size) {
+    m_streamer = &streamer;
+    m_tilesets = &tilesets;
+    m_uniform_buffer = uniform_buffer;
+    m_uniform_size = uniform_size;
+    clear_chunks();
+    return create_bind_group();
+}
+
+bool TileQuadRenderer::set_uniform_buffer(Buffer uniform_buffer, uint64_t uniform_size) {
+    m_uniform_buffer = uniform_buffer;
+    m_uniform_size = uniform_size;
+    return m_streamer == nullptr || create_bind_group();
+}
+
+void TileQuadRenderer::invalidate_tile(uint32_t map_layer, uint32_t x, uint32_t y) {
+    if (!m_streamer) return;
+    const std::vector<TilemapStreamer::LayerData>& layers = m_streamer->get_layer_data();
+    for (uint32_t layer = 0; layer < layers.size(); layer++) {
+        if (layers[layer].map_layer != map_layer) continue;
+        auto cached = m_chunks.find(chunk_key(layer, x / TilemapStreamer::chunk_size, y / TilemapStreamer::chunk_size));
+        if (cached != m_chunks.end()) cached->second.dirty = true;
+    }
+}
+
+void TileQuadRenderer::release_chunk(CachedChunk& chunk) {
+    for (RenderBundleCache::BundleId bundle : chunk.bundles) m_bundles.remove(bundle);
+    m_free_slots.push_back(chunk.slot);
+}
+
+void TileQuadRenderer::clear_chunks() {
+    for (auto& [key, chunk] : m_chunks) release_chunk(chunk);
+    m_chunks.clear();
+    m_visible.clear();
+    m_visible_bundles.clear();
+}
+
+TileQuadRenderer::CachedChunk* TileQuadRenderer::get_chunk(uint32_t layer, uint32_t chunk_x, uint32_t chunk_y) {
+    auto [cached, is_new] = m_chunks.try_emplace(chunk_key(layer, chunk_x, chunk_y));
+    CachedChunk& chunk = cached->second;
+    if (is_new) {
+        uint32_t slot_count = std::min(m_slot_count * 2, m_max_slot_count);
+        if (m_free_slots.empty() && (slot_count == m_slot_count || !create_slot_buffers(slot_count))) {
+            std::cerr << "Could not grow the tile instance buffer to " << slot_count << " chunks" << std::endl;
+            m_chunks.erase(cached);
+            return nullptr;
+        }
+        chunk.slot = m_free_slots.back();
+        m_free_slots.pop_back();
+        chunk.bundles.assign(m_frames_in_flight, RenderBundleCache::no_bundle);
+    }
+    chunk.last_used = m_frame_number;
+    if (chunk.dirty) upload_chunk(chunk, layer, chunk_x, chunk_y);
+    return &chunk;
+}
+
+void TileQuadRenderer::upload_chunk(CachedChunk& chunk, uint32_t layer, uint32_t chunk_x, uint32_t chunk_y) {
+    chunk.dirty = false;
+    m_instances.clear();
+    // Only the non-empty tiles are kept
+    const uint32_t chunk_size = TilemapStreamer::chunk_size;
+    if (m_streamer->decode_chunk(chunk_x, chunk_y, m_streamer->get_layer_data()[layer].map_layer, m_chunk_data.data())) {
+        for (uint32_t i = 0; i < chunk_tiles; i++) {
+            uint32_t gid = m_chunk_data[i];
+            if (gid == 0) continue;
+            uint32_t x = chunk_x * chunk_size + i % chunk_size;
+            uint32_t y = chunk_y * chunk_size + i / chunk_size;
+            m_instances.push_back({ (y << 16) | x, (std::min(layer, 255u) << 24) | (gid & 0xffffff) });
+        }
+    }
+    chunk.instance_count = (uint32_t)m_instances.size();
+
+    // Queue writes land between submits, frames already submitted still draw the previous tiles
+    DrawArguments arguments = { 6, chunk.instance_count, 0, 0 };
+    if (!m_instances.empty()) {
+        m_queue.writeBuffer(m_instance_buffer, chunk.slot * m_slot_stride, m_instances.data(), m_instances.size() * sizeof(TileInstance));
+    }
+    m_queue.writeBuffer(m_argument_buffer, chunk.slot * sizeof(DrawArguments), &arguments, sizeof(DrawArguments));
+    m_uploaded_bytes += m_instances.size() * sizeof(TileInstance) + sizeof(DrawArguments);
+}
+
+void TileQuadRenderer::update(uint32_t frame_slot, float camera_x, float camera_y, float view_width, float view_height) {
+    m_frame_slot = frame_slot % m_frames_in_flight;
+    m_frame_number++;
+    m_visible.clear();
+    m_uploaded_bytes = 0;
+    m_instance_count = 0;
+    if (!m_streamer) return;
+
+    const CompiledTilemap& tilemap = m_streamer->get_tilemap();
+    const std::vector<TilemapStreamer::LayerData>& layers = m_streamer->get_layer_data();
+    const float chunk_pixels = (float)(TilemapStreamer::chunk_size * TilemapStreamer::tile_size);
+    // Bottom to top, the draws then blend the layers in order
+    for (uint32_t layer = 0; layer < layers.size(); layer++) {
+        float layer_camera_x = camera_x * layers[layer].parallax_x;
+        float layer_camera_y = camera_y * layers[layer].parallax_y;
+        int32_t first_x = std::max(0, (int32_t)std::floor(layer_camera_x / chunk_pixels));
+        int32_t first_y = std::max(0, (int32_t)std::floor(layer_camera_y / chunk_pixels));
+        int32_t last_x = std::min((int32_t)tilemap.chunks_x() - 1, (int32_t)std::floor((layer_camera_x + view_width - 1.0f) / chunk_pixels));
+        int32_t last_y = std::min((int32_t)tilemap.chunks_y() - 1, (int32_t)std::floor((layer_camera_y + view_height - 1.0f) / chunk_pixels));
+        for (int32_t chunk_y = first_y; chunk_y <= last_y; chunk_y++) {
+            for (int32_t chunk_x = first_x; chunk_x <= last_x; chunk_x++) {
+                CachedChunk* chunk = get_chunk(layer, chunk_x, chunk_y);
+                if (!chunk || chunk->instance_count == 0) continue;
+                m_visible.push_back(chunk);
+                m_instance_count += chunk->instance_count;
+            }
+        }
+    }
+
+    // Chunks in view were used this frame, the pointers to them stay valid
+    if (m_chunks.size() > max_cached_chunks) {
+        for (auto it = m_chunks.begin(); it != m_chunks.end();) {
+            if (it->second.last_used == m_frame_number) {
+                ++it;
+                continue;
+            }
+            release_chunk(it->second);
+            it = m_chunks.erase(it);
+        }
+    }
+}
+
+void TileQuadRenderer::update_bundles(uint32_t uniform_offset) {
+    m_uniform_offsets[m_frame_slot] = uniform_offset;
+    m_visible_bundles.clear();
+    if (!m_use_bundles) return;
+
+    uint64_t pipeline_key = m_render_pipeline ? RenderBundleCache::handle_key(m_render_pipeline) : 0;
+    uint64_t bind_group_key = m_bind_group ? RenderBundleCache::handle_key(m_bind_group) : 0;
+    uint64_t argument_key = RenderBundleCache::handle_key(m_argument_buffer);
+    for (CachedChunk* chunk : m_visible) {
+        RenderBundleCache::BundleId& bundle = chunk->bundles[m_frame_slot];
+        if (bundle == RenderBundleCache::no_bundle) {
+            uint32_t slot = chunk->slot;
+            uint32_t frame_slot = m_frame_slot;
+            bundle = m_bundles.add("tile quad chunk", [this, slot, frame_slot](RenderBundleEncoder& render_bundle) {
+                if (!m_render_pipeline || !m_bind_group) return;
+                render_bundle.setPipeline(m_render_pipeline);
+                draw_chunk(render_bundle, slot, m_uniform_offsets[frame_slot]);
+            });
+        }
+        m_bundles.set_inputs(bundle, { pipeline_key, bind_group_key, argument_key, uniform_offset });
+        m_visible_bundles.push_back(bundle);
+    }
+    // The first frame over new chunks records many bundles at once, on several threads when the device allows it
+    m_bundles.update();
+}
+
+template<typename Encoder>
+void TileQuadRenderer::draw_chunk(Encoder& encoder, uint32_t slot, uint32_t uniform_offset) const {
+    // In binding order, uniforms then instances
+    uint32_t dynamic_offsets[2] = { uniform_offset, (uint32_t)(slot * m_slot_stride) };
+    encoder.setBindGroup(0, m_bind_group, 2, dynamic_offsets);
+    encoder.drawIndirect(m_argument_buffer, slot * sizeof(DrawArguments));
+}
+
+void TileQuadRenderer::render(RenderPassEncoder& render_pass) {
+    if (m_visible.empty() || !m_render_pipeline || !m_bind_group) return;
+
+    if (m_use_bundles) {
+        m_bundles.execute(render_pass, m_visible_bundles);
+        return;
+    }
+    render_pass.setPipeline(m_render_pipeline);
+    for (const CachedChunk* chunk : m_visible) {
+        draw_chunk(render_pass, chunk->slot, m_uniform_offsets[m_frame_slot]);
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+#include "render_bundle_cache.h"
+#include "tilemap_streamer.h"
+#include "tileset_array.h"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Draws the tilemap as one instanced quad per non-empty tile.
+ *
+ * The alternative to the full screen tilemap shader: empty tiles cost
+ * nothing, but every drawn tile costs a quad and overlapping layers are
+ * blended pixel by pixel. Sparse layers are cheaper this way, dense maps
+ * with many layers usually are not.
+ *
+ * The non-empty tiles of a chunk are collected into a compact instance list
+ * the first time the chunk comes into view and written to the chunk's own
+ * fixed slot of the instance buffer, next to its indirect draw arguments. A
+ * chunk is drawn by one drawIndirect from a render bundle of its own, so the
+ * bundle only depends on the slot and the bound resources: an edit rewrites
+ * the slot and the arguments and the bundle is replayed as it is. Chunks are
+ * drawn in layer order, which keeps the layers blending in order.
+ */
+class TileQuadRenderer {
+    public:
+        // Matches the TileInstance struct in resources/shaders/tile_quads.wgsl
+        struct TileInstance {
+            // Tile coordinates, y << 16 | x
+            uint32_t position;
+            // Visible layer << 24 | gid
+            uint32_t tile;
+        };
+
+        // The shader module is resources/shaders/tile_quads.wgsl. Without bundles every chunk is encoded into the pass each frame.
+        bool init(wgpu::Device device, GpuMemory& memory, wgpu::ShaderModule shader_module, wgpu::TextureFormat color_format, wgpu::TextureFormat depth_format,
+            uint32_t frames_in_flight = 1, bool use_bundles = true, bool threaded_bundles = false);
+        void terminate();
+        // The pipeline is compiled asynchronously, the previous one keeps drawing until it is ready
+        bool set_shader_module(wgpu::ShaderModule shader_module);
+        bool is_pipeline_pending() const { return m_pipeline_pending; }
+        bool has_pipeline() const { return m_render_pipeline != nullptr; }
+
+        // Has to be called again whenever the tilemap or one of the resources changes, which drops all cached chunks
+        bool set_tilemap(const TilemapStreamer& streamer, const TilesetArray& tilesets, wgpu::Buffer uniform_buffer, uint64_t uniform_size);
+        // When the uniform buffer alone is replaced, the cached chunks stay and only their bundles are recorded again
+        bool set_uniform_buffer(wgpu::Buffer uniform_buffer, uint64_t uniform_size);
+        // Rebuilds the instances of the chunk containing the tile the next time it is drawn, see TilemapStreamer::set_tile
+        void invalidate_tile(uint32_t map_layer, uint32_t x, uint32_t y);
+
+        // Finds the chunks in view and uploads the ones that are new or edited
+        void update(uint32_t frame_slot, float camera_x, float camera_y, float view_width, float view_height);
+        // Re-records the bundles of the chunks in view that bind something new, the uniform offset selects the frame's copy of the engine uniforms
+        void update_bundles(uint32_t uniform_offset);
+        void render(wgpu::RenderPassEncoder& render_pass);
+
+        uint32_t get_instance_count() const { return m_instance_count; }
+        // One per non-empty chunk in view
+        uint32_t get_draw_count() const { return (uint32_t)m_visible.size(); }
+        uint64_t get_uploaded_bytes() const { return m_uploaded_bytes; }
+        const RenderBundleCache::Stats& get_bundle_stats() const { return m_bundles.get_stats(); }
+
+    private:
+        // Matches the arguments of drawIndirect
+        struct DrawArguments {
+            uint32_t vertex_count;
+            uint32_t instance_count;
+            uint32_t first_vertex;
+            uint32_t first_instance;
+        };
+
+        struct CachedChunk {
+            uint32_t slot = 0;
+            uint32_t instance_count = 0;
+            bool dirty = true;
+            uint64_t last_used = 0;
+            // One per frame slot, recorded the first time the chunk is drawn from it
+            std::vector<RenderBundleCache::BundleId> bundles;
+        };
+
+        wgpu::Device m_device = nullptr;
+        GpuMemory* m_memory = nullptr;
+        wgpu::Queue m_queue = nullptr;
+        wgpu::TextureFormat m_color_format = wgpu::TextureFormat::Undefined;
+        wgpu::TextureFormat m_depth_format = wgpu::TextureFormat::Undefined;
+        wgpu::BindGroupLayout m_bind_group_layout = nullptr;
+        wgpu::PipelineLayout m_pipeline_layout = nullptr;
+        wgpu::RenderPipeline m_render_pipeline = nullptr;
+        std::unique_ptr<wgpu::CreateRenderPipelineAsyncCallback> m_pipeline_request;
+        bool m_pipeline_pending = false;
+        wgpu::Buffer m_instance_buffer = nullptr;
+        wgpu::Buffer m_argument_buffer = nullptr;
+        wgpu::BindGroup m_bind_group = nullptr;
+        // Every chunk owns one slot of the instance and argument buffers until it is evicted
+        uint32_t m_slot_count = 0;
+        uint32_t m_max_slot_count = 0;
+        uint64_t m_slot_stride = 0;
+        std::vector<uint32_t> m_free_slots;
+        uint32_t m_frames_in_flight = 1;
+        uint32_t m_frame_slot = 0;
+        std::vector<uint32_t> m_uniform_offsets;
+        bool m_use_bundles = true;
+        RenderBundleCache m_bundles;
+        uint64_t m_uploaded_bytes = 0;
+        uint32_t m_instance_count = 0;
+
+        // Kept to recreate the bind group when the instance buffer grows
+        const TilemapStreamer* m_streamer = nullptr;
+        const TilesetArray* m_tilesets = nullptr;
+        wgpu::Buffer m_uniform_buffer = nullptr;
+        uint64_t m_uniform_size = 0;
+
+        // Keyed by visible layer and packed chunk
+        std::unordered_map<uint64_t, CachedChunk> m_chunks;
+        std::vector<uint32_t> m_chunk_data;
+        std::vector<TileInstance> m_instances;
+        // In layer order, valid until the next update()
+        std::vector<CachedChunk*> m_visible;
+        std::vector<RenderBundleCache::BundleId> m_visible_bundles;
+        uint64_t m_frame_number = 0;
+
+        bool init_layouts();
+        bool create_render_pipeline(wgpu::ShaderModule shader_module);
+        // Keeps the contents of the slots in use
+        bool create_slot_buffers(uint32_t slot_count);
+        bool create_bind_group();
+        CachedChunk* get_chunk(uint32_t layer, uint32_t chunk_x, uint32_t chunk_y);
+        void upload_chunk(CachedChunk& chunk, uint32_t layer, uint32_t chunk_x, uint32_t chunk_y);
+        void release_chunk(CachedChunk& chunk);
+        void clear_chunks();
+        template<typename Encoder>
+        void draw_chunk(Encoder& encoder, uint32_t slot, uint32_t uniform_offset) const;
+};
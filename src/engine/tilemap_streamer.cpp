@@ -0,0 +1,464 @@
+#include "tilemap_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+uint32_t pack_chunk(uint32_t chunk_x, uint32_t chunk_y) {
+    return ((chunk_y << 16) | chunk_x) + 1;
+}
+
+int32_t floor_div(float value, float divisor) {
+    return (int32_t)std::floor(value / divisor);
+}
+
+uint64_t edit_key(uint32_t map_layer, uint32_t chunk_x, uint32_t chunk_y) {
+    return ((uint64_t)map_layer << 32) | pack_chunk(chunk_x, chunk_y);
+}
+
+}
+
+bool TilemapStreamer::init(Device device, GpuMemory& memory, std::shared_ptr<const CompiledTilemap> tilemap, uint32_t pool_chunks_x, uint32_t pool_chunks_y) {
+    m_memory = &memory;
+    m_device = device;
+    m_queue = m_device.getQueue();
+    m_tilemap = std::move(tilemap);
+    if (!m_tilemap || !m_tilemap->is_open()) return false;
+    m_chunk_data.resize(chunk_size * chunk_size);
+    m_first_layer_data.resize(chunk_size * chunk_size);
+
+    m_layer_data.clear();
+    for (uint32_t layer = 0; layer < m_tilemap->number_of_layers(); layer++) {
+        const CompiledTilemap::LayerInfo& info = m_tilemap->layer_info(layer);
+        if (!info.visible || info.opacity <= 0.0f) continue;
+        m_layer_data.push_back({ info.opacity, info.parallax_x, info.parallax_y, layer });
+    }
+
+    // Storage bindings cannot be empty, so a map without visible layers still gets one entry
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = std::max<uint64_t>(get_layer_buffer_size(), sizeof(LayerData));
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+    buffer_descriptor.mappedAtCreation = false;
+    m_layer_buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Tilemap);
+    if (!m_layer_buffer) return false;
+    if (!m_layer_data.empty()) {
+        m_queue.writeBuffer(m_layer_buffer, 0, m_layer_data.data(), get_layer_buffer_size());
+    }
+    if (!create_animation_buffer()) return false;
+
+    return resize_pool(pool_chunks_x, pool_chunks_y);
+}
+
+bool TilemapStreamer::create_animation_buffer() {
+    uint32_t animation_count = m_tilemap->animation_count();
+    const CompiledTilemap::Animation* animations = m_tilemap->animations();
+    const CompiledTilemap::AnimationFrame* frames = m_tilemap->animation_frames();
+
+    // Only gids up to the largest animated one need an entry, larger gids are never looked up
+    uint32_t gid_count = 1;
+    uint32_t frame_count = 0;
+    for (uint32_t i = 0; i < animation_count; i++) {
+        gid_count = std::max(gid_count, animations[i].gid + 1);
+        frame_count += animations[i].frame_count;
+    }
+    std::vector<AnimationEntry> table(gid_count + frame_count, AnimationEntry{ 0, 0 });
+    uint32_t next_frame = gid_count;
+    for (uint32_t i = 0; i < animation_count; i++) {
+        const CompiledTilemap::Animation& animation = animations[i];
+        table[animation.gid] = { next_frame + 1, animation.duration_ms };
+        uint32_t end_ms = 0;
+        for (uint32_t frame = 0; frame < animation.frame_count; frame++) {
+            const CompiledTilemap::AnimationFrame& source = frames[animation.first_frame + frame];
+            end_ms += source.duration_ms;
+            table[next_frame++] = { source.gid, end_ms };
+        }
+    }
+
+    m_animated_gid_count = gid_count;
+    m_animation_buffer_size = table.size() * sizeof(AnimationEntry);
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = m_animation_buffer_size;
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+    buffer_descriptor.mappedAtCreation = false;
+    m_animation_buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Tilemap);
+    if (!m_animation_buffer) return false;
+    m_queue.writeBuffer(m_animation_buffer, 0, table.data(), m_animation_buffer_size);
+    return true;
+}
+
+void TilemapStreamer::terminate() {
+    release_pool_textures();
+    if (m_layer_buffer) m_memory->destroy(m_layer_buffer);
+    if (m_animation_buffer) m_memory->destroy(m_animation_buffer);
+    m_animation_buffer_size = 0;
+    m_animated_gid_count = 0;
+    if (m_queue) m_queue.release();
+    m_queue = nullptr;
+    m_tilemap.reset();
+    m_layer_data.clear();
+    m_edited_chunks.clear();
+    m_dirty_rects.clear();
+}
+
+uint32_t TilemapStreamer::pool_chunks_for_view(uint32_t view_pixels) {
+    uint32_t chunk_pixels = chunk_size * tile_size;
+    // A view can straddle one more chunk than it covers, plus one chunk of prefetch margin
+    return (view_pixels + chunk_pixels - 1) / chunk_pixels + 2;
+}
+
+uint32_t TilemapStreamer::pool_layers() const {
+    return std::max(1u, get_number_of_visible_layers());
+}
+
+bool TilemapStreamer::covers_lower_layers(uint32_t layer) const {
+    // Only layers on the camera grid can hide the tiles beneath them completely
+    const LayerData& data = m_layer_data[layer];
+    return data.opacity >= 1.0f && data.parallax_x == 1.0f && data.parallax_y == 1.0f;
+}
+
+void TilemapStreamer::set_opaque_tiles(std::vector<bool>&& opaque_tiles) {
+    m_opaque_tiles = std::move(opaque_tiles);
+    // An animated tile only covers what is beneath it when every one of its frames does
+    const CompiledTilemap::Animation* animations = m_tilemap->animations();
+    const CompiledTilemap::AnimationFrame* frames = m_tilemap->animation_frames();
+    for (uint32_t i = 0; i < m_tilemap->animation_count(); i++) {
+        const CompiledTilemap::Animation& animation = animations[i];
+        if (animation.gid == 0 || animation.gid > m_opaque_tiles.size()) continue;
+        bool is_opaque = true;
+        for (uint32_t frame = 0; frame < animation.frame_count; frame++) {
+            uint32_t gid = frames[animation.first_frame + frame].gid;
+            is_opaque = is_opaque && gid > 0 && gid <= m_opaque_tiles.size() && m_opaque_tiles[gid - 1];
+        }
+        m_opaque_tiles[animation.gid - 1] = is_opaque;
+    }
+    // Drop the first layer maps computed with the previous tileset
+    if (!m_residency.empty()) {
+        uint32_t slots = m_pool_chunks_x * m_pool_chunks_y;
+        std::fill(m_residency.begin() + pool_layers() * slots, m_residency.end(), 0);
+        m_residency_dirty = true;
+    }
+}
+
+bool TilemapStreamer::resize_pool(uint32_t pool_chunks_x, uint32_t pool_chunks_y) {
+    // There is no point in a pool larger than the map itself
+    pool_chunks_x = std::max(1u, std::min(pool_chunks_x, m_tilemap->chunks_x()));
+    pool_chunks_y = std::max(1u, std::min(pool_chunks_y, m_tilemap->chunks_y()));
+    if (m_tilemap_texture && pool_chunks_x == m_pool_chunks_x && pool_chunks_y == m_pool_chunks_y) {
+        return true;
+    }
+
+    release_pool_textures();
+    m_pool_chunks_x = pool_chunks_x;
+    m_pool_chunks_y = pool_chunks_y;
+    // The last residency layer tracks the first layer map
+    m_residency.assign(m_pool_chunks_x * m_pool_chunks_y * (pool_layers() + 1), 0);
+    m_residency_dirty = true;
+    m_stats = {};
+    return create_pool_textures();
+}
+
+bool TilemapStreamer::create_pool_textures() {
+    TextureDescriptor texture_descriptor;
+    texture_descriptor.dimension = TextureDimension::_2D;
+    texture_descriptor.format = TextureFormat::R32Uint;
+    texture_descriptor.mipLevelCount = 1;
+    texture_descriptor.sampleCount = 1;
+    texture_descriptor.size = { m_pool_chunks_x * chunk_size, m_pool_chunks_y * chunk_size, pool_layers() };
+    texture_descriptor.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+    texture_descriptor.viewFormatCount = 0;
+    texture_descriptor.viewFormats = nullptr;
+    m_tilemap_texture = m_memory->create_texture(m_device, texture_descriptor, GpuMemory::Category::Tilemap);
+    if (!m_tilemap_texture) return false;
+
+    texture_descriptor.size = { m_pool_chunks_x, m_pool_chunks_y, pool_layers() + 1 };
+    m_residency_texture = m_memory->create_texture(m_device, texture_descriptor, GpuMemory::Category::Tilemap);
+    if (!m_residency_texture) return false;
+
+    texture_descriptor.format = TextureFormat::R8Uint;
+    texture_descriptor.size = { m_pool_chunks_x * chunk_size, m_pool_chunks_y * chunk_size, 1 };
+    m_first_layer_texture = m_memory->create_texture(m_device, texture_descriptor, GpuMemory::Category::Tilemap);
+    if (!m_first_layer_texture) return false;
+
+    TextureViewDescriptor view_descriptor;
+    view_descriptor.aspect = TextureAspect::All;
+    view_descriptor.baseArrayLayer = 0;
+    view_descriptor.arrayLayerCount = pool_layers();
+    view_descriptor.baseMipLevel = 0;
+    view_descriptor.mipLevelCount = 1;
+    view_descriptor.dimension = TextureViewDimension::_2DArray;
+    view_descriptor.format = TextureFormat::R32Uint;
+    m_tilemap_texture_view = m_tilemap_texture.createView(view_descriptor);
+    view_descriptor.arrayLayerCount = pool_layers() + 1;
+    m_residency_texture_view = m_residency_texture.createView(view_descriptor);
+
+    view_descriptor.arrayLayerCount = 1;
+    view_descriptor.dimension = TextureViewDimension::_2D;
+    view_descriptor.format = TextureFormat::R8Uint;
+    m_first_layer_texture_view = m_first_layer_texture.createView(view_descriptor);
+
+    return m_tilemap_texture_view && m_residency_texture_view && m_first_layer_texture_view;
+}
+
+void TilemapStreamer::release_pool_textures() {
+    if (m_tilemap_texture_view) m_tilemap_texture_view.release();
+    if (m_tilemap_texture) m_memory->destroy(m_tilemap_texture);
+    if (m_residency_texture_view) m_residency_texture_view.release();
+    if (m_residency_texture) m_memory->destroy(m_residency_texture);
+    if (m_first_layer_texture_view) m_first_layer_texture_view.release();
+    if (m_first_layer_texture) m_memory->destroy(m_first_layer_texture);
+    m_tilemap_texture_view = nullptr;
+    m_tilemap_texture = nullptr;
+    m_residency_texture_view = nullptr;
+    m_residency_texture = nullptr;
+    m_first_layer_texture_view = nullptr;
+    m_first_layer_texture = nullptr;
+}
+
+bool TilemapStreamer::set_tile(uint32_t layer, uint32_t x, uint32_t y, uint32_t gid) {
+    if (layer >= m_tilemap->number_of_layers() || x >= m_tilemap->width() || y >= m_tilemap->height()) return false;
+
+    uint32_t chunk_x = x / chunk_size;
+    uint32_t chunk_y = y / chunk_size;
+    uint64_t key = edit_key(layer, chunk_x, chunk_y);
+    std::vector<uint32_t>& tiles = m_edited_chunks[key];
+    if (tiles.empty()) {
+        tiles.resize(chunk_size * chunk_size);
+        m_tilemap->decode_chunk(chunk_x, chunk_y, layer, tiles.data());
+    }
+    uint32_t local_x = x % chunk_size;
+    uint32_t local_y = y % chunk_size;
+    uint32_t& tile = tiles[local_y * chunk_size + local_x];
+    if (tile == gid) return true;
+    tile = gid;
+
+    auto [dirty, is_new] = m_dirty_rects.try_emplace(key, DirtyRect{ local_x, local_y, local_x, local_y });
+    if (!is_new) {
+        DirtyRect& rect = dirty->second;
+        rect.min_x = std::min(rect.min_x, local_x);
+        rect.min_y = std::min(rect.min_y, local_y);
+        rect.max_x = std::max(rect.max_x, local_x);
+        rect.max_y = std::max(rect.max_y, local_y);
+    }
+    return true;
+}
+
+uint32_t TilemapStreamer::get_tile(uint32_t layer, uint32_t x, uint32_t y) const {
+    if (layer >= m_tilemap->number_of_layers() || x >= m_tilemap->width() || y >= m_tilemap->height()) return 0;
+
+    auto edited = m_edited_chunks.find(edit_key(layer, x / chunk_size, y / chunk_size));
+    if (edited != m_edited_chunks.end()) {
+        return edited->second[(y % chunk_size) * chunk_size + x % chunk_size];
+    }
+    return m_tilemap->get_tile(x, y, layer);
+}
+
+bool TilemapStreamer::decode_chunk(uint32_t chunk_x, uint32_t chunk_y, uint32_t map_layer, uint32_t* destination) const {
+    auto edited = m_edited_chunks.find(edit_key(map_layer, chunk_x, chunk_y));
+    if (edited != m_edited_chunks.end()) {
+        std::copy(edited->second.begin(), edited->second.end(), destination);
+        return true;
+    }
+    return m_tilemap->decode_chunk(chunk_x, chunk_y, map_layer, destination);
+}
+
+void TilemapStreamer::upload_edits() {
+    const uint32_t slots = m_pool_chunks_x * m_pool_chunks_y;
+    for (const auto& [key, rect] : m_dirty_rects) {
+        uint32_t map_layer = (uint32_t)(key >> 32);
+        uint32_t packed_chunk = (uint32_t)key;
+        uint32_t chunk_x = (packed_chunk - 1) & 0xffff;
+        uint32_t chunk_y = (packed_chunk - 1) >> 16;
+        uint32_t slot = (chunk_y % m_pool_chunks_y) * m_pool_chunks_x + (chunk_x % m_pool_chunks_x);
+
+        for (uint32_t layer = 0; layer < get_number_of_visible_layers(); layer++) {
+            // Chunks that are not resident pick the edit up when they are streamed in
+            if (m_layer_data[layer].map_layer != map_layer || m_residency[layer * slots + slot] != packed_chunk) continue;
+
+            const std::vector<uint32_t>& tiles = m_edited_chunks[key];
+            uint32_t width = rect.max_x - rect.min_x + 1;
+            uint32_t height = rect.max_y - rect.min_y + 1;
+            ImageCopyTexture destination;
+            destination.texture = m_tilemap_texture;
+            destination.mipLevel = 0;
+            destination.origin = { (chunk_x % m_pool_chunks_x) * chunk_size + rect.min_x, (chunk_y % m_pool_chunks_y) * chunk_size + rect.min_y, layer };
+            // Rows are read straight out of the chunk copy, so the row pitch stays a whole chunk row
+            TextureDataLayout source;
+            source.offset = 0;
+            source.bytesPerRow = 4 * chunk_size;
+            source.rowsPerImage = height;
+            size_t size = ((height - 1) * chunk_size + width) * sizeof(uint32_t);
+            m_queue.writeTexture(destination, tiles.data() + rect.min_y * chunk_size + rect.min_x, size, source, { width, height, 1 });
+            m_stats.uploaded_bytes += (uint64_t)width * height * sizeof(uint32_t);
+            m_stats.uploaded_rects++;
+
+            // The first layer map of the chunk is rebuilt by the regular streaming below
+            if (covers_lower_layers(layer) && m_residency[pool_layers() * slots + slot] == packed_chunk) {
+                m_residency[pool_layers() * slots + slot] = 0;
+                m_residency_dirty = true;
+            }
+        }
+    }
+    m_dirty_rects.clear();
+}
+
+void TilemapStreamer::update(float camera_x, float camera_y, float view_width, float view_height) {
+    m_stats.uploaded_chunks = 0;
+    m_stats.uploaded_rects = 0;
+    m_stats.uploaded_bytes = 0;
+    upload_edits();
+
+    struct Candidate {
+        uint32_t layer;
+        uint32_t chunk_x;
+        uint32_t chunk_y;
+        int32_t distance;
+    };
+    std::vector<Candidate> missing;
+    uint32_t resident = 0;
+
+    const float chunk_pixels = (float)(chunk_size * tile_size);
+    const uint32_t slots = m_pool_chunks_x * m_pool_chunks_y;
+
+    // Center the pool window on the visible chunks, the remaining slots are used for prefetching
+    auto window_start = [](int32_t first, int32_t last, int32_t pool_chunks, int32_t map_chunks) {
+        int32_t spare = std::max(0, pool_chunks - (last - first + 1));
+        int32_t start = first - spare / 2;
+        return std::max(0, std::min(start, map_chunks - pool_chunks));
+    };
+
+    auto collect_missing = [&](uint32_t layer, float parallax_x, float parallax_y) {
+        float layer_camera_x = camera_x * parallax_x;
+        float layer_camera_y = camera_y * parallax_y;
+        int32_t first_x = floor_div(layer_camera_x, chunk_pixels);
+        int32_t first_y = floor_div(layer_camera_y, chunk_pixels);
+        int32_t last_x = floor_div(layer_camera_x + view_width - 1.0f, chunk_pixels);
+        int32_t last_y = floor_div(layer_camera_y + view_height - 1.0f, chunk_pixels);
+
+        int32_t start_x = window_start(first_x, last_x, (int32_t)m_pool_chunks_x, (int32_t)m_tilemap->chunks_x());
+        int32_t start_y = window_start(first_y, last_y, (int32_t)m_pool_chunks_y, (int32_t)m_tilemap->chunks_y());
+        int32_t center_x = (first_x + last_x) / 2;
+        int32_t center_y = (first_y + last_y) / 2;
+
+        for (uint32_t y = start_y; y < start_y + m_pool_chunks_y; y++) {
+            for (uint32_t x = start_x; x < start_x + m_pool_chunks_x; x++) {
+                uint32_t slot = (y % m_pool_chunks_y) * m_pool_chunks_x + (x % m_pool_chunks_x);
+                if (m_residency[layer * slots + slot] == pack_chunk(x, y)) {
+                    resident++;
+                    continue;
+                }
+                int32_t distance = std::abs((int32_t)x - center_x) + std::abs((int32_t)y - center_y);
+                missing.push_back({ layer, x, y, distance });
+            }
+        }
+    };
+
+    for (uint32_t layer = 0; layer < get_number_of_visible_layers(); layer++) {
+        collect_missing(layer, m_layer_data[layer].parallax_x, m_layer_data[layer].parallax_y);
+    }
+    // The first layer map is stored after the layers and follows the camera grid
+    const uint32_t first_layer_map = pool_layers();
+    bool any_covering_layer = false;
+    for (uint32_t layer = 0; layer < get_number_of_visible_layers(); layer++) {
+        any_covering_layer = any_covering_layer || covers_lower_layers(layer);
+    }
+    if (!m_opaque_tiles.empty() && any_covering_layer) {
+        collect_missing(first_layer_map, 1.0f, 1.0f);
+    }
+
+    uint32_t upload_count = std::min((uint32_t)missing.size(), m_max_uploads_per_frame);
+    std::partial_sort(missing.begin(), missing.begin() + upload_count, missing.end(),
+        [](const Candidate& a, const Candidate& b) { return a.distance < b.distance; });
+    for (uint32_t i = 0; i < upload_count; i++) {
+        if (missing[i].layer == first_layer_map) {
+            upload_first_layer_map(missing[i].chunk_x, missing[i].chunk_y);
+        }
+        else {
+            upload_chunk(missing[i].layer, missing[i].chunk_x, missing[i].chunk_y);
+        }
+    }
+    m_stats.resident_chunks = resident + upload_count;
+
+    if (m_residency_dirty) {
+        ImageCopyTexture destination;
+        destination.texture = m_residency_texture;
+        destination.mipLevel = 0;
+        destination.origin = { 0, 0, 0 };
+        TextureDataLayout source;
+        source.offset = 0;
+        source.bytesPerRow = 4 * m_pool_chunks_x;
+        source.rowsPerImage = m_pool_chunks_y;
+        size_t size = m_residency.size() * sizeof(uint32_t);
+        m_queue.writeTexture(destination, m_residency.data(), size, source, { m_pool_chunks_x, m_pool_chunks_y, pool_layers() + 1 });
+        m_stats.uploaded_bytes += size;
+        m_residency_dirty = false;
+    }
+}
+
+void TilemapStreamer::upload_chunk(uint32_t layer, uint32_t chunk_x, uint32_t chunk_y) {
+    // The runs are expanded straight from the mapped file into the upload buffer
+    if (!decode_chunk(chunk_x, chunk_y, m_layer_data[layer].map_layer, m_chunk_data.data())) {
+        std::cerr << "Corrupt tilemap chunk " << chunk_x << ", " << chunk_y << std::endl;
+    }
+
+    ImageCopyTexture destination;
+    destination.texture = m_tilemap_texture;
+    destination.mipLevel = 0;
+    destination.origin = { (chunk_x % m_pool_chunks_x) * chunk_size, (chunk_y % m_pool_chunks_y) * chunk_size, layer };
+    TextureDataLayout source;
+    source.offset = 0;
+    source.bytesPerRow = 4 * chunk_size;
+    source.rowsPerImage = chunk_size;
+    size_t size = m_chunk_data.size() * sizeof(uint32_t);
+    m_queue.writeTexture(destination, m_chunk_data.data(), size, source, { chunk_size, chunk_size, 1 });
+    m_stats.uploaded_bytes += size;
+
+    uint32_t slot = (chunk_y % m_pool_chunks_y) * m_pool_chunks_x + (chunk_x % m_pool_chunks_x);
+    m_residency[layer * m_pool_chunks_x * m_pool_chunks_y + slot] = pack_chunk(chunk_x, chunk_y);
+    m_residency_dirty = true;
+    m_stats.uploaded_chunks++;
+}
+
+void TilemapStreamer::upload_first_layer_map(uint32_t chunk_x, uint32_t chunk_y) {
+    const uint8_t unresolved = 0xff;
+    const uint32_t tile_count = chunk_size * chunk_size;
+    std::fill(m_first_layer_data.begin(), m_first_layer_data.end(), unresolved);
+
+    // Walk down from the top layer, a tile is resolved by the first opaque tile found
+    uint32_t resolved = 0;
+    for (uint32_t layer = get_number_of_visible_layers(); layer-- > 0 && resolved < tile_count;) {
+        if (!covers_lower_layers(layer)) continue;
+        decode_chunk(chunk_x, chunk_y, m_layer_data[layer].map_layer, m_chunk_data.data());
+        for (uint32_t i = 0; i < tile_count; i++) {
+            uint32_t gid = m_chunk_data[i];
+            if (m_first_layer_data[i] != unresolved || gid == 0 || gid > m_opaque_tiles.size()) continue;
+            if (m_opaque_tiles[gid - 1]) {
+                m_first_layer_data[i] = (uint8_t)std::min(layer, 254u);
+                resolved++;
+            }
+        }
+    }
+    for (uint8_t& first_layer : m_first_layer_data) {
+        if (first_layer == unresolved) first_layer = 0;
+    }
+
+    ImageCopyTexture destination;
+    destination.texture = m_first_layer_texture;
+    destination.mipLevel = 0;
+    destination.origin = { (chunk_x % m_pool_chunks_x) * chunk_size, (chunk_y % m_pool_chunks_y) * chunk_size, 0 };
+    TextureDataLayout source;
+    source.offset = 0;
+    source.bytesPerRow = chunk_size;
+    source.rowsPerImage = chunk_size;
+    m_queue.writeTexture(destination, m_first_layer_data.data(), m_first_layer_data.size(), source, { chunk_size, chunk_size, 1 });
+    m_stats.uploaded_bytes += m_first_layer_data.size();
+
+    uint32_t slots = m_pool_chunks_x * m_pool_chunks_y;
+    uint32_t slot = (chunk_y % m_pool_chunks_y) * m_pool_chunks_x + (chunk_x % m_pool_chunks_x);
+    m_residency[pool_layers() * slots + slot] = pack_chunk(chunk_x, chunk_y);
+    m_residency_dirty = true;
+    m_stats.uploaded_chunks++;
+}
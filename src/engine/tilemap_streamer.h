@@ -0,0 +1,147 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+#include "../files/compiled_tilemap.h"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Keeps the chunks around the camera resident in a fixed size GPU chunk pool.
+ *
+ * The pool is addressed toroidally: chunk (x, y) always lives in slot
+ * (x % pool_chunks_x, y % pool_chunks_y), so the shader can find a tile
+ * without an indirection table. A small residency texture stores which chunk
+ * currently occupies each slot so that slots still waiting for their upload
+ * are not drawn with stale data.
+ *
+ * Every visible map layer gets its own array layer in the pool and follows
+ * the camera with its own parallax factor. Hidden layers are never uploaded.
+ *
+ * Alongside the layers, each chunk gets a first layer map holding, per tile,
+ * the topmost visible layer whose tile is fully opaque. The shader starts its
+ * layer loop there since everything beneath is covered anyway.
+ *
+ * Animated tiles are resolved in the shader through a small animation table
+ * written once by init(), so the pool never changes while tiles animate.
+ *
+ * Tiles edited at runtime go into a CPU copy of their chunk, which replaces
+ * the compiled chunk from then on. The edits of a frame are merged into one
+ * dirty rectangle per chunk and layer, and only those rectangles of resident
+ * chunks are uploaded by the next update().
+ */
+class TilemapStreamer {
+    public:
+        // Both have to match the constants in resources/shaders/shader.wgsl
+        static constexpr uint32_t chunk_size = CompiledTilemap::chunk_size;
+        static constexpr uint32_t tile_size = 16;
+
+        // Matches the Layer struct in resources/shaders/shader.wgsl
+        struct LayerData {
+            float opacity;
+            float parallax_x;
+            float parallax_y;
+            uint32_t map_layer;
+        };
+
+        // Matches the layout of uAnimations in resources/shaders/shader.wgsl. The table starts with one
+        // entry per gid, frame is the index of the first frame + 1 or 0 for static tiles and time is the
+        // length of the animation. The frames follow, with the gid drawn and the time the frame ends.
+        struct AnimationEntry {
+            uint32_t frame;
+            uint32_t time_ms;
+        };
+
+        struct Stats {
+            uint32_t resident_chunks = 0;
+            uint32_t uploaded_chunks = 0;
+            uint32_t uploaded_rects = 0;
+            uint64_t uploaded_bytes = 0;
+        };
+
+        // The tilemap is shared with the asset registry, the streamer only reads from it
+        bool init(wgpu::Device device, GpuMemory& memory, std::shared_ptr<const CompiledTilemap> tilemap, uint32_t pool_chunks_x, uint32_t pool_chunks_y);
+        void terminate();
+
+        // Uploads at most max_uploads_per_frame missing chunks, closest to the view first.
+        void update(float camera_x, float camera_y, float view_width, float view_height);
+        bool resize_pool(uint32_t pool_chunks_x, uint32_t pool_chunks_y);
+
+        // Layers are map layers, hidden ones included. Returns false outside of the map.
+        bool set_tile(uint32_t layer, uint32_t x, uint32_t y, uint32_t gid);
+        uint32_t get_tile(uint32_t layer, uint32_t x, uint32_t y) const;
+        // Like CompiledTilemap::decode_chunk, with the runtime edits applied
+        bool decode_chunk(uint32_t chunk_x, uint32_t chunk_y, uint32_t map_layer, uint32_t* destination) const;
+
+        void set_max_uploads_per_frame(uint32_t max_uploads) { m_max_uploads_per_frame = max_uploads; }
+        // Indexed by gid - 1, see TextureLoader::find_opaque_tiles
+        void set_opaque_tiles(std::vector<bool>&& opaque_tiles);
+
+        static uint32_t pool_chunks_for_view(uint32_t view_pixels);
+
+        const CompiledTilemap& get_tilemap() const { return *m_tilemap; }
+        wgpu::TextureView get_tilemap_view() const { return m_tilemap_texture_view; }
+        wgpu::TextureView get_residency_view() const { return m_residency_texture_view; }
+        wgpu::TextureView get_first_layer_view() const { return m_first_layer_texture_view; }
+        wgpu::Buffer get_layer_buffer() const { return m_layer_buffer; }
+        uint64_t get_layer_buffer_size() const { return m_layer_data.size() * sizeof(LayerData); }
+        wgpu::Buffer get_animation_buffer() const { return m_animation_buffer; }
+        uint64_t get_animation_buffer_size() const { return m_animation_buffer_size; }
+        // Gids below this have an entry in the animation table
+        uint32_t get_animated_gid_count() const { return m_animated_gid_count; }
+        uint32_t get_number_of_visible_layers() const { return (uint32_t)m_layer_data.size(); }
+        const std::vector<LayerData>& get_layer_data() const { return m_layer_data; }
+        uint32_t get_pool_chunks_x() const { return m_pool_chunks_x; }
+        uint32_t get_pool_chunks_y() const { return m_pool_chunks_y; }
+        const Stats& get_stats() const { return m_stats; }
+
+    private:
+        wgpu::Device m_device = nullptr;
+        GpuMemory* m_memory = nullptr;
+        wgpu::Queue m_queue = nullptr;
+        wgpu::Texture m_tilemap_texture = nullptr;
+        wgpu::TextureView m_tilemap_texture_view = nullptr;
+        wgpu::Texture m_residency_texture = nullptr;
+        wgpu::TextureView m_residency_texture_view = nullptr;
+        wgpu::Texture m_first_layer_texture = nullptr;
+        wgpu::TextureView m_first_layer_texture_view = nullptr;
+        wgpu::Buffer m_layer_buffer = nullptr;
+        wgpu::Buffer m_animation_buffer = nullptr;
+        uint64_t m_animation_buffer_size = 0;
+        uint32_t m_animated_gid_count = 0;
+
+        std::shared_ptr<const CompiledTilemap> m_tilemap;
+        uint32_t m_pool_chunks_x = 0;
+        uint32_t m_pool_chunks_y = 0;
+        uint32_t m_max_uploads_per_frame = 8;
+        std::vector<LayerData> m_layer_data;
+
+        // Packed (chunk_y << 16 | chunk_x) + 1 per layer and slot, 0 marks an empty slot.
+        std::vector<uint32_t> m_residency;
+        bool m_residency_dirty = false;
+        std::vector<uint32_t> m_chunk_data;
+        std::vector<uint8_t> m_first_layer_data;
+        std::vector<bool> m_opaque_tiles;
+        Stats m_stats = {};
+
+        // Keyed by map layer and packed chunk
+        struct DirtyRect {
+            uint32_t min_x;
+            uint32_t min_y;
+            uint32_t max_x;
+            uint32_t max_y;
+        };
+        std::unordered_map<uint64_t, std::vector<uint32_t>> m_edited_chunks;
+        std::unordered_map<uint64_t, DirtyRect> m_dirty_rects;
+
+        bool create_animation_buffer();
+        bool create_pool_textures();
+        void release_pool_textures();
+        uint32_t pool_layers() const;
+        bool covers_lower_layers(uint32_t layer) const;
+        void upload_chunk(uint32_t layer, uint32_t chunk_x, uint32_t chunk_y);
+        void upload_edits();
+        void upload_first_layer_map(uint32_t chunk_x, uint32_t chunk_y);
+};
@@ -0,0 +1,134 @@
+#include "tileset_array.h"
+#include "tilemap_streamer.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+bool TilesetArray::init(Device device, GpuMemory& memory, AssetRegistry& assets, const CompiledTilemap& tilemap, const path& tilemap_name, const path& default_tileset) {
+    m_memory = &memory;
+    terminate();
+    if (!load_map_tilesets(assets, tilemap, tilemap_name)) {
+        if (tilemap.tileset_count() > 0) {
+            std::cerr << "Drawing the map with " << default_tileset << " instead of its own tilesets" << std::endl;
+        }
+        if (!load_default_tileset(assets, default_tileset)) return false;
+    }
+    return create_remap_buffer(device);
+}
+
+void TilesetArray::terminate() {
+    if (m_remap_buffer) m_memory->destroy(m_remap_buffer);
+    m_remap_buffer_size = 0;
+    m_texture = nullptr;
+    m_tilesets.clear();
+}
+
+bool TilesetArray::load_map_tilesets(AssetRegistry& assets, const CompiledTilemap& tilemap, const path& tilemap_name) {
+    const uint32_t tile_size = TilemapStreamer::tile_size;
+    const uint32_t tileset_count = tilemap.tileset_count();
+    if (tileset_count == 0) return false;
+    // The array layer has 8 bits in the remap table
+    if (tileset_count > 256) {
+        std::cerr << "The map uses " << tileset_count << " tilesets, at most 256 fit into the tileset array" << std::endl;
+        return false;
+    }
+
+    std::vector<Tileset> tilesets;
+    std::vector<path> images;
+    for (uint32_t i = 0; i < tileset_count; i++) {
+        const CompiledTilemap::Tileset& tileset = tilemap.tilesets()[i];
+        path image = (tilemap_name.parent_path() / tilemap.tileset_image(i)).lexically_normal();
+        if (tileset.tile_width != tile_size || tileset.tile_height != tile_size) {
+            std::cerr << "Tileset " << image << " has " << tileset.tile_width << "x" << tileset.tile_height
+                << " tiles, only " << tile_size << "x" << tile_size << " are supported" << std::endl;
+            return false;
+        }
+        tilesets.push_back({ tileset.first_gid, tileset.tile_count, tileset.columns, image });
+        images.push_back(image);
+    }
+
+    m_texture = assets.load_indexed_texture_array(images);
+    if (!m_texture) return false;
+
+    // Tiles past the image of the tileset would be drawn from the padding or another row
+    for (uint32_t i = 0; i < tilesets.size(); i++) {
+        const Tileset& tileset = tilesets[i];
+        const TextureLoader::IndexedTexture::ImageSize& size = m_texture->texture.image_sizes[i];
+        uint64_t image_tiles = (uint64_t)(size.width / tile_size) * (size.height / tile_size);
+        if (tileset.columns > size.width / tile_size || tileset.tile_count > image_tiles) {
+            std::cerr << "Tileset " << tileset.image << " has " << tileset.tile_count << " tiles in " << tileset.columns
+                << " columns, more than its " << size.width << "x" << size.height << " image holds" << std::endl;
+            m_texture = nullptr;
+            return false;
+        }
+    }
+    m_tilesets = std::move(tilesets);
+    return true;
+}
+
+bool TilesetArray::load_default_tileset(AssetRegistry& assets, const path& default_tileset) {
+    m_texture = assets.load_indexed_texture_array({ default_tileset });
+    if (!m_texture) return false;
+    uint32_t columns = m_texture->texture.indices.getWidth() / TilemapStreamer::tile_size;
+    uint32_t rows = m_texture->texture.indices.getHeight() / TilemapStreamer::tile_size;
+    m_tilesets = { { 1, columns * rows, std::max(1u, columns), default_tileset } };
+    return true;
+}
+
+bool TilesetArray::create_remap_buffer(Device device) {
+    uint64_t gid_count = 1;
+    for (const Tileset& tileset : m_tilesets) {
+        gid_count = std::max(gid_count, (uint64_t)tileset.first_gid + tileset.tile_count);
+    }
+    // CompiledTilemap::validate keeps map tilesets below it, the default tileset is bounded by the texture size
+    if (gid_count > CompiledTilemap::max_gid) {
+        std::cerr << "The tilesets end at gid " << gid_count << ", the remap table holds " << CompiledTilemap::max_gid << std::endl;
+        return false;
+    }
+
+    // Tilesets are ordered by first gid, so a gid ends up in the last tileset starting at or before it, like in Tiled
+    std::vector<uint32_t> table(gid_count, empty_tile);
+    for (uint32_t layer = 0; layer < m_tilesets.size(); layer++) {
+        const Tileset& tileset = m_tilesets[layer];
+        for (uint32_t tile = 0; tile < tileset.tile_count; tile++) {
+            table[tileset.first_gid + tile] = pack_tile(layer, tile % tileset.columns, tile / tileset.columns);
+        }
+    }
+
+    m_remap_buffer_size = table.size() * sizeof(uint32_t);
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = m_remap_buffer_size;
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+    buffer_descriptor.mappedAtCreation = false;
+    m_remap_buffer = m_memory->create_buffer(device, buffer_descriptor, GpuMemory::Category::Tilemap);
+    if (!m_remap_buffer) return false;
+    Queue queue = device.getQueue();
+    queue.writeBuffer(m_remap_buffer, 0, table.data(), m_remap_buffer_size);
+    queue.release();
+    return true;
+}
+
+std::vector<bool> TilesetArray::find_opaque_tiles(const AssetRegistry& assets) const {
+    const uint32_t tile_size = TilemapStreamer::tile_size;
+    std::vector<bool> opaque_tiles;
+    for (const Tileset& tileset : m_tilesets) {
+        // Without margin and spacing the image has as many columns as the tileset, so tile ids index the result directly
+        std::vector<bool> tiles = TextureLoader::find_opaque_tiles(assets.resolve(tileset.image), tile_size, tile_size);
+        uint32_t tile_count = std::min<uint32_t>(tileset.tile_count, (uint32_t)tiles.size());
+        if (opaque_tiles.size() < tileset.first_gid - 1 + tileset.tile_count) {
+            opaque_tiles.resize(tileset.first_gid - 1 + tileset.tile_count, false);
+        }
+        for (uint32_t tile = 0; tile < tile_count; tile++) {
+            opaque_tiles[tileset.first_gid - 1 + tile] = tiles[tile];
+        }
+    }
+    return opaque_tiles;
+}
+
+bool TilesetArray::uses_image(const path& name) const {
+    return std::any_of(m_tilesets.begin(), m_tilesets.end(), [&](const Tileset& tileset) {
+        return tileset.image == name;
+    });
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+#include "asset_registry.h"
+
+#include <filesystem>
+#include <vector>
+
+/**
+ * Every tileset of the map in one palette indexed texture array, so maps
+ * using several tilesets still draw in a single pass with one bind group.
+ *
+ * Each tileset image is one array layer, all of them share a palette. A remap
+ * table with one entry per gid tells the tilemap shaders the array layer,
+ * column and row of the tile, so tileset boundaries and column counts never
+ * reach the shaders. Gids past the table or between tilesets are empty.
+ *
+ * Maps without tilesets, such as generated ones, and maps whose tilesets
+ * cannot be used fall back to a single default tileset starting at gid 1.
+ */
+class TilesetArray {
+    public:
+        using path = std::filesystem::path;
+
+        // Matches uTileRemap in resources/shaders/shader.wgsl and tile_quads.wgsl
+        static constexpr uint32_t empty_tile = 0xffffffffu;
+        static uint32_t pack_tile(uint32_t layer, uint32_t column, uint32_t row) { return layer << 24 | row << 12 | column; }
+
+        struct Tileset {
+            uint32_t first_gid;
+            uint32_t tile_count;
+            uint32_t columns;
+            // Relative to the resource directory
+            path image;
+        };
+
+        // The tileset images of the map are relative to the directory of tilemap_name
+        bool init(wgpu::Device device, GpuMemory& memory, AssetRegistry& assets, const CompiledTilemap& tilemap, const path& tilemap_name, const path& default_tileset);
+        void terminate();
+
+        // Indexed by gid - 1, see TilemapStreamer::set_opaque_tiles
+        std::vector<bool> find_opaque_tiles(const AssetRegistry& assets) const;
+        bool uses_image(const path& name) const;
+
+        const std::vector<Tileset>& get_tilesets() const { return m_tilesets; }
+        wgpu::TextureView get_indices_view() const { return m_texture->texture.indices_view; }
+        wgpu::TextureView get_palette_view() const { return m_texture->texture.palette_view; }
+        wgpu::Buffer get_remap_buffer() const { return m_remap_buffer; }
+        uint64_t get_remap_buffer_size() const { return m_remap_buffer_size; }
+
+    private:
+        AssetRegistry::Handle<IndexedTextureAsset> m_texture;
+        GpuMemory* m_memory = nullptr;
+        wgpu::Buffer m_remap_buffer = nullptr;
+        uint64_t m_remap_buffer_size = 0;
+        std::vector<Tileset> m_tilesets;
+
+        bool load_map_tilesets(AssetRegistry& assets, const CompiledTilemap& tilemap, const path& tilemap_name);
+        bool load_default_tileset(AssetRegistry& assets, const path& default_tileset);
+        bool create_remap_buffer(wgpu::Device device);
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Hands the newest value from one writer thread to one reader thread without
+ * locks.
+ *
+ * The writer fills its back buffer and swaps it with the middle one, the
+ * reader swaps the middle buffer with its front buffer whenever the middle one
+ * holds a value it has not seen. Neither side ever waits for the other, a slow
+ * reader simply skips the values it missed.
+ */
+template <typename T>
+class TripleBuffer {
+    public:
+        // Call before the writer and the reader start, every buffer begins as a copy of the value
+        void reset(const T& value) {
+            for (T& buffer : m_buffers) buffer = value;
+            m_back = 0;
+            m_middle.store(1, std::memory_order_relaxed);
+            m_front = 2;
+        }
+
+        // Writer side, the back buffer keeps whatever was written into it two publishes ago
+        T& get_back() { return m_buffers[m_back]; }
+        void publish() {
+            m_back = m_middle.exchange(m_back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+        }
+
+        // Reader side, returns false when nothing was published since the last call
+        bool update() {
+            if (!(m_middle.load(std::memory_order_relaxed) & fresh_bit)) return false;
+            m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & index_mask;
+            return true;
+        }
+        const T& get_front() const { return m_buffers[m_front]; }
+
+    private:
+        static constexpr uint8_t index_mask = 3;
+        static constexpr uint8_t fresh_bit = 4;
+
+        T m_buffers[3];
+        uint8_t m_back = 0;
+        std::atomic<uint8_t> m_middle = 1;
+        uint8_t m_front = 2;
+};
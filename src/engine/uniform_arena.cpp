@@ -0,0 +1,105 @@
+#include "uniform_arena.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+bool UniformArena::init(Device device, GpuMemory& memory, uint32_t frames_in_flight, uint32_t frame_capacity) {
+    m_memory = &memory;
+    terminate();
+    m_device = device;
+    m_queue = m_device.getQueue();
+    m_frames_in_flight = std::max(1u, frames_in_flight);
+
+    SupportedLimits supported_limits;
+    m_device.getLimits(&supported_limits);
+    m_alignment = std::max(1u, supported_limits.limits.minUniformBufferOffsetAlignment);
+    // Dynamic offsets are 32 bit, so the whole buffer has to stay below 4 GiB
+    uint64_t max_buffer_size = std::min<uint64_t>(supported_limits.limits.maxBufferSize, UINT32_MAX);
+    m_max_frame_capacity = (uint32_t)(max_buffer_size / m_frames_in_flight / m_alignment * m_alignment);
+    return resize(frame_capacity);
+}
+
+bool UniformArena::resize(uint32_t frame_capacity) {
+    uint64_t capacity = align_up(std::max(1u, frame_capacity), m_alignment);
+    if (capacity > m_max_frame_capacity) {
+        std::cerr << "A uniform arena of " << capacity << " bytes per frame does not fit into one buffer" << std::endl;
+        return false;
+    }
+
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.label = "Uniform arena";
+    buffer_descriptor.size = capacity * m_frames_in_flight;
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+    buffer_descriptor.mappedAtCreation = false;
+    Buffer buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Uniform);
+    if (!buffer) return false;
+
+    // Work already submitted finishes with the old buffer
+    if (m_buffer) m_memory->destroy(m_buffer);
+    m_buffer = buffer;
+    m_frame_capacity = (uint32_t)capacity;
+    m_staging.assign(m_frame_capacity, 0);
+    m_used = 0;
+    m_push_count = 0;
+    m_requested = 0;
+    m_reported_overflow = false;
+    return true;
+}
+
+void UniformArena::terminate() {
+    if (m_buffer) m_memory->destroy(m_buffer);
+    if (m_queue) m_queue.release();
+    m_buffer = nullptr;
+    m_queue = nullptr;
+    m_device = nullptr;
+    m_frame_capacity = 0;
+    m_max_frame_capacity = 0;
+    m_frame_slot = 0;
+    m_used = 0;
+    m_push_count = 0;
+    m_requested = 0;
+    m_reported_overflow = false;
+    m_staging.clear();
+}
+
+void UniformArena::begin_frame(uint32_t frame_slot) {
+    m_frame_slot = frame_slot % m_frames_in_flight;
+    m_used = 0;
+    m_push_count = 0;
+    m_requested = 0;
+}
+
+uint32_t UniformArena::push(const void* data, uint32_t size) {
+    uint64_t offset = align_up(m_used, m_alignment);
+    if (size > 0) m_requested = align_up(m_requested, m_alignment) + size;
+    if (size == 0 || offset + size > m_frame_capacity) {
+        if (!m_reported_overflow) {
+            std::cerr << "The uniform arena is full at " << m_push_count << " draws, "
+                << m_frame_capacity << " bytes per frame" << std::endl;
+            m_reported_overflow = true;
+        }
+        return no_offset;
+    }
+    std::memcpy(m_staging.data() + offset, data, size);
+    m_used = (uint32_t)(offset + size);
+    m_push_count++;
+    return m_frame_slot * m_frame_capacity + (uint32_t)offset;
+}
+
+void UniformArena::upload() {
+    if (m_used == 0) return;
+    // writeBuffer wants a multiple of 4 bytes, the gaps between slots go along
+    uint64_t size = align_up(m_used, 4);
+    m_queue.writeBuffer(m_buffer, (uint64_t)m_frame_slot * m_frame_capacity, m_staging.data(), size);
+}
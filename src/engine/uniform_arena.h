@@ -0,0 +1,66 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Uniforms of any number of draws in one buffer, bound once and selected per
+ * draw with a dynamic offset.
+ *
+ * The buffer holds one region per frame in flight. Every frame starts at the
+ * beginning of its region and push() hands out aligned slots one after the
+ * other, copied into a CPU side staging area. upload() then writes everything
+ * pushed in the frame with a single writeBuffer.
+ *
+ * A push that does not fit returns no_offset and the draw should be skipped.
+ * The arena still counts what the frame asked for, so between frames the
+ * owner can resize() it to get_requested_bytes(). That replaces the buffer,
+ * every bind group of the old one has to be created again. Bindings of the
+ * buffer must not be larger than the pushes drawn with them, or the last slot
+ * of the last region reads past the buffer.
+ */
+class UniformArena {
+    public:
+        static constexpr uint32_t no_offset = UINT32_MAX;
+
+        bool init(wgpu::Device device, GpuMemory& memory, uint32_t frames_in_flight, uint32_t frame_capacity);
+        void terminate();
+        // Only between frames, drops everything pushed. Returns false and keeps the old buffer when it does not fit
+        bool resize(uint32_t frame_capacity);
+
+        // Everything pushed the last time the slot was used is dropped
+        void begin_frame(uint32_t frame_slot);
+        uint32_t push(const void* data, uint32_t size);
+        template<typename T>
+        uint32_t push(const T& data) { return push(&data, (uint32_t)sizeof(T)); }
+        void upload();
+
+        wgpu::Buffer get_buffer() const { return m_buffer; }
+        uint32_t get_alignment() const { return m_alignment; }
+        uint32_t get_frame_capacity() const { return m_frame_capacity; }
+        // Of the current frame, what upload() writes
+        uint32_t get_used_bytes() const { return m_used; }
+        uint32_t get_push_count() const { return m_push_count; }
+        // Of the current frame, including the pushes that did not fit
+        uint64_t get_requested_bytes() const { return m_requested; }
+        uint32_t get_max_frame_capacity() const { return m_max_frame_capacity; }
+
+    private:
+        wgpu::Device m_device = nullptr;
+        GpuMemory* m_memory = nullptr;
+        wgpu::Queue m_queue = nullptr;
+        wgpu::Buffer m_buffer = nullptr;
+        uint32_t m_frames_in_flight = 1;
+        uint32_t m_frame_capacity = 0;
+        uint32_t m_max_frame_capacity = 0;
+        uint32_t m_alignment = 256;
+        uint32_t m_frame_slot = 0;
+        uint32_t m_used = 0;
+        uint32_t m_push_count = 0;
+        uint64_t m_requested = 0;
+        bool m_reported_overflow = false;
+        std::vector<uint8_t> m_staging;
+};
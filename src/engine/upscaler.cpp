@@ -0,0 +1,184 @@
+#include "upscaler.h"
+#include "device_tick.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace wgpu;
+
+bool Upscaler::init(Device device, GpuMemory& memory, ShaderModule shader_module, TextureFormat target_format) {
+    m_memory = &memory;
+    m_device = device;
+    m_queue = m_device.getQueue();
+    m_target_format = target_format;
+
+    if (!init_layouts() || !create_render_pipeline(shader_module)) {
+        std::cerr << "Could not create upscale pipeline!" << std::endl;
+        return false;
+    }
+
+    BufferDescriptor buffer_descriptor;
+    buffer_descriptor.size = sizeof(UpscaleUniforms);
+    buffer_descriptor.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+    buffer_descriptor.mappedAtCreation = false;
+    m_uniform_buffer = m_memory->create_buffer(m_device, buffer_descriptor, GpuMemory::Category::Uniform);
+    return m_uniform_buffer != nullptr;
+}
+
+void Upscaler::terminate() {
+    // The pending callback references the upscaler, after a timeout its storage is left to it
+    if (!tick_until(m_device, [this]() { return !m_pipeline_pending; })) {
+        std::cerr << "Gave up waiting for the upscale pipeline" << std::endl;
+        m_pipeline_request.release();
+    }
+    m_pipeline_request = nullptr;
+    if (m_bind_group) m_bind_group.release();
+    if (m_uniform_buffer) m_memory->destroy(m_uniform_buffer);
+    if (m_render_pipeline) m_render_pipeline.release();
+    if (m_pipeline_layout) m_pipeline_layout.release();
+    if (m_bind_group_layout) m_bind_group_layout.release();
+    if (m_queue) m_queue.release();
+    m_bind_group = nullptr;
+    m_uniform_buffer = nullptr;
+    m_render_pipeline = nullptr;
+    m_pipeline_layout = nullptr;
+    m_bind_group_layout = nullptr;
+    m_queue = nullptr;
+}
+
+bool Upscaler::set_shader_module(ShaderModule shader_module) {
+    return create_render_pipeline(shader_module);
+}
+
+bool Upscaler::init_layouts() {
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(2, Default);
+    BindGroupLayoutEntry& uniform_binding_layout = binding_layout_entries[0];
+    uniform_binding_layout.binding = 0;
+    uniform_binding_layout.visibility = ShaderStage::Fragment;
+    uniform_binding_layout.buffer.type = BufferBindingType::Uniform;
+    uniform_binding_layout.buffer.minBindingSize = sizeof(UpscaleUniforms);
+
+    // Read with textureLoad, so no sampler and no filtering
+    BindGroupLayoutEntry& scene_binding_layout = binding_layout_entries[1];
+    scene_binding_layout.binding = 1;
+    scene_binding_layout.visibility = ShaderStage::Fragment;
+    scene_binding_layout.texture.sampleType = TextureSampleType::Float;
+    scene_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutDescriptor bind_group_layout_descriptor{};
+    bind_group_layout_descriptor.entryCount = (uint32_t)binding_layout_entries.size();
+    bind_group_layout_descriptor.entries = binding_layout_entries.data();
+    m_bind_group_layout = m_device.createBindGroupLayout(bind_group_layout_descriptor);
+
+    PipelineLayoutDescriptor pipeline_layout_descriptor{};
+    pipeline_layout_descriptor.bindGroupLayoutCount = 1;
+    pipeline_layout_descriptor.bindGroupLayouts = (WGPUBindGroupLayout*)&m_bind_group_layout;
+    m_pipeline_layout = m_device.createPipelineLayout(pipeline_layout_descriptor);
+    return m_bind_group_layout && m_pipeline_layout;
+}
+
+bool Upscaler::create_render_pipeline(ShaderModule shader_module) {
+    // Only one request at a time, its callback storage must live until it has been called
+    if (!tick_until(m_device, [this]() { return !m_pipeline_pending; })) {
+        std::cerr << "The previous upscale pipeline is still compiling" << std::endl;
+        return false;
+    }
+
+    // A single triangle covering the target, generated from the vertex index
+    RenderPipelineDescriptor pipeline_descriptor;
+    pipeline_descriptor.layout = m_pipeline_layout;
+    pipeline_descriptor.vertex.bufferCount = 0;
+    pipeline_descriptor.vertex.buffers = nullptr;
+    pipeline_descriptor.vertex.module = shader_module;
+    pipeline_descriptor.vertex.entryPoint = "vs_main";
+    pipeline_descriptor.vertex.constantCount = 0;
+    pipeline_descriptor.vertex.constants = nullptr;
+
+    pipeline_descriptor.primitive.topology = PrimitiveTopology::TriangleList;
+    pipeline_descriptor.primitive.stripIndexFormat = IndexFormat::Undefined;
+    pipeline_descriptor.primitive.frontFace = FrontFace::CCW;
+    pipeline_descriptor.primitive.cullMode = CullMode::None;
+
+    FragmentState fragment_state;
+    pipeline_descriptor.fragment = &fragment_state;
+    fragment_state.module = shader_module;
+    fragment_state.entryPoint = "fs_main";
+    fragment_state.constantCount = 0;
+    fragment_state.constants = nullptr;
+
+    ColorTargetState color_target;
+    color_target.format = m_target_format;
+    color_target.blend = nullptr;
+    color_target.writeMask = ColorWriteMask::All;
+
+    fragment_state.targetCount = 1;
+    fragment_state.targets = &color_target;
+
+    pipeline_descriptor.depthStencil = nullptr;
+
+    pipeline_descriptor.multisample.count = 1;
+    pipeline_descriptor.multisample.mask = ~0u;
+    pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
+
+    m_pipeline_pending = true;
+    m_pipeline_request = m_device.createRenderPipelineAsync(pipeline_descriptor, [this](CreatePipelineAsyncStatus status, RenderPipeline pipeline, char const* message) {
+        m_pipeline_pending = false;
+        if (status != CreatePipelineAsyncStatus::Success) {
+            std::cerr << "Could not create upscale pipeline: " << (message ? message : "") << std::endl;
+            return;
+        }
+        if (m_render_pipeline) m_render_pipeline.release();
+        m_render_pipeline = pipeline;
+    });
+    return m_pipeline_request != nullptr;
+}
+
+bool Upscaler::set_scene(TextureView scene_view, uint32_t width, uint32_t height) {
+    m_scene_width = width;
+    m_scene_height = height;
+    update_uniforms();
+
+    std::vector<BindGroupEntry> bindings(2);
+    bindings[0].binding = 0;
+    bindings[0].buffer = m_uniform_buffer;
+    bindings[0].offset = 0;
+    bindings[0].size = sizeof(UpscaleUniforms);
+
+    bindings[1].binding = 1;
+    bindings[1].textureView = scene_view;
+
+    BindGroupDescriptor bind_group_descriptor;
+    bind_group_descriptor.layout = m_bind_group_layout;
+    bind_group_descriptor.entryCount = (uint32_t)bindings.size();
+    bind_group_descriptor.entries = bindings.data();
+    if (m_bind_group) m_bind_group.release();
+    m_bind_group = m_device.createBindGroup(bind_group_descriptor);
+    return m_bind_group != nullptr;
+}
+
+void Upscaler::set_target_size(uint32_t width, uint32_t height) {
+    m_target_width = width;
+    m_target_height = height;
+    update_uniforms();
+}
+
+void Upscaler::update_uniforms() {
+    if (m_scene_width == 0 || m_scene_height == 0) return;
+
+    float scale = std::min((float)m_target_width / m_scene_width, (float)m_target_height / m_scene_height);
+    // Integer scales keep every scene pixel the same size, smaller targets can only be scaled down
+    m_uniforms.scale = scale >= 1.0f ? std::floor(scale) : std::max(scale, 1.0f / 64.0f);
+    m_uniforms.offset_x = std::floor((m_target_width - m_scene_width * m_uniforms.scale) / 2.0f);
+    m_uniforms.offset_y = std::floor((m_target_height - m_scene_height * m_uniforms.scale) / 2.0f);
+    m_queue.writeBuffer(m_uniform_buffer, 0, &m_uniforms, sizeof(UpscaleUniforms));
+}
+
+void Upscaler::render(RenderPassEncoder& render_pass) const {
+    if (!m_render_pipeline || !m_bind_group) return;
+
+    render_pass.setPipeline(m_render_pipeline);
+    render_pass.setBindGroup(0, m_bind_group, 0, nullptr);
+    render_pass.draw(3, 1, 0, 0);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "gpu_memory.h"
+
+#include <memory>
+
+/**
+ * Blits the fixed resolution scene onto the swap chain.
+ *
+ * The scene is scaled by the largest integer factor that fits the target and
+ * centered, the border stays black. Targets smaller than the scene fall back
+ * to a fractional nearest neighbour scale. Either way the pass costs one
+ * texel fetch per target pixel, independent of what the scene draws.
+ */
+class Upscaler {
+    public:
+        // The shader module is resources/shaders/upscale.wgsl
+        bool init(wgpu::Device device, GpuMemory& memory, wgpu::ShaderModule shader_module, wgpu::TextureFormat target_format);
+        void terminate();
+        // The pipeline is compiled asynchronously, the previous one keeps drawing until it is ready
+        bool set_shader_module(wgpu::ShaderModule shader_module);
+        bool is_pipeline_pending() const { return m_pipeline_pending; }
+        bool has_pipeline() const { return m_render_pipeline != nullptr; }
+
+        // The scene view has to outlive the upscaler or the next call
+        bool set_scene(wgpu::TextureView scene_view, uint32_t width, uint32_t height);
+        void set_target_size(uint32_t width, uint32_t height);
+        void render(wgpu::RenderPassEncoder& render_pass) const;
+
+        float get_scale() const { return m_uniforms.scale; }
+
+    private:
+        // Matches the UpscaleUniforms struct in resources/shaders/upscale.wgsl
+        struct UpscaleUniforms {
+            float offset_x;
+            float offset_y;
+            float scale;
+            float _pad;
+        };
+
+        wgpu::Device m_device = nullptr;
+        GpuMemory* m_memory = nullptr;
+        wgpu::Queue m_queue = nullptr;
+        wgpu::TextureFormat m_target_format = wgpu::TextureFormat::Undefined;
+        wgpu::BindGroupLayout m_bind_group_layout = nullptr;
+        wgpu::PipelineLayout m_pipeline_layout = nullptr;
+        wgpu::RenderPipeline m_render_pipeline = nullptr;
+        std::unique_ptr<wgpu::CreateRenderPipelineAsyncCallback> m_pipeline_request;
+        bool m_pipeline_pending = false;
+        wgpu::Buffer m_uniform_buffer = nullptr;
+        wgpu::BindGroup m_bind_group = nullptr;
+
+        UpscaleUniforms m_uniforms = { 0.0f, 0.0f, 1.0f, 0.0f };
+        uint32_t m_scene_width = 0;
+        uint32_t m_scene_height = 0;
+        uint32_t m_target_width = 0;
+        uint32_t m_target_height = 0;
+
+        bool init_layouts();
+        bool create_render_pipeline(wgpu::ShaderModule shader_module);
+        void update_uniforms();
+};
@@ -0,0 +1,131 @@
+#include "compiled_mesh.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char magic[4] = { 'N', 'M', 'S', 'H' };
+const CompiledMesh::Header empty_header = {};
+
+uint64_t padded_size(uint64_t size) {
+    return (size + sizeof(uint32_t) - 1) / sizeof(uint32_t) * sizeof(uint32_t);
+}
+
+void append_padded(std::vector<uint8_t>& data, const void* source, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(source);
+    data.insert(data.end(), bytes, bytes + size);
+    data.resize(data.size() + padded_size(size) - size, 0);
+}
+
+}
+
+bool CompiledMesh::open(const std::filesystem::path& path) {
+    close();
+    if (!m_file.open(path)) {
+        std::cerr << "Could not map " << path << std::endl;
+        return false;
+    }
+    if (!validate()) {
+        std::cerr << path << " is not a valid compiled mesh" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool CompiledMesh::open_memory(std::vector<uint8_t>&& data) {
+    close();
+    m_memory = std::move(data);
+    if (!validate()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void CompiledMesh::close() {
+    m_file.close();
+    m_memory.clear();
+    m_memory.shrink_to_fit();
+}
+
+const CompiledMesh::Header& CompiledMesh::header() const {
+    if (size() < sizeof(Header)) return empty_header;
+    return *reinterpret_cast<const Header*>(data());
+}
+
+const CompiledMesh::Attribute* CompiledMesh::attributes() const {
+    return reinterpret_cast<const Attribute*>(data() + sizeof(Header));
+}
+
+const uint8_t* CompiledMesh::vertex_data() const {
+    return reinterpret_cast<const uint8_t*>(attributes() + header().attribute_count);
+}
+
+uint64_t CompiledMesh::vertex_data_size() const {
+    return padded_size((uint64_t)header().vertex_count * header().vertex_stride);
+}
+
+const uint8_t* CompiledMesh::index_data() const {
+    return vertex_data() + vertex_data_size();
+}
+
+uint64_t CompiledMesh::index_data_size() const {
+    return padded_size((uint64_t)header().index_count * header().index_size);
+}
+
+bool CompiledMesh::validate() const {
+    if (size() < sizeof(Header)) return false;
+    const Header& h = header();
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != format_version) return false;
+    if (h.attribute_count == 0 || h.attribute_count > max_attributes) return false;
+    // WebGPU wants the stride in whole words
+    if (h.vertex_stride == 0 || h.vertex_stride > max_vertex_stride || h.vertex_stride % 4 != 0) return false;
+    if (h.index_size != sizeof(uint16_t) && h.index_size != sizeof(uint32_t)) return false;
+
+    uint64_t end = sizeof(Header) + (uint64_t)h.attribute_count * sizeof(Attribute) + vertex_data_size() + index_data_size();
+    if (end > size()) return false;
+    const Attribute* entries = attributes();
+    for (uint32_t i = 0; i < h.attribute_count; i++) {
+        uint32_t format_size = GeometryLoader::format_size(entries[i].format);
+        if (format_size == 0 || entries[i].offset % 4 != 0 || (uint64_t)entries[i].offset + format_size > h.vertex_stride) return false;
+    }
+    return true;
+}
+
+std::vector<uint8_t> CompiledMesh::compile(const GeometryLoader::Geometry& geometry) {
+    Header h = {};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = format_version;
+    h.vertex_stride = geometry.vertex_stride;
+    h.vertex_count = geometry.vertex_stride == 0 ? 0 : (uint32_t)(geometry.vertices.size() / geometry.vertex_stride);
+    h.attribute_count = (uint32_t)geometry.attributes.size();
+    h.index_count = (uint32_t)geometry.indices.size();
+    uint32_t max_index = geometry.indices.empty() ? 0 : *std::max_element(geometry.indices.begin(), geometry.indices.end());
+    h.index_size = max_index <= UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+
+    std::vector<uint8_t> data;
+    append_padded(data, &h, sizeof(Header));
+    append_padded(data, geometry.attributes.data(), geometry.attributes.size() * sizeof(Attribute));
+    append_padded(data, geometry.vertices.data(), (size_t)h.vertex_count * h.vertex_stride);
+    if (h.index_size == sizeof(uint16_t)) {
+        std::vector<uint16_t> indices(geometry.indices.begin(), geometry.indices.end());
+        append_padded(data, indices.data(), indices.size() * sizeof(uint16_t));
+    }
+    else {
+        append_padded(data, geometry.indices.data(), geometry.indices.size() * sizeof(uint32_t));
+    }
+    return data;
+}
+
+bool CompiledMesh::write(const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return (bool)file;
+}
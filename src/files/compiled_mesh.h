@@ -0,0 +1,72 @@
+#pragma once
+
+#include "geometry_loader.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+/**
+ * Binary mesh format (.nmesh) written by nostalgia_meshc.
+ *
+ * The file starts with a Header and one Attribute per vertex attribute,
+ * followed by the vertex data exactly as the vertex buffer expects it and the
+ * indices, 16 or 32 bit. Both blocks are padded to 4 bytes, so they are
+ * copied straight from the memory mapped file into buffers mapped at
+ * creation, and the pipeline's vertex layout is built from the header.
+ * Everything is little endian.
+ */
+class CompiledMesh {
+    public:
+        static constexpr uint32_t format_version = 1;
+        // Within the limits every WebGPU device supports, see Engine::init_window_and_device
+        static constexpr uint32_t max_attributes = 8;
+        static constexpr uint32_t max_vertex_stride = 256;
+
+        using Format = GeometryLoader::Format;
+        using Attribute = GeometryLoader::Attribute;
+
+        struct Header {
+            char magic[4];
+            uint32_t version;
+            uint32_t vertex_count;
+            uint32_t vertex_stride;
+            uint32_t attribute_count;
+            uint32_t index_count;
+            // 2 or 4 bytes per index
+            uint32_t index_size;
+            uint32_t _pad;
+        };
+
+        bool open(const std::filesystem::path& path);
+        bool open_memory(std::vector<uint8_t>&& data);
+        void close();
+
+        uint32_t vertex_count() const { return header().vertex_count; }
+        uint32_t vertex_stride() const { return header().vertex_stride; }
+        uint32_t attribute_count() const { return header().attribute_count; }
+        const Attribute* attributes() const;
+        uint32_t index_count() const { return header().index_count; }
+        uint32_t index_size() const { return header().index_size; }
+
+        // Both padded to 4 bytes, the padding is part of the data
+        const uint8_t* vertex_data() const;
+        uint64_t vertex_data_size() const;
+        const uint8_t* index_data() const;
+        uint64_t index_data_size() const;
+        bool is_open() const { return size() != 0; }
+
+        // Indices are stored in 16 bits when they fit
+        static std::vector<uint8_t> compile(const GeometryLoader::Geometry& geometry);
+        static bool write(const std::filesystem::path& path, const std::vector<uint8_t>& data);
+
+    private:
+        MappedFile m_file;
+        std::vector<uint8_t> m_memory;
+
+        const uint8_t* data() const { return m_memory.empty() ? m_file.data() : m_memory.data(); }
+        size_t size() const { return m_memory.empty() ? m_file.size() : m_memory.size(); }
+        const Header& header() const;
+        bool validate() const;
+};
@@ -0,0 +1,278 @@
+#include "compiled_tilemap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char magic[4] = { 'N', 'M', 'A', 'P' };
+const CompiledTilemap::Header empty_header = {};
+const CompiledTilemap::LayerInfo default_layer_info = { 1, 1.0f, 1.0f, 1.0f, 0, 0 };
+
+uint64_t padded_size(uint64_t size) {
+    return (size + sizeof(uint32_t) - 1) / sizeof(uint32_t) * sizeof(uint32_t);
+}
+
+void append_words(std::vector<uint8_t>& data, const uint32_t* words, size_t count) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(words);
+    data.insert(data.end(), bytes, bytes + count * sizeof(uint32_t));
+}
+
+}
+
+bool CompiledTilemap::open(const std::filesystem::path& path) {
+    close();
+    if (!m_file.open(path)) {
+        std::cerr << "Could not map " << path << std::endl;
+        return false;
+    }
+    if (!validate()) {
+        std::cerr << path << " is not a valid compiled tilemap" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool CompiledTilemap::open_memory(std::vector<uint8_t>&& data) {
+    close();
+    m_memory = std::move(data);
+    if (!validate()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void CompiledTilemap::close() {
+    m_file.close();
+    m_memory.clear();
+    m_memory.shrink_to_fit();
+}
+
+const CompiledTilemap::Header& CompiledTilemap::header() const {
+    if (size() < sizeof(Header)) return empty_header;
+    return *reinterpret_cast<const Header*>(data());
+}
+
+const CompiledTilemap::LayerInfo& CompiledTilemap::layer_info(uint32_t layer) const {
+    if (layer >= header().number_of_layers) return default_layer_info;
+    return reinterpret_cast<const LayerInfo*>(data() + sizeof(Header))[layer];
+}
+
+const CompiledTilemap::ChunkEntry* CompiledTilemap::chunk_entries() const {
+    return reinterpret_cast<const ChunkEntry*>(data() + sizeof(Header) + header().number_of_layers * sizeof(LayerInfo));
+}
+
+const CompiledTilemap::Animation* CompiledTilemap::animations() const {
+    return reinterpret_cast<const Animation*>(chunk_entries() + (size_t)header().chunks_x * header().chunks_y);
+}
+
+const CompiledTilemap::AnimationFrame* CompiledTilemap::animation_frames() const {
+    return reinterpret_cast<const AnimationFrame*>(animations() + header().animation_count);
+}
+
+const uint32_t* CompiledTilemap::solid_gids() const {
+    return reinterpret_cast<const uint32_t*>(animation_frames() + header().animation_frame_count);
+}
+
+const CompiledTilemap::Tileset* CompiledTilemap::tilesets() const {
+    return reinterpret_cast<const Tileset*>(solid_gids() + header().solid_gid_count);
+}
+
+std::string CompiledTilemap::tileset_image(uint32_t tileset) const {
+    if (tileset >= header().tileset_count) return "";
+    const Tileset& entry = tilesets()[tileset];
+    const char* string_table = reinterpret_cast<const char*>(tilesets() + header().tileset_count);
+    return std::string(string_table + entry.image_offset, entry.image_length);
+}
+
+bool CompiledTilemap::validate() const {
+    if (size() < sizeof(Header)) return false;
+    const Header& h = header();
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != format_version) return false;
+    if (h.chunk_size != chunk_size) return false;
+    if (h.chunks_x != (h.width + chunk_size - 1) / chunk_size) return false;
+    if (h.chunks_y != (h.height + chunk_size - 1) / chunk_size) return false;
+
+    uint64_t index_end = sizeof(Header) + (uint64_t)h.number_of_layers * sizeof(LayerInfo) + (uint64_t)h.chunks_x * h.chunks_y * sizeof(ChunkEntry)
+        + (uint64_t)h.animation_count * sizeof(Animation) + (uint64_t)h.animation_frame_count * sizeof(AnimationFrame)
+        + (uint64_t)h.solid_gid_count * sizeof(uint32_t) + (uint64_t)h.tileset_count * sizeof(Tileset) + padded_size(h.string_table_size);
+    if (index_end > size()) return false;
+    const Animation* animation_entries = animations();
+    for (uint32_t i = 0; i < h.animation_count; i++) {
+        const Animation& animation = animation_entries[i];
+        if (animation.frame_count == 0 || animation.duration_ms == 0) return false;
+        if ((uint64_t)animation.first_frame + animation.frame_count > h.animation_frame_count) return false;
+    }
+    const Tileset* tileset_entries = tilesets();
+    for (uint32_t i = 0; i < h.tileset_count; i++) {
+        const Tileset& tileset = tileset_entries[i];
+        if (tileset.first_gid == 0 || tileset.columns == 0 || (uint64_t)tileset.image_offset + tileset.image_length > h.string_table_size) return false;
+        if (i > 0 && tileset.first_gid <= tileset_entries[i - 1].first_gid) return false;
+        if ((uint64_t)tileset.first_gid + tileset.tile_count > max_gid) return false;
+        uint64_t rows = ((uint64_t)tileset.tile_count + tileset.columns - 1) / tileset.columns;
+        if (tileset.columns > max_tileset_columns || rows > max_tileset_columns) return false;
+    }
+    const ChunkEntry* entries = chunk_entries();
+    for (uint64_t i = 0; i < (uint64_t)h.chunks_x * h.chunks_y; i++) {
+        const ChunkEntry& entry = entries[i];
+        if (entry.offset % sizeof(uint32_t) != 0 || entry.offset < index_end) return false;
+        // Compared against what is left after the offset, a huge size cannot wrap around
+        if (entry.offset > size() || entry.size > size() - entry.offset) return false;
+        if (entry.size < h.number_of_layers * sizeof(uint32_t)) return false;
+    }
+    return true;
+}
+
+bool CompiledTilemap::decode_chunk(uint32_t chunk_x, uint32_t chunk_y, uint32_t layer, uint32_t* destination) const {
+    const Header& h = header();
+    if (chunk_x >= h.chunks_x || chunk_y >= h.chunks_y || layer >= h.number_of_layers) return false;
+
+    const ChunkEntry& entry = chunk_entries()[chunk_y * h.chunks_x + chunk_x];
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(data() + entry.offset);
+    const uint64_t word_count = entry.size / sizeof(uint32_t);
+
+    const uint32_t tile_count = chunk_size * chunk_size;
+    uint32_t written = 0;
+    uint64_t cursor = words[layer];
+    if (cursor < word_count) {
+        uint32_t run_count = words[cursor++];
+        for (uint32_t run = 0; run < run_count && cursor + 1 < word_count && written < tile_count; run++) {
+            uint32_t length = std::min(words[cursor], tile_count - written);
+            uint32_t gid = words[cursor + 1];
+            std::fill(destination + written, destination + written + length, gid);
+            written += length;
+            cursor += 2;
+        }
+    }
+    // A truncated layer leaves the rest of the chunk empty instead of stale
+    std::fill(destination + written, destination + tile_count, 0);
+    return written == tile_count;
+}
+
+uint32_t CompiledTilemap::get_tile(uint32_t x, uint32_t y, uint32_t layer) const {
+    const Header& h = header();
+    if (x >= h.width || y >= h.height || layer >= h.number_of_layers) return 0;
+
+    const ChunkEntry& entry = chunk_entries()[(y / chunk_size) * h.chunks_x + x / chunk_size];
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(data() + entry.offset);
+    const uint64_t word_count = entry.size / sizeof(uint32_t);
+
+    const uint32_t tile = (y % chunk_size) * chunk_size + x % chunk_size;
+    uint64_t skipped = 0;
+    uint64_t cursor = words[layer];
+    if (cursor >= word_count) return 0;
+    uint32_t run_count = words[cursor++];
+    for (uint32_t run = 0; run < run_count && cursor + 1 < word_count; run++) {
+        skipped += words[cursor];
+        if (tile < skipped) return words[cursor + 1];
+        cursor += 2;
+    }
+    // Like a truncated layer in decode_chunk
+    return 0;
+}
+
+std::vector<uint8_t> CompiledTilemap::compile(const TilemapLoader::Tilemap& tilemap) {
+    Header h = {};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = format_version;
+    h.width = tilemap.width;
+    h.height = tilemap.height;
+    h.number_of_layers = tilemap.number_of_layers;
+    h.chunk_size = chunk_size;
+    h.chunks_x = (tilemap.width + chunk_size - 1) / chunk_size;
+    h.chunks_y = (tilemap.height + chunk_size - 1) / chunk_size;
+
+    std::vector<Animation> animations;
+    std::vector<AnimationFrame> animation_frames;
+    for (const TilemapLoader::TileAnimation& source : tilemap.animations) {
+        Animation animation = { source.gid, (uint32_t)animation_frames.size(), (uint32_t)source.frames.size(), 0 };
+        for (const AnimationFrame& frame : source.frames) {
+            animation.duration_ms += frame.duration_ms;
+            animation_frames.push_back(frame);
+        }
+        if (animation.frame_count > 0 && animation.duration_ms > 0) animations.push_back(animation);
+    }
+    h.animation_count = (uint32_t)animations.size();
+    h.animation_frame_count = (uint32_t)animation_frames.size();
+    h.solid_gid_count = (uint32_t)tilemap.solid_gids.size();
+
+    std::vector<Tileset> tilesets;
+    std::string string_table;
+    for (const TilemapLoader::Tileset& source : tilemap.tilesets) {
+        if (source.columns == 0) continue;
+        tilesets.push_back({ source.first_gid, source.tile_count, source.columns, source.tile_width, source.tile_height,
+            (uint32_t)string_table.size(), (uint32_t)source.image.size(), 0 });
+        string_table += source.image;
+    }
+    h.tileset_count = (uint32_t)tilesets.size();
+    h.string_table_size = (uint32_t)string_table.size();
+
+    size_t layers_size = h.number_of_layers * sizeof(LayerInfo);
+    size_t chunk_entries_size = (size_t)h.chunks_x * h.chunks_y * sizeof(ChunkEntry);
+    std::vector<uint8_t> data(sizeof(Header) + layers_size + chunk_entries_size);
+    std::memcpy(data.data(), &h, sizeof(Header));
+    append_words(data, reinterpret_cast<const uint32_t*>(animations.data()), animations.size() * sizeof(Animation) / sizeof(uint32_t));
+    append_words(data, reinterpret_cast<const uint32_t*>(animation_frames.data()), animation_frames.size() * sizeof(AnimationFrame) / sizeof(uint32_t));
+    append_words(data, tilemap.solid_gids.data(), tilemap.solid_gids.size());
+    append_words(data, reinterpret_cast<const uint32_t*>(tilesets.data()), tilesets.size() * sizeof(Tileset) / sizeof(uint32_t));
+    // Padded with zeros, chunks start at a word boundary
+    string_table.resize(padded_size(string_table.size()), '\0');
+    data.insert(data.end(), string_table.begin(), string_table.end());
+    for (uint32_t layer = 0; layer < h.number_of_layers; layer++) {
+        LayerInfo info = default_layer_info;
+        if (layer < tilemap.layer_info.size()) {
+            const TilemapLoader::Layer& source = tilemap.layer_info[layer];
+            info = { source.visible ? 1u : 0u, source.opacity, source.parallax_x, source.parallax_y, source.collision ? 1u : 0u, 0 };
+        }
+        std::memcpy(data.data() + sizeof(Header) + layer * sizeof(LayerInfo), &info, sizeof(LayerInfo));
+    }
+
+    std::vector<uint32_t> chunk_words;
+    std::vector<uint32_t> tiles(chunk_size * chunk_size);
+    for (uint32_t chunk_y = 0; chunk_y < h.chunks_y; chunk_y++) {
+        for (uint32_t chunk_x = 0; chunk_x < h.chunks_x; chunk_x++) {
+            chunk_words.assign(h.number_of_layers, 0);
+
+            for (uint32_t layer = 0; layer < h.number_of_layers; layer++) {
+                std::fill(tiles.begin(), tiles.end(), 0);
+                const uint32_t* layer_data = tilemap.layer.data() + (size_t)layer * tilemap.width * tilemap.height;
+                uint32_t columns = std::min(chunk_size, tilemap.width - chunk_x * chunk_size);
+                uint32_t rows = std::min(chunk_size, tilemap.height - chunk_y * chunk_size);
+                for (uint32_t row = 0; row < rows; row++) {
+                    const uint32_t* source = layer_data + (size_t)(chunk_y * chunk_size + row) * tilemap.width + chunk_x * chunk_size;
+                    std::copy(source, source + columns, tiles.begin() + row * chunk_size);
+                }
+
+                chunk_words[layer] = (uint32_t)chunk_words.size();
+                size_t run_count_index = chunk_words.size();
+                chunk_words.push_back(0);
+                for (uint32_t i = 0; i < tiles.size();) {
+                    uint32_t length = 1;
+                    while (i + length < tiles.size() && tiles[i + length] == tiles[i]) length++;
+                    chunk_words.push_back(length);
+                    chunk_words.push_back(tiles[i]);
+                    chunk_words[run_count_index]++;
+                    i += length;
+                }
+            }
+
+            ChunkEntry entry = { data.size(), chunk_words.size() * sizeof(uint32_t) };
+            std::memcpy(data.data() + sizeof(Header) + layers_size + (chunk_y * h.chunks_x + chunk_x) * sizeof(ChunkEntry), &entry, sizeof(ChunkEntry));
+            append_words(data, chunk_words.data(), chunk_words.size());
+        }
+    }
+    return data;
+}
+
+bool CompiledTilemap::write(const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return (bool)file;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "tilemap_loader.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * Binary tilemap format (.nmap) written by nostalgia_mapc.
+ *
+ * The file starts with a Header, one LayerInfo per layer, one ChunkEntry
+ * per chunk in row major order, one Animation per animated tile, the
+ * AnimationFrames of all animations, the solid gids, one Tileset per tileset
+ * and the string table holding the tileset image paths, padded to 4 bytes.
+ * Every chunk begins with the word offsets of its layers, each
+ * layer is a run count followed by (length, gid) pairs covering the
+ * chunk_size * chunk_size tiles of the chunk in row major order. Everything
+ * is little endian uint32 and 4 byte aligned, so chunks are decoded straight
+ * out of the memory mapped file into the upload buffer.
+ */
+class CompiledTilemap {
+    public:
+        static constexpr uint32_t chunk_size = 32;
+        static constexpr uint32_t format_version = 5;
+        // Gids of tilesets end below it, which bounds the remap table of TilesetArray to 64 MiB
+        static constexpr uint32_t max_gid = 1u << 24;
+        // Columns and rows of a tileset, they get 12 bits each in TilesetArray::pack_tile
+        static constexpr uint32_t max_tileset_columns = 1u << 12;
+
+        struct Header {
+            char magic[4];
+            uint32_t version;
+            uint32_t width;
+            uint32_t height;
+            uint32_t number_of_layers;
+            uint32_t chunk_size;
+            uint32_t chunks_x;
+            uint32_t chunks_y;
+            uint32_t animation_count;
+            uint32_t animation_frame_count;
+            uint32_t solid_gid_count;
+            uint32_t tileset_count;
+            // Bytes of the string table, without the padding
+            uint32_t string_table_size;
+            // Header and LayerInfo stay a multiple of 8 bytes, so the chunk entries are aligned
+            uint32_t _pad;
+        };
+
+        struct LayerInfo {
+            uint32_t visible;
+            float opacity;
+            float parallax_x;
+            float parallax_y;
+            uint32_t collision;
+            uint32_t _pad;
+        };
+
+        struct ChunkEntry {
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        struct Animation {
+            uint32_t gid;
+            uint32_t first_frame;
+            uint32_t frame_count;
+            uint32_t duration_ms;
+        };
+
+        using AnimationFrame = TilemapLoader::AnimationFrame;
+
+        struct Tileset {
+            uint32_t first_gid;
+            uint32_t tile_count;
+            uint32_t columns;
+            uint32_t tile_width;
+            uint32_t tile_height;
+            // Byte range of the image path in the string table
+            uint32_t image_offset;
+            uint32_t image_length;
+            uint32_t _pad;
+        };
+
+        bool open(const std::filesystem::path& path);
+        bool open_memory(std::vector<uint8_t>&& data);
+        void close();
+
+        // Writes chunk_size * chunk_size gids, tiles past the map edge are 0.
+        bool decode_chunk(uint32_t chunk_x, uint32_t chunk_y, uint32_t layer, uint32_t* destination) const;
+        // Walks the runs of the tile's chunk up to the tile instead of decoding all of it, 0 past the map edge
+        uint32_t get_tile(uint32_t x, uint32_t y, uint32_t layer) const;
+
+        uint32_t width() const { return header().width; }
+        uint32_t height() const { return header().height; }
+        uint32_t number_of_layers() const { return header().number_of_layers; }
+        uint32_t chunks_x() const { return header().chunks_x; }
+        uint32_t chunks_y() const { return header().chunks_y; }
+        const LayerInfo& layer_info(uint32_t layer) const;
+        uint32_t animation_count() const { return header().animation_count; }
+        const Animation* animations() const;
+        // Indexed by Animation::first_frame
+        const AnimationFrame* animation_frames() const;
+        uint32_t solid_gid_count() const { return header().solid_gid_count; }
+        const uint32_t* solid_gids() const;
+        // Ordered by first_gid, every one ends at or below max_gid
+        uint32_t tileset_count() const { return header().tileset_count; }
+        const Tileset* tilesets() const;
+        // Relative to the directory of the source map
+        std::string tileset_image(uint32_t tileset) const;
+        bool is_open() const { return size() != 0; }
+
+        static std::vector<uint8_t> compile(const TilemapLoader::Tilemap& tilemap);
+        static bool write(const std::filesystem::path& path, const std::vector<uint8_t>& data);
+
+    private:
+        MappedFile m_file;
+        std::vector<uint8_t> m_memory;
+
+        const uint8_t* data() const { return m_memory.empty() ? m_file.data() : m_memory.data(); }
+        size_t size() const { return m_memory.empty() ? m_file.size() : m_memory.size(); }
+        const Header& header() const;
+        const ChunkEntry* chunk_entries() const;
+        bool validate() const;
+};
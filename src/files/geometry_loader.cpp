@@ -1,54 +1,85 @@
 #include "geometry_loader.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
+#include <string>
 
-bool GeometryLoader::load_geometry(const path &path, std::vector<float> &pointData, std::vector<uint16_t> &indexData) {
+uint32_t GeometryLoader::format_size(Format format) {
+    if (format == Format::Float32) return 4;
+    if (format == Format::Float32x2) return 8;
+    if (format == Format::Float32x3) return 12;
+    if (format == Format::Float32x4) return 16;
+    if (format == Format::Uint32) return 4;
+    if (format == Format::Uint32x2) return 8;
+    if (format == Format::Unorm8x4) return 4;
+    return 0;
+}
+
+bool GeometryLoader::load_geometry(const path &path, Geometry &geometry) {
     std::ifstream file(path);
     if (!file.is_open()) {
         return false;
     }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    const std::string text = stream.str();
 
-    pointData.clear();
-    indexData.clear();
+    const uint32_t floats_per_point = 5;
+    geometry.attributes = {
+        { 0, Format::Float32x2, 0 },
+        { 1, Format::Float32x3, 2 * sizeof(float) },
+    };
+    geometry.vertex_stride = floats_per_point * sizeof(float);
+    geometry.vertices.clear();
+    geometry.indices.clear();
 
     enum class Section {
         None,
         Points,
         Indices,
     };
-    Section currentSection = Section::None;
+    Section current_section = Section::None;
+
+    std::vector<float> point_data;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
 
-    float value;
-    uint16_t index;
-    std::string line;
-    while (!file.eof()) {
-        getline(file, line);
         if (line == "[points]") {
-            currentSection = Section::Points;
+            current_section = Section::Points;
         }
         else if (line == "[indices]") {
-            currentSection = Section::Indices;
+            current_section = Section::Indices;
         }
-        else if (line[0] == '#' || line.empty()) {
+        else if (line.empty() || line[0] == '#') {
             // Do nothing, this is a comment
         }
-        else if (currentSection == Section::Points) {
-            std::istringstream iss(line);
+        else if (current_section == Section::Points) {
             // Get x, y, r, g, b
-            for (int i = 0; i < 5; ++i) {
-                iss >> value;
-                pointData.push_back(value);
+            const char* cursor = line.c_str();
+            for (uint32_t i = 0; i < floats_per_point; i++) {
+                char* next = nullptr;
+                point_data.push_back(std::strtof(cursor, &next));
+                cursor = next;
             }
         }
-        else if (currentSection == Section::Indices) {
-            std::istringstream iss(line);
+        else if (current_section == Section::Indices) {
             // Get corners #0 #1 and #2
-            for (int i = 0; i < 3; ++i) {
-                iss >> index;
-                indexData.push_back(index);
+            const char* cursor = line.c_str();
+            for (uint32_t i = 0; i < 3; i++) {
+                char* next = nullptr;
+                geometry.indices.push_back((uint32_t)std::strtoul(cursor, &next, 10));
+                cursor = next;
             }
         }
     }
+
+    geometry.vertices.resize(point_data.size() * sizeof(float));
+    std::memcpy(geometry.vertices.data(), point_data.data(), geometry.vertices.size());
     return true;
 }
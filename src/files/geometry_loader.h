@@ -1,9 +1,41 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <vector>
 
 class GeometryLoader {
     public:
         using path = std::filesystem::path;
-        static bool load_geometry(const path& path, std::vector<float>& pointData, std::vector<uint16_t>& indexData);
-};
\ No newline at end of file
+
+        // Matches the VertexFormat of the same name, see Mesh::vertex_format
+        enum class Format : uint32_t {
+            Float32 = 1,
+            Float32x2,
+            Float32x3,
+            Float32x4,
+            Uint32,
+            Uint32x2,
+            Unorm8x4,
+        };
+
+        struct Attribute {
+            uint32_t shader_location;
+            Format format;
+            // Bytes from the start of the vertex
+            uint32_t offset;
+        };
+
+        struct Geometry {
+            std::vector<Attribute> attributes;
+            uint32_t vertex_stride;
+            std::vector<uint8_t> vertices;
+            std::vector<uint32_t> indices;
+        };
+
+        static uint32_t format_size(Format format);
+
+        // Text geometry with a [points] section of x y r g b lines and an [indices] section of triangles,
+        // position and color end up at shader locations 0 and 1
+        static bool load_geometry(const path& path, Geometry& geometry);
+};
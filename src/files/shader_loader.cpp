@@ -12,10 +12,14 @@ wgpu::ShaderModule ShaderLoader::load_shader_module(const path &path, wgpu::Devi
     file.seekg(0);
     file.read(shaderSource.data(), size);
 
+    return create_shader_module(shaderSource, device);
+}
+
+wgpu::ShaderModule ShaderLoader::create_shader_module(const std::string& source, wgpu::Device device) {
     wgpu::ShaderModuleWGSLDescriptor shader_code_descriptor;
     shader_code_descriptor.chain.next = nullptr;
     shader_code_descriptor.chain.sType = wgpu::SType::ShaderModuleWGSLDescriptor;
-    shader_code_descriptor.code = shaderSource.c_str();
+    shader_code_descriptor.code = source.c_str();
     wgpu::ShaderModuleDescriptor shader_descriptor;
     shader_descriptor.nextInChain = &shader_code_descriptor.chain;
     wgpu::ShaderModule shader = device.createShaderModule(shader_descriptor);
@@ -3,9 +3,11 @@
 #include <webgpu/webgpu.hpp>
 
 #include <filesystem>
+#include <string>
 
 class ShaderLoader {
     public:
         using path = std::filesystem::path;
         static wgpu::ShaderModule load_shader_module(const path& path, wgpu::Device device);
+        static wgpu::ShaderModule create_shader_module(const std::string& source, wgpu::Device device);
 };
\ No newline at end of file
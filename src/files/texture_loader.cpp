@@ -2,15 +2,59 @@
 #include <stb_image.h>
 #include "tilemap_loader.h"
 
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+// RGBA8 pixels straight from stb_image
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    unsigned char* pixels = nullptr;
+    ~DecodedImage() { if (pixels) stbi_image_free(pixels); }
+};
+
+std::mutex prefetch_mutex;
+std::unordered_map<std::string, std::shared_ptr<const DecodedImage>> prefetched_images;
+
+std::shared_ptr<const DecodedImage> decode_image(const std::filesystem::path& path, bool use_prefetched = true) {
+    if (use_prefetched) {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        auto prefetched = prefetched_images.find(path.string());
+        if (prefetched != prefetched_images.end()) return prefetched->second;
+    }
+    std::shared_ptr<DecodedImage> image = std::make_shared<DecodedImage>();
+    int channels;
+    image->pixels = stbi_load(path.string().c_str(), &image->width, &image->height, &channels, 4 /* force 4 channels */);
+    return image->pixels ? image : nullptr;
+}
+
+uint32_t color_distance(uint32_t a, uint32_t b) {
+    uint32_t distance = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        int32_t difference = (int32_t)((a >> shift) & 0xff) - (int32_t)((b >> shift) & 0xff);
+        distance += difference * difference;
+    }
+    return distance;
+}
+
+}
+
 wgpu::Texture TextureLoader::load_texture(const path &path, wgpu::Device device, wgpu::TextureView *pTextureView)
 {
     using namespace wgpu;
-    int width, height, channels;
-
-    unsigned char *pixelData = stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */);
-    if (nullptr == pixelData) {
+    std::shared_ptr<const DecodedImage> image = decode_image(path);
+    if (!image) {
         return nullptr;
     }
+    const int width = image->width;
+    const int height = image->height;
+    const unsigned char *pixelData = image->pixels;
 
     TextureDescriptor textureDesc;
     textureDesc.dimension = TextureDimension::_2D;
@@ -49,11 +93,154 @@ wgpu::Texture TextureLoader::load_texture(const path &path, wgpu::Device device,
 
     queue.release();
 
-    stbi_image_free(pixelData);
-
     return texture;
 }
 
+bool TextureLoader::load_indexed_texture(const path &path, wgpu::Device device, IndexedTexture &texture, uint32_t palette_count) {
+    return load_indexed_texture(std::vector<TextureLoader::path>{ path }, device, texture, palette_count, wgpu::TextureViewDimension::_2D);
+}
+
+bool TextureLoader::load_indexed_texture_array(const std::vector<path> &paths, wgpu::Device device, IndexedTexture &texture, uint32_t palette_count) {
+    return load_indexed_texture(paths, device, texture, palette_count, wgpu::TextureViewDimension::_2DArray);
+}
+
+bool TextureLoader::load_indexed_texture(const std::vector<path> &paths, wgpu::Device device, IndexedTexture &texture, uint32_t palette_count, wgpu::TextureViewDimension view_dimension) {
+    using namespace wgpu;
+    if (paths.empty()) {
+        return false;
+    }
+
+    // Fully transparent pixels all share one palette entry, whatever their color
+    struct Image {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint32_t> pixels;
+    };
+    std::vector<Image> images;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::unordered_map<uint32_t, uint32_t> color_counts;
+    // Every color but transparent, in the order they first appear
+    std::vector<uint32_t> colors;
+    for (const TextureLoader::path& path : paths) {
+        std::shared_ptr<const DecodedImage> decoded = decode_image(path);
+        if (!decoded) {
+            return false;
+        }
+        const unsigned char *pixelData = decoded->pixels;
+        Image image = { (uint32_t)decoded->width, (uint32_t)decoded->height, std::vector<uint32_t>((size_t)decoded->width * decoded->height) };
+        for (size_t i = 0; i < image.pixels.size(); i++) {
+            const unsigned char* pixel = pixelData + 4 * i;
+            image.pixels[i] = pixel[3] == 0 ? 0 : (uint32_t)pixel[0] | (uint32_t)pixel[1] << 8 | (uint32_t)pixel[2] << 16 | (uint32_t)pixel[3] << 24;
+            if (color_counts[image.pixels[i]]++ == 0 && image.pixels[i] != 0) {
+                colors.push_back(image.pixels[i]);
+            }
+        }
+        width = std::max(width, image.width);
+        height = std::max(height, image.height);
+        images.push_back(std::move(image));
+    }
+
+    // Keep the most frequent colors of all images together, every other color maps to its closest kept one
+    if (colors.size() > palette_size - 1) {
+        std::cerr << "Quantizing " << colors.size() << " colors of " << paths.size() << " image(s) starting with " << paths.front()
+            << " to " << palette_size - 1 << ", the least frequent ones become their closest kept color" << std::endl;
+        std::stable_sort(colors.begin(), colors.end(), [&](uint32_t a, uint32_t b) {
+            return color_counts[a] > color_counts[b];
+        });
+        colors.resize(palette_size - 1);
+    }
+    // Index 0 is reserved for transparent pixels, the padding of smaller images uses it as well
+    colors.insert(colors.begin(), 0);
+    std::unordered_map<uint32_t, uint8_t> color_indices;
+    for (const auto& [color, count] : color_counts) {
+        if (color == 0) {
+            color_indices[color] = 0;
+            continue;
+        }
+        uint32_t closest = 1;
+        for (uint32_t i = 2; i < colors.size(); i++) {
+            if (color_distance(color, colors[i]) < color_distance(color, colors[closest])) {
+                closest = i;
+            }
+        }
+        color_indices[color] = (uint8_t)closest;
+    }
+
+    // Smaller images are padded to the size of the largest one, one array layer each
+    const uint32_t layers = (uint32_t)images.size();
+    std::vector<uint8_t> indices((size_t)width * height * layers, 0);
+    for (uint32_t layer = 0; layer < layers; layer++) {
+        const Image& image = images[layer];
+        uint8_t* layer_indices = indices.data() + (size_t)layer * width * height;
+        for (uint32_t y = 0; y < image.height; y++) {
+            for (uint32_t x = 0; x < image.width; x++) {
+                layer_indices[(size_t)y * width + x] = color_indices[image.pixels[(size_t)y * image.width + x]];
+            }
+        }
+    }
+
+    TextureDescriptor textureDesc;
+    textureDesc.dimension = TextureDimension::_2D;
+    textureDesc.format = TextureFormat::R8Uint;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.sampleCount = 1;
+    textureDesc.size = { width, height, layers };
+    textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+    texture.indices = device.createTexture(textureDesc);
+
+    textureDesc.format = TextureFormat::RGBA8Unorm;
+    textureDesc.size = { palette_size, std::max(1u, palette_count), 1 };
+    texture.palette = device.createTexture(textureDesc);
+    if (!texture.indices || !texture.palette) {
+        return false;
+    }
+
+    TextureViewDescriptor textureViewDesc;
+    textureViewDesc.aspect = TextureAspect::All;
+    textureViewDesc.baseArrayLayer = 0;
+    textureViewDesc.arrayLayerCount = layers;
+    textureViewDesc.baseMipLevel = 0;
+    textureViewDesc.mipLevelCount = 1;
+    textureViewDesc.dimension = view_dimension;
+    textureViewDesc.format = TextureFormat::R8Uint;
+    texture.indices_view = texture.indices.createView(textureViewDesc);
+    textureViewDesc.arrayLayerCount = 1;
+    textureViewDesc.dimension = TextureViewDimension::_2D;
+    textureViewDesc.format = TextureFormat::RGBA8Unorm;
+    texture.palette_view = texture.palette.createView(textureViewDesc);
+
+    // Upload data to the GPU textures
+    ImageCopyTexture destination;
+    destination.texture = texture.indices;
+    destination.mipLevel = 0;
+    destination.origin = { 0, 0, 0 };
+    TextureDataLayout source;
+    source.offset = 0;
+    source.bytesPerRow = width;
+    source.rowsPerImage = height;
+    Queue queue = device.getQueue();
+    queue.writeTexture(destination, indices.data(), indices.size(), source, { width, height, layers });
+
+    std::vector<uint32_t> palettes(palette_size * std::max(1u, palette_count), 0);
+    for (size_t row = 0; row < palettes.size(); row += palette_size) {
+        std::copy(colors.begin(), colors.end(), palettes.begin() + row);
+    }
+    destination.texture = texture.palette;
+    source.bytesPerRow = 4 * palette_size;
+    source.rowsPerImage = std::max(1u, palette_count);
+    queue.writeTexture(destination, palettes.data(), palettes.size() * 4, source, textureDesc.size);
+
+    queue.release();
+
+    texture.colors = std::move(colors);
+    texture.image_sizes.clear();
+    for (const Image& image : images) texture.image_sizes.push_back({ image.width, image.height });
+    return true;
+}
+
 wgpu::Texture TextureLoader::load_tilemap_as_texture(const path &path, wgpu::Device device, wgpu::TextureView *pTextureView) {
     using namespace wgpu;
     TilemapLoader::Tilemap tilemap = TilemapLoader::load_tilemap(path);
@@ -62,14 +249,16 @@ wgpu::Texture TextureLoader::load_tilemap_as_texture(const path &path, wgpu::Dev
 
 wgpu::Texture TextureLoader::load_tilemap_as_texture(TilemapLoader::Tilemap tilemap, wgpu::Device device, wgpu::TextureView *pTextureView) {
     using namespace wgpu;
+    // One array layer per map layer, so the layer count is not bounded by the texture height
     int width = tilemap.width;
-    int height = tilemap.height * tilemap.number_of_layers;
+    int height = tilemap.height;
+    uint32_t layers = std::max(1u, tilemap.number_of_layers);
     TextureDescriptor textureDesc;
     textureDesc.dimension = TextureDimension::_2D;
     textureDesc.format = TextureFormat::R32Uint;
     textureDesc.mipLevelCount = 1;
     textureDesc.sampleCount = 1;
-    textureDesc.size = { (unsigned int)width, (unsigned int)height, 1 };
+    textureDesc.size = { (unsigned int)width, (unsigned int)height, layers };
     textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
     textureDesc.viewFormatCount = 0;
     textureDesc.viewFormats = nullptr;
@@ -79,14 +268,18 @@ wgpu::Texture TextureLoader::load_tilemap_as_texture(TilemapLoader::Tilemap tile
         TextureViewDescriptor textureViewDesc;
         textureViewDesc.aspect = TextureAspect::All;
         textureViewDesc.baseArrayLayer = 0;
-        textureViewDesc.arrayLayerCount = 1;
+        textureViewDesc.arrayLayerCount = layers;
         textureViewDesc.baseMipLevel = 0;
         textureViewDesc.mipLevelCount = textureDesc.mipLevelCount;
-        textureViewDesc.dimension = TextureViewDimension::_2D;
+        textureViewDesc.dimension = TextureViewDimension::_2DArray;
         textureViewDesc.format = textureDesc.format;
         *pTextureView = texture.createView(textureViewDesc);
     }
 
+    if (tilemap.number_of_layers == 0) {
+        return texture;
+    }
+
     // Upload data to the GPU texture
     ImageCopyTexture destination;
     destination.texture = texture;
@@ -97,9 +290,48 @@ wgpu::Texture TextureLoader::load_tilemap_as_texture(TilemapLoader::Tilemap tile
     source.bytesPerRow = 4 * width;
     source.rowsPerImage = height;
     Queue queue = device.getQueue();
-    queue.writeTexture(destination, tilemap.layer.data(), width * height * 4, source, textureDesc.size);
+    queue.writeTexture(destination, tilemap.layer.data(), tilemap.layer.size() * 4, source, textureDesc.size);
 
     queue.release();
 
     return texture;
 }
+
+
+std::vector<bool> TextureLoader::find_opaque_tiles(const path &path, uint32_t tile_width, uint32_t tile_height) {
+    std::shared_ptr<const DecodedImage> image = decode_image(path);
+    if (!image) {
+        return {};
+    }
+    const uint32_t width = image->width;
+    const uint32_t height = image->height;
+    const unsigned char *pixelData = image->pixels;
+
+    uint32_t columns = width / tile_width;
+    uint32_t rows = height / tile_height;
+    std::vector<bool> opaque(columns * rows, true);
+    for (uint32_t y = 0; y < rows * tile_height; y++) {
+        for (uint32_t x = 0; x < columns * tile_width; x++) {
+            if (pixelData[4 * (y * width + x) + 3] != 255) {
+                opaque[(y / tile_height) * columns + x / tile_width] = false;
+            }
+        }
+    }
+
+    return opaque;
+}
+
+bool TextureLoader::prefetch_image(const path &path) {
+    std::shared_ptr<const DecodedImage> image = decode_image(path, false);
+    if (!image) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(prefetch_mutex);
+    prefetched_images[path.string()] = std::move(image);
+    return true;
+}
+
+void TextureLoader::clear_prefetched_images() {
+    std::lock_guard<std::mutex> lock(prefetch_mutex);
+    prefetched_images.clear();
+}
\ No newline at end of file
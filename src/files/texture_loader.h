@@ -1,14 +1,48 @@
 #pragma once
 
 #include <filesystem>
+#include <vector>
 #include <webgpu/webgpu.hpp>
 #include "tilemap_loader.h"
 
 class TextureLoader {
     public:
         using path = std::filesystem::path;
+
+        static constexpr uint32_t palette_size = 256;
+
+        // An R8Uint index per pixel plus a palette LUT of palette_size x palette_count RGBA8Unorm texels,
+        // every row of the LUT is one palette and starts out as a copy of the extracted one
+        struct IndexedTexture {
+            wgpu::Texture indices = nullptr;
+            wgpu::TextureView indices_view = nullptr;
+            wgpu::Texture palette = nullptr;
+            wgpu::TextureView palette_view = nullptr;
+            // Packed RGBA8, the colors of the first palette row
+            std::vector<uint32_t> colors;
+            // Per array layer, the size of its image before it was padded to the largest one
+            struct ImageSize {
+                uint32_t width;
+                uint32_t height;
+            };
+            std::vector<ImageSize> image_sizes;
+        };
         
         static wgpu::Texture load_texture(const path& path, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr);
+        // Index 0 is transparent. Images with more than palette_size - 1 other colors are quantized to the most frequent ones, with a warning
+        static bool load_indexed_texture(const path& path, wgpu::Device device, IndexedTexture& texture, uint32_t palette_count = 1);
+        // One array layer per image, all padded to the largest one and sharing a single palette
+        static bool load_indexed_texture_array(const std::vector<path>& paths, wgpu::Device device, IndexedTexture& texture, uint32_t palette_count = 1);
         static wgpu::Texture load_tilemap_as_texture(const path& path, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr);
         static wgpu::Texture load_tilemap_as_texture(TilemapLoader::Tilemap tilemap, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr);
+        // One entry per tile of the tileset (gid - 1), true if every pixel of the tile is fully opaque
+        static std::vector<bool> find_opaque_tiles(const path& path, uint32_t tile_width, uint32_t tile_height);
+
+        // Decodes the image ahead of time, safe to call from any thread. Every load of the path until
+        // clear_prefetched_images() takes the decoded pixels instead of reading the file again.
+        static bool prefetch_image(const path& path);
+        static void clear_prefetched_images();
+
+    private:
+        static bool load_indexed_texture(const std::vector<path>& paths, wgpu::Device device, IndexedTexture& texture, uint32_t palette_count, wgpu::TextureViewDimension view_dimension);
 };
\ No newline at end of file
@@ -1,25 +1,225 @@
 #include "tilemap_loader.h"
 #include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 using json = nlohmann::json;
 
-TilemapLoader::Tilemap TilemapLoader::load_tilemap(const std::filesystem::path &path) {
-    std::ifstream file(path);
-    json data = json::parse(file);
+namespace {
+
+// Custom properties are a list of { name, type, value } objects
+bool get_bool_property(const json& object, const char* name) {
+    if (!object.contains("properties") || !object["properties"].is_array()) return false;
+    for (const json& property : object["properties"]) {
+        if (property.value("name", "") == name && property.contains("value") && property["value"].is_boolean()) {
+            return property["value"].get<bool>();
+        }
+    }
+    return false;
+}
+
+// Tiled stores animations and tile properties per tileset, with tile ids local to the tileset
+void load_tiles(const json& tileset, uint32_t first_gid, TilemapLoader::Tilemap& tilemap) {
+    if (!tileset.contains("tiles") || !tileset["tiles"].is_array()) return;
+    for (const json& tile : tileset["tiles"]) {
+        if (!tile.contains("id") || !tile["id"].is_number_unsigned()) continue;
+        uint32_t gid = first_gid + tile["id"].get<uint32_t>();
+
+        // A solid or collision property, or shapes drawn in Tiled's collision editor
+        bool has_shapes = tile.contains("objectgroup") && !tile["objectgroup"].value("objects", json::array()).empty();
+        if (get_bool_property(tile, "solid") || get_bool_property(tile, "collision") || has_shapes) {
+            tilemap.solid_gids.push_back(gid);
+        }
+
+        if (!tile.contains("animation") || !tile["animation"].is_array()) continue;
+        TilemapLoader::TileAnimation animation = { gid, {} };
+        for (const json& frame : tile["animation"]) {
+            uint32_t duration_ms = std::max(1u, frame.value("duration", 100u));
+            animation.frames.push_back({ first_gid + frame.value("tileid", 0u), duration_ms });
+        }
+        if (!animation.frames.empty()) tilemap.animations.push_back(std::move(animation));
+    }
+}
+
+// Tiled writes the tileset and image elements of a .tsx file on one line each, with their attributes in double quotes.
+// That is all the structure read here, per tile animations and properties would need a real XML parser.
+std::string get_xml_attribute(const std::string& xml, const std::string& element, const std::string& attribute) {
+    size_t start = xml.find("<" + element + " ");
+    if (start == std::string::npos) return "";
+    std::string tag = xml.substr(start, xml.find('>', start) - start);
+    size_t value = tag.find(" " + attribute + "=\"");
+    if (value == std::string::npos) return "";
+    value += attribute.size() + 3;
+    std::string text = tag.substr(value, tag.find('"', value) - value);
+
+    const std::pair<const char*, char> entities[] = { { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' }, { "&lt;", '<' }, { "&gt;", '>' } };
+    for (const auto& [entity, character] : entities) {
+        for (size_t found = text.find(entity); found != std::string::npos; found = text.find(entity, found + 1)) {
+            text.replace(found, std::strlen(entity), 1, character);
+        }
+    }
+    return text;
+}
+
+uint32_t get_xml_uint(const std::string& xml, const std::string& element, const std::string& attribute) {
+    return (uint32_t)std::strtoul(get_xml_attribute(xml, element, attribute).c_str(), nullptr, 10);
+}
+
+// Image collections, with one image per tile, cannot go into the tileset texture array
+void add_tileset(TilemapLoader::Tileset tileset, uint32_t margin, uint32_t spacing, const std::filesystem::path& source, TilemapLoader::Tilemap& tilemap) {
+    if (tileset.image.empty() || tileset.columns == 0 || tileset.tile_count == 0) {
+        std::cerr << "Tileset " << source << " has no single image, it is not drawn" << std::endl;
+        return;
+    }
+    if (margin != 0 || spacing != 0) {
+        std::cerr << "Tileset " << source << " has a margin or spacing, its tiles will be misplaced" << std::endl;
+    }
+    tilemap.tilesets.push_back(std::move(tileset));
+}
+
+void load_xml_tileset(const std::filesystem::path& source, const std::filesystem::path& directory, uint32_t first_gid, TilemapLoader::Tilemap& tilemap) {
+    std::ifstream file(source);
+    if (!file.is_open()) {
+        std::cerr << "Could not open tileset " << source << std::endl;
+        return;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string xml = stream.str();
 
-    uint32_t number_of_layers = data["layers"].size();
-    uint32_t width = data["width"];
-    uint32_t height = data["height"];
+    TilemapLoader::Tileset tileset = {
+        first_gid,
+        get_xml_uint(xml, "tileset", "tilecount"),
+        get_xml_uint(xml, "tileset", "columns"),
+        get_xml_uint(xml, "tileset", "tilewidth"),
+        get_xml_uint(xml, "tileset", "tileheight"),
+        ""
+    };
+    std::string image = get_xml_attribute(xml, "image", "source");
+    if (!image.empty()) tileset.image = (directory / image).lexically_normal().generic_string();
+    add_tileset(std::move(tileset), get_xml_uint(xml, "tileset", "margin"), get_xml_uint(xml, "tileset", "spacing"), source, tilemap);
+    std::cout << "Skipping animations and solid tiles of " << source << ", only JSON tilesets have them read" << std::endl;
+}
 
-    std::vector<uint32_t> tilemap_data(width * height * number_of_layers);
+void load_json_tileset(const json& data, const std::filesystem::path& source, const std::filesystem::path& directory, uint32_t first_gid, TilemapLoader::Tilemap& tilemap) {
+    TilemapLoader::Tileset tileset = {
+        first_gid,
+        data.value("tilecount", 0u),
+        data.value("columns", 0u),
+        data.value("tilewidth", 0u),
+        data.value("tileheight", 0u),
+        ""
+    };
+    std::string image = data.value("image", "");
+    if (!image.empty()) tileset.image = (directory / image).lexically_normal().generic_string();
+    add_tileset(std::move(tileset), data.value("margin", 0u), data.value("spacing", 0u), source, tilemap);
+    load_tiles(data, first_gid, tilemap);
+}
+
+// Of a map whose width, height and layers have been checked, any other key may throw a json::exception
+TilemapLoader::Tilemap read_tilemap(const json& data, const std::filesystem::path& path) {
+    uint32_t width = data["width"].get<uint32_t>();
+    uint32_t height = data["height"].get<uint32_t>();
+
+    // Object and image layers carry no tile data
+    std::vector<const json*> tile_layers;
+    for (const json& layer : data["layers"]) {
+        if (!layer.is_object() || !layer.contains("data")) continue;
+        if (layer.contains("type") && layer["type"] != "tilelayer") continue;
+        tile_layers.push_back(&layer);
+    }
+    uint32_t number_of_layers = tile_layers.size();
+
+    std::vector<uint32_t> tilemap_data((size_t)width * height * number_of_layers, 0);
+    std::vector<TilemapLoader::Layer> layer_info(number_of_layers);
     for (uint32_t i = 0; i < number_of_layers; i++) {
-        std::vector<uint32_t> layer_data = data["layers"][i]["data"];
-        auto layer_start = tilemap_data.begin() + (i * width * height);
-        tilemap_data.insert(layer_start, layer_data.begin(), layer_data.end());
+        const json& layer = *tile_layers[i];
+        layer_info[i].name = layer.value("name", "");
+        layer_info[i].visible = layer.value("visible", true);
+        layer_info[i].opacity = layer.value("opacity", 1.0f);
+        layer_info[i].parallax_x = layer.value("parallaxx", 1.0f);
+        layer_info[i].parallax_y = layer.value("parallaxy", 1.0f);
+        layer_info[i].collision = get_bool_property(layer, "collision");
+
+        // Base64 or compressed layers are a string, only the uncompressed CSV array is read
+        const json& layer_data = layer["data"];
+        if (!layer_data.is_array() || !std::all_of(layer_data.begin(), layer_data.end(), [](const json& gid) { return gid.is_number_unsigned(); })) {
+            std::cerr << "Could not parse tilemap " << path << ", layer " << i << " is not an array of tile ids" << std::endl;
+            return {};
+        }
+        if (layer_data.size() != (size_t)width * height) {
+            std::cerr << "Layer " << i << " of " << path << " does not match the map size" << std::endl;
+            return {};
+        }
+        auto layer_start = tilemap_data.begin() + (size_t)i * width * height;
+        std::transform(layer_data.begin(), layer_data.end(), layer_start, [](const json& gid) { return gid.get<uint32_t>(); });
     }
 
-    Tilemap tilemap = {tilemap_data, width, height, number_of_layers};
+    TilemapLoader::Tilemap tilemap = {std::move(tilemap_data), width, height, number_of_layers, std::move(layer_info), {}, {}, {}};
+
+    // Embedded tilesets and external JSON tilesets are read completely, external XML tilesets (.tsx) only for their image.
+    // Image paths are relative to the file naming them, and end up relative to the map.
+    if (data.contains("tilesets") && data["tilesets"].is_array()) {
+        for (const json& tileset : data["tilesets"]) {
+            if (!tileset.is_object() || (tileset.contains("firstgid") && !tileset["firstgid"].is_number_unsigned())) {
+                std::cerr << "Skipping a tileset of " << path << " with an invalid firstgid" << std::endl;
+                continue;
+            }
+            uint32_t first_gid = tileset.value("firstgid", 1u);
+            if (!tileset.contains("source")) {
+                load_json_tileset(tileset, path, "", first_gid, tilemap);
+                continue;
+            }
+            if (!tileset["source"].is_string()) {
+                std::cerr << "Skipping a tileset of " << path << " with an invalid source" << std::endl;
+                continue;
+            }
+            std::filesystem::path relative_source = tileset["source"].get<std::string>();
+            std::filesystem::path source = path.parent_path() / relative_source;
+            if (source.extension() == ".tsx") {
+                load_xml_tileset(source, relative_source.parent_path(), first_gid, tilemap);
+                continue;
+            }
+            std::ifstream tileset_file(source);
+            json tileset_data = json::parse(tileset_file, nullptr, false);
+            if (!tileset_file.is_open() || tileset_data.is_discarded()) {
+                std::cerr << "Could not parse tileset " << source << std::endl;
+                continue;
+            }
+            load_json_tileset(tileset_data, source, relative_source.parent_path(), first_gid, tilemap);
+        }
+        std::sort(tilemap.tilesets.begin(), tilemap.tilesets.end(), [](const TilemapLoader::Tileset& a, const TilemapLoader::Tileset& b) {
+            return a.first_gid < b.first_gid;
+        });
+    }
     return tilemap;
+}
+
+}
+
+TilemapLoader::Tilemap TilemapLoader::load_tilemap(const std::filesystem::path &path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Could not open tilemap " << path << std::endl;
+        return {};
+    }
+    json data = json::parse(file, nullptr, false);
+    if (data.is_discarded() || !data.is_object() || !data.contains("layers") || !data["layers"].is_array()
+        || !data.contains("width") || !data["width"].is_number_unsigned() || !data.contains("height") || !data["height"].is_number_unsigned()) {
+        std::cerr << "Could not parse tilemap " << path << ", it needs a width, a height and layers" << std::endl;
+        return {};
+    }
+
+    // The checks above cover what every map needs, a mistyped optional key still throws
+    try {
+        return read_tilemap(data, path);
+    }
+    catch (const json::exception& error) {
+        std::cerr << "Could not parse tilemap " << path << ": " << error.what() << std::endl;
+        return {};
+    }
 }
\ No newline at end of file
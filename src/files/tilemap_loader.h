@@ -1,14 +1,55 @@
 #pragma once
+#include <cstdint>
 #include <filesystem>
+#include <string>
+#include <vector>
 
 class TilemapLoader {
     public:
 
+        struct Layer {
+            std::string name;
+            bool visible;
+            float opacity;
+            float parallax_x;
+            float parallax_y;
+            // Every tile of a collision layer is solid, whatever its gid
+            bool collision;
+        };
+
+        struct AnimationFrame {
+            uint32_t gid;
+            uint32_t duration_ms;
+        };
+
+        // Tiles with this gid cycle through the frames, which name the gids actually drawn
+        struct TileAnimation {
+            uint32_t gid;
+            std::vector<AnimationFrame> frames;
+        };
+
+        // Tiles are packed into the image row by row, without margin or spacing
+        struct Tileset {
+            uint32_t first_gid;
+            uint32_t tile_count;
+            uint32_t columns;
+            uint32_t tile_width;
+            uint32_t tile_height;
+            // Relative to the directory of the map
+            std::string image;
+        };
+
         struct Tilemap {
             std::vector<uint32_t> layer;
             uint32_t width;
             uint32_t height;
             uint32_t number_of_layers;
+            std::vector<Layer> layer_info;
+            std::vector<TileAnimation> animations;
+            // Gids marked solid in their tileset, on any layer
+            std::vector<uint32_t> solid_gids;
+            // Ordered by first_gid
+            std::vector<Tileset> tilesets;
         };
         
         static Tilemap load_tilemap(const std::filesystem::path& path);
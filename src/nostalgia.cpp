@@ -1,7 +1,59 @@
 #include "engine/engine.h"
 
-int main(int, char**) {
-    Engine engine = Engine(640, 480);
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+void print_usage() {
+    std::cerr << "usage: nostalgia [--present-mode fifo|mailbox|immediate] [--frames-in-flight <n>] [--tick-rate <n>] [--gpu-budget <MiB>] [--tilemap-renderer fullscreen|quads] [--trace <file>]" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    EngineSettings settings;
+    // Every option takes a value
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            std::cerr << "Missing value for " << argv[i] << std::endl;
+            print_usage();
+            return 1;
+        }
+        if (std::strcmp(argv[i], "--present-mode") == 0) {
+            if (!FramePacer::parse_present_mode(argv[i + 1], settings.frame.present_mode)) {
+                std::cerr << "Unknown present mode " << argv[i + 1] << ", expected fifo, mailbox or immediate" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--frames-in-flight") == 0) {
+            settings.frame.frames_in_flight = (uint32_t)std::strtoul(argv[i + 1], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--tick-rate") == 0) {
+            settings.tick_rate = (uint32_t)std::strtoul(argv[i + 1], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--gpu-budget") == 0) {
+            // In MiB, 0 turns eviction off
+            settings.gpu_memory_budget = (uint64_t)std::strtoull(argv[i + 1], nullptr, 10) * 1024 * 1024;
+        }
+        else if (std::strcmp(argv[i], "--tilemap-renderer") == 0) {
+            if (!Engine::parse_tilemap_renderer(argv[i + 1], settings.tilemap_renderer)) {
+                std::cerr << "Unknown tilemap renderer " << argv[i + 1] << ", expected fullscreen or quads" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0) {
+            settings.trace_path = argv[i + 1];
+        }
+        else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
+
+    Engine engine = Engine(640, 480, settings);
     if (!engine.on_init()) return 1;
     
     while (engine.is_running()) {
@@ -10,4 +62,4 @@ int main(int, char**) {
 
     engine.on_finish();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,329 @@
+#include "../engine/engine.h"
+#include "../files/compiled_tilemap.h"
+#include "../files/tilemap_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Scenario {
+    uint32_t map_width;
+    uint32_t map_height;
+    uint32_t layers;
+    uint32_t sprites;
+    // Share of the patches filled on the layers above the ground
+    uint32_t fill_percent;
+};
+
+// From the size of the demo map up to the largest maps we stream, 4096x4096 stays at 4 layers to bound the generator's memory.
+// The dense and sparse 256x256 maps are where the two tilemap renderers differ the most.
+const Scenario default_scenarios[] = {
+    { 40, 30, 1, 0, 25 },
+    { 40, 30, 3, 1000, 25 },
+    { 256, 256, 4, 0, 25 },
+    { 256, 256, 4, 0, 100 },
+    { 256, 256, 4, 0, 5 },
+    { 256, 256, 4, 10000, 25 },
+    { 256, 256, 4, 100000, 25 },
+    { 1024, 1024, 8, 10000, 25 },
+    { 1024, 1024, 16, 10000, 25 },
+    { 4096, 4096, 1, 0, 25 },
+    { 4096, 4096, 4, 100000, 25 },
+};
+
+// Completely filled layers drawn as tile quads, one draw per chunk in view, for the encoding time against the number of draws
+const Scenario draw_count_scenarios[] = {
+    { 256, 256, 8, 0, 100 },
+    { 256, 256, 32, 0, 100 },
+    { 256, 256, 128, 0, 100 },
+};
+
+const TilemapRenderer tilemap_renderers[] = { TilemapRenderer::FullScreen, TilemapRenderer::Quads };
+
+// The scene is rendered at the virtual size and upscaled to the view
+const uint32_t view_width = 1280;
+const uint32_t view_height = 720;
+const uint32_t virtual_width = 640;
+const uint32_t virtual_height = 360;
+// Stays within the gids of the demo tileset
+const uint32_t tile_count = 1024;
+// Synthetic game content, the demo tileset has none: every animated_stride-th gid alternates with the next one
+// and every solid_stride-th gid is solid, so the generated maps exercise tile animations and collisions
+const uint32_t animated_stride = 64;
+const uint32_t solid_stride = 16;
+
+uint32_t hash(uint32_t x, uint32_t y, uint32_t layer) {
+    uint32_t h = x * 73856093u ^ y * 19349663u ^ layer * 83492791u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    return h ^ (h >> 15);
+}
+
+// Ground in 8x8 patches and patches of detail on the layers above, so chunks compress and stream like a real map
+std::shared_ptr<const CompiledTilemap> generate_tilemap(const Scenario& scenario) {
+    TilemapLoader::Tilemap tilemap;
+    tilemap.width = scenario.map_width;
+    tilemap.height = scenario.map_height;
+    tilemap.number_of_layers = scenario.layers;
+    tilemap.layer.resize((size_t)tilemap.width * tilemap.height * tilemap.number_of_layers);
+    for (uint32_t layer = 0; layer < tilemap.number_of_layers; layer++) {
+        tilemap.layer_info.push_back({ "layer " + std::to_string(layer), true, 1.0f, 1.0f, 1.0f, false });
+        uint32_t* tiles = tilemap.layer.data() + (size_t)layer * tilemap.width * tilemap.height;
+        for (uint32_t y = 0; y < tilemap.height; y++) {
+            for (uint32_t x = 0; x < tilemap.width; x++) {
+                uint32_t patch = hash(x / 8, y / 8, layer);
+                bool is_filled = layer == 0 || patch % 100 < scenario.fill_percent;
+                tiles[(size_t)y * tilemap.width + x] = is_filled ? 1 + patch % tile_count : 0;
+            }
+        }
+    }
+
+    for (uint32_t gid = 1; gid < tile_count; gid += animated_stride) {
+        tilemap.animations.push_back({ gid, { { gid, 400 }, { gid + 1, 400 } } });
+    }
+    for (uint32_t gid = solid_stride; gid <= tile_count; gid += solid_stride) {
+        tilemap.solid_gids.push_back(gid);
+    }
+
+    std::shared_ptr<CompiledTilemap> compiled = std::make_shared<CompiledTilemap>();
+    compiled->open_memory(CompiledTilemap::compile(tilemap));
+    return compiled->is_open() ? compiled : nullptr;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    size_t index = std::min(values.size() - 1, (size_t)(p / 100.0 * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+// Edits random tiles of the bottom layer close to the camera's path, so most of them hit resident chunks
+void edit_tiles(Engine& engine, const Scenario& scenario, uint32_t edits, std::mt19937& random) {
+    std::uniform_int_distribution<uint32_t> random_x(0, std::min(scenario.map_width, 256u) - 1);
+    std::uniform_int_distribution<uint32_t> random_y(0, std::min(scenario.map_height, 256u) - 1);
+    std::uniform_int_distribution<uint32_t> random_gid(1, tile_count);
+    for (uint32_t i = 0; i < edits; i++) {
+        engine.set_tile(0, random_x(random), random_y(random), random_gid(random));
+    }
+}
+
+bool parse_setting(const std::string& value, std::vector<bool>& settings) {
+    if (value == "on") settings = { true };
+    else if (value == "off") settings = { false };
+    else if (value == "both") settings = { true, false };
+    else return false;
+    return true;
+}
+
+bool run(const Scenario& scenario, TilemapRenderer tilemap_renderer, bool skip_covered_layers, bool tile_quad_bundles, bool fallback_adapter, uint32_t warmup_frames, uint32_t frames, uint32_t edits, std::ostream& output) {
+    EngineSettings settings;
+    settings.tilemap_renderer = tilemap_renderer;
+    settings.skip_covered_layers = skip_covered_layers;
+    settings.tile_quad_bundles = tile_quad_bundles;
+    settings.headless = true;
+    settings.print_profile = false;
+    // The GPU pass times come from the profiler even though it prints nothing
+    settings.gpu_timestamps = true;
+    settings.force_fallback_adapter = fallback_adapter;
+    settings.sprite_count = scenario.sprites;
+    settings.virtual_width = virtual_width;
+    settings.virtual_height = virtual_height;
+    settings.tilemap = generate_tilemap(scenario);
+    if (!settings.tilemap) {
+        std::cerr << "Could not generate a " << scenario.map_width << "x" << scenario.map_height << " tilemap" << std::endl;
+        return false;
+    }
+
+    Engine engine(view_width, view_height, settings);
+    if (!engine.on_init()) return false;
+
+    for (uint32_t i = 0; i < warmup_frames; i++) {
+        engine.on_frame();
+    }
+    engine.get_profiler().reset_averages();
+
+    std::vector<double> frame_times(frames);
+    uint64_t upload_bytes = 0;
+    uint64_t tilemap_draws = 0;
+    std::mt19937 random(1);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++) {
+        auto frame_start = std::chrono::steady_clock::now();
+        edit_tiles(engine, scenario, edits, random);
+        engine.on_frame();
+        frame_times[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+        upload_bytes += engine.get_upload_bytes();
+        tilemap_draws += engine.get_tilemap_draw_count();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Read back a few frames late, the last ones of the run are not included
+    bool has_timestamps = engine.get_profiler().has_timestamps();
+    double scene_pass_ms = engine.get_profiler().get_average_ms("gpu", "scene pass");
+    double upscale_pass_ms = engine.get_profiler().get_average_ms("gpu", "upscale pass");
+    // From the command encoder to the finished command buffer, including the bundles recorded that frame
+    double encode_ms = engine.get_profiler().get_average_ms("cpu", "encode");
+    PipelineCache::Stats cache_stats = engine.get_pipeline_cache_stats();
+    engine.on_finish();
+
+    // One JSON object per line
+    output << "{\"map_width\":" << scenario.map_width << ",\"map_height\":" << scenario.map_height
+        << ",\"layers\":" << scenario.layers << ",\"sprites\":" << scenario.sprites
+        << ",\"fill_percent\":" << scenario.fill_percent
+        << ",\"tilemap_renderer\":\"" << Engine::tilemap_renderer_name(tilemap_renderer) << "\""
+        << ",\"skip_covered_layers\":" << (skip_covered_layers ? "true" : "false")
+        << ",\"tile_quad_bundles\":" << (tile_quad_bundles ? "true" : "false")
+        << ",\"edits_per_frame\":" << edits
+        << ",\"startup_ms\":" << engine.get_startup_ms()
+        << ",\"pipeline_cache\":\"" << (engine.is_pipeline_cache_warm() ? "warm" : "cold") << "\""
+        << ",\"pipeline_cache_hits\":" << cache_stats.hits << ",\"pipeline_cache_stores\":" << cache_stats.stores
+        << ",\"frames\":" << frames << ",\"fps\":" << frames / seconds
+        << ",\"frame_ms_p50\":" << percentile(frame_times, 50.0)
+        << ",\"frame_ms_p90\":" << percentile(frame_times, 90.0)
+        << ",\"frame_ms_p99\":" << percentile(frame_times, 99.0)
+        << ",\"frame_ms_max\":" << *std::max_element(frame_times.begin(), frame_times.end())
+        << ",\"upload_bytes\":" << upload_bytes
+        << ",\"upload_bytes_per_frame\":" << upload_bytes / frames
+        << ",\"tilemap_draws_per_frame\":" << tilemap_draws / frames
+        << ",\"encode_cpu_ms\":" << encode_ms;
+    // GPU pass times need timestamp queries, without them there is nothing to compare
+    if (has_timestamps) {
+        output << ",\"scene_pass_gpu_ms\":" << scene_pass_ms << ",\"upscale_pass_gpu_ms\":" << upscale_pass_ms;
+    }
+    else {
+        output << ",\"scene_pass_gpu_ms\":null,\"upscale_pass_gpu_ms\":null";
+    }
+    output << "}" << std::endl;
+    return true;
+}
+
+}
+
+// Renders fixed scenarios headless and writes one JSON line of results per scenario.
+int main(int argc, char** argv) {
+    std::vector<Scenario> scenarios(std::begin(default_scenarios), std::end(default_scenarios));
+    std::vector<Scenario> quad_scenarios(std::begin(draw_count_scenarios), std::end(draw_count_scenarios));
+    Scenario custom = { 0, 0, 1, 0, 25 };
+    std::vector<TilemapRenderer> renderers(std::begin(tilemap_renderers), std::end(tilemap_renderers));
+    // Both settings by default, so the fragment time saved by skipping covered layers shows up side by side
+    std::vector<bool> skip_settings = { true, false };
+    // Likewise the encoding time of the tile quads with and without render bundles
+    std::vector<bool> bundle_settings = { true, false };
+    bool fallback_adapter = false;
+    uint32_t warmup_frames = 60;
+    uint32_t frames = 600;
+    uint32_t edits = 0;
+    std::string output_path = "nostalgia_bench.jsonl";
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--fallback-adapter") == 0) {
+            fallback_adapter = true;
+        }
+        else if (std::strcmp(argv[i], "--map") == 0 && has_value) {
+            if (std::sscanf(argv[++i], "%ux%u", &custom.map_width, &custom.map_height) != 2) {
+                std::cerr << "Expected the map size as <width>x<height>" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--layers") == 0 && has_value) {
+            custom.layers = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--sprites") == 0 && has_value) {
+            custom.sprites = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--fill") == 0 && has_value) {
+            custom.fill_percent = std::min(100u, (uint32_t)std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--tilemap-renderer") == 0 && has_value) {
+            TilemapRenderer renderer;
+            if (!Engine::parse_tilemap_renderer(argv[++i], renderer)) {
+                std::cerr << "Expected the tilemap renderer as fullscreen or quads" << std::endl;
+                return 1;
+            }
+            renderers = { renderer };
+        }
+        else if (std::strcmp(argv[i], "--skip-covered-layers") == 0 && has_value) {
+            if (!parse_setting(argv[++i], skip_settings)) {
+                std::cerr << "Expected --skip-covered-layers as on, off or both" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--tile-quad-bundles") == 0 && has_value) {
+            if (!parse_setting(argv[++i], bundle_settings)) {
+                std::cerr << "Expected --tile-quad-bundles as on, off or both" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::max(1u, (uint32_t)std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--warmup") == 0 && has_value) {
+            warmup_frames = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--edits") == 0 && has_value) {
+            edits = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--output") == 0 && has_value) {
+            output_path = argv[++i];
+        }
+        else {
+            const char* value_options[] = { "--map", "--layers", "--sprites", "--fill", "--tilemap-renderer", "--skip-covered-layers",
+                "--tile-quad-bundles", "--frames", "--warmup", "--edits", "--output" };
+            if (!has_value && std::any_of(std::begin(value_options), std::end(value_options), [&](const char* option) { return std::strcmp(argv[i], option) == 0; })) {
+                std::cerr << "Missing value for " << argv[i] << std::endl;
+            }
+            std::cerr << "usage: nostalgia_bench [--map <width>x<height> --layers <n> --sprites <n> --fill <percent>] [--tilemap-renderer fullscreen|quads] [--skip-covered-layers on|off|both] [--tile-quad-bundles on|off|both] [--frames <n>] [--warmup <n>] [--edits <n>] [--fallback-adapter] [--output <file>]" << std::endl;
+            return 1;
+        }
+    }
+    // A map size on the command line replaces the default scenarios
+    if (custom.map_width > 0 && custom.map_height > 0) {
+        scenarios = { custom };
+        quad_scenarios.clear();
+    }
+
+    std::ofstream output(output_path, std::ios::trunc);
+    if (!output.is_open()) {
+        std::cerr << "Could not open " << output_path << std::endl;
+        return 1;
+    }
+
+    bool success = true;
+    // Only the full screen tilemap skips covered layers and only the tile quads record bundles, each runs once per setting of its own
+    auto run_renderer = [&](const Scenario& scenario, TilemapRenderer renderer) {
+        bool is_full_screen = renderer == TilemapRenderer::FullScreen;
+        for (bool setting : is_full_screen ? skip_settings : bundle_settings) {
+            std::cout << "Scenario " << scenario.map_width << "x" << scenario.map_height << ", "
+                << scenario.layers << " layers (" << scenario.fill_percent << "% filled), " << scenario.sprites << " sprites, "
+                << Engine::tilemap_renderer_name(renderer) << " tilemap"
+                << (setting ? "" : is_full_screen ? ", covered layers drawn" : ", without bundles") << std::endl;
+            if (!run(scenario, renderer, !is_full_screen || setting, is_full_screen || setting, fallback_adapter, warmup_frames, frames, edits, output)) {
+                std::cerr << "Scenario failed" << std::endl;
+                success = false;
+            }
+        }
+    };
+    // Every scenario runs once per tilemap renderer, so both show up side by side in the results
+    for (const Scenario& scenario : scenarios) {
+        for (TilemapRenderer renderer : renderers) {
+            run_renderer(scenario, renderer);
+        }
+    }
+    if (std::find(renderers.begin(), renderers.end(), TilemapRenderer::Quads) != renderers.end()) {
+        for (const Scenario& scenario : quad_scenarios) {
+            run_renderer(scenario, TilemapRenderer::Quads);
+        }
+    }
+    std::cout << "Results written to " << output_path << std::endl;
+    return success ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include "../engine/entity_store.h"
+#include "../engine/collision_grid.h"
+#include "../engine/spatial_hash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+const uint32_t map_tiles = 4096;
+const float tile_size = 16.0f;
+const float map_size = map_tiles * tile_size;
+const float delta_time = 1.0f / 60.0f;
+// Share of solid tiles, scattered like rocks and trees
+const float solid_share = 0.1f;
+
+double percentile(std::vector<double> values, double p) {
+    size_t index = std::min(values.size() - 1, (size_t)(p / 100.0 * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+// Median time of one call, in milliseconds per 100k entities
+template <typename Update>
+double measure(uint32_t entity_count, uint32_t iterations, Update update) {
+    std::vector<double> times(iterations);
+    for (uint32_t i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        update();
+        times[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return percentile(times, 50.0) * 100000.0 / entity_count;
+}
+
+}
+
+// Times the entity systems on their own, without a device or a window.
+int main(int argc, char** argv) {
+    uint32_t entity_count = 100000;
+    uint32_t iterations = 1000;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--entities") == 0 && has_value) {
+            entity_count = std::max(1u, (uint32_t)std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--iterations") == 0 && has_value) {
+            iterations = std::max(1u, (uint32_t)std::strtoul(argv[++i], nullptr, 10));
+        }
+        else {
+            std::cerr << "usage: nostalgia_entity_bench [--entities <n>] [--iterations <n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> random_share(0.0f, 1.0f);
+    CollisionGrid collision;
+    collision.init(map_tiles, map_tiles, tile_size);
+    for (uint32_t y = 0; y < map_tiles; y++) {
+        for (uint32_t x = 0; x < map_tiles; x++) {
+            if (random_share(random) < solid_share) collision.set_solid(x, y, true);
+        }
+    }
+
+    std::uniform_real_distribution<float> random_position(0.0f, map_size - tile_size);
+    std::uniform_real_distribution<float> random_velocity(-60.0f, 60.0f);
+    EntityStore entities;
+    entities.reserve(entity_count);
+    for (uint32_t i = 0; i < entity_count; i++) {
+        EntityStore::Entity entity;
+        do {
+            entity.x = random_position(random);
+            entity.y = random_position(random);
+        } while (collision.overlaps({ entity.x, entity.y, tile_size, tile_size }));
+        entity.velocity_x = random_velocity(random);
+        entity.velocity_y = random_velocity(random);
+        entity.frame_count = 4;
+        entities.create(entity);
+    }
+
+    double motion_ms = measure(entity_count, iterations, [&]() { entities.update_motion(delta_time, map_size, map_size); });
+    double animation_ms = measure(entity_count, iterations, [&]() { entities.update_animation(delta_time); });
+
+    // A whole simulation tick of motion and collisions, the collision share is what remains after the motion alone
+    SpatialHash spatial_hash;
+    spatial_hash.init(4.0f * tile_size, tile_size);
+    std::vector<float> previous_x;
+    std::vector<float> previous_y;
+    std::vector<uint8_t> tile_hits;
+    std::vector<SpatialHash::Pair> pairs;
+    size_t pair_count = 0;
+    double tick_ms = measure(entity_count, iterations, [&]() {
+        const EntityStore::Components& c = entities.get_components();
+        previous_x.assign(c.x.begin(), c.x.end());
+        previous_y.assign(c.y.begin(), c.y.end());
+        entities.update_motion(delta_time, map_size - tile_size, map_size - tile_size);
+        entities.resolve_tile_collisions(collision, previous_x.data(), previous_y.data(), tile_size, tile_hits);
+        spatial_hash.update(c.x.data(), c.y.data(), entities.size());
+        spatial_hash.find_pairs(c.x.data(), c.y.data(), pairs);
+        entities.resolve_contacts(pairs);
+        pair_count += pairs.size();
+    });
+    double collision_ms = std::max(0.0, tick_ms - motion_ms);
+
+    // Keeps the updates from being optimized away
+    const EntityStore::Components& components = entities.get_components();
+    float checksum = 0.0f;
+    for (uint32_t i = 0; i < entity_count; i++) checksum += components.x[i] + components.y[i] + (float)components.frame[i];
+
+    std::cout << entity_count << " entities, " << iterations << " iterations, median per 100k entities:" << std::endl;
+    std::cout << "    motion " << motion_ms << " ms" << std::endl;
+    std::cout << "    animation " << animation_ms << " ms" << std::endl;
+    std::cout << "    collisions " << collision_ms << " ms, " << collision_ms * entity_count / 100000.0 << " ms per tick for "
+        << entity_count << " entities (" << (double)pair_count / iterations << " contacts per tick)" << std::endl;
+    std::cout << "    total " << tick_ms + animation_ms << " ms (checksum " << checksum << ")" << std::endl;
+    return 0;
+}
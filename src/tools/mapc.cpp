@@ -0,0 +1,30 @@
+#include "../files/compiled_tilemap.h"
+#include "../files/tilemap_loader.h"
+
+#include <iostream>
+
+// Converts Tiled .tmj maps into the binary .nmap format loaded by the engine.
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: nostalgia_mapc <input.tmj> <output.nmap>" << std::endl;
+        return 1;
+    }
+
+    TilemapLoader::Tilemap tilemap = TilemapLoader::load_tilemap(argv[1]);
+    if (tilemap.width == 0 || tilemap.height == 0) {
+        return 1;
+    }
+
+    std::vector<uint8_t> compiled = CompiledTilemap::compile(tilemap);
+    if (!CompiledTilemap::write(argv[2], compiled)) {
+        std::cerr << "Could not write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    size_t raw_size = tilemap.layer.size() * sizeof(uint32_t);
+    std::cout << argv[2] << ": " << tilemap.width << "x" << tilemap.height << ", "
+        << tilemap.number_of_layers << " layers, " << tilemap.animations.size() << " animated tiles, "
+        << tilemap.solid_gids.size() << " solid tiles, " << tilemap.tilesets.size() << " tilesets, " << compiled.size() << " bytes ("
+        << raw_size << " bytes uncompressed)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include "../files/compiled_mesh.h"
+#include "../files/geometry_loader.h"
+
+#include <iostream>
+
+// Converts text geometries into the binary .nmesh format loaded by the engine.
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: nostalgia_meshc <input.txt> <output.nmesh>" << std::endl;
+        return 1;
+    }
+
+    GeometryLoader::Geometry geometry;
+    if (!GeometryLoader::load_geometry(argv[1], geometry)) {
+        std::cerr << "Could not load " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> compiled = CompiledMesh::compile(geometry);
+    CompiledMesh mesh;
+    if (!mesh.open_memory(std::vector<uint8_t>(compiled)) || !CompiledMesh::write(argv[2], compiled)) {
+        std::cerr << "Could not write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::cout << argv[2] << ": " << mesh.vertex_count() << " vertices of " << mesh.vertex_stride() << " bytes, "
+        << mesh.attribute_count() << " attributes, " << mesh.index_count() << " indices of " << mesh.index_size() * 8
+        << " bits, " << compiled.size() << " bytes" << std::endl;
+    return 0;
+}
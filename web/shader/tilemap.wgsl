@@ -14,8 +14,18 @@ struct Uniforms {
 };
 
 @group(0) @binding(0) var<uniform> uUniforms: Uniforms;
-@group(0) @binding(1) var uTileset: texture_2d<f32>;
-@group(0) @binding(2) var uTilemap: texture_2d<u32>;
+@group(0) @binding(1) var uTileset: texture_2d<u32>;
+struct Layer {
+	opacity: f32,
+	parallax_x: f32,
+	parallax_y: f32,
+	pad_: f32,
+};
+
+@group(0) @binding(2) var uTilemap: texture_2d_array<u32>;
+@group(0) @binding(3) var<storage, read> uLayers: array<Layer>;
+@group(0) @binding(4) var uFirstLayer: texture_2d<u32>;
+@group(0) @binding(5) var uPalette: texture_2d<f32>;
 
 struct VertexInput {
 	@location(0) position: vec2f,
@@ -77,13 +87,17 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
 	let inverted_uv = vec2(1.0 - in.uv.x, in.uv.y);
 	let pixel_position = in.position.xy / 2.0;
 
-	for (var i = 0; i < number_of_layers; i++) {
-		let layer_offset = vec2i(0, i * 30);
+	// Layers below the topmost opaque tile are covered, the map is on the unscrolled grid
+	let first_layer = i32(textureLoad(uFirstLayer, vec2i(pixel_position + offset) / vec2i(16, 16), 0).r);
+
+	for (var i = first_layer; i < number_of_layers; i++) {
+		let layer = uLayers[i];
+		let layer_position = pixel_position + offset * vec2f(layer.parallax_x, layer.parallax_y);
 
 		// Color by position
-		let texture_coord = vec2u((pixel_position + offset)) % vec2u(16, 16);
-		let tilemap_coord = vec2i((pixel_position + offset)) / vec2i(16, 16) + layer_offset;
-		let tilemap_data = textureLoad(uTilemap, tilemap_coord, 0).r;
+		let texture_coord = vec2u(layer_position) % vec2u(16, 16);
+		let tilemap_coord = vec2i(layer_position) / vec2i(16, 16);
+		let tilemap_data = textureLoad(uTilemap, tilemap_coord, i, 0).r;
 		
 		if (tilemap_data == u32(0)) {
 			continue;
@@ -96,8 +110,9 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
 
 		let offset_texture_coord = texture_coord_two_dim * 16 + texture_coord;
 
-		let texture_color = textureLoad(uTileset, offset_texture_coord, 0);
-		color = mix(color, texture_color.rgb, texture_color.a);
+		let color_index = textureLoad(uTileset, offset_texture_coord, 0).r;
+		let texture_color = textureLoad(uPalette, vec2u(color_index, 0), 0);
+		color = mix(color, texture_color.rgb, texture_color.a * layer.opacity);
 	}
   
   return vec4<f32>(color, 1.0);
@@ -2,27 +2,125 @@ async function load_map() {
 	const response = await fetch('resources/tilemaps/map.tmj');
 	const map = await response.json();
 
-	const number_of_layers = map.layers.length;
-	const height = map.layers[0].height;
-	const width = map.layers[0].width;
+	const height = map.height;
+	const width = map.width;
 
-	const tile_data = new Uint32Array(height * width * number_of_layers);
+	// Hidden layers are left out entirely, every remaining layer becomes one texture array layer
+	const layers = map.layers.filter((layer) => layer.type === 'tilelayer' && layer.visible !== false && layer.opacity !== 0);
+	const number_of_layers = layers.length;
+
+	const tile_data = new Uint32Array(height * width * Math.max(number_of_layers, 1));
+	const layer_data = new Float32Array(4 * Math.max(number_of_layers, 1));
 	for (let i = 0; i < number_of_layers; i++) {
-		const layer = map.layers[i];
-		const data = layer.data;
-		const layer_height = layer.height;
-		const layer_width = layer.width;
-		tile_data.set(data, i * layer_height * layer_width);
+		const layer = layers[i];
+		tile_data.set(layer.data, i * height * width);
+		layer_data.set([layer.opacity ?? 1.0, layer.parallaxx ?? 1.0, layer.parallaxy ?? 1.0, 0.0], i * 4);
 	}
 
 	return {
 		"data": tile_data,
+		"layers": layer_data,
 		"height": height,
 		"width": width,
 		"number_of_layers": number_of_layers,
 	}
 }
 
+// A tile is opaque when every one of its pixels has full alpha
+function find_opaque_tiles(bitmap) {
+	const canvas = new OffscreenCanvas(bitmap.width, bitmap.height);
+	const context = canvas.getContext('2d');
+	context.drawImage(bitmap, 0, 0);
+	const pixels = context.getImageData(0, 0, bitmap.width, bitmap.height).data;
+
+	const columns = Math.floor(bitmap.width / 16);
+	const rows = Math.floor(bitmap.height / 16);
+	const opaque_tiles = new Uint8Array(columns * rows);
+	for (let tile = 0; tile < columns * rows; tile++) {
+		const tile_x = (tile % columns) * 16;
+		const tile_y = Math.floor(tile / columns) * 16;
+		let opaque = 1;
+		for (let y = 0; y < 16 && opaque; y++) {
+			for (let x = 0; x < 16; x++) {
+				if (pixels[((tile_y + y) * bitmap.width + tile_x + x) * 4 + 3] !== 255) {
+					opaque = 0;
+					break;
+				}
+			}
+		}
+		opaque_tiles[tile] = opaque;
+	}
+	return opaque_tiles;
+}
+
+// One byte per pixel plus a 256 color palette, see TextureLoader::load_indexed_texture
+function extract_palette(bitmap) {
+	const canvas = new OffscreenCanvas(bitmap.width, bitmap.height);
+	const context = canvas.getContext('2d');
+	context.drawImage(bitmap, 0, 0);
+	const pixels = new Uint32Array(context.getImageData(0, 0, bitmap.width, bitmap.height).data.buffer);
+
+	// Fully transparent pixels all share one palette entry
+	const counts = new Map();
+	for (let i = 0; i < pixels.length; i++) {
+		if ((pixels[i] >>> 24) === 0) {
+			pixels[i] = 0;
+		}
+		counts.set(pixels[i], (counts.get(pixels[i]) ?? 0) + 1);
+	}
+
+	// Keep the most frequent colors, every other color maps to its closest kept one
+	const colors = [...counts.keys()].sort((a, b) => counts.get(b) - counts.get(a)).slice(0, 256);
+	const distance = (a, b) => {
+		let sum = 0;
+		for (let shift = 0; shift < 32; shift += 8) {
+			const difference = ((a >>> shift) & 0xff) - ((b >>> shift) & 0xff);
+			sum += difference * difference;
+		}
+		return sum;
+	};
+	const color_indices = new Map();
+	for (const color of counts.keys()) {
+		let closest = 0;
+		for (let i = 1; i < colors.length; i++) {
+			if (distance(color, colors[i]) < distance(color, colors[closest])) {
+				closest = i;
+			}
+		}
+		color_indices.set(color, closest);
+	}
+
+	const indices = new Uint8Array(pixels.length);
+	for (let i = 0; i < pixels.length; i++) {
+		indices[i] = color_indices.get(pixels[i]);
+	}
+	const palette = new Uint32Array(256);
+	palette.set(colors);
+	return { indices, palette };
+}
+
+// Per tile, the topmost layer with an opaque tile, everything beneath it is covered
+function find_first_layers(map, opaque_tiles) {
+	const size = map.width * map.height;
+	const first_layers = new Uint8Array(size);
+	for (let tile = 0; tile < size; tile++) {
+		for (let i = map.number_of_layers - 1; i > 0; i--) {
+			const opacity = map.layers[i * 4];
+			const parallax_x = map.layers[i * 4 + 1];
+			const parallax_y = map.layers[i * 4 + 2];
+			if (opacity < 1.0 || parallax_x !== 1.0 || parallax_y !== 1.0) {
+				continue;
+			}
+			const gid = map.data[i * size + tile];
+			if (gid !== 0 && opaque_tiles[gid - 1]) {
+				first_layers[tile] = i;
+				break;
+			}
+		}
+	}
+	return first_layers;
+}
+
 async function initialize_webgpu() {
 	const tilemap_shader = fetch('shader/tilemap.wgsl').then((response) => response.text());
 	const sprite_shader = fetch('shader/sprite.wgsl').then((response) => response.text());
@@ -58,7 +156,7 @@ async function initialize_webgpu() {
 				binding: 1,
 				visibility: GPUShaderStage.FRAGMENT,
 				texture: {
-					sampleType: 'float',
+					sampleType: 'uint',
 				},
 			},
 			{
@@ -66,6 +164,28 @@ async function initialize_webgpu() {
 				visibility: GPUShaderStage.FRAGMENT,
 				texture: {
 					sampleType: 'uint',
+					viewDimension: '2d-array',
+				},
+			},
+			{
+				binding: 3,
+				visibility: GPUShaderStage.FRAGMENT,
+				buffer: {
+					type: 'read-only-storage',
+				},
+			},
+			{
+				binding: 4,
+				visibility: GPUShaderStage.FRAGMENT,
+				texture: {
+					sampleType: 'uint',
+				},
+			},
+			{
+				binding: 5,
+				visibility: GPUShaderStage.FRAGMENT,
+				texture: {
+					sampleType: 'float',
 				},
 			},
 		],
@@ -100,21 +220,39 @@ async function initialize_webgpu() {
 	});
 
 	const tileset_bitmap = await createImageBitmap(await tileset_texture_image);
+	const tileset = extract_palette(tileset_bitmap);
 	const tileset_texture = device.createTexture({
 		size: {
 			width: tileset_bitmap.width,
 			height: tileset_bitmap.height,
 		},
-		format: 'rgba8unorm',
-		usage: GPUTextureUsage.TEXTURE_BINDING | GPUTextureUsage.COPY_DST | GPUTextureUsage.RENDER_ATTACHMENT,
+		format: 'r8uint',
+		usage: GPUTextureUsage.TEXTURE_BINDING | GPUTextureUsage.COPY_DST,
 	});
 
-	device.queue.copyExternalImageToTexture(
-		{ source: tileset_bitmap },
+	device.queue.writeTexture(
 		{ texture: tileset_texture },
+		tileset.indices,
+		{ bytesPerRow: tileset_bitmap.width },
 		{ width: tileset_bitmap.width, height: tileset_bitmap.height },
 	);
 
+	const palette_texture = device.createTexture({
+		size: {
+			width: 256,
+			height: 1,
+		},
+		format: 'rgba8unorm',
+		usage: GPUTextureUsage.TEXTURE_BINDING | GPUTextureUsage.COPY_DST,
+	});
+
+	device.queue.writeTexture(
+		{ texture: palette_texture },
+		tileset.palette,
+		{ bytesPerRow: 256 * 4 },
+		{ width: 256, height: 1 },
+	);
+
 	const tilemap = new Uint32Array((await map).data);
 	const tilemap_height = (await map).height;
 	const tilemap_width = (await map).width;
@@ -123,7 +261,8 @@ async function initialize_webgpu() {
 	const tilemap_texture = device.createTexture({
 		size: {
 			width: tilemap_width,
-			height: tilemap_height * number_of_layers,
+			height: tilemap_height,
+			depthOrArrayLayers: Math.max(number_of_layers, 1),
 		},
 		format: 'r32uint',
 		usage: GPUTextureUsage.COPY_DST | GPUTextureUsage.TEXTURE_BINDING | GPUTextureUsage.RENDER_ATTACHMENT,
@@ -136,13 +275,46 @@ async function initialize_webgpu() {
 		tilemap,
 		{
 			bytesPerRow: tilemap_width * 4,
+			rowsPerImage: tilemap_height,
 		},
 		{
 			width: tilemap_width,
-			height: tilemap_height * number_of_layers,
+			height: tilemap_height,
+			depthOrArrayLayers: Math.max(number_of_layers, 1),
 		},
 	);
 
+	const first_layers = find_first_layers(await map, find_opaque_tiles(tileset_bitmap));
+	const first_layer_texture = device.createTexture({
+		size: {
+			width: tilemap_width,
+			height: tilemap_height,
+		},
+		format: 'r8uint',
+		usage: GPUTextureUsage.COPY_DST | GPUTextureUsage.TEXTURE_BINDING,
+	});
+
+	device.queue.writeTexture(
+		{
+			texture: first_layer_texture,
+		},
+		first_layers,
+		{
+			bytesPerRow: tilemap_width,
+		},
+		{
+			width: tilemap_width,
+			height: tilemap_height,
+		},
+	);
+
+	const layer_data = (await map).layers;
+	const layer_buffer = device.createBuffer({
+		size: layer_data.byteLength,
+		usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_DST,
+	});
+	device.queue.writeBuffer(layer_buffer, 0, layer_data.buffer, 0, layer_data.byteLength);
+
 	const tilemap_uniform_buffer = device.createBuffer({
 		size: 12 * 4,
 		usage: GPUBufferUsage.UNIFORM | GPUBufferUsage.COPY_DST,
@@ -170,7 +342,21 @@ async function initialize_webgpu() {
 			},
 			{
 				binding: 2,
-				resource: tilemap_texture.createView(),
+				resource: tilemap_texture.createView({ dimension: '2d-array' }),
+			},
+			{
+				binding: 3,
+				resource: {
+					buffer: layer_buffer,
+				},
+			},
+			{
+				binding: 4,
+				resource: first_layer_texture.createView(),
+			},
+			{
+				binding: 5,
+				resource: palette_texture.createView(),
 			},
 		],
 	});